@@ -0,0 +1,73 @@
+#ifndef _DIRECTORY_WALKER_H_
+#define _DIRECTORY_WALKER_H_
+
+
+// ## INCLUDE #####################################################################################
+
+#include <functional>
+#include <string>
+#include <vector>
+
+
+// ## TYPE DEFINITIONS ############################################################################
+
+/**
+ * Receives a matching file path. Returning false stops the walk.
+ */
+typedef std::function<bool(const std::string&)> path_callback_t;
+
+
+// ## CLASS DEFINITION ############################################################################
+
+/**
+ * Walks a directory tree in parallel and streams the files matching a set of fnmatch filters as they are found.
+ * Each worker thread takes a directory, reads it with getdents64 and queues its subdirectories for any idle worker,
+ * so wide trees on high latency file systems are listed concurrently. Symbolic links to files are reported, symbolic
+ * links to directories are not followed. Directories that cannot be opened are skipped.
+ */
+class directory_walker {
+public:
+  /**
+   * \param search_filter File name filters, matched against the full path, case insensitive.
+   * \param num_threads Number of walker threads. 0 means one per hardware thread.
+   */
+  directory_walker(const std::vector<std::string>& search_filter, unsigned int num_threads = 0);
+
+
+  /**
+   * Walks the directory. The callback is called from the worker threads as files are found, one call at a time, in
+   * no particular order.
+   * \param search_directory Directory to walk.
+   * \param callback Called with every matching file. Returning false stops the walk early.
+   * \return False if the search directory could not be opened.
+   */
+  bool walk(const std::string& search_directory, const path_callback_t& callback) const;
+
+
+  /**
+   * Walks the directory and collects the matching files.
+   * \param search_directory Directory to walk.
+   * \return Matching files, sorted.
+   */
+  std::vector<std::string> find(const std::string& search_directory) const;
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** File name filters. */
+  std::vector<std::string> search_filter_;
+
+  /** Number of walker threads. */
+  unsigned int num_threads_;
+
+
+  /**
+   * \param path Full path of a file.
+   * \return Whether it matches one of the filters.
+   */
+  bool matches_(const std::string& path) const;
+};
+
+
+#endif // _DIRECTORY_WALKER_H_
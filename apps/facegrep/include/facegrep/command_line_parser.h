@@ -5,6 +5,7 @@
 
 #include <getopt.h>
 #include <string>
+#include <vector>
 
 #include <facegrep/facegrep.h>
 
@@ -14,6 +15,12 @@
 namespace facetools {
 
 
+// ## DEFINES #################################################################
+
+/** Name of the search cache file kept in the search directory by --cache. */
+#define SEARCH_CACHE_FILE ".facegrep_cache"
+
+
 // ## CUSTOM STRUCTURES #######################################################
 
 /**
@@ -23,6 +30,12 @@ struct facegrep_commandline_parameters_t {
   /** Name of face file we're searching for. */
   std::string face_file;
 
+  /** Names of all the face files we're searching for, face_file first. */
+  std::vector<std::string> face_files;
+
+  /** Whether every face in the face files is searched for, rather than the first of each. */
+  bool all_faces;
+
   /** Whether to jitter images. */
   bool jitter;
 
@@ -35,11 +48,115 @@ struct facegrep_commandline_parameters_t {
   /** Similarity threshold. Default is 0.6. */
   float threshold;
 
+  /** Worker threads of the load stage. */
+  unsigned int load_threads;
+
+  /** Worker threads of the detect stage. */
+  unsigned int detect_threads;
+
+  /** Worker threads of the embed stage. */
+  unsigned int embed_threads;
+
+  /** Number of face chips embedded per network call. */
+  unsigned int batch_size;
+
+  /** Whether to stop embedding the faces of a file once one of them matched. */
+  bool first_match;
+
+  /** Number of closest matches to report. 0 reports every match. */
+  unsigned int top_k;
+
+  /** Whether to print the distance next to each file. */
+  bool show_distance;
+
+  /** Whether to print files in search order rather than as they finish. */
+  bool ordered;
+
+  /** Whether to cache the faces found, in the search directory unless cache_file is set. */
+  bool cache;
+
+  /** Cache file location. */
+  std::string cache_file;
+
+  /** Socket to serve searches on, with --serve. Empty unless the program runs as a server. */
+  std::string serve_socket;
+
+  /** Socket of the server to send the search to, with --client. Empty unless the program runs as a client. */
+  std::string client_socket;
+
+  /** Number of searches a server runs at once. */
+  unsigned int instances;
+
+  /** Whether to group the faces of the search directory by person instead of searching it. */
+  bool cluster;
+
+  /** Megabytes of similarity graph edges kept in memory while clustering. */
+  unsigned int memory_budget_mb;
+
+  /** Whether copies of an image already processed reuse its faces. */
+  bool skip_duplicates;
+
+  /** Whether images whose EXIF thumbnail shows no face are skipped. */
+  bool prefilter;
+
+  /** Threshold adjustment of the thumbnail face check. */
+  double prefilter_threshold;
+
+  /** Number of image files read ahead of decoding. */
+  unsigned int read_ahead;
+
+  /** Number of worker processes to shard the search across. 0 searches in one process. Not with cache. */
+  unsigned int workers;
+
+  /** How pipeline threads and worker processes are placed on the CPUs. */
+  placement_policy_t placement;
+
+  /** Cores shared by the model threads and their BLAS threads. 0 leaves BLAS to its default. */
+  unsigned int thread_budget;
+
+  /** Whether the thread budget split is timed on the first images before the search. */
+  bool tune_threads;
+
+  /** Whether to print a summary of the stage times and counters at exit. */
+  bool stats;
+
+  /** File the stats are written to as JSON. Empty writes none. */
+  std::string stats_file;
+
+  /** Seconds between rewrites of the stats file. 0 writes it at exit only. */
+  unsigned int stats_interval;
+
+  /** File the Chrome trace of the run is written to at exit. Empty traces nothing. */
+  std::string trace_file;
+
 facegrep_commandline_parameters_t() {
   search_directory = ".";
   jitter = true;
   mmod = false;
   threshold = 0.6;
+  load_threads = 1;
+  detect_threads = 1;
+  embed_threads = 1;
+  batch_size = 32;
+  first_match = false;
+  top_k = 0;
+  show_distance = false;
+  ordered = false;
+  cache = false;
+  all_faces = false;
+  instances = 2;
+  cluster = false;
+  memory_budget_mb = 1024;
+  skip_duplicates = false;
+  prefilter = false;
+  prefilter_threshold = -0.5;
+  read_ahead = 16;
+  workers = 0;
+  placement = placement_policy_t::NONE;
+  thread_budget = 0;
+  tune_threads = false;
+  stats = false;
+  stats_interval = 0;
   }
 };
 
@@ -49,6 +166,32 @@ static struct option command_line_options[] = {
   {"jitter", no_argument, 0, 'j'},
   {"mmod", no_argument, 0, 'm'},
   {"threshold", required_argument, 0, 't'},
+  {"threads", required_argument, 0, 'p'},
+  {"batch-size", required_argument, 0, 'b'},
+  {"first-match", no_argument, 0, 'f'},
+  {"top-k", required_argument, 0, 'k'},
+  {"distance", no_argument, 0, 'd'},
+  {"ordered", no_argument, 0, 'o'},
+  {"cache", no_argument, 0, 'c'},
+  {"cache-file", required_argument, 0, 'C'},
+  {"all-faces", no_argument, 0, 'a'},
+  {"serve", required_argument, 0, 'S'},
+  {"client", required_argument, 0, 'U'},
+  {"instances", required_argument, 0, 'n'},
+  {"cluster", no_argument, 0, 'G'},
+  {"memory-budget", required_argument, 0, 'M'},
+  {"skip-duplicates", no_argument, 0, 'u'},
+  {"prefilter", no_argument, 0, 'P'},
+  {"prefilter-threshold", required_argument, 0, 'X'},
+  {"read-ahead", required_argument, 0, 'R'},
+  {"workers", required_argument, 0, 'w'},
+  {"placement", required_argument, 0, 'A'},
+  {"thread-budget", required_argument, 0, 'B'},
+  {"tune-threads", no_argument, 0, 'T'},
+  {"stats", no_argument, 0, 's'},
+  {"stats-file", required_argument, 0, 'J'},
+  {"stats-interval", required_argument, 0, 'I'},
+  {"trace", required_argument, 0, 'e'},
   {0, 0, 0, 0}
 };
 
@@ -75,6 +218,16 @@ public:
    * how to pass arguments to the program.
    */
   static void print_usage(char** argv);
+
+
+  /**
+   * Parses a --threads argument: either one count used by every stage, or "load,detect,embed" counts. 0 means one
+   * thread per hardware thread.
+   * \param argument The option argument.
+   * \param params Command line parameters to set.
+   * \return False if the argument is malformed.
+   */
+  static bool parse_threads(const std::string& argument, facegrep_commandline_parameters_t& params);
 };
 
 } // NAMESPACE facetools
@@ -3,10 +3,24 @@
 
 // ## INCLUDE #################################################################
 
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <functional>
 #include <memory>
-
+#include <mutex>
+#include <thread>
+
+#include <directory_walker.h>
+#include <facegrep/read_ahead.h>
+#include <facegrep/search_cache.h>
+#include <facetools/bounded_queue.h>
+#include <facetools/cpu_topology.h>
 #include <facetools/face_detector.h>
 #include <facetools/face_recogniser.h>
+#include <facetools/perceptual_hash.h>
+#include <facetools/thread_budget.h>
+#include <facetools/thumbnail_prefilter.h>
 
 
 // ## NAMESPACE ###############################################################
@@ -14,8 +28,90 @@
 namespace facetools {
 
 
+// ## CONSTANTS ###############################################################
+
+/** Largest relative difference between the aspect ratios of two copies of an image. */
+const double DUPLICATE_ASPECT_TOLERANCE = 0.02;
+
+
 // ## CUSTOM STRUCTURES #######################################################
 
+/**
+ * Which matches a streaming search reports.
+ */
+enum class search_mode_t {
+  /** Every template found in every file, with the distance of its closest face. */
+  ALL = 0,
+
+  /** Every matching file, with the distance of its first matching face. The remaining faces are not embedded. */
+  FIRST_MATCH,
+
+  /** The top_k closest matches, closest first, reported once the search is over. */
+  TOP_K
+};
+
+
+/**
+ * A face searched for.
+ */
+struct face_template_t {
+  /** Image file the face was taken from. */
+  std::string file;
+
+  /** Index of the face among the faces detected in the file. */
+  unsigned int face;
+};
+
+
+/**
+ * A face template found in a file. A file holding several of the templates, such as a group photo, gives one result
+ * for each of them. Each face counts towards the template closest to it only.
+ */
+struct search_result_t {
+  /** Image file name. */
+  std::string file;
+
+  /** Position of the file in the search input (or in the directory walk). */
+  size_t index;
+
+  /** Distance between the reported face and the template. */
+  float distance;
+
+  /** Index of the reported face among the faces detected in the file: the closest of those matching the template. */
+  unsigned int face;
+
+  /** Index of the template found, in facegrep::get_templates(). */
+  unsigned int face_template;
+
+  /** Number of faces embedded in the file that matched the template. */
+  unsigned int matches;
+};
+
+
+/**
+ * Faces of a directory tree grouped by person.
+ */
+struct face_clusters_t {
+  /** Image files holding faces. */
+  std::vector<std::string> files;
+
+  /** Image file of each face, as an index into files. */
+  std::vector<uint32_t> face_files;
+
+  /** Bounding box of each face in its image. */
+  std::vector<dlib::rectangle> boxes;
+
+  /** Faces of each person, as indices into face_files and boxes. Largest cluster first. */
+  std::vector<std::vector<size_t>> clusters;
+};
+
+
+/**
+ * Receives search results as they are found. Returning false stops the search.
+ */
+typedef std::function<bool(const search_result_t&)> result_callback_t;
+
+
 /**
  * Parameters for the facegrep class.
  */
@@ -38,6 +134,84 @@ struct facegrep_parameters_t {
   /** File path of shape model. */
   std::string shape_model;
 
+  /** Number of threads listing directories for search_directory. 0 means one per hardware thread. */
+  unsigned int walk_threads;
+
+  /** Number of threads reading and decoding image files. */
+  unsigned int load_threads;
+
+  /** Number of threads detecting and aligning faces. Each one holds its own copy of the detector. */
+  unsigned int detect_threads;
+
+  /** Number of threads computing embeddings. Each one holds its own copy of the recogniser. */
+  unsigned int embed_threads;
+
+  /** Maximum number of items waiting between two pipeline stages. Bounds the number of decoded images in memory. */
+  unsigned int queue_size;
+
+  /** Number of face chips, gathered across images, that the embed stage sends through the network in one call. */
+  unsigned int batch_size;
+
+  /** Longest time in milliseconds the embed stage waits to fill a batch before running a partial one. */
+  unsigned int batch_timeout_ms;
+
+  /** Which matches the streaming searches report. */
+  search_mode_t search_mode;
+
+  /** Number of matches reported in TOP_K mode. */
+  unsigned int top_k;
+
+  /** Whether streaming searches report files in input order, through a reorder buffer, rather than as they finish. */
+  bool ordered_results;
+
+  /** File caching the faces found in every image searched, so later searches skip unchanged files. Empty disables. */
+  std::string cache_file;
+
+  /** Whether every face in a template file becomes a template, rather than only the first one. */
+  bool all_template_faces;
+
+  /** Whether images whose perceptual hash is close to that of an image already processed, in this search or in the
+   * cache, reuse its faces instead of being detected and embedded again. Catches resized and re-encoded copies.
+   * Crops and stretched copies, whose aspect ratio differs by more than DUPLICATE_ASPECT_TOLERANCE, are processed, as
+   * are copies loaded while the first copy is still being detected and embedded. */
+  bool skip_duplicates;
+
+  /** Largest Hamming distance between the 64 bit perceptual hashes of two copies of an image. */
+  unsigned int duplicate_radius;
+
+  /** Number of image files read ahead of the decoders, through io_uring when the kernel allows it. JPEGs are then
+   * decoded from memory. 0 leaves every read to the decoders. */
+  unsigned int read_ahead;
+
+  /** Number of worker processes the searches are sharded across, each running the whole pipeline with the thread
+   * counts above. A worker that crashes is restarted, and the file that crashed it skipped. Workers do not use the
+   * search cache. 0 searches in this process. */
+  unsigned int workers;
+
+  /** How the load, detect and embed threads are placed on the CPUs and NUMA nodes. Each thread is pinned to a CPU,
+   * and its model replica is built there, so the replica and the buffers the thread allocates live in its node's
+   * memory. Worker processes are pinned to a node each, or to consecutive CPUs with COMPACT. */
+  placement_policy_t placement;
+
+  /** Cores shared by the detect and embed threads and the BLAS threads each of their model calls fans out to, split
+   * evenly between the worker processes when there are any. Every call gets its share of the BLAS threads, instead of
+   * one per core. 0 leaves BLAS to its default. */
+  unsigned int thread_budget;
+
+  /** Whether JPEGs whose EXIF thumbnail shows no face are reported as having none, without decoding the main image.
+   * The thumbnail check is a HOG detector, so it is ignored with the MMOD detector, which finds faces it misses. */
+  bool prefilter_thumbnails;
+
+  /** Added to the threshold of the thumbnail face check. Lower values miss fewer faces and skip fewer images. */
+  double thumbnail_threshold;
+
+  /** Bytes of similarity graph edges cluster_directory holds in memory before spilling them to disk. The graph built
+   * from them takes 8 bytes an edge more. See similarity_graph_parameters_t::memory_budget. */
+  size_t cluster_memory_budget;
+
+  /** Directory for the edges cluster_directory spills. */
+  std::string spill_directory;
+
   facegrep_parameters_t()
   {
     detector_type = face_detector_type_t::DLIB_DEFAULT;
@@ -46,6 +220,27 @@ struct facegrep_parameters_t {
     detector_model = "mmod_human_face_detector.dat";
     recogniser_model = "dlib_face_recognition_resnet_model_v1.dat";
     shape_model = "shape_predictor_68_face_landmarks.dat";
+    walk_threads = 0;
+    load_threads = 1;
+    detect_threads = 1;
+    embed_threads = 1;
+    queue_size = 4;
+    batch_size = 32;
+    batch_timeout_ms = 20;
+    search_mode = search_mode_t::ALL;
+    top_k = 10;
+    ordered_results = false;
+    all_template_faces = false;
+    cluster_memory_budget = size_t(1) << 30;
+    spill_directory = "/tmp";
+    skip_duplicates = false;
+    duplicate_radius = 4;
+    read_ahead = 16;
+    workers = 0;
+    placement = placement_policy_t::NONE;
+    thread_budget = 0;
+    prefilter_thumbnails = false;
+    thumbnail_threshold = thumbnail_prefilter_parameters_t().adjust_threshold;
   }
 };
 
@@ -72,12 +267,75 @@ public:
 
 
   /**
-   * Tries to find the face template in the image files given.
+   * Initialises facegrep with several faces to search for at once. Every candidate face is compared with all the
+   * templates in the same pass, so the images are decoded, detected and embedded once whatever the template count.
+   * \param face_template_files Images of the faces we're searching for. Each contributes its first face, or all of
+   * them with all_template_faces.
+   */
+  void init(const std::vector<std::string>& face_template_files);
+
+
+  /**
+   * \return The templates being searched for. search_result_t::face_template indexes this list.
+   */
+  const std::vector<face_template_t>& get_templates() const;
+
+
+  /**
+   * Changes the settings that only decide which faces match and how results are reported: threshold, search_mode,
+   * top_k, ordered_results and all_template_faces. The models, thread counts and cache stay as constructed, so one
+   * facegrep can serve queries with different settings. Takes effect from the next init() and search.
+   * \param params Parameters to take the query settings from.
+   */
+  void set_query_parameters(const facegrep_parameters_t& params);
+
+
+  /**
+   * Tries to find the face template in the image files given. Files flow through a pipeline of load, detect/align,
+   * embed and match stages connected by bounded queues, each stage running its own worker threads.
    * \param image_files List of image file names to search through for the template face.
-   * \return List of image files where matches were found.
+   * \return List of image files where matches were found, in input order. A file appears once per matching face.
    */
   std::vector<std::string> search(const std::vector<std::string> image_files);
 
+  /**
+   * Tries to find the face template in the images of a directory tree. Files go into the search pipeline as the
+   * directory walker finds them, so detection starts before the listing is complete.
+   * \param search_directory Directory to search, including all subdirectories.
+   * \return List of image files where matches were found, in the order they were found. A file appears once per
+   * matching face.
+   */
+  std::vector<std::string> search_directory(const std::string& search_directory);
+
+
+  /**
+   * Streams the files matching the face templates to a callback, called on the calling thread as results arrive.
+   * What is reported, and in which order, follows the search_mode, top_k and ordered_results parameters.
+   * \param image_files List of image file names to search through for the template face.
+   * \param callback Receives the matching files. Returning false stops the search.
+   */
+  void search(const std::vector<std::string>& image_files, const result_callback_t& callback);
+
+
+  /**
+   * Streams the files matching the face templates in a directory tree to a callback. See search.
+   * \param search_directory Directory to search, including all subdirectories.
+   * \param callback Receives the matching files. Returning false stops the search.
+   */
+  void search_directory(const std::string& search_directory, const result_callback_t& callback);
+
+
+  /**
+   * Groups every face in a directory tree by person. Faces are found and embedded by the search pipeline, using the
+   * cache when there is one, and linked when closer than the threshold by an out of core similarity graph pass that
+   * spills its edges to spill_directory beyond cluster_memory_budget. Chinese whispers then splits the graph into
+   * people. Needs no templates.
+   * \param search_directory Directory to cluster, including all subdirectories.
+   * \return The faces and their clusters.
+   */
+  face_clusters_t cluster_directory(const std::string& search_directory);
+
+
   /**
    * Tries to find the face template in the image files given.
    * \param face_template_file Face we're searching for.
@@ -86,6 +344,17 @@ public:
    */
   std::vector<std::string> search(const std::string face_template_file, const std::vector<std::string> image_files);
 
+
+  /**
+   * Splits the thread budget between model threads and BLAS threads by timing a few images: the detect and embed
+   * stages get 1, 2, 4... threads each, up to the budget, with the rest of it going to BLAS, and the fastest split is
+   * kept. Without a thread_budget, the budget is every CPU. Templates are not needed, nor is the search cache used.
+   * \param sample_files Image files timed, such as the first few of the search. Each split processes them once, after
+   * one warm-up pass.
+   * \return The split kept. Its workers are the detect and embed threads together.
+   */
+  thread_split_t tune_threads(const std::vector<std::string>& sample_files);
+
 #ifndef _DEBUG_
 private:
 #endif
@@ -93,13 +362,168 @@ private:
   /** See facegrep_parameters_t. */
   struct internal_parameters_t {
     float threshold;
+    unsigned int walk_threads;
+    unsigned int load_threads;
+    unsigned int detect_threads;
+    unsigned int embed_threads;
+    unsigned int queue_size;
+    unsigned int batch_size;
+    unsigned int batch_timeout_ms;
+    search_mode_t search_mode;
+    unsigned int top_k;
+    bool ordered_results;
+    std::string cache_file;
+    bool all_template_faces;
+    size_t cluster_memory_budget;
+    std::string spill_directory;
+    bool skip_duplicates;
+    unsigned int duplicate_radius;
+    unsigned int read_ahead;
+    unsigned int workers;
+    placement_policy_t placement;
+    unsigned int thread_budget;
+    unsigned int blas_threads;
   } params_;
 
+  /** Hash of the models and settings the cached faces depend on. */
+  uint64_t settings_hash_;
+
+  /** Size and modification time of an image file, checked against the search cache. */
+  struct file_stamp_t {
+    bool valid;
+    uint64_t size;
+    int64_t mtime;
+  };
+
+  /** Streams image file names into a callback, which returns false when the search is aborted. */
+  typedef std::function<void(const path_callback_t&)> path_source_t;
+
+  /** Image file name travelling from the source to the load stage, with the file contents when read ahead. */
+  struct image_file_t {
+    size_t file;
+    std::string name;
+    std::vector<unsigned char> data;
+    size_t data_size;
+
+    image_file_t() : data_size(0) {}
+  };
+
+  /** Decoded image travelling from the load stage to the detect stage. */
+  struct loaded_image_t {
+    size_t file;
+    std::string name;
+    file_stamp_t stamp;
+    uint64_t image_hash;
+    dlib::matrix<dlib::rgb_pixel> image;
+  };
+
+  /** Aligned faces travelling from the detect stage to the embed stage, with the perceptual hash and size of their
+   * image when skipping duplicates. */
+  struct detected_faces_t {
+    size_t file;
+    std::string name;
+    file_stamp_t stamp;
+    uint64_t image_hash;
+    uint32_t width;
+    uint32_t height;
+    std::vector<face> faces;
+  };
+
+  /** Images whose faces are known, by perceptual hash, so copies of them skip detection and embedding. */
+  struct duplicate_store_t {
+    std::mutex mutex;
+    perceptual_hash_index index;
+    std::vector<search_cache_entry_t> images;
+
+    explicit duplicate_store_t(unsigned int radius) : index(radius) {}
+
+    /** Records an image. Its image_hash, width and height must be set. */
+    void add(const search_cache_entry_t& entry)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      index.insert(entry.image_hash, images.size());
+      images.push_back(entry);
+    }
+
+    /** Finds the closest recorded copy of an image, with its boxes scaled to the image size. A copy of another
+     * shape, such as a crop that hashes alike, is no match: its boxes cannot be scaled onto the image. */
+    bool find(uint64_t image_hash, long width, long height, search_cache_entry_t& entry)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      size_t id = 0;
+      if(!index.find(image_hash, id))
+        return false;
+
+      auto& copy = images[id];
+      double aspect = double(width) * std::max(1u, copy.height);
+      double copy_aspect = double(height) * std::max(1u, copy.width);
+      if(std::abs(aspect - copy_aspect) > DUPLICATE_ASPECT_TOLERANCE * copy_aspect)
+        return false;
+
+      entry = copy;
+
+      double x_scale = double(width) / std::max(1u, entry.width);
+      double y_scale = double(height) / std::max(1u, entry.height);
+      for(auto& box : entry.boxes)
+        box = dlib::rectangle(std::lround(box.left() * x_scale), std::lround(box.top() * y_scale),
+          std::lround((box.right() + 1) * x_scale) - 1, std::lround((box.bottom() + 1) * y_scale) - 1);
+
+      return true;
+    }
+  };
+
+  /** Squared distance from each embedded face to its closest template, and which template that is, travelling from
+   * the embed stage to the match stage. Pipelines collecting faces pass their boxes and embeddings instead. */
+  struct scored_faces_t {
+    size_t file;
+    std::string name;
+    std::vector<float> distances;
+    std::vector<unsigned int> templates;
+    std::vector<dlib::rectangle> boxes;
+    std::vector<embedding_t> embeddings;
+  };
+
+  /** Receives the faces of each file at the end of the pipeline. Returning false stops the pipeline. */
+  typedef std::function<bool(scored_faces_t&)> faces_consumer_t;
+
+  /** First error raised by a pipeline worker, and how to stop the other stages when it happens. */
+  struct pipeline_error_t {
+    std::mutex mutex;
+    std::exception_ptr error;
+    std::function<void()> abort;
+
+    /** Aborts the pipeline without an error, once the consumer has seen enough results. */
+    void stop()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      abort();
+    }
+
+    /** Keeps the first error and aborts the pipeline. */
+    void fail(std::exception_ptr exception)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(!error) {
+        error = exception;
+        abort();
+      }
+    }
+  };
+
   /** Whether the face template has been initialised for search. */
   bool initialised_;
 
-  /** Embedding for our template face.*/
-  embedding_t template_embedding_;
+  /** Faces searched for. */
+  std::vector<face_template_t> templates_;
+
+  /** Embeddings of the template faces.*/
+  std::vector<embedding_t> template_embeddings_;
+
+  /** Template embeddings packed row-major, for the blocked distance kernel. */
+  std::vector<float> template_rows_;
+
+  /** Squared norm of each template embedding. */
+  std::vector<float> template_norms_;
 
   /** Face detector. */
   std::unique_ptr<face_detector> detector_;
@@ -107,6 +531,24 @@ private:
   /** Face recogniser. */
   std::unique_ptr<face_recogniser> recogniser_;
 
+  /** Detector copies for detect workers 1 and up. Worker 0 uses detector_. */
+  std::vector<std::unique_ptr<face_detector>> detector_replicas_;
+
+  /** Recogniser copies for embed workers 1 and up. Worker 0 uses recogniser_. */
+  std::vector<std::unique_ptr<face_recogniser>> recogniser_replicas_;
+
+  /** Thumbnail prefilter of each load worker. Empty when the prefilter is off. */
+  std::vector<std::unique_ptr<thumbnail_prefilter>> prefilters_;
+
+  /** CPU of each load worker. Empty when the threads are not pinned. */
+  std::vector<unsigned int> load_cpus_;
+
+  /** CPU of each detect worker, where its detector was built. Empty when the threads are not pinned. */
+  std::vector<unsigned int> detect_cpus_;
+
+  /** CPU of each embed worker, where its recogniser was built. Empty when the threads are not pinned. */
+  std::vector<unsigned int> embed_cpus_;
+
 
   /**
    * Determines whether two embeddings are sufficiently close. Closeness is determined by the threshold parameter.
@@ -115,6 +557,143 @@ private:
    * \return True if close, false if not close.
    */
   bool face_matched_(const embedding_t& face1, const embedding_t& face2);
+
+
+  /**
+   * \param image_files Image file names. Must outlive the source.
+   * \return Source producing the file names in order.
+   */
+  path_source_t vector_source_(const std::vector<std::string>& image_files) const;
+
+
+  /**
+   * \param search_directory Directory to walk.
+   * \return Source producing the images of the directory tree as the directory walker finds them.
+   */
+  path_source_t directory_source_(const std::string& search_directory) const;
+
+
+  /**
+   * Runs the search pipeline on the files a source produces.
+   * \param source Produces the image file names, on a thread of its own.
+   * \param mode Which matches to report.
+   * \param ordered Whether to report files in source order.
+   * \param callback Receives the matching files on the calling thread. Returning false stops the search.
+   */
+  void search_(const path_source_t& source, search_mode_t mode, bool ordered, const result_callback_t& callback);
+
+
+  /**
+   * Runs a search on worker processes, each searching shards of the files in this process. Results are merged here,
+   * the way search_ reports them.
+   * \param source Produces the image file names. Run to completion before the workers start.
+   * \param mode Which matches to report.
+   * \param ordered Whether to report files in source order.
+   * \param callback Receives the matching files on the calling thread. Returning false stops the search.
+   */
+  void search_workers_(const path_source_t& source, search_mode_t mode, bool ordered, const result_callback_t& callback);
+
+
+  /**
+   * \return The share of the thread budget of one process: the whole of it, or a worker process's part.
+   */
+  thread_budget process_budget_() const;
+
+
+  /**
+   * Chooses the CPUs of the load, detect and embed threads with the placement policy.
+   */
+  void place_threads_();
+
+
+  /**
+   * Builds the detector and recogniser replicas of the workers, each on its worker's CPU when they are pinned.
+   * \param clone Whether worker 0 gets a fresh copy of detector_ and recogniser_ too, as in a worker process, which
+   * would otherwise share the parent's.
+   */
+  void make_replicas_(bool clone);
+
+
+  /**
+   * Runs the load, detect and embed stages on the files a source produces.
+   * \param source Produces the image file names, on a thread of its own.
+   * \param mode Search mode. FIRST_MATCH embeds faces in rounds.
+   * \param collect Whether to pass on the boxes and embeddings of the faces rather than their template distances.
+   * \param consumer Receives every file, in completion order, on the calling thread.
+   */
+  void run_pipeline_(const path_source_t& source, search_mode_t mode, bool collect, const faces_consumer_t& consumer);
+
+
+  /**
+   * Finds the closest template of each embedding. Distances are estimated from one blocked matrix product of the
+   * embeddings with the templates, |e - t|^2 = |e|^2 + |t|^2 - 2 e.t, so many templates cost little more than one.
+   * Templates the estimate puts within reach of the threshold get their distance computed exactly.
+   * \param embeddings Embeddings of candidate faces.
+   * \param scores Output. Gets the squared distance and template index of each embedding appended.
+   */
+  void score_(const std::vector<embedding_t>& embeddings, scored_faces_t& scores) const;
+
+
+  /**
+   * Scores the cached faces of a file against the templates, as the embed stage would have.
+   * \param entry Cached faces.
+   * \param mode Search mode. FIRST_MATCH stops at the first matching face.
+   * \param scores Output. Gets the scores of the faces appended.
+   */
+  void score_cached_(const search_cache_entry_t& entry, search_mode_t mode, scored_faces_t& scores);
+
+
+  /**
+   * Turns the distances of a file into search results, one for each template some face matched.
+   * \param scores Squared template distances of the faces of a file.
+   * \param results Output. Gets the results appended, in template order.
+   * \return Whether the file matched.
+   */
+  bool make_results_(scored_faces_t& scores, std::vector<search_result_t>& results);
+
+
+  /**
+   * Gathers detected faces from several images until batch_size chips are waiting, batch_timeout_ms has passed since
+   * the first one arrived, or the input is drained.
+   * \param input Queue of detected faces.
+   * \param batch Output. Images in the batch, with their faces.
+   * \return False if the input was drained before anything arrived.
+   */
+  bool fill_batch_(bounded_queue<detected_faces_t>& input, std::vector<detected_faces_t>& batch);
+
+
+  /**
+   * Embeds the chips of a batch, scores them against the templates and hands the distances back to their images. All
+   * chips go through the recogniser in one call, except in FIRST_MATCH mode, where the i-th faces of the images still
+   * without a match are embedded together in round i.
+   * \param recogniser Recogniser to use.
+   * \param batch Images in the batch, with their faces.
+   * \param mode Search mode.
+   * \param collect Whether to hand back the boxes and embeddings of the faces instead of scoring them.
+   * \param cache Search cache to record the faces of each image in, or null. Images whose faces were not all embedded
+   * are not recorded.
+   * \param duplicates Store to record the faces of each image in for its copies, or null. Same rule as the cache.
+   * \param output Queue to send the distances of each image to.
+   * \return False if the output queue was closed.
+   */
+  bool embed_batch_(face_recogniser& recogniser, std::vector<detected_faces_t>& batch, search_mode_t mode,
+    bool collect, search_cache* cache, duplicate_store_t* duplicates, bounded_queue<scored_faces_t>& output);
+
+
+  /**
+   * Starts the worker threads of a pipeline stage. The output queue is closed when the last worker returns, and an
+   * exception in any worker aborts the whole pipeline.
+   * \param threads Thread list to add the workers to.
+   * \param name Stage name, naming its threads in the trace. Must outlive the trace.
+   * \param workers Number of workers.
+   * \param cpus CPU each worker is pinned to, or empty.
+   * \param output Queue the stage feeds.
+   * \param errors Shared error state of the pipeline.
+   * \param function Worker body, taking (unsigned int worker).
+   */
+  template <typename queue_t, typename function_t>
+  void start_stage_(std::vector<std::thread>& threads, const char* name, unsigned int workers,
+    const std::vector<unsigned int>& cpus, queue_t& output, pipeline_error_t& errors, function_t function);
 };
 
 
@@ -0,0 +1,216 @@
+#ifndef _FACEGREP_READ_AHEAD_H_
+#define _FACEGREP_READ_AHEAD_H_
+
+// ## INCLUDE #################################################################
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// ## NAMESPACE ###############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * Parameters for the read_ahead class.
+ */
+struct read_ahead_parameters_t {
+  /** Number of files being read at once. */
+  unsigned int depth;
+
+  /** Files larger than this are not read, and are left to the decoder. */
+  size_t max_file_size;
+
+  /** Whether to use io_uring when the kernel allows it. Otherwise reads are hinted with posix_fadvise and done when
+   * the file is collected, by which time the kernel has usually fetched it. */
+  bool use_io_uring;
+
+  read_ahead_parameters_t()
+  {
+    depth = 16;
+    max_file_size = size_t(64) << 20;
+    use_io_uring = true;
+  }
+};
+
+
+/**
+ * A file read by the read_ahead class.
+ */
+struct file_read_t {
+  /** Caller's identifier, given to read_ahead::submit(). */
+  size_t tag;
+
+  /** File name. */
+  std::string name;
+
+  /** Pooled buffer holding the file. It may be longer than the file. Hand it back with read_ahead::release(). */
+  std::vector<unsigned char> data;
+
+  /** Number of bytes read. 0 if the file could not be opened or read, or is too large, in which case the decoder
+   * should read it itself and report any error. */
+  size_t size;
+};
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * Keeps a number of whole-file reads in flight, so that decoding never waits on storage latency while there is work
+ * queued behind it. Reads go through io_uring when the kernel supports it, falling back to posix_fadvise hints and
+ * pread. Files are read into pooled buffers that the decoder uses in place.
+ *
+ * Not thread safe, except release(), which decoder threads call.
+ */
+class read_ahead {
+public:
+  /**
+   * \param params Structure containing the parameters.
+   */
+  explicit read_ahead(const read_ahead_parameters_t& params = read_ahead_parameters_t());
+
+
+  /**
+   * Waits for the reads in flight, so the kernel no longer writes into the buffers, and releases the ring.
+   */
+  ~read_ahead();
+
+
+  /**
+   * Starts reading a file. Call only when not full().
+   * \param tag Caller's identifier, handed back with the file.
+   * \param name File name.
+   */
+  void submit(size_t tag, const std::string& name);
+
+
+  /**
+   * Collects a finished read, in completion order.
+   * \param read Output. Finished read.
+   * \param wait Whether to wait for a read to finish when none has.
+   * \return False if there was no read to collect.
+   */
+  bool next(file_read_t& read, bool wait);
+
+
+  /**
+   * \return Whether depth reads are in flight.
+   */
+  bool full() const noexcept;
+
+
+  /**
+   * \return Whether no read is in flight.
+   */
+  bool empty() const noexcept;
+
+
+  /**
+   * \return Whether reads go through io_uring.
+   */
+  bool uses_io_uring() const noexcept;
+
+
+  /**
+   * Returns a buffer to the pool. Thread safe.
+   * \param buffer Buffer from a file_read_t.
+   */
+  void release(std::vector<unsigned char>&& buffer);
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** A read in flight. */
+  struct slot_t {
+    size_t tag;
+    std::string name;
+    int fd;
+    std::vector<unsigned char> data;
+    size_t size;
+    size_t done;
+  };
+
+  /** Parameters. */
+  read_ahead_parameters_t params_;
+
+  /** Read slots, depth of them. */
+  std::vector<slot_t> slots_;
+
+  /** Slots not in use. */
+  std::vector<size_t> free_slots_;
+
+  /** Slots in use, in submission order. Only the fallback reads them in this order. */
+  std::deque<size_t> pending_;
+
+  /** Finished reads not collected yet: files that could not be read at all. */
+  std::deque<size_t> finished_;
+
+  /** io_uring file descriptor, or -1 for the fallback. */
+  int ring_fd_;
+
+  /** Mapped io_uring rings. */
+  void* sq_ring_;
+  void* cq_ring_;
+  void* sqes_;
+  size_t sq_ring_size_;
+  size_t cq_ring_size_;
+  size_t sqes_size_;
+
+  /** Ring fields, inside the mappings. */
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  void* cqes_;
+
+  /** Buffers ready for reuse. */
+  std::vector<std::vector<unsigned char>> pool_;
+
+  /** Guards pool_. */
+  std::mutex pool_mutex_;
+
+
+  /**
+   * Sets up io_uring.
+   * \return False if the kernel does not allow it.
+   */
+  bool open_ring_();
+
+
+  /**
+   * Queues a read of the rest of a slot's file on the ring.
+   * \param slot Slot number.
+   * \return False if the read could not be queued.
+   */
+  bool queue_read_(size_t slot);
+
+
+  /**
+   * Waits for a read on the ring to complete, resubmitting short reads.
+   * \param wait Whether to wait when nothing has completed.
+   * \return Number of the finished slot, or slots_.size() if none.
+   */
+  size_t reap_(bool wait);
+
+
+  /**
+   * Hands a slot's file over and frees the slot.
+   * \param slot Slot number.
+   * \param read Output. Finished read.
+   */
+  void finish_(size_t slot, file_read_t& read);
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACEGREP_READ_AHEAD_H_
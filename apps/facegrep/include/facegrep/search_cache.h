@@ -0,0 +1,172 @@
+#ifndef _FACEGREP_SEARCH_CACHE_H_
+#define _FACEGREP_SEARCH_CACHE_H_
+
+// ## INCLUDE #################################################################
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <facetools/face.h>
+
+
+// ## NAMESPACE ###############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * What facegrep found in one image file.
+ */
+struct search_cache_entry_t {
+  /** File size in bytes when it was processed. */
+  uint64_t size;
+
+  /** File modification time in nanoseconds when it was processed. */
+  int64_t mtime;
+
+  /** Face boxes, in detection order. Empty when the file holds no faces. */
+  std::vector<dlib::rectangle> boxes;
+
+  /** Embedding of each face. */
+  std::vector<embedding_t> embeddings;
+
+  /** Perceptual hash of the image, for spotting copies of it. 0 when not computed. */
+  uint64_t image_hash;
+
+  /** Image width in pixels, for scaling the boxes to a copy of another size. */
+  uint32_t width;
+
+  /** Image height in pixels. */
+  uint32_t height;
+
+  search_cache_entry_t()
+  {
+    size = 0;
+    mtime = 0;
+    image_hash = 0;
+    width = 0;
+    height = 0;
+  }
+};
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * Persistent record of the faces found in image files, so repeated searches of a directory only process new or
+ * changed files. Entries are keyed by path and validated against the file size and modification time, and files
+ * without faces are recorded too. The cache file is an append-only log of entries behind a header that holds a hash
+ * of the models and detector settings; a cache written with other settings is discarded. Thread safe.
+ */
+class search_cache {
+public:
+  /**
+   * Opens or creates a cache file.
+   * \param file_name Cache file.
+   * \param settings_hash Hash of everything besides the image that changes the faces found or their embeddings.
+   */
+  search_cache(const std::string& file_name, uint64_t settings_hash);
+
+
+  /**
+   * Reads the size and modification time of a file.
+   * \param path File to check.
+   * \param size Output. File size in bytes.
+   * \param mtime Output. Modification time in nanoseconds.
+   * \return False if the file cannot be checked.
+   */
+  static bool stat_file(const std::string& path, uint64_t& size, int64_t& mtime);
+
+
+  /**
+   * Looks up a file.
+   * \param path File name.
+   * \param size Current file size.
+   * \param mtime Current modification time.
+   * \param entry Output. Set when found.
+   * \return True if the file is cached and unchanged.
+   */
+  bool get(const std::string& path, uint64_t size, int64_t mtime, search_cache_entry_t& entry) const;
+
+
+  /**
+   * Checks whether a file is cached and unchanged, without copying its entry.
+   * \param path File name.
+   * \param size Current file size.
+   * \param mtime Current modification time.
+   * \return True if the file is cached and unchanged.
+   */
+  bool contains(const std::string& path, uint64_t size, int64_t mtime) const;
+
+
+  /**
+   * Records what was found in a file and appends it to the cache file.
+   * \param path File name.
+   * \param entry Faces found.
+   */
+  void put(const std::string& path, const search_cache_entry_t& entry);
+
+
+  /**
+   * Calls a function for every cached file, under the cache lock.
+   * \param function Callable taking (const std::string& path, const search_cache_entry_t& entry).
+   */
+  void for_each(const std::function<void(const std::string&, const search_cache_entry_t&)>& function) const;
+
+
+  /**
+   * Writes buffered entries to disk.
+   */
+  void flush();
+
+
+  /**
+   * \return Number of files cached.
+   */
+  size_t size() const;
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Cache file name. */
+  std::string file_name_;
+
+  /** Settings the cached faces were found with. */
+  uint64_t settings_hash_;
+
+  /** Cached files. */
+  std::unordered_map<std::string, search_cache_entry_t> entries_;
+
+  /** Log the new entries are appended to. */
+  std::ofstream log_;
+
+  /** Guards entries_ and log_. */
+  mutable std::mutex mutex_;
+
+
+  /**
+   * Reads the cache file.
+   * \param records Output. Number of valid records read, superseded ones included.
+   * \return False if the file is missing or was written with other settings.
+   */
+  bool load_(size_t& records);
+
+
+  /**
+   * Rewrites the cache file with only the live entries.
+   */
+  void compact_();
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACEGREP_SEARCH_CACHE_H_
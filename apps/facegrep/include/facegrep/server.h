@@ -0,0 +1,225 @@
+#ifndef _FACEGREP_SERVER_H_
+#define _FACEGREP_SERVER_H_
+
+// ## INCLUDE #################################################################
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <facegrep/facegrep.h>
+#include <facetools/bounded_queue.h>
+
+
+// ## NAMESPACE ###############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * A search sent to a facegrep server. Paths are resolved by the server, so they should be absolute.
+ */
+struct facegrep_request_t {
+  /** Images of the faces searched for. */
+  std::vector<std::string> face_files;
+
+  /** Directory to search, including all subdirectories. Empty to search image_files instead. */
+  std::string search_directory;
+
+  /** Image files to search when there is no search_directory. */
+  std::vector<std::string> image_files;
+
+  /** Threshold for deciding closeness between faces. */
+  float threshold;
+
+  /** Which matches are reported. */
+  search_mode_t search_mode;
+
+  /** Number of files reported in TOP_K mode. */
+  unsigned int top_k;
+
+  /** Whether files are reported in search order. */
+  bool ordered_results;
+
+  /** Whether every face in a face file is searched for, rather than only the first one. */
+  bool all_template_faces;
+
+  facegrep_request_t()
+  {
+    threshold = 0.6;
+    search_mode = search_mode_t::ALL;
+    top_k = 10;
+    ordered_results = false;
+    all_template_faces = false;
+  }
+};
+
+
+/**
+ * Parameters for the facegrep_server class.
+ */
+struct facegrep_server_parameters_t {
+  /** Path of the Unix domain socket to listen on. A stale socket file there is replaced. */
+  std::string socket_path;
+
+  /** Number of searches run at once. Each one holds a facegrep, with its own copies of the models. Further clients
+   * wait for a free one. */
+  unsigned int instances;
+
+  /** Number of connections waiting to be accepted. */
+  unsigned int backlog;
+
+  facegrep_server_parameters_t()
+  {
+    instances = 2;
+    backlog = 16;
+  }
+};
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * A resident facegrep listening on a Unix domain socket. The models are loaded once, when the server is constructed,
+ * and every connection is served on a thread of its own by whichever facegrep instance is free, so many short
+ * searches cost no model loading at all.
+ *
+ * The protocol is line based. A client sends "facegrep 1", then "key value" lines (face, directory, image, threshold,
+ * mode, top_k, ordered, all_faces) and "end". The server replies with one "template" line per face searched for, one
+ * "match" line per result, as the search finds them, and "done", or "error" and a message.
+ */
+class facegrep_server {
+public:
+  /**
+   * Loads the models and starts listening.
+   * \param params Server parameters.
+   * \param facegrep_params Parameters of the facegrep instances. Query settings are overridden by each request, and
+   * neither the search cache, worker processes nor thread placement are used. The instances share the thread budget.
+   */
+  facegrep_server(const facegrep_server_parameters_t& params, const facegrep_parameters_t& facegrep_params);
+
+
+  /**
+   * Stops listening and removes the socket file.
+   */
+  ~facegrep_server();
+
+
+  /**
+   * Accepts connections until stop() is called, then stops listening and waits for the searches in progress to
+   * finish. Runs once.
+   */
+  void run();
+
+
+  /**
+   * Makes run() return. Safe to call from other threads and from signal handlers.
+   */
+  void stop();
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Parameters. */
+  facegrep_server_parameters_t params_;
+
+  /** Listening socket. */
+  int listen_fd_;
+
+  /** Pipe waking run() up when stop() is called. */
+  int stop_pipe_[2];
+
+  /** Facegrep instances. */
+  std::vector<std::unique_ptr<facegrep>> instances_;
+
+  /** Instances not running a search. */
+  bounded_queue<facegrep*> idle_;
+
+  /** Guards connections_. */
+  std::mutex connections_mutex_;
+
+  /** Signalled when a connection closes. */
+  std::condition_variable connections_closed_;
+
+  /** Number of connections being served. */
+  unsigned int connections_;
+
+
+  /**
+   * Reads a request, runs it on a free instance and streams the results back. Closes the connection.
+   * \param fd Connected socket.
+   */
+  void serve_(int fd);
+
+
+  /**
+   * Runs a request on an instance.
+   * \param fg Instance to use.
+   * \param request Search to run.
+   * \param fd Connected socket to write the replies to.
+   */
+  void search_(facegrep& fg, const facegrep_request_t& request, int fd);
+};
+
+
+/**
+ * Client side of the facegrep server protocol.
+ */
+class facegrep_client {
+public:
+  /**
+   * Sends a search to a server and streams back its results. Relative paths in the request are made absolute first,
+   * since the server does not share the client's working directory.
+   * \param socket_path Path of the server socket.
+   * \param request Search to run.
+   * \param templates Output. Faces searched for, filled in before the first result, so the callback can look up
+   * search_result_t::face_template in it.
+   * \param callback Receives the matching files. Returning false stops the search.
+   */
+  static void query(const std::string& socket_path, const facegrep_request_t& request,
+    std::vector<face_template_t>& templates, const result_callback_t& callback);
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /**
+   * Sends a request and reads the replies until the search is over.
+   * \param fd Socket connected to the server.
+   * \param request Search to run, with absolute paths.
+   * \param templates Output. Faces searched for.
+   * \param callback Receives the matching files. Returning false stops the search.
+   * \return False if the server closed the connection before the search was over.
+   */
+  static bool read_replies_(int fd, const facegrep_request_t& request, std::vector<face_template_t>& templates,
+    const result_callback_t& callback);
+};
+
+
+// ## FUNCTIONS ###############################################################
+
+/**
+ * Writes a request in the server protocol.
+ * \param request Request to write.
+ * \return Protocol text, ending with the "end" line.
+ */
+std::string format_request(const facegrep_request_t& request);
+
+
+/**
+ * Parses a request line into a request.
+ * \param line Line, without its newline.
+ * \param request Request to update.
+ * \return False if the line is not a valid request line.
+ */
+bool parse_request_line(const std::string& line, facegrep_request_t& request);
+
+
+} // NAMESPACE facetools
+
+#endif // _FACEGREP_SERVER_H_
@@ -0,0 +1,163 @@
+#ifndef _FACEGREP_WORKER_POOL_H_
+#define _FACEGREP_WORKER_POOL_H_
+
+// ## INCLUDE #################################################################
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include <facegrep/facegrep.h>
+
+
+// ## NAMESPACE ###############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * Parameters for the worker_pool class.
+ */
+struct worker_pool_parameters_t {
+  /** Number of worker processes. */
+  unsigned int workers;
+
+  /** Number of files handed to a worker at a time. */
+  unsigned int shard_size;
+
+  /** Number of times a single file may take its worker down before it is skipped. */
+  unsigned int max_failures;
+
+  /** CPUs each worker process is restricted to, worker i getting set i modulo their number, such as the CPUs of one
+   * NUMA node. Threads the worker starts inherit its set. Empty leaves the workers to the scheduler. */
+  std::vector<std::vector<unsigned int>> cpu_sets;
+
+  worker_pool_parameters_t()
+  {
+    workers = 2;
+    shard_size = 32;
+    max_failures = 2;
+  }
+};
+
+
+/**
+ * Runs the files first to first + count - 1 of a search in a worker process, sending each result to emit with its
+ * index in the whole search. The file name need not be set.
+ */
+typedef std::function<void(size_t first, size_t count, const result_callback_t& emit)> shard_search_t;
+
+/**
+ * Receives the results of the files first to first + count - 1 in the parent, once they are all done, in no
+ * particular order. Returning false stops the search.
+ */
+typedef std::function<bool(size_t first, size_t count, std::vector<search_result_t>& results)> shard_consumer_t;
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * Splits a search into shards of consecutive files and runs them on forked worker processes, which take the next
+ * shard from the parent whenever they finish one. Workers start as copies of the parent, so models loaded before the
+ * search are shared with them until written to, and a crash takes down a single worker. The parent restarts it and
+ * requeues its shard file by file, so the file that caused the crash is isolated and skipped once it has failed
+ * max_failures times.
+ *
+ * The parent must not run other threads while searching, as they would not exist in the workers.
+ */
+class worker_pool {
+public:
+  /**
+   * \param params Structure containing the parameters.
+   */
+  explicit worker_pool(const worker_pool_parameters_t& params = worker_pool_parameters_t());
+
+
+  /**
+   * Stops the workers still running.
+   */
+  ~worker_pool();
+
+
+  /**
+   * Searches files 0 to num_files - 1.
+   * \param num_files Number of files.
+   * \param search Searches a shard. Runs in the workers, so it only sees the parent's state as it was at the fork.
+   * Exceptions count as crashes.
+   * \param consumer Receives the results of each shard in the parent. Files skipped come as shards of one file
+   * without results.
+   * \return Files skipped, sorted.
+   */
+  std::vector<size_t> run(size_t num_files, const shard_search_t& search, const shard_consumer_t& consumer);
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Consecutive files of a search. */
+  struct shard_t {
+    size_t first;
+    size_t count;
+    unsigned int failures;
+  };
+
+  /** A worker process. */
+  struct worker_t {
+    pid_t pid;
+    int fd;
+    bool busy;
+    shard_t shard;
+    std::vector<search_result_t> results;
+    std::string buffer;
+  };
+
+  /** Parameters. */
+  worker_pool_parameters_t params_;
+
+  /** Running workers. */
+  std::vector<worker_t> workers_;
+
+
+  /**
+   * Forks a worker.
+   * \param search Shard search the worker runs.
+   * \param slot Index of the worker in workers_, which picks its CPU set.
+   * \return The worker, idle.
+   */
+  worker_t start_worker_(const shard_search_t& search, size_t slot);
+
+
+  /**
+   * Body of a worker process: runs the shards it is sent until the parent closes the socket. Never returns.
+   * \param fd Socket to the parent.
+   * \param search Shard search.
+   */
+  [[noreturn]] static void run_worker_(int fd, const shard_search_t& search);
+
+
+  /**
+   * Reads what a worker sent.
+   * \param worker Worker with data waiting.
+   * \param finished Output. Set when the worker finished its shard.
+   * \return False if the worker died.
+   */
+  bool read_worker_(worker_t& worker, bool& finished);
+
+
+  /**
+   * Closes a worker's socket, which makes it exit, and waits for it. Does nothing if it is already stopped.
+   * \param worker Worker to stop.
+   * \param kill Whether to kill it rather than let it finish its shard.
+   */
+  static void stop_worker_(worker_t& worker, bool kill);
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACEGREP_WORKER_POOL_H_
@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <iostream>
 #include <string.h>
+#include <sstream>
+#include <vector>
 
 #include <facegrep/command_line_parser.h>
 #include <file_utils.h>
@@ -21,7 +23,8 @@ facegrep_commandline_parameters_t command_line_parser::parse(int argc, char** ar
 
   while(true) {
     int option_index = 0;
-    int c = getopt_long(argc, argv, "jmt:", command_line_options, &option_index);
+    int c = getopt_long(argc, argv, "jmt:p:b:fk:docC:aS:U:n:GM:uPX:R:w:A:B:TsJ:I:e:", command_line_options,
+      &option_index);
 
     if(c == -1)
       break;
@@ -37,20 +40,151 @@ facegrep_commandline_parameters_t command_line_parser::parse(int argc, char** ar
       case 't':
         params.threshold = std::stof(optarg);
         break;
+      case 'p':
+        if(!parse_threads(optarg, params))
+          print_usage(argv);
+        break;
+      case 'b':
+        if(std::stoi(optarg) < 1)
+          print_usage(argv);
+        params.batch_size = std::stoi(optarg);
+        break;
+      case 'f':
+        params.first_match = true;
+        break;
+      case 'k':
+        if(std::stoi(optarg) < 1)
+          print_usage(argv);
+        params.top_k = std::stoi(optarg);
+        break;
+      case 'd':
+        params.show_distance = true;
+        break;
+      case 'o':
+        params.ordered = true;
+        break;
+      case 'c':
+        params.cache = true;
+        break;
+      case 'C':
+        params.cache = true;
+        params.cache_file = optarg;
+        break;
+      case 'a':
+        params.all_faces = true;
+        break;
+      case 'S':
+        params.serve_socket = optarg;
+        break;
+      case 'U':
+        params.client_socket = optarg;
+        break;
+      case 'n':
+        if(std::stoi(optarg) < 1)
+          print_usage(argv);
+        params.instances = std::stoi(optarg);
+        break;
+      case 'G':
+        params.cluster = true;
+        break;
+      case 'M':
+        if(std::stoi(optarg) < 1)
+          print_usage(argv);
+        params.memory_budget_mb = std::stoi(optarg);
+        break;
+      case 'u':
+        params.skip_duplicates = true;
+        break;
+      case 'P':
+        params.prefilter = true;
+        break;
+      case 'X':
+        params.prefilter = true;
+        params.prefilter_threshold = std::stod(optarg);
+        break;
+      case 'R':
+        if(std::stoi(optarg) < 0)
+          print_usage(argv);
+        params.read_ahead = std::stoi(optarg);
+        break;
+      case 'w':
+        if(std::stoi(optarg) < 1)
+          print_usage(argv);
+        params.workers = std::stoi(optarg);
+        break;
+      case 'A':
+        if(!parse_placement_policy(optarg, params.placement))
+          print_usage(argv);
+        break;
+      case 'B':
+        if(std::stoi(optarg) < 1)
+          print_usage(argv);
+        params.thread_budget = std::stoi(optarg);
+        break;
+      case 'T':
+        params.tune_threads = true;
+        break;
+      case 's':
+        params.stats = true;
+        break;
+      case 'J':
+        params.stats_file = optarg;
+        break;
+      case 'I':
+        if(std::stoi(optarg) < 1)
+          print_usage(argv);
+        params.stats_interval = std::stoi(optarg);
+        break;
+      case 'e':
+        params.trace_file = optarg;
+        break;
       default:
         print_usage(argv);
     }
   }
 
+  // A server takes its face files and directories from the clients, and keeps no cache. Its searches run on threads,
+  // which worker processes cannot be forked from.
+  if(!params.serve_socket.empty())
+  {
+    if(optind < argc || !params.client_socket.empty() || params.cache || params.cluster || params.workers)
+      print_usage(argv);
+
+    return params;
+  }
+
+  // Clustering takes the directory alone.
+  if(params.cluster)
+  {
+    if(optind != argc-1 || !params.client_socket.empty())
+      print_usage(argv);
+
+    params.search_directory = argv[optind];
+    if(!dir_exists(params.search_directory))
+      print_usage(argv);
+
+    return params;
+  }
+
+  // Searches run on a server do not use a cache either, nor do worker processes, which cannot share one.
+  if((!params.client_socket.empty() || params.workers) && params.cache)
+    print_usage(argv);
+
+  // Every argument but the last is a face file.
   if(optind < argc-1)
   {
-    params.face_file = argv[optind];
-    params.search_directory = argv[optind+1];
+    params.face_files.assign(argv + optind, argv + argc - 1);
+    params.face_file = params.face_files[0];
+    params.search_directory = argv[argc-1];
   }
   else
     print_usage(argv);
 
-  if(!file_exists(params.face_file) || !dir_exists(params.search_directory))
+  for(auto& face_file : params.face_files)
+    if(!file_exists(face_file))
+      print_usage(argv);
+
+  if(!dir_exists(params.search_directory))
     print_usage(argv);
 
   return params;
@@ -60,16 +194,97 @@ facegrep_commandline_parameters_t command_line_parser::parse(int argc, char** ar
 void command_line_parser::print_usage(char** argv)
 {
   std::string program_name = argv[0];
-  std::cout << "Usage: " << program_name + " [options] <face file> <search directory>\n" <<
+  std::cout << "Usage: " << program_name + " [options] <face file>... <search directory>\n" <<
+    "       " << program_name + " [options] --serve <socket>\n" <<
+    "       " << program_name + " [options] --cluster <search directory>\n" <<
     "Options:\n"
     "  -j or --jitter\t Apply jitter averaging. Makes it more robust.\n"
     "  -m or --mmod\t\t Uses the max marginal object face detection method.\n"
     "              \t\t Slow but more accurate [recommended if you have powerful GPU].\n"
     "  -t or --threshold\t Distance threshold to use for determining face similarity. Default: 0.6.\n"
+    "  -p or --threads\t Worker threads per pipeline stage, as N or load,detect,embed. 0 uses every core.\n"
+    "              \t\t Default: 1.\n"
+    "  -b or --batch-size\t Number of faces, gathered across images, embedded per network call. Default: 32.\n"
+    "  -f or --first-match\t Stop looking at the faces of an image once one matched.\n"
+    "  -k or --top-k\t\t Only print the k closest matches, closest first, once the search is over.\n"
+    "  -d or --distance\t Print the face distance after each image.\n"
+    "  -o or --ordered\t Print images in search order. By default they are printed as soon as they match.\n"
+    "  -c or --cache\t\t Remember the faces found in each image, so later searches only process new or changed\n"
+    "              \t\t images. The cache is kept in <search directory>/" SEARCH_CACHE_FILE ".\n"
+    "  -C or --cache-file\t Same as --cache, with the cache kept in the given file.\n"
+    "  -a or --all-faces\t Search for every face in the face files, not just the first of each. With several\n"
+    "              \t\t faces, each match is printed with the face file it matched, once for every face\n"
+    "              \t\t file an image holds.\n"
+    "  -S or --serve\t\t Load the models once and serve searches sent with --client on a Unix domain socket.\n"
+    "  -U or --client\t Run the search on the server listening on the given socket, without loading models.\n"
+    "  -n or --instances\t Searches a server runs at once, each with its own copy of the models. Default: 2.\n"
+    "  -G or --cluster\t Group every face in the directory by person. Prints one line per face: cluster number,\n"
+    "              \t\t image and face box (left,top,right,bottom), largest cluster first.\n"
+    "  -M or --memory-budget\t Megabytes of face pairs kept in memory while clustering. The rest are spilled to\n"
+    "              \t\t $TMPDIR or /tmp. Default: 1024.\n"
+    "  -u or --skip-duplicates\t Give resized or re-encoded copies of an image the faces of the first copy seen, in\n"
+    "              \t\t this search or in the cache, instead of processing them again.\n"
+    "  -P or --prefilter\t Skip JPEGs whose EXIF thumbnail shows no face, without decoding the full image.\n"
+    "              \t\t Ignored with --mmod, as the thumbnail check uses the default detector.\n"
+    "  -X or --prefilter-threshold Same as --prefilter, with the given thumbnail detector threshold adjustment.\n"
+    "              \t\t Lower values miss fewer faces and skip fewer images. Default: -0.5.\n"
+    "  -R or --read-ahead\t Number of image files read ahead of decoding, with io_uring where available. 0 reads\n"
+    "              \t\t each file when it is decoded. Default: 16.\n"
+    "  -w or --workers\t Shard the search across this many worker processes, each running the --threads\n"
+    "              \t\t pipeline. A worker that crashes is restarted and the image that crashed it skipped.\n"
+    "              \t\t Not with --cache, which the workers cannot share.\n"
+    "  -A or --placement\t Pin threads and workers to CPUs: none, compact (fill one NUMA node first) or spread\n"
+    "              \t\t (across the nodes). Models are copied to each thread's node. Default: none.\n"
+    "  -B or --thread-budget\t Cores shared by the detect and embed threads and the BLAS threads of their model\n"
+    "              \t\t calls, split between the --workers. Default: BLAS uses every core in every call.\n"
+    "  -T or --tune-threads\t Time a few splits of the thread budget, or of every core, between detect and embed\n"
+    "              \t\t threads and BLAS threads on the first images, and search with the fastest.\n"
+    "  -s or --stats\t\t Print the time spent in each stage (decode, detect, embed, match...) with its\n"
+    "              \t\t percentiles, and counts of images, faces, bytes read and cache hits, to standard\n"
+    "              \t\t error at exit. Worker processes' own stages are not included.\n"
+    "  -J or --stats-file\t Write the same stats, with their latency histograms, to the given file as JSON at exit.\n"
+    "  -I or --stats-interval Also rewrite the --stats-file every given number of seconds.\n"
+    "  -e or --trace\t\t Write a trace of the run to the given file, in the Chrome trace event format that\n"
+    "              \t\t Perfetto loads: a span per image in each pipeline stage, and per model call, on each\n"
+    "              \t\t thread. Shows stalls and idle threads. Worker processes are not traced.\n"
   ;
 
   exit(1);
 }
 
 
+bool command_line_parser::parse_threads(const std::string& argument, facegrep_commandline_parameters_t& params)
+{
+  std::vector<unsigned int> counts;
+  std::istringstream stream(argument);
+  std::string field;
+
+  while(std::getline(stream, field, ',')) {
+    try {
+      size_t end = 0;
+      int count = std::stoi(field, &end);
+      if(count < 0 || field.find_first_not_of(' ', end) != std::string::npos)
+        return false;
+
+      counts.push_back(count);
+    }
+    catch(const std::exception&) {
+      return false;
+    }
+  }
+
+  if(counts.size() == 1)
+    counts.resize(3, counts[0]);
+
+  if(counts.size() != 3)
+    return false;
+
+  params.load_threads = counts[0];
+  params.detect_threads = counts[1];
+  params.embed_threads = counts[2];
+
+  return true;
+}
+
+
 } // NAMESPACE facetools
\ No newline at end of file
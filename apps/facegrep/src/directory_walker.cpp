@@ -0,0 +1,215 @@
+// ## INCLUDE #################################################################
+
+#include <directory_walker.h>
+#include <file_utils.h>
+#include <facetools/parallel.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <dirent.h>
+#include <exception>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+// ## CONSTANTS ###############################################################
+
+/** Size of the getdents64 buffer. Large reads cut round trips on network file systems. */
+static const size_t DIRENT_BUFFER_SIZE = 64 * 1024;
+
+
+// ## PRIVATE STRUCTURES ######################################################
+
+/**
+ * State shared by the walker threads.
+ */
+struct walk_state_t {
+  /** Guards everything but the callback. */
+  std::mutex mutex;
+
+  /** Signalled when directories are queued or the walk ends. */
+  std::condition_variable wake;
+
+  /** Directories waiting to be read. */
+  std::vector<std::string> directories;
+
+  /** Directories queued or being read. The walk is over when this drops to 0. */
+  size_t pending;
+
+  /** Set when the callback asks to stop. */
+  bool stopped;
+
+  /** Serialises callback calls. */
+  std::mutex callback_mutex;
+};
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/**
+ * Reads one directory.
+ * \param directory Directory path.
+ * \param buffer getdents64 buffer of DIRENT_BUFFER_SIZE bytes.
+ * \param subdirectories Output. Subdirectories found.
+ * \param files Output. Non-directory entries found.
+ */
+static void read_directory(const std::string& directory, char* buffer, std::vector<std::string>& subdirectories,
+  std::vector<std::string>& files)
+{
+  int fd = openat(AT_FDCWD, directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(fd < 0)
+    return;
+
+  std::string prefix = directory.back() == '/' ? directory : directory + "/";
+
+  while(true) {
+    long bytes = syscall(SYS_getdents64, fd, buffer, DIRENT_BUFFER_SIZE);
+    if(bytes <= 0)
+      break;
+
+    for(long offset = 0; offset < bytes;) {
+      auto entry = reinterpret_cast<const struct dirent64*>(buffer + offset);
+      offset += entry->d_reclen;
+
+      const char* name = entry->d_name;
+      if(name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+        continue;
+
+      unsigned char type = entry->d_type;
+      struct stat sb;
+
+      if(type == DT_UNKNOWN) {
+        if(fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+          continue;
+
+        type = S_ISDIR(sb.st_mode) ? DT_DIR : S_ISLNK(sb.st_mode) ? DT_LNK : DT_REG;
+      }
+
+      // Links are reported when they point at a file. Linked directories are not followed, which rules out cycles.
+      if(type == DT_LNK && (fstatat(fd, name, &sb, 0) != 0 || S_ISDIR(sb.st_mode)))
+        continue;
+
+      if(type == DT_DIR)
+        subdirectories.push_back(prefix + name);
+      else
+        files.push_back(prefix + name);
+    }
+  }
+
+  close(fd);
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+directory_walker::directory_walker(const std::vector<std::string>& search_filter, unsigned int num_threads)
+{
+  search_filter_ = search_filter;
+  num_threads_ = facetools::resolve_thread_count(num_threads);
+}
+
+
+bool directory_walker::walk(const std::string& search_directory, const path_callback_t& callback) const
+{
+  if(!dir_exists(search_directory))
+    return false;
+
+  walk_state_t state;
+  state.directories.push_back(search_directory);
+  state.pending = 1;
+  state.stopped = false;
+
+  facetools::run_on_threads(num_threads_, [&](unsigned int) {
+    std::unique_ptr<uint64_t[]> buffer(new uint64_t[DIRENT_BUFFER_SIZE / sizeof(uint64_t)]);
+    std::vector<std::string> subdirectories;
+    std::vector<std::string> files;
+
+    while(true) {
+      std::string directory;
+      {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.wake.wait(lock, [&] { return state.stopped || !state.directories.empty() || !state.pending; });
+
+        if(state.stopped || state.directories.empty())
+          return;
+
+        directory = std::move(state.directories.back());
+        state.directories.pop_back();
+      }
+
+      subdirectories.clear();
+      files.clear();
+      read_directory(directory, reinterpret_cast<char*>(buffer.get()), subdirectories, files);
+
+      files.erase(std::remove_if(files.begin(), files.end(), [&](const std::string& file) { return !matches_(file); }),
+        files.end());
+
+      // A throwing callback still has to stop the walk, or the other workers would wait for it forever.
+      bool keep_going = true;
+      std::exception_ptr error;
+
+      if(!files.empty()) {
+        std::lock_guard<std::mutex> lock(state.callback_mutex);
+        try {
+          for(size_t i = 0; i < files.size() && keep_going; ++i)
+            keep_going = callback(files[i]);
+        }
+        catch(...) {
+          error = std::current_exception();
+          keep_going = false;
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.pending += subdirectories.size();
+        state.pending -= 1;
+        std::move(subdirectories.begin(), subdirectories.end(), std::back_inserter(state.directories));
+
+        if(!keep_going)
+          state.stopped = true;
+      }
+
+      // Wakes idle workers for the new directories, or everybody when the walk is over.
+      state.wake.notify_all();
+
+      if(error)
+        std::rethrow_exception(error);
+    }
+  });
+
+  return true;
+}
+
+
+std::vector<std::string> directory_walker::find(const std::string& search_directory) const
+{
+  std::vector<std::string> files_found;
+
+  walk(search_directory, [&](const std::string& file) {
+    files_found.push_back(file);
+    return true;
+  });
+
+  std::sort(files_found.begin(), files_found.end());
+
+  return files_found;
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+bool directory_walker::matches_(const std::string& path) const
+{
+  for(auto& filter : search_filter_)
+    if(fnmatch(filter.c_str(), path.c_str(), FNM_CASEFOLD) == 0)
+      return true;
+
+  return false;
+}
@@ -1,7 +1,24 @@
 // ## INCLUDE #################################################################
 
 #include <facegrep/facegrep.h>
+#include <facegrep/worker_pool.h>
+#include <directory_walker.h>
+#include <file_finder.h>
+#include <facetools/distance.h>
 #include <facetools/error.h>
+#include <facetools/hash.h>
+#include <facetools/jpeg_decoder.h>
+#include <facetools/parallel.h>
+#include <facetools/similarity_graph.h>
+#include <facetools/stats.h>
+#include <facetools/trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
 
 
 // ## NAMESPACE ###############################################################
@@ -9,12 +26,76 @@
 namespace facetools {
 
 
+// ## CONSTANTS ###############################################################
+
+/** File names are small, so the path queue holds many more of them than the image queues hold images. */
+static const unsigned int PATHS_PER_QUEUE_SLOT = 256;
+
+/** How long the read ahead stage waits for more file names before checking on the reads in flight. */
+static const unsigned int READ_AHEAD_POLL_MS = 1;
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/**
+ * Orders results by distance, then by position in the search, then by template.
+ * \param a First result.
+ * \param b Second result.
+ * \return Whether a is closer than b.
+ */
+static bool closer(const search_result_t& a, const search_result_t& b)
+{
+  if(a.distance != b.distance)
+    return a.distance < b.distance;
+
+  return a.index < b.index || (a.index == b.index && a.face_template < b.face_template);
+}
+
+
+/**
+ * \param cpus CPU of each worker of a stage, or empty.
+ * \param worker Worker index.
+ * \return CPU of the worker, or -1 when it is not pinned.
+ */
+static int worker_cpu(const std::vector<unsigned int>& cpus, unsigned int worker)
+{
+  return cpus.empty() ? -1 : int(cpus[worker % cpus.size()]);
+}
+
+
 // ## PUBLIC METHODS ##########################################################
 
 facegrep::facegrep(const facegrep_parameters_t& params)
 {
   require_true(params.threshold > 0, "facegrep: threshold < 0");
   params_.threshold = params.threshold;
+  params_.load_threads = resolve_thread_count(params.load_threads);
+  params_.detect_threads = resolve_thread_count(params.detect_threads);
+  params_.embed_threads = resolve_thread_count(params.embed_threads);
+  params_.queue_size = params.queue_size;
+  params_.walk_threads = params.walk_threads;
+  params_.batch_size = std::max(1u, params.batch_size);
+  params_.batch_timeout_ms = params.batch_timeout_ms;
+  params_.search_mode = params.search_mode;
+  params_.top_k = std::max(1u, params.top_k);
+  params_.ordered_results = params.ordered_results;
+  params_.cache_file = params.cache_file;
+  params_.all_template_faces = params.all_template_faces;
+  params_.cluster_memory_budget = params.cluster_memory_budget;
+  params_.spill_directory = params.spill_directory;
+  params_.skip_duplicates = params.skip_duplicates;
+  params_.duplicate_radius = params.duplicate_radius;
+  params_.read_ahead = params.read_ahead;
+  params_.workers = params.workers;
+  params_.placement = params.placement;
+  params_.thread_budget = params.thread_budget;
+
+  // Every detect and embed thread may be in a model call at once. Load threads decode images, without BLAS.
+  params_.blas_threads = 0;
+  if(params_.thread_budget)
+    params_.blas_threads = process_budget_().split(params_.detect_threads + params_.embed_threads).blas_threads;
+
+  place_threads_();
 
   face_detector_parameters_t detector_params;
   detector_params.detector_type = params.detector_type;
@@ -25,7 +106,7 @@ facegrep::facegrep(const facegrep_parameters_t& params)
   if(!params.shape_model.empty())
     detector_params.shape_predictor_model_file = params.shape_model;
 
-  detector_ = std::make_unique<face_detector>(detector_params);
+  run_pinned(worker_cpu(detect_cpus_, 0), [&] { detector_ = std::make_unique<face_detector>(detector_params); });
 
   face_recogniser_parameters_t recogniser_params;
   recogniser_params.jitter_images = params.jitter;
@@ -34,49 +115,203 @@ facegrep::facegrep(const facegrep_parameters_t& params)
   if(!params.recogniser_model.empty())
     recogniser_params.recogniser_model_file = params.recogniser_model;
 
-  recogniser_ = std::make_unique<face_recogniser>(recogniser_params);
+  run_pinned(worker_cpu(embed_cpus_, 0), [&] {
+    recogniser_ = std::make_unique<face_recogniser>(recogniser_params);
+  });
+
+  // Everything besides the image that changes which faces are found, where, and their embeddings.
+  settings_hash_ = 0;
+  if(!params_.cache_file.empty()) {
+    settings_hash_ = hash_combine(hash_file(recogniser_params.recogniser_model_file), params.jitter);
+    settings_hash_ = hash_combine(settings_hash_, hash_file(detector_params.shape_predictor_model_file));
+    settings_hash_ = hash_combine(settings_hash_, uint64_t(params.detector_type));
+    settings_hash_ = hash_combine(settings_hash_, detector_params.max_scaling_length);
+    settings_hash_ = hash_combine(settings_hash_, detector_params.max_scaling_times);
+
+    if(params.detector_type == face_detector_type_t::MMOD)
+      settings_hash_ = hash_combine(settings_hash_, hash_file(detector_params.face_detector_model_file));
+  }
+
+  make_replicas_(false);
+
+  // A thumbnail HOG cannot find stands for an image MMOD might have found faces in.
+  if(params.prefilter_thumbnails && params.detector_type == face_detector_type_t::MMOD)
+    std::cout << "facegrep: WARNING! The thumbnail prefilter only works with the default detector. It is off.\n";
+  else if(params.prefilter_thumbnails) {
+    thumbnail_prefilter_parameters_t prefilter_params;
+    prefilter_params.adjust_threshold = params.thumbnail_threshold;
+
+    for(unsigned int i = 0; i < params_.load_threads; ++i)
+      run_pinned(worker_cpu(load_cpus_, i), [&] {
+        prefilters_.push_back(std::make_unique<thumbnail_prefilter>(prefilter_params));
+      });
+  }
 
   initialised_ = false;
 }
 
 void facegrep::init(const std::string face_template_file)
 {
-  auto faces = detector_->extract_faces(face_template_file);
-  auto faces_found = faces.size();
+  init(std::vector<std::string>{face_template_file});
+}
+
+
+void facegrep::init(const std::vector<std::string>& face_template_files)
+{
+  std::vector<face> faces;
+  templates_.clear();
+
+  for(auto& face_template_file : face_template_files) {
+    auto found = detector_->extract_faces(face_template_file);
+
+    if(found.empty())
+    {
+      std::cout << "facegrep: No faces found in face template image " << face_template_file << ".\n";
+      continue;
+    }
+    else if(found.size() > 1 && !params_.all_template_faces)
+    {
+      std::cout << "facegrep: WARNING! More than one face found in template image " << face_template_file <<
+        ". Using the first face found.\n";
+      found.resize(1);
+    }
 
-  if(!faces_found)
+    for(unsigned int i = 0; i < found.size(); ++i) {
+      templates_.push_back({face_template_file, i});
+      faces.push_back(std::move(found[i]));
+    }
+  }
+
+  if(faces.empty())
   {
-    std::cout << "facegrep: No faces found in face template image.\n";
     initialised_ = false;
     return;
   }
-  else if(faces_found > 1)
-  {
-    std::cout << "facegrep: WARNING! More than one face found in template image. Using the first face found.\n";
-  }
 
-  template_embedding_ = recogniser_->get_embedding(faces[0]);
+  // One face at a time, as the single face overload never jitters: templates embed as they always have.
+  template_embeddings_.clear();
+  for(auto& template_face : faces)
+    template_embeddings_.push_back(recogniser_->get_embedding(template_face));
+
+  size_t dims = template_embeddings_[0].size();
+  template_rows_.resize(template_embeddings_.size() * dims);
+  template_norms_.resize(template_embeddings_.size());
+
+  for(size_t i = 0; i < template_embeddings_.size(); ++i) {
+    std::copy(template_embeddings_[i].begin(), template_embeddings_[i].end(), template_rows_.begin() + i * dims);
+    template_norms_[i] = dot_product(&template_rows_[i * dims], &template_rows_[i * dims], dims);
+  }
 
   initialised_ = true;
 }
 
 
+const std::vector<face_template_t>& facegrep::get_templates() const
+{
+  return templates_;
+}
+
+
+void facegrep::set_query_parameters(const facegrep_parameters_t& params)
+{
+  require_true(params.threshold > 0, "facegrep: threshold < 0");
+  params_.threshold = params.threshold;
+  params_.search_mode = params.search_mode;
+  params_.top_k = std::max(1u, params.top_k);
+  params_.ordered_results = params.ordered_results;
+  params_.all_template_faces = params.all_template_faces;
+}
+
+
 std::vector<std::string> facegrep::search(const std::vector<std::string> image_files)
 {
   std::vector<std::string> files_found;
-  for(auto& image_file : image_files)
-  {
-    auto faces = detector_->extract_faces(image_file);
-    auto embeddings = recogniser_->get_embedding(faces);
-    for(auto& candidate : embeddings)
-      if(face_matched_(template_embedding_, candidate))
-        files_found.push_back(image_file);
-  }
+
+  search_(vector_source_(image_files), search_mode_t::ALL, true, [&](const search_result_t& result) {
+    files_found.insert(files_found.end(), result.matches, result.file);
+    return true;
+  });
 
   return files_found;
 }
 
 
+std::vector<std::string> facegrep::search_directory(const std::string& search_directory)
+{
+  std::vector<std::string> files_found;
+
+  search_(directory_source_(search_directory), search_mode_t::ALL, true, [&](const search_result_t& result) {
+    files_found.insert(files_found.end(), result.matches, result.file);
+    return true;
+  });
+
+  return files_found;
+}
+
+
+void facegrep::search(const std::vector<std::string>& image_files, const result_callback_t& callback)
+{
+  search_(vector_source_(image_files), params_.search_mode, params_.ordered_results, callback);
+}
+
+
+void facegrep::search_directory(const std::string& search_directory, const result_callback_t& callback)
+{
+  search_(directory_source_(search_directory), params_.search_mode, params_.ordered_results, callback);
+}
+
+
+face_clusters_t facegrep::cluster_directory(const std::string& search_directory)
+{
+  trace_span span("cluster_directory", "pipeline");
+
+  face_clusters_t clusters;
+  std::vector<float> rows;
+  size_t dims = 0;
+
+  run_pipeline_(directory_source_(search_directory), search_mode_t::ALL, true, [&](scored_faces_t& item) {
+    if(item.embeddings.empty())
+      return true;
+
+    uint32_t file = clusters.files.size();
+    clusters.files.push_back(std::move(item.name));
+
+    for(size_t i = 0; i < item.embeddings.size(); ++i) {
+      dims = item.embeddings[i].size();
+      rows.insert(rows.end(), item.embeddings[i].begin(), item.embeddings[i].end());
+      clusters.face_files.push_back(file);
+      clusters.boxes.push_back(item.boxes[i]);
+    }
+
+    return true;
+  });
+
+  similarity_graph_parameters_t graph_params;
+  graph_params.threshold = params_.threshold;
+  graph_params.memory_budget = params_.cluster_memory_budget;
+  graph_params.spill_directory = params_.spill_directory;
+
+  size_t num_faces = clusters.face_files.size();
+  auto graph = build_similarity_graph(rows.data(), num_faces, dims, graph_params);
+  std::vector<float>().swap(rows);
+
+  // Every person is a dense clique, which the coloured sweep would split into one pass per face.
+  chinese_whispers_parameters_t whispers_params;
+  whispers_params.sweep = chinese_whispers_sweep_t::SYNCHRONOUS;
+
+  std::vector<unsigned long> labels;
+  clusters.clusters.resize(chinese_whispers(graph, labels, whispers_params));
+
+  for(size_t i = 0; i < num_faces; ++i)
+    clusters.clusters[labels[i]].push_back(i);
+
+  std::stable_sort(clusters.clusters.begin(), clusters.clusters.end(),
+    [](const std::vector<size_t>& a, const std::vector<size_t>& b) { return a.size() > b.size(); });
+
+  return clusters;
+}
+
+
 std::vector<std::string> facegrep::search(const std::string face_template_file, const std::vector<std::string> image_files)
 {
   std::vector<std::string> files_found;
@@ -90,9 +325,849 @@ std::vector<std::string> facegrep::search(const std::string face_template_file,
 }
 
 
+thread_split_t facegrep::tune_threads(const std::vector<std::string>& sample_files)
+{
+  // Files the cache knows would skip the work being timed.
+  std::string cache_file = params_.cache_file;
+  params_.cache_file.clear();
+
+  auto run = [&] {
+    auto start = std::chrono::steady_clock::now();
+    run_pipeline_(vector_source_(sample_files), search_mode_t::ALL, true, [](scored_faces_t&) { return true; });
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  auto apply = [&](const thread_split_t& split) {
+    params_.detect_threads = std::max(1u, split.workers / 2);
+    params_.embed_threads = params_.detect_threads;
+    params_.blas_threads = split.blas_threads;
+    place_threads_();
+    make_replicas_(false);
+  };
+
+  thread_split_t best;
+  try {
+    // The warm-up pass reads the files into the page cache.
+    run();
+
+    best = thread_budget::tune(process_budget_().candidates(2), [&](const thread_split_t& split) {
+      apply(split);
+      return sample_files.size() / std::max(run(), 1e-6);
+    });
+  }
+  catch(...) {
+    params_.cache_file = cache_file;
+    throw;
+  }
+
+  apply(best);
+  params_.cache_file = cache_file;
+
+  return best;
+}
+
+
 bool facegrep::face_matched_(const embedding_t& face1, const embedding_t& face2)
 {
-    return (dlib::length(face1-face2) < params_.threshold);
+    return within_distance(face1, face2, params_.threshold);
+}
+
+
+facegrep::path_source_t facegrep::vector_source_(const std::vector<std::string>& image_files) const
+{
+  return [&image_files](const path_callback_t& emit) {
+    for(auto& image_file : image_files)
+      if(!emit(image_file))
+        return;
+  };
+}
+
+
+facegrep::path_source_t facegrep::directory_source_(const std::string& search_directory) const
+{
+  unsigned int walk_threads = params_.walk_threads;
+
+  return [search_directory, walk_threads](const path_callback_t& emit) {
+    directory_walker walker(file_finder::image_search_filter(), walk_threads);
+    walker.walk(search_directory, emit);
+  };
+}
+
+
+void facegrep::search_(const path_source_t& source, search_mode_t mode, bool ordered, const result_callback_t& callback)
+{
+  trace_span span("search", "pipeline");
+
+  if(params_.workers) {
+    search_workers_(source, mode, ordered, callback);
+    return;
+  }
+
+  // Match stage. Every file reaches it, matched or not, so the reorder buffer can release files in source order as
+  // soon as all the earlier ones are done.
+  std::map<size_t, scored_faces_t> reorder_buffer;
+  size_t next_file = 0;
+  std::vector<search_result_t> top;
+  std::vector<search_result_t> results;
+
+  auto report = [&](scored_faces_t& scores) {
+    results.clear();
+    if(!make_results_(scores, results))
+      return true;
+
+    for(auto& result : results) {
+      if(mode != search_mode_t::TOP_K) {
+        if(!callback(result))
+          return false;
+
+        continue;
+      }
+
+      // Bounded max-heap: the farthest of the k closest matches so far sits on top.
+      top.push_back(std::move(result));
+      std::push_heap(top.begin(), top.end(), closer);
+      if(top.size() > params_.top_k) {
+        std::pop_heap(top.begin(), top.end(), closer);
+        top.pop_back();
+      }
+    }
+
+    return true;
+  };
+
+  run_pipeline_(source, mode, false, [&](scored_faces_t& item) {
+    if(!ordered || mode == search_mode_t::TOP_K)
+      return report(item);
+
+    bool keep_going = true;
+    size_t file = item.file;
+    reorder_buffer.emplace(file, std::move(item));
+
+    while(keep_going && !reorder_buffer.empty() && reorder_buffer.begin()->first == next_file) {
+      keep_going = report(reorder_buffer.begin()->second);
+      reorder_buffer.erase(reorder_buffer.begin());
+      ++next_file;
+    }
+
+    return keep_going;
+  });
+
+  std::sort_heap(top.begin(), top.end(), closer);
+  for(auto& result : top)
+    if(!callback(result))
+      break;
+}
+
+
+void facegrep::search_workers_(const path_source_t& source, search_mode_t mode, bool ordered,
+  const result_callback_t& callback)
+{
+  // Workers are forked with the whole file list, so the directory walk is over before they start.
+  std::vector<std::string> image_files;
+  source([&](const std::string& name) {
+    image_files.push_back(name);
+    return true;
+  });
+
+  worker_pool_parameters_t pool_params;
+  pool_params.workers = params_.workers;
+
+  // SPREAD gives every worker a node of its own, in turn. COMPACT packs each worker's threads on consecutive CPUs.
+  if(params_.placement == placement_policy_t::SPREAD) {
+    cpu_topology topology;
+    for(unsigned int node = 0; node < topology.num_nodes(); ++node)
+      pool_params.cpu_sets.push_back(topology.node_cpus(node));
+  }
+  else if(params_.placement == placement_policy_t::COMPACT) {
+    unsigned int threads = params_.load_threads + params_.detect_threads + params_.embed_threads;
+    auto cpus = cpu_topology().place(threads * params_.workers, params_.placement);
+
+    for(size_t first = 0; first < cpus.size(); first += threads)
+      pool_params.cpu_sets.emplace_back(cpus.begin() + first, cpus.begin() + first + threads);
+  }
+
+  worker_pool pool(pool_params);
+  bool local_models = params_.placement == placement_policy_t::NONE;
+
+  // Runs in the workers, where changing the parameters leaves the parent alone. Cache files are not safe to share
+  // between processes.
+  auto search = [&](size_t first, size_t count, const result_callback_t& emit) {
+    params_.workers = 0;
+    params_.cache_file.clear();
+
+    // The models are still the pages of the parent's. A copy made on the worker's own CPUs is local to them, and its
+    // threads stay free within the worker's set.
+    if(!local_models) {
+      load_cpus_.clear();
+      detect_cpus_.clear();
+      embed_cpus_.clear();
+      make_replicas_(true);
+      local_models = true;
+    }
+
+    std::vector<std::string> shard(image_files.begin() + first, image_files.begin() + first + count);
+    search_(vector_source_(shard), mode, false, [&](const search_result_t& result) {
+      search_result_t shard_result = result;
+      shard_result.index += first;
+
+      return emit(shard_result);
+    });
+  };
+
+  // Each worker reports the top_k matches of its shards, which hold the overall top_k.
+  std::map<size_t, std::pair<size_t, std::vector<search_result_t>>> reorder_buffer;
+  size_t next_file = 0;
+  std::vector<search_result_t> top;
+
+  auto report = [&](std::vector<search_result_t>& results) {
+    for(auto& result : results) {
+      result.file = image_files[result.index];
+
+      if(mode == search_mode_t::TOP_K)
+        top.push_back(std::move(result));
+      else if(!callback(result))
+        return false;
+    }
+
+    return true;
+  };
+
+  auto skipped = pool.run(image_files.size(), search, [&](size_t first, size_t count,
+    std::vector<search_result_t>& results) {
+    if(!ordered || mode == search_mode_t::TOP_K)
+      return report(results);
+
+    std::sort(results.begin(), results.end(), [](const search_result_t& a, const search_result_t& b) {
+      return a.index < b.index || (a.index == b.index && a.face_template < b.face_template);
+    });
+    reorder_buffer.emplace(first, std::make_pair(count, std::move(results)));
+
+    bool keep_going = true;
+    while(keep_going && !reorder_buffer.empty() && reorder_buffer.begin()->first == next_file) {
+      keep_going = report(reorder_buffer.begin()->second.second);
+      next_file += reorder_buffer.begin()->second.first;
+      reorder_buffer.erase(reorder_buffer.begin());
+    }
+
+    return keep_going;
+  });
+
+  for(size_t file : skipped)
+    std::cout << "facegrep: WARNING! Skipped " << image_files[file] << ", which crashed its worker.\n";
+
+  std::sort(top.begin(), top.end(), closer);
+  if(top.size() > params_.top_k)
+    top.resize(params_.top_k);
+
+  for(auto& result : top)
+    if(!callback(result))
+      break;
+}
+
+
+thread_budget facegrep::process_budget_() const
+{
+  unsigned int threads = params_.thread_budget ? params_.thread_budget : thread_budget().threads();
+  return thread_budget(std::max(1u, threads / std::max(1u, params_.workers)));
+}
+
+
+void facegrep::place_threads_()
+{
+  load_cpus_.clear();
+  detect_cpus_.clear();
+  embed_cpus_.clear();
+
+  // Detect and embed threads hold the models, so they come first, on the same node when COMPACT can manage it.
+  std::vector<unsigned int> cpus;
+  if(params_.placement != placement_policy_t::NONE)
+    cpus = cpu_topology().place(params_.detect_threads + params_.embed_threads + params_.load_threads,
+      params_.placement);
+
+  if(!cpus.empty()) {
+    auto next = cpus.begin();
+    detect_cpus_.assign(next, next + params_.detect_threads);
+    next += params_.detect_threads;
+    embed_cpus_.assign(next, next + params_.embed_threads);
+    next += params_.embed_threads;
+    load_cpus_.assign(next, cpus.end());
+  }
+}
+
+
+void facegrep::make_replicas_(bool clone)
+{
+  detector_replicas_.clear();
+  recogniser_replicas_.clear();
+
+  // dlib networks keep per-call state, so every worker thread gets a model of its own.
+  for(unsigned int i = clone ? 0 : 1; i < params_.detect_threads; ++i) {
+    run_pinned(worker_cpu(detect_cpus_, i), [&] {
+      auto replica = std::make_unique<face_detector>(*detector_);
+
+      if(i)
+        detector_replicas_.push_back(std::move(replica));
+      else
+        detector_ = std::move(replica);
+    });
+  }
+
+  for(unsigned int i = clone ? 0 : 1; i < params_.embed_threads; ++i) {
+    run_pinned(worker_cpu(embed_cpus_, i), [&] {
+      auto replica = std::make_unique<face_recogniser>(*recogniser_);
+
+      if(i)
+        recogniser_replicas_.push_back(std::move(replica));
+      else
+        recogniser_ = std::move(replica);
+    });
+  }
+}
+
+
+void facegrep::run_pipeline_(const path_source_t& source, search_mode_t mode, bool collect,
+  const faces_consumer_t& consumer)
+{
+  bounded_queue<image_file_t> paths(params_.queue_size * PATHS_PER_QUEUE_SLOT);
+  bounded_queue<image_file_t> fetched(params_.queue_size);
+  bounded_queue<loaded_image_t> loaded(params_.queue_size);
+  bounded_queue<detected_faces_t> detected(params_.queue_size);
+  bounded_queue<scored_faces_t> scored(params_.queue_size);
+
+  // Set for every search, as other facegrep instances in the process may have changed it.
+  if(params_.blas_threads)
+    set_blas_threads(params_.blas_threads);
+
+  pipeline_error_t errors;
+  errors.abort = [&] {
+    paths.close();
+    fetched.close();
+    loaded.close();
+    detected.close();
+    scored.close();
+  };
+
+  std::unique_ptr<search_cache> cache;
+  if(!params_.cache_file.empty())
+    cache = std::make_unique<search_cache>(params_.cache_file, settings_hash_);
+
+  // Copies of images processed in earlier searches are found through the hashes in the cache.
+  std::unique_ptr<duplicate_store_t> duplicates;
+  if(params_.skip_duplicates) {
+    duplicates = std::make_unique<duplicate_store_t>(params_.duplicate_radius);
+
+    if(cache)
+      cache->for_each([&](const std::string&, const search_cache_entry_t& entry) {
+        if(entry.width)
+          duplicates->add(entry);
+      });
+  }
+
+  // Outlives the threads, as the loaders hand their buffers back to it.
+  std::unique_ptr<read_ahead> reader;
+  if(params_.read_ahead) {
+    read_ahead_parameters_t read_ahead_params;
+    read_ahead_params.depth = params_.read_ahead;
+    reader = std::make_unique<read_ahead>(read_ahead_params);
+  }
+
+  std::vector<std::thread> threads;
+
+  // Files are numbered in the order the source produces them.
+  start_stage_(threads, "source", 1, {}, paths, errors, [&](unsigned int) {
+    size_t next_file = 0;
+
+    source([&](const std::string& name) {
+      image_file_t item;
+      item.file = next_file++;
+      item.name = name;
+
+      return paths.push(std::move(item));
+    });
+  });
+
+  // Keeps reads in flight while the loaders decode. Unchanged cached files need no reading and go straight through.
+  if(reader) {
+    start_stage_(threads, "read_ahead", 1, {}, fetched, errors, [&](unsigned int) {
+      bool more = true;
+
+      while(more || !reader->empty()) {
+        if(more && !reader->full()) {
+          image_file_t path;
+          bool popped = reader->empty() ? paths.pop(path) :
+            paths.pop_for(path, std::chrono::milliseconds(READ_AHEAD_POLL_MS));
+
+          if(popped) {
+            file_stamp_t stamp;
+            if(cache && search_cache::stat_file(path.name, stamp.size, stamp.mtime) &&
+              cache->contains(path.name, stamp.size, stamp.mtime)) {
+              if(!fetched.push(std::move(path)))
+                return;
+            }
+            else
+              reader->submit(path.file, path.name);
+
+            continue;
+          }
+
+          more = !paths.drained();
+          if(!more)
+            continue;
+        }
+
+        bool wait = !more || reader->full();
+        file_read_t read;
+        if(!reader->next(read, wait)) {
+          require_true(!wait, "facegrep: read ahead failed");
+          continue;
+        }
+
+        image_file_t item;
+        item.file = read.tag;
+        item.name = std::move(read.name);
+        item.data = std::move(read.data);
+        item.data_size = read.size;
+
+        if(!fetched.push(std::move(item)))
+          return;
+      }
+    });
+  }
+
+  auto& load_input = reader ? fetched : paths;
+
+  start_stage_(threads, "load", params_.load_threads, load_cpus_, loaded, errors, [&](unsigned int worker) {
+    auto prefilter = prefilters_.empty() ? nullptr : prefilters_[worker].get();
+    image_file_t path;
+
+    // Files whose faces are known skip straight to the match stage. It stays open until every loader is done.
+    auto push_known = [&](loaded_image_t& item, search_cache_entry_t& entry) {
+      scored_faces_t output;
+      output.file = item.file;
+      output.name = std::move(item.name);
+
+      if(collect) {
+        output.boxes = std::move(entry.boxes);
+        output.embeddings = std::move(entry.embeddings);
+      }
+      else
+        score_cached_(entry, mode, output);
+
+      return scored.push(std::move(output));
+    };
+
+    while(load_input.pop(path)) {
+      trace_span span("load_image", "pipeline", "file", path.file);
+      loaded_image_t item;
+      item.file = path.file;
+      item.name = std::move(path.name);
+      item.image_hash = 0;
+      item.stamp.valid = cache && search_cache::stat_file(item.name, item.stamp.size, item.stamp.mtime);
+      add_stat(stat_counter_t::IMAGES);
+
+      search_cache_entry_t entry;
+      if(item.stamp.valid && cache->get(item.name, item.stamp.size, item.stamp.mtime, entry)) {
+        add_stat(stat_counter_t::SEARCH_CACHE_HITS);
+        if(!push_known(item, entry))
+          return;
+
+        continue;
+      }
+
+      const unsigned char* data = path.data_size ? path.data.data() : nullptr;
+
+      // A thumbnail without faces stands for the whole image, which is never decoded.
+      if(prefilter) {
+        thumbnail_verdict_t verdict;
+        {
+          stat_timer timer(stat_timer_t::THUMBNAIL_CHECK);
+          verdict = data ? prefilter->check(data, path.data_size) : prefilter->check(item.name);
+        }
+
+        if(verdict == thumbnail_verdict_t::NO_FACE) {
+          add_stat(stat_counter_t::THUMBNAIL_SKIPS);
+          if(reader)
+            reader->release(std::move(path.data));
+
+          entry = search_cache_entry_t();
+          if(!push_known(item, entry))
+            return;
+
+          continue;
+        }
+      }
+
+      // The size of the files the decoders read themselves is only looked up when someone is counting.
+      if(stats_enabled()) {
+        uint64_t bytes = path.data_size;
+        int64_t mtime = 0;
+
+        if(!data && item.stamp.valid)
+          bytes = item.stamp.size;
+        else if(!data && !search_cache::stat_file(item.name, bytes, mtime))
+          bytes = 0;
+
+        add_stat(stat_counter_t::BYTES_READ, bytes);
+      }
+
+      // Files read ahead are decoded in place. dlib reads the others, and reports the errors.
+      {
+        stat_timer timer(stat_timer_t::DECODE);
+        if(!is_jpeg(data, path.data_size) || !decode_jpeg(data, path.data_size, item.image))
+          dlib::load_image(item.image, item.name);
+      }
+
+      if(reader)
+        reader->release(std::move(path.data));
+
+      if(duplicates) {
+        {
+          stat_timer timer(stat_timer_t::PERCEPTUAL_HASH);
+          item.image_hash = difference_hash(item.image);
+        }
+
+        if(duplicates->find(item.image_hash, item.image.nc(), item.image.nr(), entry)) {
+          add_stat(stat_counter_t::DUPLICATES);
+          if(!push_known(item, entry))
+            return;
+
+          continue;
+        }
+      }
+
+      if(!loaded.push(std::move(item)))
+        return;
+    }
+  });
+
+  start_stage_(threads, "detect", params_.detect_threads, detect_cpus_, detected, errors, [&](unsigned int worker) {
+    auto& detector = worker ? *detector_replicas_[worker - 1] : *detector_;
+    loaded_image_t item;
+
+    while(loaded.pop(item)) {
+      trace_span span("detect_image", "pipeline", "file", item.file);
+      detected_faces_t output;
+      output.file = item.file;
+      output.name = std::move(item.name);
+      output.stamp = item.stamp;
+      output.image_hash = item.image_hash;
+      output.width = item.image.nc();
+      output.height = item.image.nr();
+      output.faces = detector.extract_faces(item.image);
+
+      if(!detected.push(std::move(output)))
+        return;
+    }
+  });
+
+  start_stage_(threads, "embed", params_.embed_threads, embed_cpus_, scored, errors, [&](unsigned int worker) {
+    auto& recogniser = worker ? *recogniser_replicas_[worker - 1] : *recogniser_;
+    std::vector<detected_faces_t> batch;
+
+    while(fill_batch_(detected, batch)) {
+      trace_span span("embed_batch", "pipeline", "images", batch.size());
+      if(!embed_batch_(recogniser, batch, mode, collect, cache.get(), duplicates.get(), scored))
+        return;
+    }
+  });
+
+  // Consumer, on the calling thread.
+  try {
+    bool keep_going = true;
+    scored_faces_t item;
+
+    trace_thread_name("match", 0);
+
+    while(keep_going && scored.pop(item)) {
+      trace_span span("match_image", "pipeline", "file", item.file);
+      keep_going = consumer(item);
+    }
+
+    if(!keep_going)
+      errors.stop();
+  }
+  catch(...) {
+    errors.fail(std::current_exception());
+  }
+
+  for(auto& thread : threads)
+    thread.join();
+
+  if(cache)
+    cache->flush();
+
+  if(errors.error)
+    std::rethrow_exception(errors.error);
+}
+
+
+void facegrep::score_(const std::vector<embedding_t>& embeddings, scored_faces_t& scores) const
+{
+  require_true(!templates_.empty(), "facegrep: no face templates to search for");
+
+  stat_timer timer(stat_timer_t::MATCH);
+  size_t count = embeddings.size();
+  size_t num_templates = templates_.size();
+  size_t dims = template_rows_.size() / num_templates;
+
+  std::vector<float> rows(count * dims);
+  std::vector<float> norms(count);
+  std::vector<float> products(count * num_templates);
+
+  for(size_t i = 0; i < count; ++i) {
+    require_true(size_t(embeddings[i].size()) == dims, "facegrep: embedding and template sizes differ");
+    std::copy(embeddings[i].begin(), embeddings[i].end(), rows.begin() + i * dims);
+    norms[i] = dot_product(&rows[i * dims], &rows[i * dims], dims);
+  }
+
+  pairwise_dot_products(rows.data(), count, template_rows_.data(), num_templates, dims, products.data());
+
+  float squared_threshold = params_.threshold * params_.threshold;
+
+  for(size_t i = 0; i < count; ++i) {
+    const float* row_products = &products[i * num_templates];
+    float best = std::numeric_limits<float>::max();
+    unsigned int closest = 0;
+
+    for(size_t t = 0; t < num_templates; ++t) {
+      // The expansion loses precision when its terms nearly cancel, so a match is never decided on it alone.
+      float distance = std::max(0.0f, norms[i] + template_norms_[t] - 2 * row_products[t]);
+      if(distance < squared_threshold + DISTANCE_ESTIMATE_SLACK * (norms[i] + template_norms_[t]))
+        distance = squared_distance(&rows[i * dims], &template_rows_[t * dims], dims);
+
+      if(distance < best) {
+        best = distance;
+        closest = t;
+      }
+    }
+
+    scores.distances.push_back(best);
+    scores.templates.push_back(closest);
+  }
+}
+
+
+void facegrep::score_cached_(const search_cache_entry_t& entry, search_mode_t mode, scored_faces_t& scores)
+{
+  float squared_threshold = params_.threshold * params_.threshold;
+  score_(entry.embeddings, scores);
+
+  if(mode != search_mode_t::FIRST_MATCH)
+    return;
+
+  for(size_t i = 0; i < scores.distances.size(); ++i) {
+    if(scores.distances[i] < squared_threshold) {
+      scores.distances.resize(i + 1);
+      scores.templates.resize(i + 1);
+      break;
+    }
+  }
+}
+
+
+bool facegrep::make_results_(scored_faces_t& scores, std::vector<search_result_t>& results)
+{
+  float squared_threshold = params_.threshold * params_.threshold;
+  size_t first = results.size();
+
+  // Few faces match, so finding each one's result with a scan stays cheap.
+  for(size_t i = 0; i < scores.distances.size(); ++i) {
+    if(scores.distances[i] >= squared_threshold)
+      continue;
+
+    unsigned int face_template = scores.templates[i];
+    auto result = std::find_if(results.begin() + first, results.end(), [&](const search_result_t& found) {
+      return found.face_template == face_template;
+    });
+
+    if(result == results.end()) {
+      results.push_back(search_result_t());
+      result = results.end() - 1;
+      result->index = scores.file;
+      result->distance = scores.distances[i];
+      result->face = i;
+      result->face_template = face_template;
+      result->matches = 0;
+    }
+
+    ++result->matches;
+    if(scores.distances[i] < result->distance) {
+      result->distance = scores.distances[i];
+      result->face = i;
+    }
+  }
+
+  if(results.size() == first)
+    return false;
+
+  add_stat(stat_counter_t::MATCHES);
+
+  std::sort(results.begin() + first, results.end(), [](const search_result_t& a, const search_result_t& b) {
+    return a.face_template < b.face_template;
+  });
+
+  for(auto result = results.begin() + first; result != results.end(); ++result) {
+    result->file = scores.name;
+    result->distance = std::sqrt(result->distance);
+  }
+
+  return true;
+}
+
+
+bool facegrep::fill_batch_(bounded_queue<detected_faces_t>& input, std::vector<detected_faces_t>& batch)
+{
+  batch.clear();
+
+  detected_faces_t item;
+  if(!input.pop(item))
+    return false;
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(params_.batch_timeout_ms);
+  size_t chips = item.faces.size();
+  batch.push_back(std::move(item));
+
+  while(chips < params_.batch_size) {
+    auto now = std::chrono::steady_clock::now();
+    if(now >= deadline || !input.pop_for(item, deadline - now))
+      break;
+
+    chips += item.faces.size();
+    batch.push_back(std::move(item));
+  }
+
+  return true;
+}
+
+
+bool facegrep::embed_batch_(face_recogniser& recogniser, std::vector<detected_faces_t>& batch, search_mode_t mode,
+  bool collect, search_cache* cache, duplicate_store_t* duplicates, bounded_queue<scored_faces_t>& output)
+{
+  float squared_threshold = params_.threshold * params_.threshold;
+  bool first_match = mode == search_mode_t::FIRST_MATCH && !collect;
+
+  std::vector<scored_faces_t> results(batch.size());
+  bool record = cache || duplicates;
+  std::vector<search_cache_entry_t> entries(record ? batch.size() : 0);
+
+  for(size_t i = 0; i < batch.size(); ++i) {
+    results[i].file = batch[i].file;
+    results[i].name = batch[i].name;
+
+    if(record)
+      for(auto& chip : batch[i].faces)
+        entries[i].boxes.push_back(chip.bounding_box.rect);
+
+    if(collect)
+      for(auto& chip : batch[i].faces)
+        results[i].boxes.push_back(chip.bounding_box.rect);
+  }
+
+  for(size_t round = 0; ; ++round) {
+    std::vector<face> chips;
+    std::vector<size_t> owners;
+
+    for(size_t i = 0; i < batch.size(); ++i) {
+      auto& faces = batch[i].faces;
+      auto& distances = results[i].distances;
+
+      if(!first_match) {
+        for(auto& chip : faces) {
+          chips.push_back(std::move(chip));
+          owners.push_back(i);
+        }
+      }
+      else if(round < faces.size() && (distances.empty() || distances.back() >= squared_threshold)) {
+        chips.push_back(std::move(faces[round]));
+        owners.push_back(i);
+      }
+    }
+
+    if(chips.empty())
+      break;
+
+    auto embeddings = recogniser.get_embedding(chips);
+
+    if(collect) {
+      for(size_t j = 0; j < embeddings.size(); ++j) {
+        if(record)
+          entries[owners[j]].embeddings.push_back(embeddings[j]);
+
+        results[owners[j]].embeddings.push_back(std::move(embeddings[j]));
+      }
+
+      break;
+    }
+
+    // Every chip of the round against every template in one matrix product.
+    scored_faces_t round_scores;
+    score_(embeddings, round_scores);
+
+    for(size_t j = 0; j < embeddings.size(); ++j) {
+      results[owners[j]].distances.push_back(round_scores.distances[j]);
+      results[owners[j]].templates.push_back(round_scores.templates[j]);
+
+      if(record)
+        entries[owners[j]].embeddings.push_back(std::move(embeddings[j]));
+    }
+
+    if(!first_match)
+      break;
+  }
+
+  for(size_t i = 0; i < batch.size(); ++i) {
+    auto& stamp = batch[i].stamp;
+    if(record && entries[i].embeddings.size() == entries[i].boxes.size()) {
+      entries[i].image_hash = batch[i].image_hash;
+      entries[i].width = duplicates ? batch[i].width : 0;
+      entries[i].height = duplicates ? batch[i].height : 0;
+
+      if(duplicates)
+        duplicates->add(entries[i]);
+
+      if(cache && stamp.valid) {
+        entries[i].size = stamp.size;
+        entries[i].mtime = stamp.mtime;
+        cache->put(batch[i].name, entries[i]);
+      }
+    }
+
+    if(!output.push(std::move(results[i])))
+      return false;
+  }
+
+  return true;
+}
+
+
+template <typename queue_t, typename function_t>
+void facegrep::start_stage_(std::vector<std::thread>& threads, const char* name, unsigned int workers,
+  const std::vector<unsigned int>& cpus, queue_t& output, pipeline_error_t& errors, function_t function)
+{
+  auto remaining = std::make_shared<std::atomic<unsigned int>>(workers);
+
+  for(unsigned int worker = 0; worker < workers; ++worker) {
+    int cpu = worker_cpu(cpus, worker);
+
+    // Pinned before anything is allocated, so the worker's buffers are local to its node.
+    threads.emplace_back([&output, &errors, function, remaining, name, worker, cpu] {
+      if(cpu >= 0)
+        pin_thread({unsigned(cpu)});
+
+      trace_thread_name(name, worker);
+
+      try {
+        function(worker);
+      }
+      catch(...) {
+        errors.fail(std::current_exception());
+      }
+
+      if(--*remaining == 0)
+        output.close();
+    });
+  }
 }
 
 
@@ -2,12 +2,19 @@
 
 #include <facetools/face_detector.h>
 #include <facetools/face_recogniser.h>
+#include <facetools/stats.h>
+#include <facetools/trace.h>
 #include <facegrep/command_line_parser.h>
-#include <file_utils.h>
+#include <facegrep/server.h>
+#include <directory_walker.h>
 #include <file_finder.h>
+#include <file_utils.h>
 
 #include <iostream>
 #include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <memory>
 
 
 // ## NAMESPACES ##############################################################
@@ -23,19 +30,52 @@ using namespace facetools;
 #define FACE_RECOGNITION_MODEL "dlib_face_recognition_resnet_model_v1.dat"
 #define SHAPE_PREDICTOR_MODEL "shape_predictor_68_face_landmarks.dat"
 
+/** Number of images --tune-threads times each split on. */
+#define TUNE_SAMPLE_FILES 16
+
 
 // ## INLINE FUNCTIONS ########################################################
 
 /**
- * Print the file list to standard output.
- * \param file_list File list to print.
+ * Print a search result to standard output.
+ * \param result Result to print.
+ * \param show_distance Whether to print the face distance after the file name.
+ * \param template_labels Label of each face template, printed after the result. Empty with a single template.
+ */
+inline void print_result(const search_result_t& result, bool show_distance,
+  const std::vector<std::string>& template_labels)
+{
+  std::cout << result.file;
+  if(show_distance)
+    std::cout << '\t' << result.distance;
+
+  if(!template_labels.empty())
+    std::cout << '\t' << template_labels[result.face_template];
+
+  std::cout << std::endl;
+}
+
+
+/**
+ * Labels the face templates for print_result. With several templates each match names the one it hit: the face
+ * file, and the face in it with --all-faces.
+ * \param templates Faces searched for.
+ * \param all_faces Whether every face of the face files is searched for.
+ * \return Label of each template, or nothing with a single template.
  */
-inline void print_file_list(std::vector<std::string> file_list)
+inline std::vector<std::string> make_template_labels(const std::vector<face_template_t>& templates, bool all_faces)
 {
-  for(auto& entry: file_list)
-    std::cout << entry << std::endl;
+  std::vector<std::string> template_labels;
+  for(size_t i = 0; templates.size() > 1 && i < templates.size(); ++i) {
+    template_labels.push_back(templates[i].file);
+    if(all_faces)
+      template_labels.back() += "#" + std::to_string(templates[i].face);
+  }
+
+  return template_labels;
 }
 
+
 /**
  * Checks for the existence of local and system wide versions of a model file and assigns it to model parameter. Local
  * files take precedence. Print an error if no files found.
@@ -68,6 +108,54 @@ inline void assign_model(std::string& model, const std::string& local_candidate,
 static void init_parameters(facegrep_commandline_parameters_t& cmd_params, facegrep_parameters_t& params);
 
 
+/**
+ * Searches the directory for the face files and prints the matches.
+ * \param cmd_params Command line parameters.
+ * \param params Facegrep parameters.
+ * \return Exit code.
+ */
+static int search(facegrep_commandline_parameters_t& cmd_params, facegrep_parameters_t& params);
+
+
+/**
+ * Clusters the faces of the search directory and prints them.
+ * \param cmd_params Command line parameters.
+ * \param params Facegrep parameters.
+ * \return Exit code.
+ */
+static int cluster(facegrep_commandline_parameters_t& cmd_params, facegrep_parameters_t& params);
+
+
+/**
+ * Runs a facegrep server until interrupted.
+ * \param cmd_params Command line parameters.
+ * \param params Facegrep parameters of the server instances.
+ * \return Exit code.
+ */
+static int serve(facegrep_commandline_parameters_t& cmd_params, facegrep_parameters_t& params);
+
+
+/**
+ * Runs the search on a facegrep server and prints the results.
+ * \param cmd_params Command line parameters.
+ * \return Exit code.
+ */
+static int query_server(facegrep_commandline_parameters_t& cmd_params);
+
+
+/**
+ * Stops the running server. Installed for SIGINT and SIGTERM.
+ * \param signal Signal number.
+ */
+static void stop_server(int signal);
+
+
+// ## PRIVATE VARIABLES #######################################################
+
+/** Server stopped by stop_server. */
+static facegrep_server* running_server = nullptr;
+
+
 // ## MAIN FUNCTION ###########################################################
 
 /**
@@ -80,26 +168,114 @@ int main(int argc, char** argv)
 {
   auto command_line_args = command_line_parser::parse(argc, argv);
 
+  // A client sends the search away, so it needs no models.
+  if(!command_line_args.client_socket.empty())
+    return query_server(command_line_args);
+
   facegrep_parameters_t params;
   init_parameters(command_line_args, params);
-  facegrep fg(params);
-  fg.init(command_line_args.face_file);
 
-  auto image_files = file_finder::find_images(command_line_args.search_directory);
-  auto results = fg.search(image_files);
-  std::sort(results.begin(), results.end());
-  print_file_list(results);
+  // The stats file is written once more when the writer goes, after the run, however it ended.
+  std::unique_ptr<stats_writer> stats_file;
+  if(command_line_args.stats || !command_line_args.stats_file.empty())
+    set_stats_enabled(true);
 
-  return 0;
+  if(!command_line_args.stats_file.empty())
+    stats_file = std::make_unique<stats_writer>(command_line_args.stats_file, command_line_args.stats_interval);
+
+  if(!command_line_args.trace_file.empty())
+    set_trace_enabled(true);
+
+  int status = 0;
+  if(!command_line_args.serve_socket.empty())
+    status = serve(command_line_args, params);
+  else if(command_line_args.cluster)
+    status = cluster(command_line_args, params);
+  else
+    status = search(command_line_args, params);
+
+  stats_file.reset();
+
+  if(!command_line_args.trace_file.empty() && !write_trace(command_line_args.trace_file))
+    std::cout << "facegrep: WARNING! Could not write the trace to " << command_line_args.trace_file << ".\n";
+
+  if(command_line_args.stats) {
+    std::cerr << "facegrep: stats\n";
+    write_stats(std::cerr, get_stats());
+  }
+
+  return status;
 }
 
 
 // ## PRIVATE FUNCTION DEFINITIONS ############################################
 
+static int search(facegrep_commandline_parameters_t& cmd_params, facegrep_parameters_t& params)
+{
+  facegrep fg(params);
+
+  // The walk is stopped as soon as the sample is complete.
+  if(cmd_params.tune_threads) {
+    std::vector<std::string> sample_files;
+    directory_walker(file_finder::image_search_filter()).walk(cmd_params.search_directory,
+      [&](const std::string& path) {
+        sample_files.push_back(path);
+        return sample_files.size() < TUNE_SAMPLE_FILES;
+      });
+
+    if(!sample_files.empty())
+      fg.tune_threads(sample_files);
+  }
+
+  fg.init(cmd_params.face_files);
+
+  auto& templates = fg.get_templates();
+  if(templates.empty()) {
+    std::cout << "facegrep: No faces found in the face template images.\n";
+    return 1;
+  }
+
+  auto template_labels = make_template_labels(templates, cmd_params.all_faces);
+
+  fg.search_directory(cmd_params.search_directory, [&](const search_result_t& result) {
+    print_result(result, cmd_params.show_distance, template_labels);
+    return true;
+  });
+
+  return 0;
+}
+
+
 static void init_parameters(facegrep_commandline_parameters_t& cmd_params, facegrep_parameters_t& params)
 {
   params.jitter = cmd_params.jitter;
   params.threshold = cmd_params.threshold;
+  params.load_threads = cmd_params.load_threads;
+  params.detect_threads = cmd_params.detect_threads;
+  params.embed_threads = cmd_params.embed_threads;
+  params.batch_size = cmd_params.batch_size;
+  params.ordered_results = cmd_params.ordered;
+  params.all_template_faces = cmd_params.all_faces;
+  params.skip_duplicates = cmd_params.skip_duplicates;
+  params.prefilter_thumbnails = cmd_params.prefilter;
+  params.thumbnail_threshold = cmd_params.prefilter_threshold;
+  params.read_ahead = cmd_params.read_ahead;
+  params.workers = cmd_params.workers;
+  params.placement = cmd_params.placement;
+  params.thread_budget = cmd_params.thread_budget;
+
+  if(!cmd_params.cache_file.empty())
+    params.cache_file = cmd_params.cache_file;
+  else if(cmd_params.cache)
+    params.cache_file = cmd_params.search_directory + "/" SEARCH_CACHE_FILE;
+
+  if(cmd_params.top_k) {
+    params.search_mode = search_mode_t::TOP_K;
+    params.top_k = cmd_params.top_k;
+  }
+  else if(cmd_params.first_match) {
+    params.search_mode = search_mode_t::FIRST_MATCH;
+  }
 
   if(cmd_params.mmod)
     params.detector_type = face_detector_type_t::MMOD;
@@ -120,4 +296,93 @@ static void init_parameters(facegrep_commandline_parameters_t& cmd_params, faceg
     "No face recogniser model file found.");
 
   assign_model(params.shape_model, local_shape_model, global_shape_model, "No shape model file found.");
+}
+
+
+static int cluster(facegrep_commandline_parameters_t& cmd_params, facegrep_parameters_t& params)
+{
+  params.cluster_memory_budget = size_t(cmd_params.memory_budget_mb) << 20;
+
+  const char* spill_directory = getenv("TMPDIR");
+  if(spill_directory && *spill_directory)
+    params.spill_directory = spill_directory;
+
+  facegrep fg(params);
+  auto clusters = fg.cluster_directory(cmd_params.search_directory);
+
+  for(size_t c = 0; c < clusters.clusters.size(); ++c) {
+    for(size_t face : clusters.clusters[c]) {
+      auto& box = clusters.boxes[face];
+      std::cout << c << '\t' << clusters.files[clusters.face_files[face]] << '\t' << box.left() << ',' << box.top() <<
+        ',' << box.right() << ',' << box.bottom() << '\n';
+    }
+  }
+
+  std::cout.flush();
+  return 0;
+}
+
+
+static int serve(facegrep_commandline_parameters_t& cmd_params, facegrep_parameters_t& params)
+{
+  facegrep_server_parameters_t server_params;
+  server_params.socket_path = cmd_params.serve_socket;
+  server_params.instances = cmd_params.instances;
+
+  facegrep_server server(server_params, params);
+
+  running_server = &server;
+  std::signal(SIGINT, stop_server);
+  std::signal(SIGTERM, stop_server);
+
+  std::cout << "facegrep: serving on " << cmd_params.serve_socket << std::endl;
+  server.run();
+
+  running_server = nullptr;
+  return 0;
+}
+
+
+static int query_server(facegrep_commandline_parameters_t& cmd_params)
+{
+  facegrep_request_t request;
+  request.face_files = cmd_params.face_files;
+  request.search_directory = cmd_params.search_directory;
+  request.threshold = cmd_params.threshold;
+  request.ordered_results = cmd_params.ordered;
+  request.all_template_faces = cmd_params.all_faces;
+
+  if(cmd_params.top_k) {
+    request.search_mode = search_mode_t::TOP_K;
+    request.top_k = cmd_params.top_k;
+  }
+  else if(cmd_params.first_match) {
+    request.search_mode = search_mode_t::FIRST_MATCH;
+  }
+
+  std::vector<face_template_t> templates;
+  std::vector<std::string> template_labels;
+
+  try {
+    facegrep_client::query(cmd_params.client_socket, request, templates, [&](const search_result_t& result) {
+      if(template_labels.empty())
+        template_labels = make_template_labels(templates, cmd_params.all_faces);
+
+      print_result(result, cmd_params.show_distance, template_labels);
+      return true;
+    });
+  }
+  catch(const std::exception& e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+static void stop_server(int)
+{
+  if(running_server)
+    running_server->stop();
 }
\ No newline at end of file
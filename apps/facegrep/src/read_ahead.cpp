@@ -0,0 +1,358 @@
+// ## INCLUDE #################################################################
+
+#include <facegrep/read_ahead.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+// ## NAMESPACE ###############################################################
+
+namespace facetools {
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/* There is no glibc wrapper for the io_uring system calls, and liburing is not a dependency. */
+static int io_uring_setup(unsigned int entries, io_uring_params* params)
+{
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+
+static int io_uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+  return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+
+/* Reads a whole file with pread, retrying short reads. Returns the bytes read, or 0 on error. */
+static size_t read_file(int fd, unsigned char* data, size_t size)
+{
+  size_t done = 0;
+  while(done < size) {
+    ssize_t bytes = pread(fd, data + done, size - done, done);
+    if(bytes < 0 && errno == EINTR)
+      continue;
+
+    if(bytes < 0)
+      return 0;
+
+    if(bytes == 0)
+      break;
+
+    done += bytes;
+  }
+
+  return done;
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+read_ahead::read_ahead(const read_ahead_parameters_t& params)
+{
+  params_ = params;
+  params_.depth = std::max(1u, params_.depth);
+
+  slots_.resize(params_.depth);
+  for(size_t slot = params_.depth; slot > 0; --slot)
+    free_slots_.push_back(slot - 1);
+
+  ring_fd_ = -1;
+  sq_ring_ = cq_ring_ = sqes_ = MAP_FAILED;
+
+  if(params_.use_io_uring && !open_ring_()) {
+    if(sqes_ != MAP_FAILED)
+      munmap(sqes_, sqes_size_);
+
+    if(cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+      munmap(cq_ring_, cq_ring_size_);
+
+    if(sq_ring_ != MAP_FAILED)
+      munmap(sq_ring_, sq_ring_size_);
+
+    if(ring_fd_ >= 0)
+      close(ring_fd_);
+
+    ring_fd_ = -1;
+  }
+}
+
+
+read_ahead::~read_ahead()
+{
+  file_read_t read;
+  while(!empty() && next(read, true)) {}
+
+  if(ring_fd_ >= 0) {
+    munmap(sqes_, sqes_size_);
+    if(cq_ring_ != sq_ring_)
+      munmap(cq_ring_, cq_ring_size_);
+    munmap(sq_ring_, sq_ring_size_);
+    close(ring_fd_);
+  }
+}
+
+
+void read_ahead::submit(size_t tag, const std::string& name)
+{
+  size_t slot = free_slots_.back();
+  free_slots_.pop_back();
+
+  auto& read = slots_[slot];
+  read.tag = tag;
+  read.name = name;
+  read.size = 0;
+  read.done = 0;
+  read.fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+
+  struct stat status;
+  if(read.fd < 0 || fstat(read.fd, &status) != 0 || !S_ISREG(status.st_mode) || status.st_size == 0 ||
+    size_t(status.st_size) > params_.max_file_size) {
+    finished_.push_back(slot);
+    return;
+  }
+
+  read.size = status.st_size;
+
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    if(!pool_.empty()) {
+      read.data = std::move(pool_.back());
+      pool_.pop_back();
+    }
+  }
+
+  if(read.data.size() < read.size)
+    read.data.resize(read.size);
+
+  if(ring_fd_ >= 0) {
+    if(!queue_read_(slot)) {
+      read.size = 0;
+      finished_.push_back(slot);
+    }
+  }
+  else {
+    posix_fadvise(read.fd, 0, read.size, POSIX_FADV_WILLNEED);
+    pending_.push_back(slot);
+  }
+}
+
+
+bool read_ahead::next(file_read_t& read, bool wait)
+{
+  if(!finished_.empty()) {
+    size_t slot = finished_.front();
+    finished_.pop_front();
+    finish_(slot, read);
+
+    return true;
+  }
+
+  if(pending_.empty())
+    return false;
+
+  if(ring_fd_ >= 0) {
+    size_t slot = reap_(wait);
+    if(slot == slots_.size())
+      return false;
+
+    finish_(slot, read);
+
+    return true;
+  }
+
+  // The fallback reads the oldest file, which the kernel has been fetching since it was submitted.
+  size_t slot = pending_.front();
+  pending_.pop_front();
+  slots_[slot].done = read_file(slots_[slot].fd, slots_[slot].data.data(), slots_[slot].size);
+  slots_[slot].size = slots_[slot].done;
+  finish_(slot, read);
+
+  return true;
+}
+
+
+bool read_ahead::full() const noexcept
+{
+  return free_slots_.empty();
+}
+
+
+bool read_ahead::empty() const noexcept
+{
+  return free_slots_.size() == slots_.size();
+}
+
+
+bool read_ahead::uses_io_uring() const noexcept
+{
+  return ring_fd_ >= 0;
+}
+
+
+void read_ahead::release(std::vector<unsigned char>&& buffer)
+{
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+
+  // Enough buffers for the reads in flight. The others go, so one large file does not pin its memory.
+  if(pool_.size() < slots_.size() && buffer.capacity())
+    pool_.push_back(std::move(buffer));
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+bool read_ahead::open_ring_()
+{
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+
+  ring_fd_ = io_uring_setup(params_.depth, &params);
+  if(ring_fd_ < 0)
+    return false;
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if(single_mmap)
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+    IORING_OFF_SQ_RING);
+  if(sq_ring_ == MAP_FAILED)
+    return false;
+
+  cq_ring_ = single_mmap ? sq_ring_ : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    ring_fd_, IORING_OFF_CQ_RING);
+  if(cq_ring_ == MAP_FAILED)
+    return false;
+
+  sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if(sqes_ == MAP_FAILED)
+    return false;
+
+  auto sq = static_cast<char*>(sq_ring_);
+  auto cq = static_cast<char*>(cq_ring_);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = cq + params.cq_off.cqes;
+
+  return true;
+}
+
+
+bool read_ahead::queue_read_(size_t slot)
+{
+  auto& read = slots_[slot];
+
+  // Only this thread writes the tail, and the kernel consumes entries on every enter, so the entry is free.
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & *sq_mask_;
+  auto sqe = static_cast<io_uring_sqe*>(sqes_) + index;
+
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = read.fd;
+  sqe->addr = reinterpret_cast<uint64_t>(read.data.data() + read.done);
+  sqe->len = read.size - read.done;
+  sqe->off = read.done;
+  sqe->user_data = slot;
+
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+  int submitted;
+  do {
+    submitted = io_uring_enter(ring_fd_, 1, 0, 0);
+  } while(submitted < 0 && errno == EINTR);
+
+  if(submitted != 1) {
+    // Take the entry back, so the kernel never sees it.
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+    return false;
+  }
+
+  if(read.done == 0)
+    pending_.push_back(slot);
+
+  return true;
+}
+
+
+size_t read_ahead::reap_(bool wait)
+{
+  while(true) {
+    unsigned head = *cq_head_;
+
+    if(head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      if(!wait)
+        return slots_.size();
+
+      if(io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        return slots_.size();
+
+      continue;
+    }
+
+    auto cqe = static_cast<io_uring_cqe*>(cqes_) + (head & *cq_mask_);
+    size_t slot = cqe->user_data;
+    int result = cqe->res;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+
+    auto& read = slots_[slot];
+    if(result > 0 && read.done + result < read.size) {
+      // Short read: queue the rest.
+      read.done += result;
+      if(queue_read_(slot))
+        continue;
+
+      read.size = 0;
+    }
+    else if(result >= 0) {
+      // 0 means the file shrank since it was opened.
+      read.done += result;
+      read.size = read.done;
+    }
+    else
+      read.size = 0;
+
+    pending_.erase(std::find(pending_.begin(), pending_.end(), slot));
+
+    return slot;
+  }
+}
+
+
+void read_ahead::finish_(size_t slot, file_read_t& read)
+{
+  auto& finished = slots_[slot];
+
+  if(finished.fd >= 0)
+    close(finished.fd);
+
+  read.tag = finished.tag;
+  read.name = std::move(finished.name);
+  read.data = std::move(finished.data);
+  read.size = finished.size;
+
+  finished.data = std::vector<unsigned char>();
+  free_slots_.push_back(slot);
+}
+
+
+} // NAMESPACE facetools
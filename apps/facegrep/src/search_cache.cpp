@@ -0,0 +1,264 @@
+// ## INCLUDE #################################################################
+
+#include <facegrep/search_cache.h>
+#include <facetools/error.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// ## NAMESPACE ###############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+static const char CACHE_MAGIC[4] = {'F', 'G', 'S', 'C'};
+static const uint32_t CACHE_VERSION = 2;
+
+/** Sanity limits for records read back from disk. */
+static const uint32_t MAX_PATH_LENGTH = 1 << 16;
+static const uint32_t MAX_FACES = 1 << 16;
+static const uint32_t MAX_DIMS = 4096;
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+template <typename T>
+static void write_value(std::ostream& stream, const T& value)
+{
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+
+template <typename T>
+static bool read_value(std::istream& stream, T& value)
+{
+  return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+
+static void write_header(std::ostream& stream, uint64_t settings_hash)
+{
+  stream.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  write_value(stream, CACHE_VERSION);
+  write_value(stream, settings_hash);
+}
+
+
+static void write_record(std::ostream& stream, const std::string& path, const search_cache_entry_t& entry)
+{
+  uint32_t faces = entry.boxes.size();
+  uint32_t dims = faces ? entry.embeddings[0].size() : 0;
+
+  write_value(stream, uint32_t(path.size()));
+  stream.write(path.data(), path.size());
+  write_value(stream, entry.size);
+  write_value(stream, entry.mtime);
+  write_value(stream, entry.image_hash);
+  write_value(stream, entry.width);
+  write_value(stream, entry.height);
+  write_value(stream, faces);
+  write_value(stream, dims);
+
+  for(auto& box : entry.boxes) {
+    int64_t sides[4] = {box.left(), box.top(), box.right(), box.bottom()};
+    stream.write(reinterpret_cast<const char*>(sides), sizeof(sides));
+  }
+
+  std::vector<float> values(dims);
+  for(auto& embedding : entry.embeddings) {
+    std::copy(embedding.begin(), embedding.end(), values.begin());
+    stream.write(reinterpret_cast<const char*>(values.data()), dims * sizeof(float));
+  }
+}
+
+
+static bool read_record(std::istream& stream, std::string& path, search_cache_entry_t& entry)
+{
+  uint32_t length = 0;
+  uint32_t faces = 0;
+  uint32_t dims = 0;
+
+  if(!read_value(stream, length) || length > MAX_PATH_LENGTH)
+    return false;
+
+  path.resize(length);
+  stream.read(&path[0], length);
+
+  if(!read_value(stream, entry.size) || !read_value(stream, entry.mtime) || !read_value(stream, entry.image_hash) ||
+    !read_value(stream, entry.width) || !read_value(stream, entry.height) || !read_value(stream, faces) ||
+    !read_value(stream, dims) || faces > MAX_FACES || dims > MAX_DIMS || (faces && !dims))
+    return false;
+
+  entry.boxes.resize(faces);
+  for(auto& box : entry.boxes) {
+    int64_t sides[4];
+    if(!stream.read(reinterpret_cast<char*>(sides), sizeof(sides)))
+      return false;
+
+    box = dlib::rectangle(sides[0], sides[1], sides[2], sides[3]);
+  }
+
+  std::vector<float> values(dims);
+  entry.embeddings.resize(faces);
+  for(auto& embedding : entry.embeddings) {
+    if(!stream.read(reinterpret_cast<char*>(values.data()), dims * sizeof(float)))
+      return false;
+
+    embedding.set_size(dims);
+    std::copy(values.begin(), values.end(), embedding.begin());
+  }
+
+  return true;
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+search_cache::search_cache(const std::string& file_name, uint64_t settings_hash)
+{
+  file_name_ = file_name;
+  settings_hash_ = settings_hash;
+
+  // A fresh file needs its header, and a log mostly made of superseded records is worth rewriting.
+  size_t records = 0;
+  if(!load_(records) || records > 2 * entries_.size())
+    compact_();
+
+  log_.open(file_name_, std::ios::binary | std::ios::app);
+  require_true(log_.is_open(), "search cache: cannot open " + file_name_);
+}
+
+
+bool search_cache::stat_file(const std::string& path, uint64_t& size, int64_t& mtime)
+{
+  struct stat sb;
+  if(stat(path.c_str(), &sb) != 0)
+    return false;
+
+  size = sb.st_size;
+  mtime = int64_t(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+
+  return true;
+}
+
+
+bool search_cache::get(const std::string& path, uint64_t size, int64_t mtime, search_cache_entry_t& entry) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto found = entries_.find(path);
+  if(found == entries_.end() || found->second.size != size || found->second.mtime != mtime)
+    return false;
+
+  entry = found->second;
+
+  return true;
+}
+
+
+bool search_cache::contains(const std::string& path, uint64_t size, int64_t mtime) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto found = entries_.find(path);
+
+  return found != entries_.end() && found->second.size == size && found->second.mtime == mtime;
+}
+
+
+void search_cache::put(const std::string& path, const search_cache_entry_t& entry)
+{
+  require_true(entry.boxes.size() == entry.embeddings.size(), "search cache: one embedding per box expected");
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_[path] = entry;
+  write_record(log_, path, entry);
+}
+
+
+void search_cache::for_each(
+  const std::function<void(const std::string&, const search_cache_entry_t&)>& function) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for(auto& entry : entries_)
+    function(entry.first, entry.second);
+}
+
+
+void search_cache::flush()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  log_.flush();
+}
+
+
+size_t search_cache::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+bool search_cache::load_(size_t& records)
+{
+  std::ifstream file(file_name_, std::ios::binary);
+  if(!file)
+    return false;
+
+  char magic[4];
+  uint32_t version = 0;
+  uint64_t settings_hash = 0;
+  file.read(magic, sizeof(magic));
+
+  if(!file || !std::equal(magic, magic + 4, CACHE_MAGIC) || !read_value(file, version) ||
+    version != CACHE_VERSION || !read_value(file, settings_hash) || settings_hash != settings_hash_)
+    return false;
+
+  std::streamoff good_end = file.tellg();
+  std::string path;
+  search_cache_entry_t entry;
+
+  while(file.peek() != EOF && read_record(file, path, entry)) {
+    entries_[path] = entry;
+    good_end = file.tellg();
+    ++records;
+  }
+
+  // Drops a record cut short by an interrupted run, so new records are not appended after garbage.
+  file.clear();
+  file.seekg(0, std::ios::end);
+  if(file.tellg() != good_end)
+    expect_true(truncate(file_name_.c_str(), good_end) == 0, "search cache: cannot repair " + file_name_);
+
+  return true;
+}
+
+
+void search_cache::compact_()
+{
+  std::string temporary = file_name_ + ".tmp";
+
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    require_true(file.is_open(), "search cache: cannot write " + temporary);
+
+    write_header(file, settings_hash_);
+    for(auto& entry : entries_)
+      write_record(file, entry.first, entry.second);
+
+    require_true(static_cast<bool>(file.flush()), "search cache: cannot write " + temporary);
+  }
+
+  require_true(rename(temporary.c_str(), file_name_.c_str()) == 0, "search cache: cannot write " + file_name_);
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,561 @@
+// ## INCLUDE #################################################################
+
+#include <facegrep/server.h>
+#include <facetools/error.h>
+#include <file_utils.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+
+// ## NAMESPACE ###############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+/** First line of every request. The number changes with the protocol. */
+static const char PROTOCOL_HEADER[] = "facegrep 1";
+
+/** Longest time in seconds the server waits on a client that neither sends nor reads, so stop() cannot hang. */
+static const int CLIENT_TIMEOUT_S = 60;
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/**
+ * Reads newline terminated lines from a socket.
+ */
+class line_reader {
+public:
+  explicit line_reader(int fd) : fd_(fd), start_(0) {}
+
+  /**
+   * \param line Output. Next line, without its newline.
+   * \return False on end of file, error or timeout.
+   */
+  bool read_line(std::string& line)
+  {
+    while(true) {
+      size_t end = buffer_.find('\n', start_);
+      if(end != std::string::npos) {
+        line.assign(buffer_, start_, end - start_);
+        start_ = end + 1;
+        return true;
+      }
+
+      buffer_.erase(0, start_);
+      start_ = 0;
+
+      char chunk[4096];
+      ssize_t count = read(fd_, chunk, sizeof(chunk));
+      if(count < 0 && errno == EINTR)
+        continue;
+      if(count <= 0)
+        return false;
+
+      buffer_.append(chunk, count);
+    }
+  }
+
+private:
+  int fd_;
+  std::string buffer_;
+  size_t start_;
+};
+
+
+/**
+ * Writes a whole string to a socket. Never raises SIGPIPE.
+ * \param fd Connected socket.
+ * \param text Text to write.
+ * \return False if the peer went away.
+ */
+static bool write_all(int fd, const std::string& text)
+{
+  size_t written = 0;
+  while(written < text.size()) {
+    ssize_t count = send(fd, text.data() + written, text.size() - written, MSG_NOSIGNAL);
+    if(count < 0 && errno == EINTR)
+      continue;
+    if(count <= 0)
+      return false;
+
+    written += count;
+  }
+
+  return true;
+}
+
+
+/**
+ * Splits a reply line on tabs.
+ * \param line Line to split.
+ * \param fields Number of fields. The last one takes the rest of the line, tabs included, as file names may hold them.
+ * \return The fields, or fewer if the line is short.
+ */
+static std::vector<std::string> split_fields(const std::string& line, size_t fields)
+{
+  std::vector<std::string> result;
+  size_t start = 0;
+
+  while(result.size() + 1 < fields) {
+    size_t end = line.find('\t', start);
+    if(end == std::string::npos)
+      break;
+
+    result.push_back(line.substr(start, end - start));
+    start = end + 1;
+  }
+
+  result.push_back(line.substr(start));
+  return result;
+}
+
+
+/**
+ * Fills a sockaddr_un with a socket path.
+ * \param socket_path Path of the socket.
+ * \param address Output.
+ */
+static void make_address(const std::string& socket_path, sockaddr_un& address)
+{
+  require_true(!socket_path.empty() && socket_path.size() < sizeof(address.sun_path),
+    "facegrep: invalid socket path " + socket_path);
+
+  address = sockaddr_un();
+  address.sun_family = AF_UNIX;
+  std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+}
+
+
+/**
+ * \param socket_path Path of a server socket.
+ * \return Socket connected to the server, or -1.
+ */
+static int connect_to(const std::string& socket_path)
+{
+  sockaddr_un address;
+  make_address(socket_path, address);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0)
+    return -1;
+
+  if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+/**
+ * \param path File path.
+ * \return The path, made absolute against the working directory when relative.
+ */
+static std::string absolute_path(const std::string& path)
+{
+  if(path.empty() || path[0] == '/')
+    return path;
+
+  char directory[PATH_MAX];
+  require_true(getcwd(directory, sizeof(directory)) != nullptr, "facegrep: cannot read the working directory");
+
+  return std::string(directory) + "/" + path;
+}
+
+
+// ## PUBLIC FUNCTIONS ########################################################
+
+std::string format_request(const facegrep_request_t& request)
+{
+  static const char* MODES[] = {"all", "first", "top"};
+  std::string text = std::string(PROTOCOL_HEADER) + "\n";
+
+  auto add_path = [&](const char* key, const std::string& path) {
+    require_true(path.find('\n') == std::string::npos, "facegrep: cannot send a path with a newline: " + path);
+    text += std::string(key) + " " + path + "\n";
+  };
+
+  for(auto& face_file : request.face_files)
+    add_path("face", face_file);
+
+  if(!request.search_directory.empty())
+    add_path("directory", request.search_directory);
+
+  for(auto& image_file : request.image_files)
+    add_path("image", image_file);
+
+  char threshold[32];
+  snprintf(threshold, sizeof(threshold), "%.9g", request.threshold);
+
+  text += std::string("threshold ") + threshold + "\n";
+  text += std::string("mode ") + MODES[int(request.search_mode)] + "\n";
+  text += "top_k " + std::to_string(request.top_k) + "\n";
+  text += std::string("ordered ") + (request.ordered_results ? "1" : "0") + "\n";
+  text += std::string("all_faces ") + (request.all_template_faces ? "1" : "0") + "\n";
+  text += "end\n";
+
+  return text;
+}
+
+
+bool parse_request_line(const std::string& line, facegrep_request_t& request)
+{
+  size_t space = line.find(' ');
+  if(space == std::string::npos)
+    return false;
+
+  std::string key = line.substr(0, space);
+  std::string value = line.substr(space + 1);
+
+  try {
+    if(key == "face")
+      request.face_files.push_back(value);
+    else if(key == "directory")
+      request.search_directory = value;
+    else if(key == "image")
+      request.image_files.push_back(value);
+    else if(key == "threshold") {
+      request.threshold = std::stof(value);
+      return request.threshold > 0;
+    }
+    else if(key == "mode") {
+      if(value == "all")
+        request.search_mode = search_mode_t::ALL;
+      else if(value == "first")
+        request.search_mode = search_mode_t::FIRST_MATCH;
+      else if(value == "top")
+        request.search_mode = search_mode_t::TOP_K;
+      else
+        return false;
+    }
+    else if(key == "top_k") {
+      int top_k = std::stoi(value);
+      request.top_k = top_k;
+      return top_k > 0;
+    }
+    else if(key == "ordered" || key == "all_faces") {
+      if(value != "0" && value != "1")
+        return false;
+
+      (key == "ordered" ? request.ordered_results : request.all_template_faces) = value == "1";
+    }
+    else
+      return false;
+  }
+  catch(const std::exception&) {
+    return false;
+  }
+
+  return true;
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+facegrep_server::facegrep_server(const facegrep_server_parameters_t& params,
+  const facegrep_parameters_t& facegrep_params) :
+  params_(params), listen_fd_(-1), idle_(std::max(1u, params.instances)), connections_(0)
+{
+  stop_pipe_[0] = stop_pipe_[1] = -1;
+
+  // Cache files belong to one search directory, and instances would race on them. Worker processes cannot be forked
+  // from the threads the searches run on. Every instance would place its threads on the same CPUs. Searches run at
+  // once, so each instance gets its share of the thread budget.
+  facegrep_parameters_t instance_params = facegrep_params;
+  instance_params.cache_file.clear();
+  instance_params.workers = 0;
+  instance_params.placement = placement_policy_t::NONE;
+  if(instance_params.thread_budget)
+    instance_params.thread_budget = std::max(1u, instance_params.thread_budget / std::max(1u, params_.instances));
+
+  for(unsigned int i = 0; i < std::max(1u, params_.instances); ++i) {
+    instances_.push_back(std::make_unique<facegrep>(instance_params));
+    idle_.push(instances_.back().get());
+  }
+
+  sockaddr_un address;
+  make_address(params_.socket_path, address);
+
+  // A socket file nobody answers on is left over from a server that died; a live one is not ours to take.
+  struct stat sb;
+  if(stat(params_.socket_path.c_str(), &sb) == 0 && S_ISSOCK(sb.st_mode)) {
+    int fd = connect_to(params_.socket_path);
+    if(fd >= 0)
+      close(fd);
+
+    require_true(fd < 0, "facegrep: a server is already listening on " + params_.socket_path);
+    unlink(params_.socket_path.c_str());
+  }
+
+  require_true(pipe2(stop_pipe_, O_CLOEXEC | O_NONBLOCK) == 0, "facegrep: cannot create the stop pipe");
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  require_true(listen_fd_ >= 0, "facegrep: cannot create a socket");
+
+  require_true(bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0,
+    "facegrep: cannot bind to " + params_.socket_path);
+
+  // Queries name arbitrary files, so only the owner may send them.
+  chmod(params_.socket_path.c_str(), S_IRUSR | S_IWUSR);
+
+  require_true(listen(listen_fd_, params_.backlog) == 0, "facegrep: cannot listen on " + params_.socket_path);
+}
+
+
+facegrep_server::~facegrep_server()
+{
+  if(listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(params_.socket_path.c_str());
+  }
+
+  for(int fd : stop_pipe_)
+    if(fd >= 0)
+      close(fd);
+}
+
+
+void facegrep_server::run()
+{
+  while(true) {
+    pollfd fds[2] = {{listen_fd_, POLLIN, 0}, {stop_pipe_[0], POLLIN, 0}};
+
+    if(poll(fds, 2, -1) < 0) {
+      require_true(errno == EINTR, "facegrep: poll failed on the server socket");
+      continue;
+    }
+
+    if(fds[1].revents)
+      break;
+
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if(fd < 0)
+      continue;
+
+    timeval timeout = {CLIENT_TIMEOUT_S, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    {
+      std::lock_guard<std::mutex> lock(connections_mutex_);
+      ++connections_;
+    }
+
+    std::thread([this, fd] {
+      serve_(fd);
+
+      // Notified under the lock, so run() cannot return and the server go away before this thread is done with it.
+      std::lock_guard<std::mutex> lock(connections_mutex_);
+      --connections_;
+      connections_closed_.notify_all();
+    }).detach();
+  }
+
+  // Clients connecting from now on are refused rather than left waiting in the backlog.
+  close(listen_fd_);
+  unlink(params_.socket_path.c_str());
+  listen_fd_ = -1;
+
+  char byte;
+  while(read(stop_pipe_[0], &byte, 1) > 0);
+
+  std::unique_lock<std::mutex> lock(connections_mutex_);
+  connections_closed_.wait(lock, [this] { return connections_ == 0; });
+}
+
+
+void facegrep_server::stop()
+{
+  char byte = 0;
+  ssize_t written = write(stop_pipe_[1], &byte, 1);
+  (void) written;
+}
+
+
+void facegrep_client::query(const std::string& socket_path, const facegrep_request_t& request,
+  std::vector<face_template_t>& templates, const result_callback_t& callback)
+{
+  facegrep_request_t absolute = request;
+  for(auto& face_file : absolute.face_files)
+    face_file = absolute_path(face_file);
+
+  for(auto& image_file : absolute.image_files)
+    image_file = absolute_path(image_file);
+
+  absolute.search_directory = absolute_path(absolute.search_directory);
+
+  int fd = connect_to(socket_path);
+  require_true(fd >= 0, "facegrep: no server listening on " + socket_path);
+
+  bool done = false;
+
+  try {
+    done = read_replies_(fd, absolute, templates, callback);
+  }
+  catch(...) {
+    close(fd);
+    throw;
+  }
+
+  close(fd);
+
+  if(done)
+    return;
+
+  require_true(false, "facegrep: the server closed the connection");
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+bool facegrep_client::read_replies_(int fd, const facegrep_request_t& request, std::vector<face_template_t>& templates,
+  const result_callback_t& callback)
+{
+  if(!write_all(fd, format_request(request)))
+    return false;
+
+  templates.clear();
+  line_reader reader(fd);
+  std::string line;
+
+  while(reader.read_line(line)) {
+    if(line == "done")
+      return true;
+
+    auto fields = split_fields(line, 7);
+
+    if(fields[0] == "error")
+      require_true(false, "facegrep: " + (fields.size() > 1 ? line.substr(6) : std::string("server error")));
+    else if(fields[0] == "template" && fields.size() == 3) {
+      templates.push_back({fields[2], unsigned(std::stoul(fields[1]))});
+    }
+    else if(fields[0] == "match" && fields.size() == 7) {
+      search_result_t result;
+      result.index = std::stoull(fields[1]);
+      result.distance = std::stof(fields[2]);
+      result.face = std::stoul(fields[3]);
+      result.face_template = std::stoul(fields[4]);
+      result.matches = std::stoul(fields[5]);
+      result.file = fields[6];
+
+      require_true(result.face_template < templates.size(), "facegrep: malformed reply from the server");
+
+      // Closing the connection is what stops the search on the server.
+      if(!callback(result))
+        return true;
+    }
+    else
+      require_true(false, "facegrep: malformed reply from the server");
+  }
+
+  return false;
+}
+
+
+
+void facegrep_server::serve_(int fd)
+{
+  line_reader reader(fd);
+  std::string line;
+  facegrep_request_t request;
+
+  bool valid = reader.read_line(line) && line == PROTOCOL_HEADER;
+  while(valid && (valid = reader.read_line(line)) && line != "end")
+    valid = parse_request_line(line, request);
+
+  if(!valid) {
+    write_all(fd, "error\tmalformed request\n");
+    close(fd);
+    return;
+  }
+
+  facegrep* fg = nullptr;
+  idle_.pop(fg);
+
+  try {
+    search_(*fg, request, fd);
+  }
+  catch(const std::exception& e) {
+    std::string message = e.what();
+    std::replace(message.begin(), message.end(), '\n', ' ');
+    write_all(fd, "error\t" + message + "\n");
+  }
+
+  idle_.push(fg);
+  close(fd);
+}
+
+
+void facegrep_server::search_(facegrep& fg, const facegrep_request_t& request, int fd)
+{
+  if(request.face_files.empty()) {
+    write_all(fd, "error\tno face files\n");
+    return;
+  }
+
+  if(!request.search_directory.empty() && !dir_exists(request.search_directory)) {
+    write_all(fd, "error\tsearch directory not found: " + request.search_directory + "\n");
+    return;
+  }
+
+  facegrep_parameters_t query;
+  query.threshold = request.threshold;
+  query.search_mode = request.search_mode;
+  query.top_k = request.top_k;
+  query.ordered_results = request.ordered_results;
+  query.all_template_faces = request.all_template_faces;
+  fg.set_query_parameters(query);
+
+  fg.init(request.face_files);
+
+  auto& templates = fg.get_templates();
+  if(templates.empty()) {
+    write_all(fd, "error\tNo faces found in the face template images.\n");
+    return;
+  }
+
+  std::string reply;
+  for(auto& face_template : templates)
+    reply += "template\t" + std::to_string(face_template.face) + "\t" + face_template.file + "\n";
+
+  if(!write_all(fd, reply))
+    return;
+
+  bool connected = true;
+  auto callback = [&](const search_result_t& result) {
+    char distance[32];
+    snprintf(distance, sizeof(distance), "%.9g", result.distance);
+
+    connected = write_all(fd, "match\t" + std::to_string(result.index) + "\t" + distance + "\t" +
+      std::to_string(result.face) + "\t" + std::to_string(result.face_template) + "\t" +
+      std::to_string(result.matches) + "\t" + result.file + "\n");
+
+    // A client that hung up has seen all the results it wanted.
+    return connected;
+  };
+
+  if(!request.search_directory.empty())
+    fg.search_directory(request.search_directory, callback);
+  else
+    fg.search(request.image_files, callback);
+
+  if(connected)
+    write_all(fd, "done\n");
+}
+
+
+} // NAMESPACE facetools
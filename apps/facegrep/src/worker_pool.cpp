@@ -0,0 +1,331 @@
+// ## INCLUDE #################################################################
+
+#include <facegrep/worker_pool.h>
+#include <facetools/cpu_topology.h>
+#include <facetools/error.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+// ## NAMESPACE ###############################################################
+
+namespace facetools {
+
+
+// ## PRIVATE STRUCTURES ######################################################
+
+/** Shard sent by the parent: its first file and file count. */
+struct shard_request_t {
+  uint64_t first;
+  uint64_t count;
+};
+
+/** Result sent by a worker, or the end of its shard. Parent and workers are the same binary, so it goes as is. */
+struct worker_message_t {
+  uint64_t index;
+  float distance;
+  uint32_t face;
+  uint32_t face_template;
+  uint32_t matches;
+  uint32_t done;
+};
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/**
+ * Writes a whole buffer to a socket. Never raises SIGPIPE.
+ * \param fd Connected socket.
+ * \param data Data to write.
+ * \param size Size of the data in bytes.
+ * \return False if the peer went away.
+ */
+static bool send_all(int fd, const void* data, size_t size)
+{
+  size_t written = 0;
+  while(written < size) {
+    ssize_t count = send(fd, static_cast<const char*>(data) + written, size - written, MSG_NOSIGNAL);
+    if(count < 0 && errno == EINTR)
+      continue;
+    if(count <= 0)
+      return false;
+
+    written += count;
+  }
+
+  return true;
+}
+
+
+/**
+ * Reads a whole buffer from a socket.
+ * \param fd Connected socket.
+ * \param data Output buffer.
+ * \param size Number of bytes to read.
+ * \return False on end of file or error.
+ */
+static bool receive_all(int fd, void* data, size_t size)
+{
+  size_t done = 0;
+  while(done < size) {
+    ssize_t count = read(fd, static_cast<char*>(data) + done, size - done);
+    if(count < 0 && errno == EINTR)
+      continue;
+    if(count <= 0)
+      return false;
+
+    done += count;
+  }
+
+  return true;
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+worker_pool::worker_pool(const worker_pool_parameters_t& params)
+{
+  params_ = params;
+  params_.workers = std::max(1u, params_.workers);
+  params_.shard_size = std::max(1u, params_.shard_size);
+  params_.max_failures = std::max(1u, params_.max_failures);
+}
+
+
+worker_pool::~worker_pool()
+{
+  for(auto& worker : workers_)
+    stop_worker_(worker, true);
+}
+
+
+std::vector<size_t> worker_pool::run(size_t num_files, const shard_search_t& search, const shard_consumer_t& consumer)
+{
+  std::deque<shard_t> shards;
+  for(size_t first = 0; first < num_files; first += params_.shard_size)
+    shards.push_back({first, std::min<size_t>(params_.shard_size, num_files - first), 0});
+
+  std::vector<size_t> skipped;
+  bool keep_going = true;
+
+  try {
+    while(workers_.size() < std::min<size_t>(params_.workers, shards.size()))
+      workers_.push_back(start_worker_(search, workers_.size()));
+
+    auto busy = [this] {
+      return std::any_of(workers_.begin(), workers_.end(), [](const worker_t& worker) { return worker.busy; });
+    };
+
+    while(keep_going && (!shards.empty() || busy())) {
+      // A worker that cannot take its shard has died, which the poll below reports.
+      for(auto& worker : workers_) {
+        if(worker.busy || shards.empty())
+          continue;
+
+        worker.shard = shards.front();
+        worker.results.clear();
+        worker.busy = true;
+        shards.pop_front();
+
+        shard_request_t request = {worker.shard.first, worker.shard.count};
+        send_all(worker.fd, &request, sizeof(request));
+      }
+
+      std::vector<pollfd> fds;
+      for(auto& worker : workers_)
+        fds.push_back({worker.fd, POLLIN, 0});
+
+      int ready = poll(fds.data(), fds.size(), -1);
+      if(ready < 0 && errno == EINTR)
+        continue;
+
+      require_true(ready >= 0, "facegrep: cannot wait for the workers");
+
+      for(size_t i = 0; keep_going && i < fds.size(); ++i) {
+        if(!fds[i].revents)
+          continue;
+
+        auto& worker = workers_[i];
+        bool finished = false;
+        if(read_worker_(worker, finished)) {
+          if(finished) {
+            worker.busy = false;
+            keep_going = consumer(worker.shard.first, worker.shard.count, worker.results);
+          }
+
+          continue;
+        }
+
+        // Whichever file took the worker down, the others of its shard are innocent: they go back one by one, first
+        // in line, so an ordered search is not held up.
+        if(worker.busy) {
+          shard_t shard = worker.shard;
+          ++shard.failures;
+
+          if(shard.count > 1) {
+            for(size_t file = shard.first + shard.count; file-- > shard.first;)
+              shards.push_front({file, 1, 0});
+          }
+          else if(shard.failures < params_.max_failures)
+            shards.push_front(shard);
+          else {
+            skipped.push_back(shard.first);
+            std::vector<search_result_t> none;
+            keep_going = consumer(shard.first, 1, none);
+          }
+        }
+
+        stop_worker_(worker, true);
+        worker = start_worker_(search, i);
+      }
+    }
+  }
+  catch(...) {
+    for(auto& worker : workers_)
+      stop_worker_(worker, true);
+
+    workers_.clear();
+    throw;
+  }
+
+  // Idle workers exit when their socket closes. Busy ones only have results nobody wants.
+  for(auto& worker : workers_)
+    stop_worker_(worker, worker.busy);
+
+  workers_.clear();
+
+  std::sort(skipped.begin(), skipped.end());
+  return skipped;
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+worker_pool::worker_t worker_pool::start_worker_(const shard_search_t& search, size_t slot)
+{
+  int fds[2];
+  require_true(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0, "facegrep: cannot create a socket pair");
+
+  // Output still buffered would be written a second time by the worker.
+  std::cout.flush();
+
+  pid_t pid = fork();
+  if(pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    require_true(false, "facegrep: cannot start a worker process");
+  }
+
+  if(pid == 0) {
+    close(fds[0]);
+    for(auto& worker : workers_)
+      close(worker.fd);
+
+    // Memory the worker allocates from now on is local to its CPUs.
+    if(!params_.cpu_sets.empty())
+      pin_thread(params_.cpu_sets[slot % params_.cpu_sets.size()]);
+
+    run_worker_(fds[1], search);
+  }
+
+  close(fds[1]);
+
+  worker_t worker;
+  worker.pid = pid;
+  worker.fd = fds[0];
+  worker.busy = false;
+  worker.shard = {0, 0, 0};
+
+  return worker;
+}
+
+
+void worker_pool::run_worker_(int fd, const shard_search_t& search)
+{
+  shard_request_t request;
+
+  // _exit leaves the parent's atexit handlers and static objects alone.
+  while(receive_all(fd, &request, sizeof(request))) {
+    bool connected = true;
+
+    try {
+      search(request.first, request.count, [&](const search_result_t& result) {
+        worker_message_t message = {result.index, result.distance, result.face, result.face_template, result.matches,
+          0};
+        connected = send_all(fd, &message, sizeof(message));
+
+        return connected;
+      });
+    }
+    catch(...) {
+      _exit(1);
+    }
+
+    worker_message_t done = {0, 0, 0, 0, 0, 1};
+    if(!connected || !send_all(fd, &done, sizeof(done)))
+      break;
+  }
+
+  _exit(0);
+}
+
+
+bool worker_pool::read_worker_(worker_t& worker, bool& finished)
+{
+  char chunk[4096];
+  ssize_t count = read(worker.fd, chunk, sizeof(chunk));
+  if(count < 0 && errno == EINTR)
+    return true;
+  if(count <= 0)
+    return false;
+
+  worker.buffer.append(chunk, count);
+
+  size_t start = 0;
+  for(; start + sizeof(worker_message_t) <= worker.buffer.size(); start += sizeof(worker_message_t)) {
+    worker_message_t message;
+    std::copy_n(worker.buffer.data() + start, sizeof(message), reinterpret_cast<char*>(&message));
+
+    if(message.done) {
+      finished = true;
+      continue;
+    }
+
+    search_result_t result;
+    result.index = message.index;
+    result.distance = message.distance;
+    result.face = message.face;
+    result.face_template = message.face_template;
+    result.matches = message.matches;
+    worker.results.push_back(std::move(result));
+  }
+
+  worker.buffer.erase(0, start);
+  return true;
+}
+
+
+void worker_pool::stop_worker_(worker_t& worker, bool kill)
+{
+  if(worker.fd < 0)
+    return;
+
+  if(kill)
+    ::kill(worker.pid, SIGKILL);
+
+  close(worker.fd);
+  while(waitpid(worker.pid, nullptr, 0) < 0 && errno == EINTR) {}
+
+  worker.fd = -1;
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,136 @@
+#ifndef _FACETOOLS_BENCHMARK_H_
+#define _FACETOOLS_BENCHMARK_H_
+
+// ## INCLUDE #################################################################
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// ## NAMESPACE ###############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * Timing of one benchmark at one thread count.
+ */
+struct benchmark_result_t {
+  /** Benchmark name, such as detect/mmod. */
+  std::string name;
+
+  /** Number of threads running the body at once. */
+  unsigned int threads;
+
+  /** Number of calls of the body, over all threads. */
+  size_t iterations;
+
+  /** Number of items processed, over all threads. */
+  size_t items;
+
+  /** Wall clock time of the timed calls, in seconds. */
+  double seconds;
+
+  /** Other measurements, such as the recall of an approximate search, by name. */
+  std::map<std::string, double> counters;
+};
+
+
+/**
+ * A benchmark body. Processes a few items and returns how many.
+ */
+typedef std::function<size_t()> benchmark_body_t;
+
+/**
+ * Builds the body of one thread, with state of its own such as a model replica. Called on that thread, untimed.
+ */
+typedef std::function<benchmark_body_t(unsigned int worker)> benchmark_setup_t;
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * A small benchmark harness. Each benchmark gets one untimed warm-up call per thread, then its body is called until
+ * a minimum time has passed. Throughput is items processed per second of wall clock time, so thread counts compare
+ * directly.
+ */
+class benchmark_runner {
+public:
+  /**
+   * \param min_seconds Time each benchmark runs for, at least.
+   * \param filter Only benchmarks whose name contains this run. Empty runs them all.
+   */
+  explicit benchmark_runner(double min_seconds = 0.5, const std::string& filter = "");
+
+
+  /**
+   * \param name Benchmark name.
+   * \return Whether the filter selects the benchmark. Lets expensive setup be skipped.
+   */
+  bool selected(const std::string& name) const;
+
+
+  /**
+   * Runs a benchmark on the calling thread.
+   * \param name Benchmark name.
+   * \param body Benchmark body.
+   * \param threads Number of threads the body runs internally, such as a pipeline's, recorded with the result.
+   */
+  void run(const std::string& name, const benchmark_body_t& body, unsigned int threads = 1);
+
+
+  /**
+   * Runs a benchmark on several threads at once, each calling its own body.
+   * \param name Benchmark name.
+   * \param threads Number of threads.
+   * \param setup Builds the body of each thread.
+   */
+  void run(const std::string& name, unsigned int threads, const benchmark_setup_t& setup);
+
+
+  /**
+   * Records a measurement of a benchmark other than its time. Does nothing if the benchmark did not run.
+   * \param name Benchmark name. Every result of that name gets the counter.
+   * \param counter Counter name, such as recall.
+   * \param value Counter value.
+   */
+  void set_counter(const std::string& name, const std::string& counter, double value);
+
+
+  /**
+   * \return Results so far, in the order the benchmarks ran.
+   */
+  const std::vector<benchmark_result_t>& results() const noexcept;
+
+
+  /**
+   * Writes the results as JSON: a context object and a list of benchmarks, each with its per item throughput, its
+   * speedup over the same benchmark on one thread and its counters.
+   * \param out Stream to write to.
+   */
+  void write_json(std::ostream& out) const;
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Minimum time per benchmark. */
+  double min_seconds_;
+
+  /** Benchmark name filter. */
+  std::string filter_;
+
+  /** Results so far. */
+  std::vector<benchmark_result_t> results_;
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_BENCHMARK_H_
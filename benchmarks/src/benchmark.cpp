@@ -0,0 +1,219 @@
+// ## INCLUDE #################################################################
+
+#include <benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+
+// ## NAMESPACE ###############################################################
+
+namespace facetools {
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/**
+ * \param start Start of the interval.
+ * \return Seconds since start.
+ */
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/**
+ * \param text Text to quote.
+ * \return The text as a JSON string.
+ */
+static std::string json_string(const std::string& text)
+{
+  std::string quoted = "\"";
+  for(char c : text) {
+    if(c == '"' || c == '\\')
+      quoted += '\\';
+
+    quoted += c;
+  }
+
+  return quoted + "\"";
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+benchmark_runner::benchmark_runner(double min_seconds, const std::string& filter) :
+  min_seconds_(min_seconds), filter_(filter)
+{
+}
+
+
+bool benchmark_runner::selected(const std::string& name) const
+{
+  return filter_.empty() || name.find(filter_) != std::string::npos;
+}
+
+
+void benchmark_runner::run(const std::string& name, const benchmark_body_t& body, unsigned int threads)
+{
+  if(!selected(name))
+    return;
+
+  body();
+
+  benchmark_result_t result = {name, std::max(1u, threads), 0, 0, 0};
+  auto start = std::chrono::steady_clock::now();
+
+  do {
+    result.items += body();
+    ++result.iterations;
+  } while(seconds_since(start) < min_seconds_);
+
+  result.seconds = seconds_since(start);
+  results_.push_back(result);
+}
+
+
+void benchmark_runner::run(const std::string& name, unsigned int threads, const benchmark_setup_t& setup)
+{
+  if(!selected(name))
+    return;
+
+  threads = std::max(1u, threads);
+
+  std::mutex mutex;
+  std::condition_variable all_ready, started;
+  unsigned int ready = 0;
+  bool go = false;
+  std::atomic<bool> stop(false);
+  std::exception_ptr error;
+
+  std::vector<size_t> iterations(threads, 0), items(threads, 0);
+  std::vector<std::thread> workers;
+
+  // Every thread builds and warms its body up before the clock starts.
+  for(unsigned int worker = 0; worker < threads; ++worker) {
+    workers.emplace_back([&, worker] {
+      benchmark_body_t body;
+
+      try {
+        body = setup(worker);
+        body();
+      }
+      catch(...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!error)
+          error = std::current_exception();
+        body = nullptr;
+      }
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if(++ready == threads)
+          all_ready.notify_one();
+
+        started.wait(lock, [&] { return go; });
+      }
+
+      try {
+        while(body && !stop) {
+          items[worker] += body();
+          ++iterations[worker];
+        }
+      }
+      catch(...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!error)
+          error = std::current_exception();
+      }
+    });
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_ready.wait(lock, [&] { return ready == threads; });
+    go = true;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  started.notify_all();
+
+  // Calls in progress at the deadline are finished, and counted.
+  std::this_thread::sleep_for(std::chrono::duration<double>(min_seconds_));
+  stop = true;
+
+  for(auto& worker : workers)
+    worker.join();
+
+  if(error)
+    std::rethrow_exception(error);
+
+  benchmark_result_t result = {name, threads, 0, 0, seconds_since(start)};
+  for(unsigned int worker = 0; worker < threads; ++worker) {
+    result.iterations += iterations[worker];
+    result.items += items[worker];
+  }
+
+  results_.push_back(result);
+}
+
+
+void benchmark_runner::set_counter(const std::string& name, const std::string& counter, double value)
+{
+  for(auto& result : results_)
+    if(result.name == name)
+      result.counters[counter] = value;
+}
+
+
+const std::vector<benchmark_result_t>& benchmark_runner::results() const noexcept
+{
+  return results_;
+}
+
+
+void benchmark_runner::write_json(std::ostream& out) const
+{
+  out << "{\n  \"context\": {\"hardware_threads\": " << std::thread::hardware_concurrency() << ", \"min_seconds\": " <<
+    min_seconds_ << "},\n  \"benchmarks\": [";
+
+  for(size_t i = 0; i < results_.size(); ++i) {
+    auto& result = results_[i];
+    double throughput = result.seconds > 0 ? result.items / result.seconds : 0;
+
+    out << (i ? "," : "") << "\n    {\"name\": " << json_string(result.name) << ", \"threads\": " << result.threads <<
+      ", \"iterations\": " << result.iterations << ", \"items\": " << result.items << ", \"seconds\": " <<
+      result.seconds << ", \"items_per_second\": " << throughput << ", \"ns_per_item\": " <<
+      (result.items ? result.seconds * 1e9 / result.items : 0);
+
+    // Speedup over the single thread run of the same benchmark, when there is one.
+    auto single = std::find_if(results_.begin(), results_.end(), [&](const benchmark_result_t& other) {
+      return other.name == result.name && other.threads == 1 && other.items;
+    });
+
+    if(single != results_.end())
+      out << ", \"speedup\": " << throughput / (single->items / single->seconds);
+
+    if(!result.counters.empty()) {
+      out << ", \"counters\": {";
+      for(auto counter = result.counters.begin(); counter != result.counters.end(); ++counter)
+        out << (counter == result.counters.begin() ? "" : ", ") << json_string(counter->first) << ": " <<
+          counter->second;
+
+      out << "}";
+    }
+
+    out << "}";
+  }
+
+  out << "\n  ]\n}\n";
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,455 @@
+/* Microbenchmarks of the facetools hot paths, written out as JSON.
+ *
+ * Usage: facetools_bench [options]
+ *   -o or --output       File to write the JSON to. Default: standard output.
+ *   -f or --filter       Only run the benchmarks whose name contains this.
+ *   -t or --min-time     Seconds each benchmark runs for, at least. Default: 0.5.
+ *   -p or --max-threads  Largest thread count of the scaling benchmarks. Default: one per hardware thread.
+ *   -m or --models       Directory holding the models. Default: ../models.
+ *   -d or --data         Directory holding the test data. Default: ../test_data.
+ *
+ * Run it from the build directory, as the tests are. Progress goes to standard error.
+ */
+
+// ## INCLUDES ################################################################
+
+#include <benchmark.h>
+#include <facegrep/facegrep.h>
+#include <facetools/embedding_index.h>
+#include <facetools/face_detector.h>
+#include <facetools/face_recogniser.h>
+#include <facetools/hnsw_index.h>
+#include <facetools/parallel.h>
+#include <file_finder.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+using namespace facetools;
+
+
+// ## CONSTANTS ###############################################################
+
+/** Embedding counts of the get_people benchmarks. */
+static const size_t PEOPLE_SIZES[] = {256, 1024, 4096, 8192};
+
+/** Faces per synthetic person in the get_people benchmarks. */
+static const size_t FACES_PER_PERSON = 8;
+
+/** Embedding pairs compared per face_matched_ call. */
+static const size_t MATCHED_PAIRS = 4096;
+
+/** Gallery size and number of probes of the hnsw benchmarks. */
+static const size_t HNSW_FACES = 20000;
+static const size_t HNSW_QUERIES = 200;
+
+/** Neighbours asked for by the knn benchmarks. */
+static const size_t HNSW_K = 10;
+
+/** facegrep's default match threshold. */
+static const float HNSW_THRESHOLD = 0.6f;
+
+/** Benchmarks of approximate search against the exact scan. */
+static const char* HNSW_BENCHMARKS[] = {"hnsw/build", "hnsw/radius", "hnsw/knn", "hnsw/flat_radius", "hnsw/flat_knn"};
+
+/** Directories and files per directory of the synthetic find_images tree. */
+static const unsigned int TREE_DIRECTORIES = 32;
+static const unsigned int TREE_FILES = 128;
+
+/** Options for getopt. */
+static struct option bench_options[] = {
+  {"output", required_argument, 0, 'o'},
+  {"filter", required_argument, 0, 'f'},
+  {"min-time", required_argument, 0, 't'},
+  {"max-threads", required_argument, 0, 'p'},
+  {"models", required_argument, 0, 'm'},
+  {"data", required_argument, 0, 'd'},
+  {0, 0, 0, 0}
+};
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/**
+ * \param max_threads Largest thread count.
+ * \return 1, 2, 4... up to max_threads, and max_threads itself.
+ */
+static std::vector<unsigned int> thread_counts(unsigned int max_threads)
+{
+  std::vector<unsigned int> counts;
+  for(unsigned int threads = 1; threads < max_threads; threads *= 2)
+    counts.push_back(threads);
+
+  counts.push_back(max_threads);
+  return counts;
+}
+
+
+/**
+ * Makes embeddings of people whose faces sit close together, the way the recogniser places them.
+ * \param count Number of embeddings.
+ * \param seed Random seed.
+ * \return Embeddings, FACES_PER_PERSON per person.
+ */
+static std::vector<embedding_t> make_embeddings(size_t count, unsigned int seed)
+{
+  std::mt19937 generator(seed);
+  std::normal_distribution<float> centre(0, 0.1f), spread(0, 0.01f);
+
+  std::vector<embedding_t> embeddings;
+  embedding_t person(128);
+
+  for(size_t i = 0; i < count; ++i) {
+    if(i % FACES_PER_PERSON == 0)
+      for(long d = 0; d < person.size(); ++d)
+        person(d) = centre(generator);
+
+    embedding_t face(128);
+    for(long d = 0; d < face.size(); ++d)
+      face(d) = person(d) + spread(generator);
+
+    embeddings.push_back(face);
+  }
+
+  return embeddings;
+}
+
+
+/**
+ * \param matches Matches of a search.
+ * \param expected Matches of an exact search.
+ * \return Number of expected rows that the search found.
+ */
+static size_t count_found(const std::vector<index_match_t>& matches, const std::vector<index_match_t>& expected)
+{
+  size_t count = 0;
+  for(auto& match : expected)
+    count += std::any_of(matches.begin(), matches.end(), [&](const index_match_t& found) {
+      return found.row == match.row;
+    });
+
+  return count;
+}
+
+
+/**
+ * Makes a directory tree of empty image files and other files.
+ * \param root Directory to fill.
+ */
+static void make_tree(const std::string& root)
+{
+  for(unsigned int d = 0; d < TREE_DIRECTORIES; ++d) {
+    std::string directory = root + "/d" + std::to_string(d);
+    system(("mkdir -p " + directory).c_str());
+
+    for(unsigned int f = 0; f < TREE_FILES; ++f)
+      std::ofstream(directory + "/f" + std::to_string(f) + (f % 4 ? ".jpg" : ".txt"));
+  }
+}
+
+
+// ## MAIN FUNCTION ###########################################################
+
+int main(int argc, char** argv)
+{
+  std::string output, filter, models = "../models", data = "../test_data";
+  double min_seconds = 0.5;
+  unsigned int max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  while(true) {
+    int c = getopt_long(argc, argv, "o:f:t:p:m:d:", bench_options, nullptr);
+    if(c == -1)
+      break;
+
+    switch(c) {
+      case 'o':
+        output = optarg;
+        break;
+      case 'f':
+        filter = optarg;
+        break;
+      case 't':
+        min_seconds = std::stod(optarg);
+        break;
+      case 'p':
+        max_threads = std::max(1, std::stoi(optarg));
+        break;
+      case 'm':
+        models = optarg;
+        break;
+      case 'd':
+        data = optarg;
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0] << " [-o output] [-f filter] [-t min seconds] [-p max threads] " <<
+          "[-m models] [-d test data]\n";
+        return 1;
+    }
+  }
+
+  benchmark_runner runner(min_seconds, filter);
+  auto progress = [&](const std::string& name) {
+    if(runner.selected(name))
+      std::cerr << "facetools_bench: " << name << std::endl;
+  };
+
+  const std::string search_directory = data + "/facegrep/searchdir";
+  const std::string face_file = search_directory + "/bruce0.jpg";
+  const std::string group_file = data + "/facetools/bald_guys.jpg";
+  auto image_files = file_finder::find_images(search_directory);
+
+  face_detector_parameters_t detector_params;
+  detector_params.detector_type = face_detector_type_t::DLIB_DEFAULT;
+  detector_params.face_detector_model_file = models + "/mmod_human_face_detector.dat";
+  detector_params.shape_predictor_model_file = models + "/shape_predictor_68_face_landmarks.dat";
+
+  face_recogniser_parameters_t recogniser_params;
+  recogniser_params.recogniser_model_file = models + "/dlib_face_recognition_resnet_model_v1.dat";
+
+  face_detector detector(detector_params);
+  face_recogniser recogniser(recogniser_params);
+
+  std::vector<dlib::matrix<dlib::rgb_pixel>> images(image_files.size());
+  for(size_t i = 0; i < image_files.size(); ++i)
+    dlib::load_image(images[i], image_files[i]);
+
+  dlib::matrix<dlib::rgb_pixel> group;
+  dlib::load_image(group, group_file);
+
+  // Image decoding and scaling.
+  progress("load_image");
+  runner.run("load_image", [&] {
+    dlib::matrix<dlib::rgb_pixel> image;
+    for(auto& image_file : image_files)
+      dlib::load_image(image, image_file);
+
+    return image_files.size();
+  });
+
+  progress("downscale_image");
+  runner.run("downscale_image", [&] {
+    auto scaled = detector.downscale_image(group);
+    return size_t(scaled.size() ? 1 : 0);
+  });
+
+  // Detection, with a detector replica per thread, as the pipeline has.
+  auto run_detect = [&](const std::string& name, face_detector& model) {
+    for(unsigned int threads : thread_counts(max_threads)) {
+      progress(name + " x" + std::to_string(threads));
+      runner.run(name, threads, [&](unsigned int) -> benchmark_body_t {
+        auto replica = std::make_shared<face_detector>(model);
+
+        return [&, replica] {
+          for(auto& image : images) {
+            auto copy = image;
+            replica->detect(copy);
+          }
+
+          return images.size();
+        };
+      });
+    }
+  };
+
+  run_detect("detect/dlib_default", detector);
+
+  if(runner.selected("detect/mmod")) {
+    face_detector_parameters_t mmod_params = detector_params;
+    mmod_params.detector_type = face_detector_type_t::MMOD;
+    face_detector mmod_detector(mmod_params);
+
+    run_detect("detect/mmod", mmod_detector);
+  }
+
+  auto group_copy = group;
+  auto group_faces = detector.detect(group_copy);
+
+  progress("align");
+  runner.run("align", [&] {
+    detector.align(group_faces, group);
+    return group_faces.size();
+  });
+
+  // Embeddings of every face found in the search directory.
+  std::vector<face> faces;
+  for(auto& image : images) {
+    auto copy = image;
+    auto found = detector.extract_faces(copy);
+    faces.insert(faces.end(), found.begin(), found.end());
+  }
+
+  for(bool jitter : {false, true}) {
+    std::string name = jitter ? "get_embedding/jitter" : "get_embedding/no_jitter";
+
+    for(unsigned int threads : thread_counts(max_threads)) {
+      progress(name + " x" + std::to_string(threads));
+      runner.run(name, threads, [&](unsigned int) -> benchmark_body_t {
+        auto replica = std::make_shared<face_recogniser>(recogniser);
+        replica->set_jitter(jitter);
+
+        return [&, replica] {
+          replica->get_embedding(faces);
+          return faces.size();
+        };
+      });
+    }
+  }
+
+  // Clustering, on every hardware thread, at growing sizes.
+  for(size_t count : PEOPLE_SIZES) {
+    std::string name = "get_people/" + std::to_string(count);
+    if(!runner.selected(name))
+      continue;
+
+    progress(name);
+    auto embeddings = make_embeddings(count, count);
+    runner.run(name, [&] {
+      recogniser.get_people(embeddings);
+      return embeddings.size();
+    }, resolve_thread_count(recogniser_params.num_threads));
+  }
+
+  // Approximate search, one query at a time, against the exact scan of a flat index, with the recall it trades.
+  if(std::any_of(std::begin(HNSW_BENCHMARKS), std::end(HNSW_BENCHMARKS), [&](const char* name) {
+    return runner.selected(name);
+  })) {
+    auto gallery = make_embeddings(HNSW_FACES, 2);
+
+    // Probes are fresh photos of people in the gallery.
+    std::mt19937 generator(3);
+    std::normal_distribution<float> spread(0, 0.01f);
+    std::vector<embedding_t> probes;
+
+    for(size_t q = 0; q < HNSW_QUERIES; ++q) {
+      embedding_t probe = gallery[q * 97 % gallery.size()];
+      for(long d = 0; d < probe.size(); ++d)
+        probe(d) += spread(generator);
+
+      probes.push_back(probe);
+    }
+
+    const std::string index_file = "/tmp/facetools_bench_hnsw.ftix";
+    {
+      embedding_index_writer writer(index_file);
+      for(auto& embedding : gallery)
+        writer.add(embedding, "gallery", dlib::rectangle());
+
+      writer.finish();
+    }
+
+    embedding_index flat(index_file);
+    hnsw_index index;
+    index.build(gallery);
+
+    progress("hnsw/build");
+    runner.run("hnsw/build", [&] {
+      hnsw_index built;
+      built.build(gallery);
+      return gallery.size();
+    }, resolve_thread_count(hnsw_parameters_t().num_threads));
+
+    size_t probe = 0;
+    auto run_query = [&](const std::string& name, const std::function<void(const embedding_t&)>& query) {
+      progress(name);
+      runner.run(name, [&] {
+        query(probes[probe++ % probes.size()]);
+        return size_t(1);
+      });
+    };
+
+    run_query("hnsw/radius", [&](const embedding_t& query) { index.radius(query, HNSW_THRESHOLD); });
+    run_query("hnsw/knn", [&](const embedding_t& query) { index.knn(query, HNSW_K); });
+    run_query("hnsw/flat_radius", [&](const embedding_t& query) { flat.search(query, HNSW_THRESHOLD, 1); });
+    run_query("hnsw/flat_knn", [&](const embedding_t& query) { flat.nearest(query, HNSW_K, 1); });
+
+    size_t radius_expected = 0, radius_found = 0, knn_found = 0;
+    for(auto& query : probes) {
+      auto expected = flat.search(query, HNSW_THRESHOLD);
+      radius_expected += expected.size();
+      radius_found += count_found(index.radius(query, HNSW_THRESHOLD), expected);
+      knn_found += count_found(index.knn(query, HNSW_K), flat.nearest(query, HNSW_K));
+    }
+
+    runner.set_counter("hnsw/radius", "recall", double(radius_found) / std::max<size_t>(radius_expected, 1));
+    runner.set_counter("hnsw/knn", "recall", double(knn_found) / (probes.size() * HNSW_K));
+    std::remove(index_file.c_str());
+  }
+
+  // Search pieces and the whole search.
+  facegrep_parameters_t facegrep_params;
+  facegrep_params.jitter = false;
+  facegrep_params.detector_type = face_detector_type_t::DLIB_DEFAULT;
+  facegrep_params.detector_model = detector_params.face_detector_model_file;
+  facegrep_params.recogniser_model = recogniser_params.recogniser_model_file;
+  facegrep_params.shape_model = detector_params.shape_predictor_model_file;
+
+  if(runner.selected("face_matched_")) {
+    facegrep fg(facegrep_params);
+    auto embeddings = make_embeddings(2 * MATCHED_PAIRS, 1);
+    size_t matched = 0;
+
+    progress("face_matched_");
+    runner.run("face_matched_", [&] {
+      for(size_t i = 0; i < MATCHED_PAIRS; ++i)
+        matched += fg.face_matched_(embeddings[2 * i], embeddings[2 * i + 1]);
+
+      return MATCHED_PAIRS;
+    });
+  }
+
+  progress("find_images");
+  runner.run("find_images/test_data", [&] {
+    return file_finder::find_images(data).size();
+  });
+
+  if(runner.selected("find_images/tree")) {
+    char tree[] = "/tmp/facetools_bench_XXXXXX";
+    if(mkdtemp(tree)) {
+      make_tree(tree);
+      runner.run("find_images/tree", [&] {
+        return file_finder::find_images(tree).size();
+      });
+
+      system((std::string("rm -rf ") + tree).c_str());
+    }
+  }
+
+  for(unsigned int threads : thread_counts(max_threads)) {
+    if(!runner.selected("facegrep_search"))
+      break;
+
+    progress("facegrep_search x" + std::to_string(threads));
+    facegrep_params.load_threads = threads;
+    facegrep_params.detect_threads = threads;
+    facegrep_params.embed_threads = threads;
+
+    facegrep fg(facegrep_params);
+    fg.init(face_file);
+
+    runner.run("facegrep_search", [&] {
+      fg.search(image_files);
+      return image_files.size();
+    }, threads);
+  }
+
+  if(output.empty())
+    runner.write_json(std::cout);
+  else {
+    std::ofstream out(output);
+    runner.write_json(out);
+  }
+
+  return 0;
+}
@@ -0,0 +1,192 @@
+/* Compares the thread placement policies of facegrep.
+ *
+ * Usage: facegrep_placement_bench [threads per stage] [search directory] [face file] [rounds]
+ *
+ * Two measurements per policy. The memory one has every thread stream through a buffer of its own, built either by
+ * the main thread, as models were before placement, or by the thread itself, as the replicas now are. It shows the
+ * remote memory traffic without the models. The search one runs facegrep on the directory, in one process and on
+ * worker processes. Run it from the directory holding the models, as the tests are.
+ */
+
+// ## INCLUDES ################################################################
+
+#include <facegrep/facegrep.h>
+#include <facetools/cpu_topology.h>
+#include <file_finder.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+using namespace facetools;
+
+
+// ## CONSTANTS ###############################################################
+
+/** Floats in the buffer of each thread, about the size of the recogniser's activations. */
+static const size_t BUFFER_FLOATS = size_t(16) << 20;
+
+/** Passes each thread makes over its buffer. */
+static const unsigned int BUFFER_PASSES = 8;
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/**
+ * \param start Start of the interval.
+ * \return Seconds since start.
+ */
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/**
+ * Streams per thread buffers on threads placed by a policy.
+ * \param topology CPU topology.
+ * \param policy Placement policy.
+ * \param threads Number of threads.
+ * \param local Whether each thread builds its own buffer, rather than the main thread building them all.
+ * \return Gigabytes read per second, over all threads, not counting the time spent building the buffers.
+ */
+static double stream_buffers(const cpu_topology& topology, placement_policy_t policy, unsigned int threads, bool local)
+{
+  auto cpus = topology.place(threads, policy);
+  std::vector<std::unique_ptr<std::vector<float>>> buffers(threads);
+
+  if(!local)
+    for(auto& buffer : buffers)
+      buffer = std::make_unique<std::vector<float>>(BUFFER_FLOATS, 1.0f);
+
+  std::vector<double> sums(threads), elapsed(threads);
+  std::vector<std::thread> workers;
+
+  for(unsigned int i = 0; i < threads; ++i) {
+    workers.emplace_back([&, i] {
+      if(!cpus.empty())
+        pin_thread({cpus[i]});
+
+      if(local)
+        buffers[i] = std::make_unique<std::vector<float>>(BUFFER_FLOATS, 1.0f);
+
+      auto start = std::chrono::steady_clock::now();
+      double sum = 0;
+      for(unsigned int pass = 0; pass < BUFFER_PASSES; ++pass)
+        for(float value : *buffers[i])
+          sum += value;
+
+      sums[i] = sum;
+      elapsed[i] = seconds_since(start);
+    });
+  }
+
+  for(auto& worker : workers)
+    worker.join();
+
+  // Checked, so the reads cannot be optimised away.
+  for(double sum : sums)
+    if(sum != double(BUFFER_FLOATS) * BUFFER_PASSES)
+      std::cout << "facegrep_placement_bench: WARNING! Wrong buffer sum.\n";
+
+  double bytes = double(threads) * BUFFER_PASSES * BUFFER_FLOATS * sizeof(float);
+  return bytes / *std::max_element(elapsed.begin(), elapsed.end()) / 1e9;
+}
+
+
+/**
+ * Runs searches with a placement policy.
+ * \param policy Placement policy.
+ * \param threads Threads per pipeline stage.
+ * \param workers Worker processes, or 0.
+ * \param face_file Face searched for.
+ * \param search_directory Directory searched.
+ * \param rounds Number of searches timed.
+ * \param setup_seconds Output. Time taken building the models and their replicas.
+ * \return Images searched per second.
+ */
+static double run_search(placement_policy_t policy, unsigned int threads, unsigned int workers,
+  const std::string& face_file, const std::string& search_directory, unsigned int rounds, double& setup_seconds)
+{
+  facegrep_parameters_t params;
+  params.jitter = false;
+  params.load_threads = threads;
+  params.detect_threads = threads;
+  params.embed_threads = threads;
+  params.workers = workers;
+  params.placement = policy;
+
+  auto start = std::chrono::steady_clock::now();
+  facegrep fg(params);
+  setup_seconds = seconds_since(start);
+
+  fg.init(face_file);
+
+  // The first search warms the page cache and the models up.
+  auto image_files = file_finder::find_images(search_directory);
+  fg.search(image_files);
+
+  start = std::chrono::steady_clock::now();
+  for(unsigned int round = 0; round < rounds; ++round)
+    fg.search(image_files);
+
+  return image_files.size() * rounds / seconds_since(start);
+}
+
+
+// ## MAIN FUNCTION ###########################################################
+
+int main(int argc, char** argv)
+{
+  unsigned int threads = argc > 1 ? std::stoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency() / 3);
+  std::string search_directory = argc > 2 ? argv[2] : "../test_data/facegrep/searchdir";
+  std::string face_file = argc > 3 ? argv[3] : "../test_data/facegrep/searchdir/bruce0.jpg";
+  unsigned int rounds = argc > 4 ? std::stoi(argv[4]) : 3;
+
+  cpu_topology topology;
+  std::cout << "CPUs: " << topology.cpus().size() << ", NUMA nodes: " << topology.num_nodes() << "\n";
+  for(unsigned int node = 0; node < topology.num_nodes(); ++node)
+    std::cout << "  node " << node << ": " << topology.node_cpus(node).size() << " CPUs\n";
+
+  struct policy_t {
+    const char* name;
+    placement_policy_t policy;
+  };
+
+  const policy_t policies[] = {
+    {"none", placement_policy_t::NONE},
+    {"compact", placement_policy_t::COMPACT},
+    {"spread", placement_policy_t::SPREAD}
+  };
+
+  unsigned int stream_threads = 3 * threads;
+  std::cout << std::fixed << std::setprecision(2) << "\nMemory streaming, " << stream_threads << " threads (GB/s)\n" <<
+    "policy\t\tmain thread buffers\tlocal buffers\n";
+
+  for(auto& policy : policies)
+    std::cout << policy.name << "\t\t" << stream_buffers(topology, policy.policy, stream_threads, false) << "\t\t\t" <<
+      stream_buffers(topology, policy.policy, stream_threads, true) << "\n";
+
+  std::cout << "\nSearch, " << threads << " threads per stage (images/s, model setup s)\n" <<
+    "policy\t\tthreads\t\t\tworkers x2\n";
+
+  for(auto& policy : policies) {
+    double setup_threads = 0, setup_workers = 0;
+    double in_process = run_search(policy.policy, threads, 0, face_file, search_directory, rounds, setup_threads);
+    double sharded = run_search(policy.policy, threads, 2, face_file, search_directory, rounds, setup_workers);
+
+    std::cout << policy.name << "\t\t" << in_process << " (" << setup_threads << ")\t\t" << sharded << " (" <<
+      setup_workers << ")\n";
+  }
+
+  return 0;
+}
@@ -0,0 +1,150 @@
+/* Blocking, bounded multi-producer multi-consumer queue used to connect the
+ * stages of a pipeline.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_BOUNDED_QUEUE_H_
+#define _FACETOOLS_BOUNDED_QUEUE_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * FIFO queue holding at most capacity items. Producers block while it is full, consumers block while it is empty.
+ * Closing the queue wakes everybody up: pushes then fail and pops drain what is left before failing. A stage closes
+ * its output queue once its last worker is done, which is how the end of the stream travels down the pipeline.
+ */
+template <typename T>
+class bounded_queue {
+public:
+  /**
+   * \param capacity Maximum number of queued items (at least 1).
+   */
+  explicit bounded_queue(size_t capacity) : capacity_(capacity ? capacity : 1), closed_(false) {}
+
+
+  /**
+   * Adds an item, waiting for space if the queue is full.
+   * \param item Item to add.
+   * \return False if the queue was closed and the item dropped.
+   */
+  bool push(T item)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+
+    if(closed_)
+      return false;
+
+    items_.push_back(std::move(item));
+    lock.unlock();
+    not_empty_.notify_one();
+
+    return true;
+  }
+
+
+  /**
+   * Removes the oldest item, waiting for one if the queue is empty.
+   * \param item Output. Set when an item was removed.
+   * \return False once the queue is closed and empty.
+   */
+  bool pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+
+    return pop_locked_(lock, item);
+  }
+
+
+  /**
+   * Removes the oldest item, waiting at most timeout for one.
+   * \param item Output. Set when an item was removed.
+   * \param timeout Longest time to wait.
+   * \return False if nothing arrived in time, or the queue is closed and empty.
+   */
+  template <typename rep_t, typename period_t>
+  bool pop_for(T& item, const std::chrono::duration<rep_t, period_t>& timeout)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait_for(lock, timeout, [this] { return closed_ || !items_.empty(); });
+
+    return pop_locked_(lock, item);
+  }
+
+
+  /**
+   * Closes the queue. Items already queued can still be popped.
+   */
+  void close()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+
+  /**
+   * \return Whether the queue was closed and is now empty.
+   */
+  bool drained() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_ && items_.empty();
+  }
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  const size_t capacity_;
+  bool closed_;
+  std::deque<T> items_;
+  mutable std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+
+
+  bool pop_locked_(std::unique_lock<std::mutex>& lock, T& item)
+  {
+    if(items_.empty())
+      return false;
+
+    item = std::move(items_.front());
+    items_.pop_front();
+    lock.unlock();
+    not_full_.notify_one();
+
+    return true;
+  }
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_BOUNDED_QUEUE_H_
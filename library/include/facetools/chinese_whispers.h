@@ -0,0 +1,135 @@
+/* Parallel, deterministic Chinese whispers graph clustering.
+ * Label propagation over a compressed sparse row (CSR) adjacency, in either
+ * colour-partitioned sweeps (no two neighbours update at the same time, so
+ * results match a sequential sweep) or damped synchronous sweeps. All
+ * randomness comes from a seed, so a given graph and seed always produce the
+ * same clustering regardless of the thread count.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_CHINESE_WHISPERS_H_
+#define _FACETOOLS_CHINESE_WHISPERS_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <dlib/clustering.h>
+#include <cstdint>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * How labels are updated during a sweep.
+ */
+enum class chinese_whispers_sweep_t {
+  /** Nodes are greedily coloured and each colour class updates in parallel. Equivalent to a sequential sweep. A clique
+   * of k nodes needs k colours, each a pass with a barrier after it, so dense face clusters leave little to run in
+   * parallel. Prefer SYNCHRONOUS for graphs with large cliques. */
+  COLOURED = 0,
+
+  /** Every node updates in parallel from the previous sweep's labels. A seeded half of the nodes update per sweep,
+   * which stops two-colour oscillations. A sweep that changes nothing is followed by one that evaluates every node,
+   * and clustering only stops early once that finds no node to change. Each sweep is a single parallel pass, whatever
+   * the cliques. */
+  SYNCHRONOUS
+};
+
+
+/**
+ * Parameters for the chinese_whispers function.
+ */
+struct chinese_whispers_parameters_t {
+  /** Maximum number of sweeps. Stops earlier once a sweep changes no labels. */
+  unsigned long max_iterations;
+
+  /** Seed for node ordering and tie breaking. */
+  uint64_t seed;
+
+  /** Sweep strategy. */
+  chinese_whispers_sweep_t sweep;
+
+  /** Number of threads. 0 uses one per hardware thread. */
+  unsigned int num_threads;
+
+  chinese_whispers_parameters_t()
+  {
+    max_iterations = 100;
+    seed = 0;
+    sweep = chinese_whispers_sweep_t::COLOURED;
+    num_threads = 0;
+  }
+};
+
+
+/**
+ * Undirected weighted graph in compressed sparse row form. Neighbours of node i are
+ * neighbours[offsets[i]] ... neighbours[offsets[i+1]-1]. Fewer than 2^32 nodes.
+ */
+struct csr_graph {
+  /** Start of each node's neighbour list. num_nodes() + 1 entries. */
+  std::vector<size_t> offsets;
+
+  /** Concatenated neighbour lists. */
+  std::vector<uint32_t> neighbours;
+
+  /** Edge weight for each entry in neighbours, or empty when every edge weighs 1. */
+  std::vector<float> weights;
+
+  /** \return Number of nodes. */
+  size_t num_nodes() const noexcept { return offsets.empty() ? 0 : offsets.size() - 1; }
+};
+
+
+// ## FUNCTION DECLARATIONS ###################################################
+
+/**
+ * Builds a CSR adjacency from an undirected edge list. Each edge is stored in both directions and self loops are
+ * dropped. Edge weights come from sample_pair::distance() (1 by default), as in dlib::chinese_whispers, and are left
+ * out when they are all 1.
+ * \param edges Edge list.
+ * \param num_nodes Number of nodes. Must be greater than every index in edges, and less than 2^32.
+ * \return The graph.
+ */
+csr_graph make_csr_graph(const std::vector<dlib::sample_pair>& edges, size_t num_nodes);
+
+
+/**
+ * Clusters a graph with Chinese whispers.
+ * \param graph Graph to cluster.
+ * \param labels Output. Cluster label for each node, numbered from 0 in order of each cluster's lowest node index.
+ * \param params Parameters.
+ * \return Number of clusters.
+ */
+unsigned long chinese_whispers(const csr_graph& graph, std::vector<unsigned long>& labels,
+  const chinese_whispers_parameters_t& params = chinese_whispers_parameters_t());
+
+
+/**
+ * Clusters a graph given as an edge list. Unlike dlib::chinese_whispers, nodes without edges still get their own
+ * label, so labels always has num_nodes entries.
+ * \param edges Edge list.
+ * \param num_nodes Number of nodes.
+ * \param labels Output. Cluster label for each node.
+ * \param params Parameters.
+ * \return Number of clusters.
+ */
+unsigned long chinese_whispers(const std::vector<dlib::sample_pair>& edges, size_t num_nodes,
+  std::vector<unsigned long>& labels, const chinese_whispers_parameters_t& params = chinese_whispers_parameters_t());
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_CHINESE_WHISPERS_H_
@@ -0,0 +1,190 @@
+/* CPU and NUMA topology discovery, and placement of worker threads on it.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_CPU_TOPOLOGY_H_
+#define _FACETOOLS_CPU_TOPOLOGY_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * How worker threads are placed on the CPUs.
+ */
+enum class placement_policy_t {
+  /** Threads are left to the scheduler. */
+  NONE = 0,
+
+  /** Threads fill one NUMA node before the next, one per physical core before the SMT siblings. A pipeline that fits
+   * in a node keeps its models, buffers and queue handoffs in that node's memory. */
+  COMPACT,
+
+  /** Consecutive threads go to different NUMA nodes, for the most memory bandwidth. Each thread's model replica and
+   * buffers are still local to it. */
+  SPREAD
+};
+
+
+/**
+ * A logical CPU.
+ */
+struct cpu_t {
+  /** CPU number, as used by the scheduler. */
+  unsigned int id;
+
+  /** Physical core id, unique within a package. SMT siblings share it. */
+  unsigned int core;
+
+  /** Physical package (socket) id. */
+  unsigned int package;
+
+  /** Index of the NUMA node, 0 to cpu_topology::num_nodes() - 1. */
+  unsigned int node;
+};
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * The CPUs of the machine, their cores, packages and NUMA nodes, as listed in /sys. Machines without NUMA, or
+ * without /sys, show up as a single node.
+ */
+class cpu_topology {
+public:
+  /**
+   * Discovers the topology.
+   * \param sys_root Directory holding the cpu and node directories of /sys/devices/system.
+   * \param allowed_only Whether to keep only the CPUs this process may run on.
+   */
+  explicit cpu_topology(const std::string& sys_root = "/sys/devices/system", bool allowed_only = true);
+
+
+  /**
+   * \return The CPUs, by id.
+   */
+  const std::vector<cpu_t>& cpus() const noexcept;
+
+
+  /**
+   * \return Number of NUMA nodes with CPUs.
+   */
+  unsigned int num_nodes() const noexcept;
+
+
+  /**
+   * \param node Node index.
+   * \return Ids of the CPUs of the node.
+   */
+  std::vector<unsigned int> node_cpus(unsigned int node) const;
+
+
+  /**
+   * Chooses a CPU for each of a number of worker threads. Workers beyond the CPU count wrap around.
+   * \param workers Number of workers.
+   * \param policy Placement policy.
+   * \return CPU id of each worker. Empty with placement_policy_t::NONE.
+   */
+  std::vector<unsigned int> place(unsigned int workers, placement_policy_t policy) const;
+
+
+  /**
+   * Parses a CPU list in the /sys format, such as "0-3,8,10-11".
+   * \param text CPU list.
+   * \param cpus Output. CPU ids, in list order.
+   * \return False if the text is malformed.
+   */
+  static bool parse_cpu_list(const std::string& text, std::vector<unsigned int>& cpus);
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** CPUs, by id. */
+  std::vector<cpu_t> cpus_;
+
+  /** Number of NUMA nodes. */
+  unsigned int num_nodes_;
+
+
+  /**
+   * Orders the CPUs of a node, the first thread of every core before the SMT siblings.
+   * \param node Node index.
+   * \return CPU ids.
+   */
+  std::vector<unsigned int> ordered_node_cpus_(unsigned int node) const;
+};
+
+
+// ## FUNCTIONS ###############################################################
+
+/**
+ * Restricts the calling thread to a set of CPUs. Threads it starts afterwards inherit the set.
+ * \param cpus CPU ids.
+ * \return False if the set was refused, in which case the thread is left as it was.
+ */
+bool pin_thread(const std::vector<unsigned int>& cpus);
+
+
+/**
+ * \param policy Placement policy name: none, compact or spread.
+ * \param placement Output. Placement policy.
+ * \return False if the name is unknown.
+ */
+bool parse_placement_policy(const std::string& policy, placement_policy_t& placement);
+
+
+/**
+ * Runs a function on a thread pinned to a CPU, and waits for it. Memory the function touches first is then
+ * allocated on that CPU's node, so it builds node local model replicas and buffers.
+ * \param cpu CPU id, or -1 to run the function on the calling thread.
+ * \param function Callable taking no arguments. Exceptions it throws are rethrown.
+ */
+template <typename function_t>
+void run_pinned(int cpu, function_t function)
+{
+  if(cpu < 0) {
+    function();
+    return;
+  }
+
+  std::exception_ptr error;
+  std::thread thread([&] {
+    pin_thread({unsigned(cpu)});
+
+    try {
+      function();
+    }
+    catch(...) {
+      error = std::current_exception();
+    }
+  });
+
+  thread.join();
+
+  if(error)
+    std::rethrow_exception(error);
+}
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_CPU_TOPOLOGY_H_
@@ -0,0 +1,196 @@
+/* Distance kernels for face embeddings.
+ * Squared L2 distances and dot products computed in place on contiguous float
+ * data, with AVX2 and AVX-512 versions selected at runtime and a portable
+ * scalar fallback.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_DISTANCE_H_
+#define _FACETOOLS_DISTANCE_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <cstddef>
+#include <cstdint>
+
+#include "face.h"
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+/**
+ * Relative slack on squared distances estimated from dot products, |a|^2 + |b|^2 - 2a.b, scaled by |a|^2 + |b|^2.
+ * Covers the rounding of the expansion, which loses precision when its terms nearly cancel. Pairs the estimate puts
+ * within the slack of a threshold need their distance checked exactly.
+ */
+const float DISTANCE_ESTIMATE_SLACK = 1e-4f;
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * Instruction set used by the distance kernels.
+ */
+enum class distance_kernel_t {
+  /** Portable C++ implementation. */
+  SCALAR = 0,
+
+  /** 256 bit AVX2 + FMA implementation. */
+  AVX2,
+
+  /** 512 bit AVX-512F implementation. */
+  AVX512
+};
+
+
+// ## FUNCTION DECLARATIONS ###################################################
+
+/**
+ * \return Kernel currently used by the distance functions. Defaults to the best one the CPU supports.
+ */
+distance_kernel_t get_distance_kernel() noexcept;
+
+
+/**
+ * \param kernel Kernel to check.
+ * \return Whether the CPU (and the compiler) supports the kernel.
+ */
+bool distance_kernel_supported(distance_kernel_t kernel) noexcept;
+
+
+/**
+ * Selects the kernel used by the distance functions. Mostly useful for testing and benchmarking.
+ * \param kernel Kernel to use. Throws if it is not supported.
+ */
+void set_distance_kernel(distance_kernel_t kernel);
+
+
+/**
+ * \param a First vector.
+ * \param b Second vector.
+ * \param dims Number of elements in each vector.
+ * \return Squared euclidean distance between a and b.
+ */
+float squared_distance(const float* a, const float* b, size_t dims) noexcept;
+
+
+/**
+ * \param a First vector.
+ * \param b Second vector.
+ * \param dims Number of elements in each vector.
+ * \return Dot product of a and b.
+ */
+float dot_product(const float* a, const float* b, size_t dims) noexcept;
+
+
+/**
+ * Checks whether two vectors are closer than a threshold. Stops early once a partial sum reaches the threshold.
+ * \param a First vector.
+ * \param b Second vector.
+ * \param dims Number of elements in each vector.
+ * \param squared_threshold Squared distance threshold.
+ * \return True if the squared distance is less than squared_threshold.
+ */
+bool within_squared_distance(const float* a, const float* b, size_t dims, float squared_threshold) noexcept;
+
+
+/**
+ * One-vs-many squared distances.
+ * \param query Query vector.
+ * \param rows Contiguous row-major block of num_rows vectors.
+ * \param num_rows Number of rows.
+ * \param dims Number of elements in each vector.
+ * \param distances Output, num_rows elements.
+ */
+void squared_distances(const float* query, const float* rows, size_t num_rows, size_t dims, float* distances) noexcept;
+
+
+/**
+ * One-vs-many dot products.
+ * \param query Query vector.
+ * \param rows Contiguous row-major block of num_rows vectors.
+ * \param num_rows Number of rows.
+ * \param dims Number of elements in each vector.
+ * \param products Output, num_rows elements.
+ */
+void dot_products(const float* query, const float* rows, size_t num_rows, size_t dims, float* products) noexcept;
+
+
+/**
+ * Many-vs-many squared distances, computed in cache sized tiles.
+ * \param queries Contiguous row-major block of num_queries vectors.
+ * \param num_queries Number of queries.
+ * \param rows Contiguous row-major block of num_rows vectors.
+ * \param num_rows Number of rows.
+ * \param dims Number of elements in each vector.
+ * \param distances Output, row-major num_queries x num_rows matrix.
+ */
+void pairwise_squared_distances(const float* queries, size_t num_queries, const float* rows, size_t num_rows,
+  size_t dims, float* distances) noexcept;
+
+
+/**
+ * Many-vs-many dot products, computed in cache sized tiles.
+ * \param queries Contiguous row-major block of num_queries vectors.
+ * \param num_queries Number of queries.
+ * \param rows Contiguous row-major block of num_rows vectors.
+ * \param num_rows Number of rows.
+ * \param dims Number of elements in each vector.
+ * \param products Output, row-major num_queries x num_rows matrix.
+ */
+void pairwise_dot_products(const float* queries, size_t num_queries, const float* rows, size_t num_rows,
+  size_t dims, float* products) noexcept;
+
+
+/**
+ * Converts IEEE 754 half precision values to single precision.
+ * \param in Half precision values.
+ * \param out Output, count elements.
+ * \param count Number of values.
+ */
+void half_to_float(const uint16_t* in, float* out, size_t count) noexcept;
+
+
+/**
+ * Converts single precision values to IEEE 754 half precision, rounding to nearest even. Values too large for half
+ * precision become infinities.
+ * \param in Single precision values.
+ * \param out Output, count elements.
+ * \param count Number of values.
+ */
+void float_to_half(const float* in, uint16_t* out, size_t count) noexcept;
+
+
+/**
+ * \param a First embedding.
+ * \param b Second embedding.
+ * \return Squared euclidean distance between the embeddings.
+ */
+float squared_distance(const embedding_t& a, const embedding_t& b);
+
+
+/**
+ * Allocation free replacement for dlib::length(a-b) < threshold.
+ * \param a First embedding.
+ * \param b Second embedding.
+ * \param threshold Distance threshold.
+ * \return True if the embeddings are closer than the threshold.
+ */
+bool within_distance(const embedding_t& a, const embedding_t& b, float threshold);
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_DISTANCE_H_
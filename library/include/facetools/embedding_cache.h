@@ -0,0 +1,146 @@
+/* Bounded LRU cache of face embeddings keyed by content hash, with an
+ * optional on-disk backing store.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_EMBEDDING_CACHE_H_
+#define _FACETOOLS_EMBEDDING_CACHE_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "face.h"
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * Thread safe LRU cache from a 64 bit key to an embedding. When a directory is given, entries are also written there
+ * (one small file per key) and memory misses fall back to it, so the cache survives between runs.
+ */
+class embedding_cache {
+public:
+  /**
+   * \param capacity Maximum number of entries kept in memory. Must be > 0.
+   * \param directory On-disk store. Empty for a memory only cache. Created if missing.
+   */
+  embedding_cache(size_t capacity, const std::string& directory = "");
+
+
+  /**
+   * Looks up an embedding, checking memory first and then the on-disk store.
+   * \param key Key.
+   * \param embedding Output. Set when found.
+   * \return Whether the key was found.
+   */
+  bool get(uint64_t key, embedding_t& embedding);
+
+
+  /**
+   * Stores an embedding, evicting the least recently used entry from memory if full.
+   * \param key Key.
+   * \param embedding Embedding to store.
+   */
+  void put(uint64_t key, const embedding_t& embedding);
+
+
+  /**
+   * \return Number of entries in memory.
+   */
+  size_t size() const;
+
+
+  /**
+   * \return Number of get calls that found the key.
+   */
+  size_t get_hits() const;
+
+
+  /**
+   * \return Number of get calls that did not find the key.
+   */
+  size_t get_misses() const;
+
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Most recently used entries first. */
+  using entry_list_t = std::list<std::pair<uint64_t, embedding_t>>;
+
+  /** Maximum number of entries in memory. */
+  size_t capacity_;
+
+  /** On-disk store. Empty when disabled. */
+  std::string directory_;
+
+  /** Entries in recency order. */
+  entry_list_t entries_;
+
+  /** Key to entry. */
+  std::unordered_map<uint64_t, entry_list_t::iterator> index_;
+
+  /** Statistics. */
+  size_t hits_;
+  size_t misses_;
+
+  /** Guards all of the above. */
+  mutable std::mutex mutex_;
+
+
+  /**
+   * Inserts or refreshes an entry in memory. Caller holds mutex_.
+   * \param key Key.
+   * \param embedding Embedding.
+   */
+  void insert_(uint64_t key, const embedding_t& embedding);
+
+
+  /**
+   * \param key Key.
+   * \return Path of the key's file in the on-disk store.
+   */
+  std::string file_name_(uint64_t key) const;
+
+
+  /**
+   * Reads an entry from the on-disk store.
+   * \param key Key.
+   * \param embedding Output. Set when found.
+   * \return Whether the entry was found and valid.
+   */
+  bool load_(uint64_t key, embedding_t& embedding) const;
+
+
+  /**
+   * Writes an entry to the on-disk store. Writes go to a temporary file that is renamed into place, so concurrent
+   * readers and writers never see a partial entry.
+   * \param key Key.
+   * \param embedding Embedding.
+   */
+  void save_(uint64_t key, const embedding_t& embedding) const;
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_EMBEDDING_CACHE_H_
@@ -0,0 +1,328 @@
+/* Memory-mapped flat index of face embeddings, with a streaming writer.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_EMBEDDING_INDEX_H_
+#define _FACETOOLS_EMBEDDING_INDEX_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "face.h"
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## ENUMERATIONS ############################################################
+
+/**
+ * How the embedding rows are stored.
+ */
+enum class index_element_t : uint32_t {
+  /** Single precision, read in place. */
+  FLOAT32 = 0,
+
+  /** Half precision: half the file size and memory traffic, converted to single precision while scanning. */
+  FLOAT16 = 1
+};
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * Where the embedding of a row came from.
+ */
+struct index_entry_t {
+  /** Source image file. */
+  std::string file;
+
+  /** Face box in the source image. */
+  dlib::rectangle box;
+
+  /** Index of the face in the source image. */
+  uint32_t face;
+
+  index_entry_t()
+  {
+    face = 0;
+  }
+};
+
+
+/**
+ * A row found by a query.
+ */
+struct index_match_t {
+  /** Row number. */
+  size_t row;
+
+  /** Euclidean distance to the query. */
+  float distance;
+};
+
+
+// ## CLASS DEFINITIONS #######################################################
+
+/**
+ * Writes an embedding index file. Rows are streamed to disk as they are added, the row table and file names are kept
+ * in memory until finish() writes them and the header. The file is built under a temporary name and renamed into
+ * place by finish(), so readers never see a partial index.
+ *
+ * File layout, little endian:
+ *   64 byte header: magic "FTEI", version, dims, element type, row count and the offsets of the sections below.
+ *   Rows: row count * dims elements, starting at offset 64, contiguous.
+ *   Table: one 32 byte record per row (file name offset and length, face index, box), 64 byte aligned.
+ *   Strings: the distinct file names, back to back.
+ */
+class embedding_index_writer {
+public:
+  /**
+   * \param file_name Index file to write.
+   * \param dims Embedding dimensions.
+   * \param element How rows are stored.
+   */
+  embedding_index_writer(const std::string& file_name, size_t dims = 128,
+    index_element_t element = index_element_t::FLOAT32);
+
+
+  /**
+   * Discards the temporary file if finish() was not called.
+   */
+  ~embedding_index_writer();
+
+
+  /**
+   * Appends a row.
+   * \param embedding Embedding of the face, dims elements.
+   * \param file Source image file.
+   * \param box Face box in the source image.
+   * \param face Index of the face in the source image.
+   */
+  void add(const embedding_t& embedding, const std::string& file, const dlib::rectangle& box, uint32_t face = 0);
+
+
+  /**
+   * Appends a row.
+   * \param embedding Embedding of the face, dims elements.
+   * \param file Source image file.
+   * \param box Face box in the source image.
+   * \param face Index of the face in the source image.
+   */
+  void add(const float* embedding, const std::string& file, const dlib::rectangle& box, uint32_t face = 0);
+
+
+  /**
+   * Writes the row table and header and moves the index into place. Nothing can be added afterwards.
+   */
+  void finish();
+
+
+  /**
+   * \return Number of rows added.
+   */
+  size_t size() const;
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Index file name. */
+  std::string file_name_;
+
+  /** Embedding dimensions. */
+  size_t dims_;
+
+  /** How rows are stored. */
+  index_element_t element_;
+
+  /** Temporary file the index is built in. */
+  std::ofstream file_;
+
+  /** Set by finish(). */
+  bool finished_;
+
+  /** Packed 32 byte table records. */
+  std::vector<char> table_;
+
+  /** Distinct file names, back to back. */
+  std::string strings_;
+
+  /** Offset of each file name in strings_. */
+  std::unordered_map<std::string, uint64_t> string_offsets_;
+
+  /** Half precision conversion buffer. */
+  std::vector<uint16_t> half_row_;
+
+
+  /**
+   * \return Name of the temporary file.
+   */
+  std::string temporary_name_() const;
+};
+
+
+/**
+ * Read only view of an embedding index file. The file is memory mapped and validated when opened, rows are scanned
+ * in place with the SIMD distance kernels, so a brute force query runs at memory bandwidth. Thread safe.
+ */
+class embedding_index {
+public:
+  /**
+   * Opens and validates an index file.
+   * \param file_name Index file written by embedding_index_writer.
+   */
+  explicit embedding_index(const std::string& file_name);
+
+
+  /**
+   * Unmaps the file.
+   */
+  ~embedding_index();
+
+
+  embedding_index(const embedding_index&) = delete;
+  embedding_index& operator=(const embedding_index&) = delete;
+
+
+  /**
+   * \return Number of rows.
+   */
+  size_t size() const;
+
+
+  /**
+   * \return Embedding dimensions.
+   */
+  size_t dims() const;
+
+
+  /**
+   * \return How rows are stored.
+   */
+  index_element_t element() const;
+
+
+  /**
+   * \param row Row number.
+   * \return Where the row came from.
+   */
+  index_entry_t get_entry(size_t row) const;
+
+
+  /**
+   * \param row Row number.
+   * \return Embedding of the row.
+   */
+  embedding_t get_embedding(size_t row) const;
+
+
+  /**
+   * Reads a row as single precision.
+   * \param row Row number.
+   * \param output Output, dims elements.
+   */
+  void get_row(size_t row, float* output) const;
+
+
+  /**
+   * Finds every row within a distance of the query.
+   * \param query Query embedding.
+   * \param threshold Largest euclidean distance of a match.
+   * \param num_threads Number of scanning threads. 0 means one per hardware thread.
+   * \return Matches, nearest first.
+   */
+  std::vector<index_match_t> search(const embedding_t& query, float threshold, unsigned int num_threads = 0) const;
+
+
+  /**
+   * Finds the rows nearest to the query.
+   * \param query Query embedding.
+   * \param k Number of rows to return.
+   * \param num_threads Number of scanning threads. 0 means one per hardware thread.
+   * \return Up to k matches, nearest first.
+   */
+  std::vector<index_match_t> nearest(const embedding_t& query, size_t k, unsigned int num_threads = 0) const;
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Index file name. */
+  std::string file_name_;
+
+  /** Mapped file. */
+  const char* data_;
+
+  /** Size of the mapping. */
+  size_t data_size_;
+
+  /** Number of rows. */
+  size_t size_;
+
+  /** Embedding dimensions. */
+  size_t dims_;
+
+  /** How rows are stored. */
+  index_element_t element_;
+
+  /** First row. */
+  const char* rows_;
+
+  /** First table record. */
+  const char* table_;
+
+  /** File names. */
+  const char* strings_;
+
+
+  /**
+   * Receives the squared distances from the query to a block of rows: (worker, first row, distances, row count).
+   */
+  typedef std::function<void(unsigned int, size_t, const float*, size_t)> scan_callback_t;
+
+
+  /**
+   * Computes the squared distances from the query to every row, one block at a time on a pool of threads.
+   * \param query Query embedding.
+   * \param num_threads Number of scanning threads, already resolved.
+   * \param callback Called once per block, from the worker that scanned it.
+   */
+  void scan_(const embedding_t& query, unsigned int num_threads, const scan_callback_t& callback) const;
+
+
+  /**
+   * Orders matches nearest first, ties by row.
+   */
+  static bool nearer_(const index_match_t& a, const index_match_t& b);
+
+
+  /**
+   * Merges the matches of the scanning threads.
+   * \param matches Matches of each thread, with squared distances.
+   * \param limit Maximum number of matches to keep.
+   * \return The nearest matches, sorted, with euclidean distances.
+   */
+  static std::vector<index_match_t> merge_matches_(const std::vector<std::vector<index_match_t>>& matches,
+    size_t limit);
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_EMBEDDING_INDEX_H_
@@ -40,6 +40,14 @@ bool expect_true(bool expression, std::string error_message) noexcept;
 void require_true(bool expression, std::string error_message);
 
 
+/**
+ * Same as above, for a literal message. Nothing is allocated unless the expression is false, so hot loops can check.
+ * \param expression Expression.
+ * \param error_message Error message.
+ */
+void require_true(bool expression, const char* error_message);
+
+
 } // NAMESPACE facetools
 
 #endif // _FACETOOLS_ERROR_H_
\ No newline at end of file
@@ -30,8 +30,11 @@
 #include <dlib/dnn.h>
 #include <dlib/image_io.h>
 #include <dlib/image_processing/frontal_face_detector.h>
+#include <cstdint>
+#include <memory>
 #include <string>
 
+#include "embedding_cache.h"
 #include "face.h"
 
 
@@ -93,9 +96,20 @@ struct face_recogniser_parameters_t {
   /** Path name for recogniser model. */
   std::string recogniser_model_file;
 
+  /** Number of threads used when clustering. 0 uses one per hardware thread. */
+  unsigned int num_threads;
+
+  /** Number of embeddings kept in the in-memory cache. 0 disables the cache. */
+  size_t embedding_cache_size;
+
+  /** Directory backing the embedding cache on disk. Empty keeps the cache in memory only. */
+  std::string embedding_cache_directory;
+
   face_recogniser_parameters_t()
   {
     recogniser_model_file = "dlib_face_recognition_resnet_model_v1.dat";
+    num_threads = 0;
+    embedding_cache_size = 0;
     jitter_images = false;
     face_difference_threshold = 0.4; /* Davis optimised for 0.6.  If you are looking at face clusters, then 0.4 might work better for minorities. */
   }
@@ -119,7 +133,7 @@ public:
 
 
   /**
-   * Get the embedding for the face specified.
+   * Get the embedding for the face specified. Served from the embedding cache when enabled and the same chip was seen.
    * \param input_face Face we want an embedding for.
    * \return 128 dimensional vector representing the face (embedding).
    */
@@ -127,7 +141,7 @@ public:
 
 
   /**
-   * Get the embedding for the list of faces specified.
+   * Get the embedding for the list of faces specified. Faces found in the embedding cache skip the network.
    * \param input_faces List of faces we want an embedding for.
    * \return List of 128 dimensional vectors representing the face (embedding).
    */
@@ -141,7 +155,8 @@ public:
 
 
   /**
-   * Gets a list of distinct people found in your image. The indexes are the same as the embedding list.
+   * Gets a list of distinct people found in your image. The indexes are the same as the embedding list. Clusters are
+   * reproducible: the same embeddings always give the same clusters, in order of each cluster's lowest face index.
    * \param embeddings List of face embeddings.
    * \return List of of embedding indices corresponding to faces.
    */
@@ -163,29 +178,25 @@ private:
   struct internal_parameters_t {
     float face_difference_threshold;
     bool jitter_images;
+    unsigned int num_threads;
   } params_;
 
   resnet_v1 recogniser_; /* Recogniser neural network. */
 
+  /** Embedding cache. Null when disabled. Shared between copies of the recogniser. */
+  std::shared_ptr<embedding_cache> cache_;
 
-  /**
-   * Gets the faces not assigned by the Chinese whispers algorithm.
-   * \param visited_face Status list for which face was visited (indexed by original face list).
-   * \param labels_size Number of face cluster labels assigned by Chinese whispers.
-   * \return Number of unassigned faces.
-   */
-  size_t chinese_whispers_get_unvisited_faces_(std::vector<bool>& visited_face, const size_t labels_size);
+  /** Hash of the model file, part of every cache key. */
+  uint64_t model_hash_;
 
 
   /**
-   * Add the unvisited faces to their own cluster.
-   * \param people List of identified faces to modify.
-   * \param visited_face Status list for which face was visited (indexed by original face list).
-   * \param faces_size Number of faces in original list.
-   * \param num_clusters Number of face clusters output by Chinese whispers.
+   * Computes the cache key of an aligned face: its chip pixels, the model and whether jitter is applied.
+   * \param input_face Aligned face.
+   * \param jitter Whether the embedding is jitter averaged.
+   * \return Cache key.
    */
-  void chinese_whispers_add_remaining_faces_(std::vector<facelist_t>& people, const std::vector<bool>& visited_face,
-    const size_t faces_size, const size_t num_clusters);
+  uint64_t cache_key_(const face& input_face, bool jitter) const;
 
 
   /**
@@ -0,0 +1,59 @@
+/* Fast non-cryptographic hashing used for cache keys.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_HASH_H_
+#define _FACETOOLS_HASH_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## FUNCTION DECLARATIONS ###################################################
+
+/**
+ * 64 bit hash of a block of memory. Stable across runs and platforms of the same endianness, so it can key on-disk
+ * caches. Not suitable where collisions could be chosen by an attacker.
+ * \param data Data to hash.
+ * \param size Size of the data in bytes.
+ * \param seed Seed, for chaining hashes or separating key spaces.
+ * \return Hash value.
+ */
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0) noexcept;
+
+
+/**
+ * Mixes a value into a hash.
+ * \param hash Hash so far.
+ * \param value Value to add.
+ * \return Combined hash.
+ */
+uint64_t hash_combine(uint64_t hash, uint64_t value) noexcept;
+
+
+/**
+ * Hashes the contents of a file.
+ * \param file_name File to hash. Throws if it can't be read.
+ * \return Hash value.
+ */
+uint64_t hash_file(const std::string& file_name);
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_HASH_H_
@@ -0,0 +1,287 @@
+/* Hierarchical navigable small world graph for approximate nearest neighbour
+ * queries over face embeddings.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_HNSW_INDEX_H_
+#define _FACETOOLS_HNSW_INDEX_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "embedding_index.h"
+#include "face.h"
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * HNSW index parameters.
+ */
+struct hnsw_parameters_t {
+  /** Links per node on the upper layers. The bottom layer allows twice as many. Higher means better recall, more
+   * memory and slower inserts. */
+  unsigned int M;
+
+  /** Candidate list size while inserting. Higher means a better graph and slower construction. */
+  unsigned int ef_construction;
+
+  /** Default candidate list size while querying, raised to k when smaller. Higher means better recall and slower
+   * queries. */
+  unsigned int ef_search;
+
+  /** Seed for the node levels. */
+  uint64_t seed;
+
+  /** Threads used by build(). 0 uses one per hardware thread. */
+  unsigned int num_threads;
+
+  hnsw_parameters_t()
+  {
+    M = 16;
+    ef_construction = 200;
+    ef_search = 64;
+    seed = 0;
+    num_threads = 0;
+  }
+};
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * Approximate nearest neighbour index (Malkov and Yashunin, HNSW). Nodes live on a stack of proximity graphs that
+ * get sparser towards the top; a query descends greedily through the upper layers and runs a best first search on
+ * the bottom one, visiting a few thousand nodes rather than the whole gallery.
+ *
+ * Queries are thread safe. Inserts are not, and must not run alongside queries; build() parallelises insertion
+ * internally.
+ */
+class hnsw_index {
+public:
+  /**
+   * Creates an empty index.
+   * \param dims Embedding dimensions.
+   * \param params Index parameters.
+   */
+  hnsw_index(size_t dims = 128, const hnsw_parameters_t& params = hnsw_parameters_t());
+
+
+  /**
+   * Inserts a batch of embeddings on params.num_threads threads. Node numbers continue from size(), in order.
+   * \param embeddings Embeddings to insert.
+   */
+  void build(const std::vector<embedding_t>& embeddings);
+
+
+  /**
+   * Inserts a batch of embeddings on params.num_threads threads. Node numbers continue from size(), in order.
+   * \param rows Contiguous row-major block of num_rows embeddings.
+   * \param num_rows Number of embeddings.
+   */
+  void build(const float* rows, size_t num_rows);
+
+
+  /**
+   * Inserts one embedding.
+   * \param embedding Embedding to insert.
+   * \return Node number of the embedding.
+   */
+  size_t insert(const embedding_t& embedding);
+
+
+  /**
+   * Finds the approximate k nearest nodes.
+   * \param query Query embedding.
+   * \param k Number of nodes to return.
+   * \param ef Candidate list size. 0 uses params.ef_search.
+   * \return Up to k matches, nearest first, with euclidean distances.
+   */
+  std::vector<index_match_t> knn(const embedding_t& query, size_t k, size_t ef = 0) const;
+
+
+  /**
+   * Finds the nodes within a distance of the query. The candidate list grows until its farthest member is out of
+   * range, so dense neighbourhoods are returned whole.
+   * \param query Query embedding.
+   * \param threshold Largest euclidean distance of a match.
+   * \param ef Initial candidate list size. 0 uses params.ef_search.
+   * \return Matches, nearest first, with euclidean distances.
+   */
+  std::vector<index_match_t> radius(const embedding_t& query, float threshold, size_t ef = 0) const;
+
+
+  /**
+   * \param node Node number.
+   * \return Embedding of the node.
+   */
+  embedding_t get_embedding(size_t node) const;
+
+
+  /**
+   * \return Number of nodes.
+   */
+  size_t size() const;
+
+
+  /**
+   * \return Embedding dimensions.
+   */
+  size_t dims() const;
+
+
+  /**
+   * Writes the index to a file.
+   * \param file_name Output file.
+   */
+  void save(const std::string& file_name) const;
+
+
+  /**
+   * Replaces the index with one read from a file. Dimensions and M come from the file.
+   * \param file_name File written by save().
+   */
+  void load(const std::string& file_name);
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Candidate node and its squared distance to the query. */
+  typedef std::pair<float, uint32_t> candidate_t;
+
+  /** Parameters. */
+  hnsw_parameters_t params_;
+
+  /** Embedding dimensions. */
+  size_t dims_;
+
+  /** Number of nodes. */
+  size_t size_;
+
+  /** Embeddings, row-major, one row per node. */
+  std::vector<float> data_;
+
+  /** Top layer of each node. */
+  std::vector<uint8_t> levels_;
+
+  /** Links of each node, one list per layer from the bottom up. */
+  std::vector<std::vector<std::vector<uint32_t>>> links_;
+
+  /** Per node locks for concurrent inserts, one per reserved node. */
+  std::unique_ptr<std::mutex[]> node_mutexes_;
+
+  /** Number of node locks. */
+  size_t reserved_;
+
+  /** Guards entry_point_ and max_level_ during concurrent inserts. */
+  std::mutex entry_mutex_;
+
+  /** Node the searches start from, on the top layer. */
+  uint32_t entry_point_;
+
+  /** Top layer of the graph, -1 when empty. */
+  int max_level_;
+
+
+  /**
+   * Makes room for more nodes. Not thread safe.
+   * \param capacity Number of nodes.
+   */
+  void reserve_(size_t capacity);
+
+
+  /**
+   * \param node Node number.
+   * \return Layer a node reaches, drawn from the seeded exponential distribution.
+   */
+  int random_level_(size_t node) const;
+
+
+  /**
+   * Links an already stored node into the graph. Safe to call concurrently for different nodes.
+   * \param node Node number.
+   */
+  void insert_(uint32_t node);
+
+
+  /**
+   * Best first search of one layer.
+   * \param query Query, dims elements.
+   * \param entry Node to start from.
+   * \param ef Candidate list size.
+   * \param level Layer to search.
+   * \param lock Whether other threads may be changing links.
+   * \return Up to ef nearest nodes found, in no particular order.
+   */
+  std::vector<candidate_t> search_layer_(const float* query, uint32_t entry, size_t ef, int level, bool lock) const;
+
+
+  /**
+   * Greedy descent through the upper layers.
+   * \param query Query, dims elements.
+   * \param entry Node to start from.
+   * \param from_level Layer to start on.
+   * \param to_level Layer to stop on.
+   * \param lock Whether other threads may be changing links.
+   * \return Nearest node found on to_level.
+   */
+  uint32_t descend_(const float* query, uint32_t entry, int from_level, int to_level, bool lock) const;
+
+
+  /**
+   * Picks up to max_links diverse neighbours among candidates: a candidate is kept only if it is closer to the base
+   * node than to every neighbour already kept, which preserves links across clusters. Spare slots are then filled
+   * with the nearest rejected candidates, so tight clusters of faces do not leave nodes unreachable.
+   * \param candidates Candidates with their squared distances to the base node.
+   * \param max_links Most neighbours to keep.
+   * \return Chosen neighbours.
+   */
+  std::vector<uint32_t> select_neighbours_(std::vector<candidate_t> candidates, size_t max_links) const;
+
+
+  /**
+   * Adds a link, pruning the node's links back to the layer's limit. Caller holds the node lock.
+   * \param node Node to link from.
+   * \param neighbour Node to link to.
+   * \param level Layer of the link.
+   */
+  void add_link_(uint32_t node, uint32_t neighbour, int level);
+
+
+  /**
+   * \param level Layer.
+   * \return Most links a node may have on the layer.
+   */
+  size_t max_links_(int level) const;
+
+
+  /**
+   * \param node Node number.
+   * \return Embedding of the node, dims elements.
+   */
+  const float* row_(uint32_t node) const;
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_HNSW_INDEX_H_
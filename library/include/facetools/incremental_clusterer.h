@@ -0,0 +1,231 @@
+/* Incremental face clustering.
+ * Keeps cluster assignments and representative embeddings between calls, so
+ * new faces can be added to an existing gallery without reclustering it.
+ * Each batch is compared with the cluster representatives; only clusters
+ * that gain an edge to a new face are reclustered (with Chinese whispers)
+ * together with the batch, which lets them merge or split locally.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_INCREMENTAL_CLUSTERER_H_
+#define _FACETOOLS_INCREMENTAL_CLUSTERER_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "face.h"
+#include "face_recogniser.h"
+#include "hnsw_index.h"
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * Parameters for the incremental_clusterer class.
+ */
+struct incremental_clusterer_parameters_t {
+  /** Two faces closer than this are connected in the clustering graph. Same meaning as in face_recogniser. */
+  float face_difference_threshold;
+
+  /** Seed for the Chinese whispers passes. */
+  uint64_t seed;
+
+  /** Number of threads. 0 uses one per hardware thread. */
+  unsigned int num_threads;
+
+  /** Number of clusters from which new faces find the clusters near them through an HNSW index of the
+   * representatives. Below it, a batch is checked against every representative with a few blocked matrix products,
+   * exactly. The index is approximate: a cluster it misses is left alone, as if the face were farther from it. */
+  size_t index_clusters;
+
+  incremental_clusterer_parameters_t()
+  {
+    face_difference_threshold = 0.4;
+    seed = 0;
+    num_threads = 0;
+    index_clusters = 65536;
+  }
+};
+
+
+/**
+ * A face's cluster after a batch was added.
+ */
+struct cluster_assignment_t {
+  /** Face index, in the order faces were added. */
+  unsigned int face;
+
+  /** Cluster identifier. Identifiers are stable: a cluster keeps its identifier while it exists. */
+  unsigned long cluster;
+};
+
+
+// ## CLASS DEFINITION ########################################################
+
+class incremental_clusterer {
+public:
+  /**
+   * \param params Parameters to use.
+   */
+  incremental_clusterer(const incremental_clusterer_parameters_t& params);
+
+
+  /**
+   * Adds a batch of faces. New faces join existing clusters, start new ones, or cause the clusters they connect to
+   * be reclustered. Cost depends on the batch, the number of clusters and the size of the clusters it touches, not on
+   * the total number of faces. The clusters cost one short product per face and representative, until there are
+   * index_clusters of them, then a logarithmic search per face.
+   * \param embeddings Embeddings of the new faces. Their face indices continue from size().
+   * \return Assignments that changed, sorted by face. Always includes every new face.
+   */
+  std::vector<cluster_assignment_t> add(const std::vector<embedding_t>& embeddings);
+
+
+  /**
+   * \param face Face index.
+   * \return Cluster the face belongs to.
+   */
+  unsigned long get_cluster(unsigned int face) const;
+
+
+  /**
+   * \param cluster Cluster identifier.
+   * \return Faces in the cluster. Empty if the cluster was merged into another one.
+   */
+  const facelist_t& get_members(unsigned long cluster) const;
+
+
+  /**
+   * \return Lists of faces, one per non-empty cluster, in cluster identifier order. Same layout as
+   * face_recogniser::get_people.
+   */
+  std::vector<facelist_t> get_people() const;
+
+
+  /**
+   * \param cluster Cluster identifier.
+   * \return Mean embedding of the cluster's faces.
+   */
+  embedding_t get_representative(unsigned long cluster) const;
+
+
+  /**
+   * \return Number of non-empty clusters.
+   */
+  size_t num_clusters() const noexcept;
+
+
+  /**
+   * \return Number of faces added so far.
+   */
+  size_t size() const noexcept;
+
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Cluster state. */
+  struct cluster_t {
+    /** Member faces. */
+    facelist_t members;
+
+    /** Mean of the member embeddings. */
+    std::vector<float> representative;
+
+    /** Largest distance from the representative to a member. */
+    float radius;
+
+    /** Node of the representative in index_. */
+    size_t node;
+  };
+
+  /** See incremental_clusterer_parameters_t. */
+  incremental_clusterer_parameters_t params_;
+
+  /** Embedding size. Set by the first batch. */
+  size_t dims_;
+
+  /** All embeddings, row-major. */
+  std::vector<float> rows_;
+
+  /** Cluster of each face. */
+  std::vector<unsigned long> labels_;
+
+  /** Clusters by identifier. */
+  std::vector<cluster_t> clusters_;
+
+  /** Number of non-empty clusters. */
+  size_t num_clusters_;
+
+  /** Radii of the non-empty clusters. The largest bounds how far a representative may be from a face it touches. */
+  std::multiset<float> radii_;
+
+  /** Representatives of the non-empty clusters, once there are params_.index_clusters of them. Null before. */
+  std::unique_ptr<hnsw_index> index_;
+
+  /** Cluster of each node of index_. NO_CLUSTER once the cluster has moved on: nodes cannot be removed, so an updated
+   * representative is inserted again. */
+  std::vector<unsigned long> node_clusters_;
+
+  /** Number of nodes of index_ whose cluster moved on. */
+  size_t stale_nodes_;
+
+
+  /**
+   * Finds the clusters whose representative may be within threshold + radius of each face: through index_, within
+   * threshold + the largest radius, when it exists, and otherwise from blocked matrix products of the faces with
+   * every representative, with the slack their rounding needs.
+   * \param faces Contiguous row-major block of num_faces face rows.
+   * \param num_faces Number of faces.
+   * \return Candidate cluster identifiers of each face, sorted.
+   */
+  std::vector<std::vector<unsigned long>> find_candidate_clusters_(const float* faces, size_t num_faces) const;
+
+
+  /**
+   * Finds the clusters with at least one member closer than the threshold to a face. A cluster is only scanned when
+   * the face is within threshold + radius of its representative.
+   * \param face Face row.
+   * \param candidates Clusters to check, from find_candidate_clusters_.
+   * \return Cluster identifiers.
+   */
+  std::vector<unsigned long> find_touched_clusters_(const float* face, const std::vector<unsigned long>& candidates)
+    const;
+
+
+  /**
+   * Recomputes a cluster's representative and radius from its members.
+   * \param cluster Cluster to update.
+   */
+  void update_cluster_(cluster_t& cluster);
+
+
+  /**
+   * Brings the representative index up to date with the clusters a batch changed. Builds it when the clusters reach
+   * params_.index_clusters, and rebuilds it once most of its nodes are stale.
+   * \param affected Clusters whose representative changed.
+   */
+  void update_index_(const std::vector<unsigned long>& affected);
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_INCREMENTAL_CLUSTERER_H_
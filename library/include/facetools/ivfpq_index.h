@@ -0,0 +1,210 @@
+/* Inverted file index with product quantised codes, for galleries too large
+ * to hold as float embeddings.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_IVFPQ_INDEX_H_
+#define _FACETOOLS_IVFPQ_INDEX_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "embedding_index.h"
+#include "face.h"
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * IVF-PQ index parameters.
+ */
+struct ivfpq_parameters_t {
+  /** Number of coarse clusters (inverted lists). Around the square root of the gallery size works well. */
+  unsigned int num_lists;
+
+  /** Number of sub-quantisers, which is also the code size in bytes. Must divide the dimensions. */
+  unsigned int code_size;
+
+  /** Lloyd iterations when training the coarse clusters and the codebooks. */
+  unsigned int training_iterations;
+
+  /** Default number of inverted lists scanned per query. */
+  unsigned int num_probes;
+
+  /** Default number of candidates re-ranked with exact distances when a store is given. */
+  unsigned int rerank;
+
+  /** Seed for the k-means initialisation. */
+  uint64_t seed;
+
+  /** Number of threads. 0 uses one per hardware thread. */
+  unsigned int num_threads;
+
+  ivfpq_parameters_t()
+  {
+    num_lists = 1024;
+    code_size = 16;
+    training_iterations = 20;
+    num_probes = 16;
+    rerank = 100;
+    seed = 0;
+    num_threads = 0;
+  }
+};
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * Approximate nearest neighbour index for very large galleries. A coarse k-means splits the embeddings into inverted
+ * lists, and each embedding is stored in its list as the product quantised code of its residual from the list
+ * centroid: code_size bytes plus a 4 byte row number instead of 512 bytes of floats. A query scans the lists nearest
+ * to it, scoring codes with per subspace distance tables (asymmetric distance computation), and the best candidates
+ * are re-ranked with exact distances read from an embedding_index, where row numbers point.
+ *
+ * Queries are thread safe. Training and adding are not.
+ */
+class ivfpq_index {
+public:
+  /**
+   * Creates an untrained index.
+   * \param dims Embedding dimensions.
+   * \param params Index parameters.
+   */
+  ivfpq_index(size_t dims = 128, const ivfpq_parameters_t& params = ivfpq_parameters_t());
+
+
+  /**
+   * Trains the coarse clusters and the codebooks on a sample of the gallery. Clears the index.
+   * \param sample Contiguous row-major block of num_rows embeddings. At least num_lists and 256 rows.
+   * \param num_rows Number of embeddings.
+   */
+  void train(const float* sample, size_t num_rows);
+
+
+  /**
+   * Trains the coarse clusters and the codebooks on a sample of the gallery. Clears the index.
+   * \param sample Embeddings. At least num_lists and 256 of them.
+   */
+  void train(const std::vector<embedding_t>& sample);
+
+
+  /**
+   * Encodes and adds embeddings.
+   * \param rows Contiguous row-major block of num_rows embeddings.
+   * \param num_rows Number of embeddings.
+   * \param first_row Row number of the first embedding, usually its row in the store searches re-rank from.
+   */
+  void add(const float* rows, size_t num_rows, size_t first_row);
+
+
+  /**
+   * Encodes and adds every embedding of a store, keeping their row numbers.
+   * \param store Embeddings to add.
+   */
+  void add(const embedding_index& store);
+
+
+  /**
+   * Finds the approximate k nearest embeddings.
+   * \param query Query embedding.
+   * \param k Number of matches to return.
+   * \param store Store to read exact embeddings from for re-ranking, or nullptr to rank by code distances alone.
+   * \param num_probes Number of inverted lists to scan. 0 uses params.num_probes.
+   * \param rerank Number of candidates to re-rank, at least k. 0 uses params.rerank.
+   * \return Up to k matches, nearest first. Distances are exact when re-ranked, approximate otherwise.
+   */
+  std::vector<index_match_t> search(const embedding_t& query, size_t k, const embedding_index* store = nullptr,
+    size_t num_probes = 0, size_t rerank = 0) const;
+
+
+  /**
+   * \return Whether train() has been called.
+   */
+  bool trained() const;
+
+
+  /**
+   * \return Number of embeddings added.
+   */
+  size_t size() const;
+
+
+  /**
+   * Writes the trained quantisers and the lists to a file.
+   * \param file_name Output file.
+   */
+  void save(const std::string& file_name) const;
+
+
+  /**
+   * Replaces the index with one read from a file. Dimensions, list count and code size come from the file.
+   * \param file_name File written by save().
+   */
+  void load(const std::string& file_name);
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Parameters. */
+  ivfpq_parameters_t params_;
+
+  /** Embedding dimensions. */
+  size_t dims_;
+
+  /** Dimensions of each sub-quantiser. */
+  size_t sub_dims_;
+
+  /** Number of embeddings added. */
+  size_t size_;
+
+  /** Coarse centroids, num_lists x dims. */
+  std::vector<float> centroids_;
+
+  /** Codebooks, code_size x 256 x sub_dims. */
+  std::vector<float> codebooks_;
+
+  /** Row number of each embedding, per list. */
+  std::vector<std::vector<uint32_t>> list_rows_;
+
+  /** Codes of each embedding, code_size bytes each, per list. */
+  std::vector<std::vector<uint8_t>> list_codes_;
+
+
+  /**
+   * Finds the nearest coarse centroid of each row.
+   * \param rows Contiguous row-major block of num_rows embeddings.
+   * \param num_rows Number of embeddings.
+   * \param lists Output, num_rows elements.
+   */
+  void assign_(const float* rows, size_t num_rows, uint32_t* lists) const;
+
+
+  /**
+   * Product quantises a residual.
+   * \param residual Residual from the list centroid, dims elements.
+   * \param code Output, code_size bytes.
+   */
+  void encode_(const float* residual, uint8_t* code) const;
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_IVFPQ_INDEX_H_
@@ -0,0 +1,53 @@
+/* JPEG decoding from memory, for images whose bytes are already loaded, such
+ * as EXIF thumbnails and files read ahead of the decoder.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_JPEG_DECODER_H_
+#define _FACETOOLS_JPEG_DECODER_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+#include <cstddef>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## FUNCTION DECLARATIONS ###################################################
+
+/**
+ * \param data File contents, or at least their first two bytes.
+ * \param size Size of the data in bytes.
+ * \return Whether the data starts like a JPEG stream.
+ */
+inline bool is_jpeg(const unsigned char* data, size_t size) noexcept
+{
+  return size >= 2 && data[0] == 0xff && data[1] == 0xd8;
+}
+
+
+/**
+ * Decodes a JPEG held in memory with libjpeg, as dlib::load_image would decode the same file.
+ * \param data JPEG stream.
+ * \param size Size of the stream in bytes.
+ * \param image Output. Decoded image.
+ * \return False if the stream could not be decoded. Nothing is printed.
+ */
+bool decode_jpeg(const unsigned char* data, size_t size, dlib::matrix<dlib::rgb_pixel>& image);
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_JPEG_DECODER_H_
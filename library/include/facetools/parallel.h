@@ -0,0 +1,173 @@
+/* Small threading helpers shared by the facetools algorithms.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_PARALLEL_H_
+#define _FACETOOLS_PARALLEL_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## INLINE FUNCTIONS ########################################################
+
+/**
+ * Resolves a requested thread count.
+ * \param requested Requested number of threads. 0 means one per hardware thread.
+ * \return Number of threads to use (at least 1).
+ */
+inline unsigned int resolve_thread_count(unsigned int requested) noexcept
+{
+  if(requested)
+    return requested;
+
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+/**
+ * Calls function(worker, index) for every index in [begin, end). Indices are handed out dynamically, one at a time, so
+ * uneven work items balance across threads. The calling thread takes part as worker 0. The first exception thrown by
+ * a worker is rethrown once every thread has finished.
+ * \param begin First index.
+ * \param end One past the last index.
+ * \param num_threads Number of threads to use. 0 means one per hardware thread.
+ * \param function Callable taking (unsigned int worker, size_t index).
+ */
+template <typename function_t>
+void parallel_for(size_t begin, size_t end, unsigned int num_threads, function_t function)
+{
+  if(begin >= end)
+    return;
+
+  unsigned int workers = std::min<size_t>(resolve_thread_count(num_threads), end - begin);
+  std::atomic<size_t> next(begin);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto work = [&](unsigned int worker) {
+    try {
+      for(size_t i = next++; i < end; i = next++)
+        function(worker, i);
+    }
+    catch(...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if(!error)
+        error = std::current_exception();
+      next = end;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for(unsigned int worker = 1; worker < workers; ++worker)
+    threads.emplace_back(work, worker);
+
+  work(0);
+
+  for(auto& thread : threads)
+    thread.join();
+
+  if(error)
+    std::rethrow_exception(error);
+}
+
+
+/**
+ * Runs function(worker) on exactly num_threads threads (the calling thread is worker 0), for algorithms that
+ * synchronise their workers with a barrier. The first exception thrown by a worker is rethrown after all finish.
+ * Workers that wait on a barrier must not throw.
+ * \param num_threads Number of threads. 0 means one per hardware thread.
+ * \param function Callable taking (unsigned int worker).
+ */
+template <typename function_t>
+void run_on_threads(unsigned int num_threads, function_t function)
+{
+  unsigned int workers = resolve_thread_count(num_threads);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto work = [&](unsigned int worker) {
+    try {
+      function(worker);
+    }
+    catch(...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if(!error)
+        error = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for(unsigned int worker = 1; worker < workers; ++worker)
+    threads.emplace_back(work, worker);
+
+  work(0);
+
+  for(auto& thread : threads)
+    thread.join();
+
+  if(error)
+    std::rethrow_exception(error);
+}
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * Reusable barrier for a fixed number of threads. Waiting threads spin and yield, which suits the short phases of
+ * the iterative algorithms that use it.
+ */
+class spin_barrier {
+public:
+  /**
+   * \param count Number of threads that must call wait() before any of them returns.
+   */
+  explicit spin_barrier(unsigned int count) noexcept : count_(count), waiting_(0), generation_(0) {}
+
+
+  /**
+   * Blocks until count threads have called wait().
+   */
+  void wait() noexcept
+  {
+    unsigned int generation = generation_.load(std::memory_order_acquire);
+
+    if(waiting_.fetch_add(1, std::memory_order_acq_rel) + 1 == count_) {
+      waiting_.store(0, std::memory_order_relaxed);
+      generation_.fetch_add(1, std::memory_order_release);
+      return;
+    }
+
+    while(generation_.load(std::memory_order_acquire) == generation)
+      std::this_thread::yield();
+  }
+
+private:
+  const unsigned int count_;
+  std::atomic<unsigned int> waiting_;
+  std::atomic<unsigned int> generation_;
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_PARALLEL_H_
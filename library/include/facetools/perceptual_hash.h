@@ -0,0 +1,123 @@
+/* Perceptual image hashes for spotting re-encoded and resized copies of the
+ * same photo.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_PERCEPTUAL_HASH_H_
+#define _FACETOOLS_PERCEPTUAL_HASH_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## FUNCTION DECLARATIONS ###################################################
+
+/**
+ * Difference hash (dHash) of an image. The image is averaged down to a 9 x 8 grey thumbnail and each bit records
+ * whether a thumbnail pixel is darker than its right neighbour, so the hash survives scaling, recompression and small
+ * colour changes, but not crops, flips or rotations.
+ * \param image Image to hash.
+ * \return 64 bit hash, row by row from the top left. 0 for an empty image.
+ */
+uint64_t difference_hash(const dlib::matrix<dlib::rgb_pixel>& image) noexcept;
+
+
+/**
+ * \param a First hash.
+ * \param b Second hash.
+ * \return Number of bits that differ.
+ */
+inline unsigned int hamming_distance(uint64_t a, uint64_t b) noexcept
+{
+  return __builtin_popcountll(a ^ b);
+}
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * Finds stored hashes within a Hamming radius of a query (multi-index hashing). Hashes are split into radius + 1
+ * chunks and each chunk indexed exactly; by the pigeonhole principle a hash within the radius matches the query on at
+ * least one chunk, so a query looks up radius + 1 buckets instead of scanning every hash.
+ *
+ * Not thread safe.
+ */
+class perceptual_hash_index {
+public:
+  /**
+   * Creates an empty index.
+   * \param radius Largest Hamming distance of a match, below 64.
+   */
+  explicit perceptual_hash_index(unsigned int radius = 4);
+
+
+  /**
+   * Adds a hash.
+   * \param hash Hash to add.
+   * \param id Caller's identifier, returned by find().
+   */
+  void insert(uint64_t hash, size_t id);
+
+
+  /**
+   * Finds the stored hash closest to a query, within the radius. Ties go to the hash inserted first.
+   * \param hash Query.
+   * \param id Output. Identifier of the match.
+   * \return Whether a match was found.
+   */
+  bool find(uint64_t hash, size_t& id) const;
+
+
+  /**
+   * \return Number of hashes stored.
+   */
+  size_t size() const noexcept;
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Largest Hamming distance of a match. */
+  unsigned int radius_;
+
+  /** First bit and width of each chunk. */
+  std::vector<std::pair<unsigned int, unsigned int>> chunks_;
+
+  /** Stored hashes and their identifiers, in insertion order. */
+  std::vector<std::pair<uint64_t, size_t>> hashes_;
+
+  /** Positions in hashes_ for each value of each chunk. */
+  std::vector<std::unordered_map<uint64_t, std::vector<size_t>>> tables_;
+
+
+  /**
+   * \param hash Hash.
+   * \param chunk Chunk number.
+   * \return Bits of the chunk.
+   */
+  uint64_t chunk_(uint64_t hash, size_t chunk) const noexcept;
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_PERCEPTUAL_HASH_H_
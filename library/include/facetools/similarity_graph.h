@@ -0,0 +1,116 @@
+/* Similarity graph construction for face clustering.
+ * Finds every pair of embeddings closer than a threshold using a blocked,
+ * multi-threaded pass that computes distance tiles from dot products
+ * (|a-b|^2 = |a|^2 + |b|^2 - 2a.b).
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_SIMILARITY_GRAPH_H_
+#define _FACETOOLS_SIMILARITY_GRAPH_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <dlib/clustering.h>
+#include <string>
+#include <vector>
+
+#include "chinese_whispers.h"
+#include "face.h"
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * Parameters for building a similarity graph out of core.
+ */
+struct similarity_graph_parameters_t {
+  /** Distance threshold. */
+  float threshold;
+
+  /** Bytes of edges held in memory while the pairs are searched, at 8 bytes an edge. Edges beyond it are spilled to
+   * disk. The finished graph is not counted: it takes another 8 bytes an edge and 8 bytes a node, plus 8 bytes a node
+   * while it is filled. Edges that stayed in memory fit in the budget, so peak memory is at most the budget plus the
+   * graph, and once any were spilled, all are, leaving about the larger of the two. */
+  size_t memory_budget;
+
+  /** Directory for the spill file. The file is unlinked as soon as it is created. */
+  std::string spill_directory;
+
+  /** Number of threads. 0 uses one per hardware thread. */
+  unsigned int num_threads;
+
+  similarity_graph_parameters_t()
+  {
+    threshold = 0.6;
+    memory_budget = size_t(1) << 30;
+    spill_directory = "/tmp";
+    num_threads = 0;
+  }
+};
+
+
+// ## FUNCTION DECLARATIONS ###################################################
+
+/**
+ * Finds all pairs of embeddings closer than the threshold. The result is identical to, and in the same order as, a
+ * serial double loop over i < j.
+ * \param embeddings List of embeddings. All must have the same size.
+ * \param threshold Distance threshold.
+ * \param num_threads Number of threads to use. 0 means one per hardware thread.
+ * \return List of edges (i, j) with i < j, sorted by i then j.
+ */
+std::vector<dlib::sample_pair> find_similar_pairs(const std::vector<embedding_t>& embeddings, float threshold,
+  unsigned int num_threads = 0);
+
+
+/**
+ * Finds all pairs of rows closer than the threshold.
+ * \param rows Contiguous row-major block of num_rows vectors.
+ * \param num_rows Number of rows.
+ * \param dims Number of elements in each row.
+ * \param threshold Distance threshold.
+ * \param num_threads Number of threads to use. 0 means one per hardware thread.
+ * \return List of edges (i, j) with i < j, sorted by i then j.
+ */
+std::vector<dlib::sample_pair> find_similar_pairs(const float* rows, size_t num_rows, size_t dims, float threshold,
+  unsigned int num_threads = 0);
+
+
+/**
+ * Builds the graph linking every pair of rows closer than the threshold, for galleries whose edge lists outgrow
+ * memory. Edges are found by the same blocked pass as find_similar_pairs but stored as two 32 bit node numbers, and
+ * written to a spill file whenever they pass the memory budget; the graph is then built in two streaming passes over
+ * them. The graph equals make_csr_graph(find_similar_pairs(...)).
+ * \param rows Contiguous row-major block of num_rows vectors. Fewer than 2^32 rows.
+ * \param num_rows Number of rows.
+ * \param dims Number of elements in each row.
+ * \param params Threshold, memory budget and spill location.
+ * \return Graph with num_rows nodes, unit weights (so no weights stored) and each neighbour list sorted.
+ */
+csr_graph build_similarity_graph(const float* rows, size_t num_rows, size_t dims,
+  const similarity_graph_parameters_t& params = similarity_graph_parameters_t());
+
+
+/**
+ * Copies embeddings into a contiguous row-major float block.
+ * \param embeddings List of embeddings. All must have the same size.
+ * \return Packed rows (embeddings.size() x dims).
+ */
+std::vector<float> pack_embeddings(const std::vector<embedding_t>& embeddings);
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_SIMILARITY_GRAPH_H_
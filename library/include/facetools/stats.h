@@ -0,0 +1,328 @@
+/* Low overhead counters and latency histograms of the detection, recognition and search stages.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_STATS_H_
+#define _FACETOOLS_STATS_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+/** Number of latency histogram buckets. Bucket i counts the times of 2^i to 2^(i+1) - 1 nanoseconds. */
+const unsigned int STAT_HISTOGRAM_BUCKETS = 64;
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * Things counted.
+ */
+enum class stat_counter_t {
+  /** Image files taken in by the search pipeline, whether decoded or not. */
+  IMAGES = 0,
+
+  /** Bytes of image files read. */
+  BYTES_READ,
+
+  /** Faces detected. */
+  FACES,
+
+  /** Embeddings computed by the network. */
+  EMBEDDINGS,
+
+  /** Embeddings served by the embedding cache. */
+  EMBEDDING_CACHE_HITS,
+
+  /** Image files whose faces came from the search cache. */
+  SEARCH_CACHE_HITS,
+
+  /** Images given the faces of an earlier copy of them. */
+  DUPLICATES,
+
+  /** JPEGs skipped because their thumbnail shows no face. */
+  THUMBNAIL_SKIPS,
+
+  /** Image files matching a face template. */
+  MATCHES,
+
+  /** Number of counters. */
+  COUNT
+};
+
+
+/**
+ * Stages timed.
+ */
+enum class stat_timer_t {
+  /** Image file decoding, including the read when not read ahead. */
+  DECODE = 0,
+
+  /** Shrinking large images before detection. */
+  DOWNSCALE,
+
+  /** Upsampling small images before detection. */
+  PYRAMID_UP,
+
+  /** Face detection proper, HOG or MMOD. */
+  DETECT,
+
+  /** Facial landmark prediction. */
+  SHAPE_PREDICT,
+
+  /** Aligned face chip extraction. */
+  CHIP_EXTRACT,
+
+  /** Embedding network calls, whatever their batch size. */
+  EMBED,
+
+  /** Scoring embeddings against the face templates. */
+  MATCH,
+
+  /** EXIF thumbnail face checks. */
+  THUMBNAIL_CHECK,
+
+  /** Perceptual hashing of images, for duplicate detection. */
+  PERCEPTUAL_HASH,
+
+  /** Number of timers. */
+  COUNT
+};
+
+
+/**
+ * Aggregated times of one stage.
+ */
+struct timer_stats_t {
+  /** Number of times the stage ran. */
+  uint64_t count;
+
+  /** Sum of the times, in nanoseconds. */
+  uint64_t total_ns;
+
+  /** Longest time, in nanoseconds. */
+  uint64_t max_ns;
+
+  /** Number of times in each power of two bucket. See STAT_HISTOGRAM_BUCKETS. */
+  std::vector<uint64_t> buckets;
+
+  timer_stats_t() : count(0), total_ns(0), max_ns(0), buckets(STAT_HISTOGRAM_BUCKETS, 0) {}
+
+  /**
+   * \return Mean time in nanoseconds, or 0 if the stage never ran.
+   */
+  double mean_ns() const;
+
+  /**
+   * Estimates a percentile from the histogram, interpolating within its bucket.
+   * \param p Percentile, between 0 and 100.
+   * \return Time in nanoseconds, or 0 if the stage never ran.
+   */
+  double percentile_ns(double p) const;
+};
+
+
+/**
+ * Counters and timers of every thread, summed.
+ */
+struct stats_snapshot_t {
+  /** Value of each counter, indexed by stat_counter_t. */
+  std::vector<uint64_t> counters;
+
+  /** Times of each stage, indexed by stat_timer_t. */
+  std::vector<timer_stats_t> timers;
+
+  stats_snapshot_t() : counters(size_t(stat_counter_t::COUNT), 0), timers(size_t(stat_timer_t::COUNT)) {}
+
+  /**
+   * \param counter Counter.
+   * \return Its value.
+   */
+  uint64_t operator[](stat_counter_t counter) const { return counters[size_t(counter)]; }
+
+  /**
+   * \param timer Timer.
+   * \return Its times.
+   */
+  const timer_stats_t& operator[](stat_timer_t timer) const { return timers[size_t(timer)]; }
+};
+
+
+// ## CLASS DEFINITIONS #######################################################
+
+/**
+ * Times a stage from construction to destruction, when stats are enabled, and records it as a span of the trace when
+ * tracing is. Nothing is read from the clock otherwise.
+ */
+class stat_timer {
+public:
+  /**
+   * \param timer Stage timed.
+   */
+  explicit stat_timer(stat_timer_t timer);
+
+  ~stat_timer();
+
+  stat_timer(const stat_timer&) = delete;
+  stat_timer& operator=(const stat_timer&) = delete;
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Stage timed. */
+  stat_timer_t timer_;
+
+  /** Whether the clock was read at construction. */
+  bool running_;
+
+  /** Construction time. */
+  std::chrono::steady_clock::time_point start_;
+};
+
+
+/**
+ * Writes the stats as JSON to a file every few seconds, and once more when destroyed. Each write replaces the file
+ * whole, so readers never see half of one.
+ */
+class stats_writer {
+public:
+  /**
+   * \param file File to write.
+   * \param interval_seconds Seconds between writes. 0 only writes when destroyed.
+   */
+  stats_writer(const std::string& file, unsigned int interval_seconds);
+
+  ~stats_writer();
+
+  stats_writer(const stats_writer&) = delete;
+  stats_writer& operator=(const stats_writer&) = delete;
+
+
+  /**
+   * Writes the stats now.
+   * \return False if the file could not be written.
+   */
+  bool write() const;
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** File written. */
+  std::string file_;
+
+  /** Seconds between writes. */
+  unsigned int interval_seconds_;
+
+  /** Guards stop_. */
+  std::mutex mutex_;
+
+  /** Wakes the writer thread when stopping. */
+  std::condition_variable wake_;
+
+  /** Whether the writer thread should return. */
+  bool stop_;
+
+  /** Periodic writer thread. Not started without an interval. */
+  std::thread thread_;
+};
+
+
+// ## FUNCTIONS ###############################################################
+
+/**
+ * Turns stats collection on or off for the whole process. Off by default, when counting and timing cost one relaxed
+ * atomic load.
+ * \param state Whether to collect stats.
+ */
+void set_stats_enabled(bool state) noexcept;
+
+
+/**
+ * \return Whether stats are being collected.
+ */
+bool stats_enabled() noexcept;
+
+
+/**
+ * Adds to a counter of the calling thread. Each thread counts into storage of its own, so nothing is shared with the
+ * other threads until get_stats() reads it.
+ * \param counter Counter.
+ * \param amount Amount added.
+ */
+void add_stat(stat_counter_t counter, uint64_t amount = 1) noexcept;
+
+
+/**
+ * Records a time of a stage on the calling thread.
+ * \param timer Stage.
+ * \param ns Time in nanoseconds.
+ */
+void record_time(stat_timer_t timer, uint64_t ns) noexcept;
+
+
+/**
+ * Sums the counters and timers of every thread that has recorded any, including the threads that have exited. Takes
+ * no lock, so it can run while the threads record. Each value is then as recent as its last update.
+ * \return Totals since the start of the process.
+ */
+stats_snapshot_t get_stats();
+
+
+/**
+ * \param counter Counter.
+ * \return Its name in the reports, such as "bytes_read".
+ */
+const char* stat_name(stat_counter_t counter) noexcept;
+
+
+/**
+ * \param timer Timer.
+ * \return Its name in the reports, such as "pyramid_up".
+ */
+const char* stat_name(stat_timer_t timer) noexcept;
+
+
+/**
+ * Writes a human readable summary: every counter, then the count, mean and percentiles of every stage that ran.
+ * \param out Stream to write to.
+ * \param stats Stats to write.
+ */
+void write_stats(std::ostream& out, const stats_snapshot_t& stats);
+
+
+/**
+ * Writes the stats as JSON: a counters object, and a timers object holding the count, total, mean, max, p50, p90 and
+ * p99 times of every stage in nanoseconds, with its non-empty histogram buckets.
+ * \param out Stream to write to.
+ * \param stats Stats to write.
+ */
+void write_stats_json(std::ostream& out, const stats_snapshot_t& stats);
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_STATS_H_
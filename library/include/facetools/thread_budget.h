@@ -0,0 +1,115 @@
+/* A budget of cores, split between threads running models and the BLAS threads inside each model call.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_THREAD_BUDGET_H_
+#define _FACETOOLS_THREAD_BUDGET_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <functional>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * How a thread budget is split.
+ */
+struct thread_split_t {
+  /** Threads calling the models at once. */
+  unsigned int workers;
+
+  /** BLAS threads each model call may use. */
+  unsigned int blas_threads;
+};
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * A number of cores shared by the threads that run models and the BLAS threads their convolutions and matrix products
+ * fan out to. OpenBLAS starts one thread per core for every call by default, so N threads calling models at once keep
+ * N times as many threads busy as there are cores, and throughput collapses. The budget gives each call its share.
+ */
+class thread_budget {
+public:
+  /**
+   * \param threads Number of cores in the budget. 0 means every CPU this process may run on.
+   */
+  explicit thread_budget(unsigned int threads = 0);
+
+
+  /**
+   * \return Number of cores in the budget.
+   */
+  unsigned int threads() const noexcept;
+
+
+  /**
+   * Shares the budget between a number of workers.
+   * \param workers Number of threads calling the models at once.
+   * \return The split, with at least one BLAS thread per worker, even over budget.
+   */
+  thread_split_t split(unsigned int workers) const noexcept;
+
+
+  /**
+   * Lists the splits worth trying: step workers, then twice as many, and so on up to the budget.
+   * \param step Smallest number of workers, and the multiple the others are of, such as the number of pipeline
+   * stages running models.
+   * \return Splits, fewest workers first.
+   */
+  std::vector<thread_split_t> candidates(unsigned int step = 1) const;
+
+
+  /**
+   * Measures splits and picks the fastest.
+   * \param candidates Splits to try, in order.
+   * \param throughput Runs a short workload with a split and returns its throughput. Called once per candidate.
+   * \return The split with the highest throughput, or the first one on ties.
+   */
+  static thread_split_t tune(const std::vector<thread_split_t>& candidates,
+    const std::function<double(const thread_split_t&)>& throughput);
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Number of cores. */
+  unsigned int threads_;
+};
+
+
+// ## FUNCTIONS ###############################################################
+
+/**
+ * Sets the number of threads BLAS calls use from now on, in the whole process. Works when the process is linked with
+ * OpenBLAS, and does nothing otherwise.
+ * \param threads Number of threads.
+ * \return False if no BLAS with a runtime thread count is linked in.
+ */
+bool set_blas_threads(unsigned int threads);
+
+
+/**
+ * \return Number of threads BLAS calls use, or 0 if no BLAS with a runtime thread count is linked in.
+ */
+unsigned int get_blas_threads();
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_THREAD_BUDGET_H_
@@ -0,0 +1,163 @@
+/* Cheap face prefilter working on the EXIF thumbnail of a JPEG, so that
+ * photos without faces can be rejected without decoding the main image.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_THUMBNAIL_PREFILTER_H_
+#define _FACETOOLS_THUMBNAIL_PREFILTER_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <dlib/image_processing/frontal_face_detector.h>
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/**
+ * Outcome of a thumbnail check.
+ */
+enum class thumbnail_verdict_t {
+  /** The thumbnail shows no face. The image can be skipped. */
+  NO_FACE = 0,
+
+  /** The thumbnail may show a face. The image should be processed. */
+  MAY_HAVE_FACE,
+
+  /** The file has no usable thumbnail. The image should be processed. */
+  NO_THUMBNAIL
+};
+
+
+/**
+ * Parameters for the thumbnail_prefilter class.
+ */
+struct thumbnail_prefilter_parameters_t {
+  /** Added to the HOG detector threshold. Lower values miss fewer faces and reject fewer images. This is the recall
+   * knob: the default keeps almost every face the full detector finds. */
+  double adjust_threshold;
+
+  /** Length the longest side of the thumbnail is doubled up to before detection. EXIF thumbnails are about 160 pixels
+   * wide, too small for the 80 pixel HOG window to see any but the largest faces. */
+  unsigned int upscale_length;
+
+  /** Thumbnails whose longest side is shorter than this are not trusted, and the image is processed. */
+  unsigned int min_length;
+
+  thumbnail_prefilter_parameters_t()
+  {
+    adjust_threshold = -0.5;
+    upscale_length = 640;
+    min_length = 80;
+  }
+};
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * Rejects JPEG files whose embedded EXIF thumbnail shows no face. Only the file header is read and only the thumbnail
+ * is decoded, so rejecting a 24 megapixel photo costs a few kilobytes of I/O and a small HOG scan.
+ *
+ * Not thread safe: use one per thread.
+ */
+class thumbnail_prefilter {
+public:
+  /**
+   * \param params Structure containing the parameters.
+   */
+  explicit thumbnail_prefilter(const thumbnail_prefilter_parameters_t& params = thumbnail_prefilter_parameters_t());
+
+
+  /**
+   * Checks the thumbnail of an image file.
+   * \param image_file Image file. Files that are not JPEGs have no thumbnail.
+   * \return Verdict. I/O and decoding errors give NO_THUMBNAIL, so the full decode can report them.
+   */
+  thumbnail_verdict_t check(const std::string& image_file);
+
+
+  /**
+   * Checks the thumbnail of an image file already in memory.
+   * \param data File contents.
+   * \param size Size of the data in bytes.
+   * \return Verdict.
+   */
+  thumbnail_verdict_t check(const unsigned char* data, size_t size);
+
+
+  /**
+   * Permissive face check on a small image.
+   * \param image Image to check.
+   * \return Whether the image may show a face.
+   */
+  bool may_have_face(const dlib::matrix<dlib::rgb_pixel>& image);
+
+
+  /**
+   * Reads the EXIF thumbnail of a JPEG file. Only the start of the file, where cameras put it, is read.
+   * \param image_file JPEG file.
+   * \param thumbnail Output. Compressed thumbnail, a complete JPEG stream.
+   * \return False if the file is not a JPEG or has no JPEG thumbnail.
+   */
+  static bool read_exif_thumbnail(const std::string& image_file, std::vector<unsigned char>& thumbnail);
+
+
+  /**
+   * Finds the EXIF thumbnail of a JPEG held in memory.
+   * \param data JPEG stream, or at least its first segments.
+   * \param size Size of the data in bytes.
+   * \param thumbnail Output. Compressed thumbnail, a complete JPEG stream.
+   * \return False if the data is not a JPEG or has no JPEG thumbnail.
+   */
+  static bool find_exif_thumbnail(const unsigned char* data, size_t size, std::vector<unsigned char>& thumbnail);
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** Parameters. */
+  thumbnail_prefilter_parameters_t params_;
+
+  /** HOG face detector. Cheap to run on a thumbnail, whatever detector the full images use. */
+  dlib::frontal_face_detector detector_;
+
+
+  /**
+   * Decodes and checks a thumbnail.
+   * \param thumbnail Compressed thumbnail.
+   * \return Verdict.
+   */
+  thumbnail_verdict_t check_thumbnail_(const std::vector<unsigned char>& thumbnail);
+
+
+  /**
+   * Finds the thumbnail in the payload of an EXIF APP1 segment.
+   * \param exif Payload, after the "Exif\0\0" header: a TIFF structure.
+   * \param size Size of the payload.
+   * \param thumbnail Output. Compressed thumbnail.
+   * \return False if there is no JPEG thumbnail.
+   */
+  static bool parse_exif_(const unsigned char* exif, size_t size, std::vector<unsigned char>& thumbnail);
+};
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_THUMBNAIL_PREFILTER_H_
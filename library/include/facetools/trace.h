@@ -0,0 +1,131 @@
+/* Execution traces of the detection, recognition and search stages, in the Chrome trace event format.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_TRACE_H_
+#define _FACETOOLS_TRACE_H_
+
+
+// ## INCLUDES ################################################################
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+/** Number of events each thread keeps. Once full, a thread's newest events overwrite its oldest. */
+const size_t TRACE_BUFFER_EVENTS = 1 << 16;
+
+
+// ## CLASS DEFINITION ########################################################
+
+/**
+ * Records a span from construction to destruction on the calling thread, when tracing is enabled. Nothing is read
+ * from the clock otherwise.
+ */
+class trace_span {
+public:
+  /**
+   * \param name Span name. Must outlive the trace, as string literals do.
+   * \param category Span category, such as "pipeline". Same lifetime rule.
+   * \param arg_name Name of the argument shown with the span, or null for none. Same lifetime rule.
+   * \param arg Argument value, such as the index of the file being processed.
+   */
+  trace_span(const char* name, const char* category, const char* arg_name = nullptr, int64_t arg = 0);
+
+  ~trace_span();
+
+  trace_span(const trace_span&) = delete;
+  trace_span& operator=(const trace_span&) = delete;
+
+#ifndef _DEBUG_
+private:
+#endif
+
+  /** See the constructor. */
+  const char* name_;
+  const char* category_;
+  const char* arg_name_;
+  int64_t arg_;
+
+  /** Whether the clock was read at construction. */
+  bool running_;
+
+  /** Construction time. */
+  std::chrono::steady_clock::time_point start_;
+};
+
+
+// ## FUNCTIONS ###############################################################
+
+/**
+ * Turns tracing on or off for the whole process. Off by default, when spans cost one relaxed atomic load. Turning it
+ * on starts the trace clock, if not already started.
+ * \param state Whether to record spans.
+ */
+void set_trace_enabled(bool state) noexcept;
+
+
+/**
+ * \return Whether spans are being recorded.
+ */
+bool trace_enabled() noexcept;
+
+
+/**
+ * Records a span that has ended, on the calling thread. Each thread writes to a ring buffer of its own, without locks
+ * or atomic read-modify-writes.
+ * \param name Span name. Must outlive the trace.
+ * \param category Span category. Must outlive the trace.
+ * \param start Start time.
+ * \param end End time.
+ * \param arg_name Argument name, or null for none. Must outlive the trace.
+ * \param arg Argument value.
+ */
+void trace_complete(const char* name, const char* category, std::chrono::steady_clock::time_point start,
+  std::chrono::steady_clock::time_point end, const char* arg_name = nullptr, int64_t arg = 0) noexcept;
+
+
+/**
+ * Names the calling thread in the trace, such as "detect 2". Threads are named when they start, so a thread whose
+ * ring wrapped since keeps its number but loses its name.
+ * \param name Thread role. Must outlive the trace.
+ * \param index Number of the thread within its role.
+ */
+void trace_thread_name(const char* name, unsigned int index) noexcept;
+
+
+/**
+ * Writes every event still held, from every thread, as Chrome trace event JSON that Perfetto and chrome://tracing
+ * load. Spans become complete ("X") events, timed in microseconds since tracing was first enabled, with the Linux
+ * thread ids. Best called once the traced threads are idle: events overwritten while being read are left out.
+ * \param out Stream to write to.
+ */
+void write_trace(std::ostream& out);
+
+
+/**
+ * Writes the trace to a file. See write_trace.
+ * \param file File to write.
+ * \return False if the file could not be written.
+ */
+bool write_trace(const std::string& file);
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_TRACE_H_
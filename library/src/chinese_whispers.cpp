@@ -0,0 +1,307 @@
+/* Parallel, deterministic Chinese whispers graph clustering.
+ * Label propagation over a compressed sparse row (CSR) adjacency, in either
+ * colour-partitioned sweeps (no two neighbours update at the same time, so
+ * results match a sequential sweep) or damped synchronous sweeps. All
+ * randomness comes from a seed, so a given graph and seed always produce the
+ * same clustering regardless of the thread count.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/chinese_whispers.h>
+#include <facetools/error.h>
+#include <facetools/parallel.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <utility>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+static const unsigned long NO_LABEL = std::numeric_limits<unsigned long>::max();
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/* splitmix64 finaliser. Cheap, well mixed and stable across platforms. */
+static inline uint64_t mix_(uint64_t value) noexcept
+{
+  value += 0x9e3779b97f4a7c15ULL;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+
+/* Greedy colouring in a seeded node order. Returns the nodes grouped by colour, with class_offsets marking where
+ * each colour starts. */
+static void colour_graph_(const csr_graph& graph, uint64_t seed, std::vector<unsigned long>& class_nodes,
+  std::vector<size_t>& class_offsets)
+{
+  size_t num_nodes = graph.num_nodes();
+
+  std::vector<std::pair<uint64_t, unsigned long>> order(num_nodes);
+  for(size_t i = 0; i < num_nodes; ++i)
+    order[i] = std::make_pair(mix_(seed ^ mix_(i)), i);
+  std::sort(order.begin(), order.end());
+
+  std::vector<unsigned long> colours(num_nodes, NO_LABEL);
+  std::vector<size_t> forbidden; // forbidden[c] == node + 1 when colour c is taken by a neighbour of node
+  unsigned long num_colours = 0;
+
+  for(auto& entry : order) {
+    unsigned long node = entry.second;
+
+    for(size_t e = graph.offsets[node]; e < graph.offsets[node+1]; ++e) {
+      unsigned long colour = colours[graph.neighbours[e]];
+      if(colour != NO_LABEL)
+        forbidden[colour] = node + 1;
+    }
+
+    unsigned long colour = 0;
+    while(colour < num_colours && forbidden[colour] == node + 1)
+      ++colour;
+
+    if(colour == num_colours) {
+      ++num_colours;
+      forbidden.push_back(0);
+    }
+
+    colours[node] = colour;
+  }
+
+  class_offsets.assign(num_colours + 1, 0);
+  for(auto colour : colours)
+    ++class_offsets[colour + 1];
+  for(size_t c = 0; c < num_colours; ++c)
+    class_offsets[c + 1] += class_offsets[c];
+
+  std::vector<size_t> position(class_offsets.begin(), class_offsets.end() - 1);
+  class_nodes.resize(num_nodes);
+  for(auto& entry : order)
+    class_nodes[position[colours[entry.second]]++] = entry.second;
+}
+
+
+/* Picks the label with the largest total edge weight among a node's neighbours. Ties keep the node's current label
+ * if it is one of the best, otherwise go to the label with the lowest seeded priority. */
+static unsigned long best_label_(const csr_graph& graph, unsigned long node, const unsigned long* labels,
+  uint64_t seed, std::vector<std::pair<unsigned long, float>>& scratch)
+{
+  size_t begin = graph.offsets[node];
+  size_t end = graph.offsets[node+1];
+  unsigned long current = labels[node];
+
+  if(begin == end)
+    return current;
+
+  scratch.clear();
+  for(size_t e = begin; e < end; ++e)
+    scratch.push_back(std::make_pair(labels[graph.neighbours[e]], graph.weights.empty() ? 1.0f : graph.weights[e]));
+  std::sort(scratch.begin(), scratch.end());
+
+  unsigned long best = current;
+  float best_weight = -1;
+  uint64_t best_priority = 0;
+
+  for(size_t i = 0; i < scratch.size();) {
+    unsigned long label = scratch[i].first;
+    float weight = 0;
+    for(; i < scratch.size() && scratch[i].first == label; ++i)
+      weight += scratch[i].second;
+
+    uint64_t priority = mix_(seed ^ mix_(label));
+
+    if(weight > best_weight ||
+      (weight == best_weight && best != current && (label == current || priority < best_priority))) {
+      best = label;
+      best_weight = weight;
+      best_priority = priority;
+    }
+  }
+
+  return best;
+}
+
+
+/* Renumbers labels to 0..k-1 in order of each cluster's lowest node index. */
+static unsigned long compact_labels_(std::vector<unsigned long>& labels)
+{
+  std::vector<unsigned long> mapping(labels.size(), NO_LABEL);
+  unsigned long num_clusters = 0;
+
+  for(auto& label : labels) {
+    if(mapping[label] == NO_LABEL)
+      mapping[label] = num_clusters++;
+    label = mapping[label];
+  }
+
+  return num_clusters;
+}
+
+
+// ## FUNCTION DEFINITIONS ####################################################
+
+csr_graph make_csr_graph(const std::vector<dlib::sample_pair>& edges, size_t num_nodes)
+{
+  require_true(num_nodes < (size_t(1) << 32), "chinese whispers: too many nodes");
+
+  csr_graph graph;
+  graph.offsets.assign(num_nodes + 1, 0);
+  bool weighted = false;
+
+  for(auto& edge : edges) {
+    require_true(edge.index1() < num_nodes && edge.index2() < num_nodes, "chinese whispers: edge index out of range");
+    if(edge.index1() == edge.index2())
+      continue;
+
+    ++graph.offsets[edge.index1() + 1];
+    ++graph.offsets[edge.index2() + 1];
+    weighted |= edge.distance() != 1;
+  }
+
+  for(size_t i = 0; i < num_nodes; ++i)
+    graph.offsets[i + 1] += graph.offsets[i];
+
+  graph.neighbours.resize(graph.offsets[num_nodes]);
+  if(weighted)
+    graph.weights.resize(graph.offsets[num_nodes]);
+
+  std::vector<size_t> position(graph.offsets.begin(), graph.offsets.end() - 1);
+  for(auto& edge : edges) {
+    if(edge.index1() == edge.index2())
+      continue;
+
+    size_t forward = position[edge.index1()]++;
+    size_t backward = position[edge.index2()]++;
+    graph.neighbours[forward] = edge.index2();
+    graph.neighbours[backward] = edge.index1();
+
+    if(weighted) {
+      graph.weights[forward] = edge.distance();
+      graph.weights[backward] = edge.distance();
+    }
+  }
+
+  return graph;
+}
+
+
+unsigned long chinese_whispers(const csr_graph& graph, std::vector<unsigned long>& labels,
+  const chinese_whispers_parameters_t& params)
+{
+  const size_t num_nodes = graph.num_nodes();
+  labels.resize(num_nodes);
+  for(size_t i = 0; i < num_nodes; ++i)
+    labels[i] = i;
+
+  if(num_nodes == 0)
+    return 0;
+
+  const bool synchronous = params.sweep == chinese_whispers_sweep_t::SYNCHRONOUS;
+
+  std::vector<unsigned long> class_nodes;
+  std::vector<size_t> class_offsets;
+
+  if(synchronous) {
+    class_nodes.resize(num_nodes);
+    for(size_t i = 0; i < num_nodes; ++i)
+      class_nodes[i] = i;
+    class_offsets = {0, num_nodes};
+  }
+  else {
+    colour_graph_(graph, params.seed, class_nodes, class_offsets);
+  }
+
+  const size_t num_classes = class_offsets.size() - 1;
+  const unsigned int workers = std::min<size_t>(resolve_thread_count(params.num_threads), num_nodes);
+
+  std::vector<unsigned long> next_labels(synchronous ? num_nodes : 0);
+  std::atomic<size_t> changes[2];
+  changes[0] = 0;
+  changes[1] = 0;
+  spin_barrier barrier(workers);
+
+  run_on_threads(workers, [&](unsigned int worker) {
+    std::vector<std::pair<unsigned long, float>> scratch;
+    unsigned long* current = labels.data();
+    unsigned long* target = synchronous ? next_labels.data() : labels.data();
+
+    // A synchronous sweep only updates half the nodes, so one that changes nothing proves nothing about the other
+    // half. The sweep after it evaluates every node, still updating only its own half, and the graph has converged
+    // when no node would change.
+    bool full = !synchronous;
+
+    for(unsigned long iteration = 0; iteration < params.max_iterations; ++iteration) {
+      uint64_t sweep_seed = mix_(params.seed ^ mix_(iteration));
+      size_t worker_changes = 0;
+
+      for(size_t c = 0; c < num_classes; ++c) {
+        size_t class_size = class_offsets[c+1] - class_offsets[c];
+        size_t begin = class_offsets[c] + class_size * worker / workers;
+        size_t end = class_offsets[c] + class_size * (worker + 1) / workers;
+
+        for(size_t i = begin; i < end; ++i) {
+          unsigned long node = class_nodes[i];
+          unsigned long label = current[node];
+          bool sampled = !synchronous || (mix_(sweep_seed ^ node) & 1);
+
+          if(sampled || full)
+            label = best_label_(graph, node, current, params.seed, scratch);
+
+          worker_changes += label != current[node];
+          target[node] = sampled ? label : current[node];
+        }
+
+        barrier.wait();
+      }
+
+      changes[iteration & 1] += worker_changes;
+      barrier.wait();
+
+      bool quiet = changes[iteration & 1] == 0;
+      bool converged = quiet && full;
+      full = !synchronous || quiet;
+      if(worker == 0)
+        changes[(iteration + 1) & 1] = 0;
+
+      std::swap(current, target);
+      if(!synchronous)
+        target = current;
+
+      barrier.wait();
+
+      if(converged)
+        break;
+    }
+
+    if(worker == 0 && current != labels.data())
+      labels.swap(next_labels);
+  });
+
+  return compact_labels_(labels);
+}
+
+
+unsigned long chinese_whispers(const std::vector<dlib::sample_pair>& edges, size_t num_nodes,
+  std::vector<unsigned long>& labels, const chinese_whispers_parameters_t& params)
+{
+  return chinese_whispers(make_csr_graph(edges, num_nodes), labels, params);
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,307 @@
+/* CPU and NUMA topology discovery, and placement of worker threads on it.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/cpu_topology.h>
+
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <tuple>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/**
+ * Reads the first line of a /sys file.
+ * \param path File to read.
+ * \param line Output. First line.
+ * \return False if the file cannot be read.
+ */
+static bool read_line(const std::string& path, std::string& line)
+{
+  std::ifstream file(path);
+  return static_cast<bool>(std::getline(file, line));
+}
+
+
+/**
+ * Reads a number from a /sys file.
+ * \param path File to read.
+ * \param fallback Value returned when the file cannot be read.
+ * \return The number.
+ */
+static unsigned int read_number(const std::string& path, unsigned int fallback)
+{
+  std::string line;
+  if(!read_line(path, line))
+    return fallback;
+
+  try {
+    int value = std::stoi(line);
+    return value < 0 ? fallback : unsigned(value);
+  }
+  catch(const std::exception&) {
+    return fallback;
+  }
+}
+
+
+/**
+ * Lists the numbered entries of a directory with a given prefix, such as cpu0, cpu1 or node0.
+ * \param directory Directory to list.
+ * \param prefix Entry name prefix.
+ * \return Numbers of the entries, sorted.
+ */
+static std::vector<unsigned int> numbered_entries(const std::string& directory, const std::string& prefix)
+{
+  std::vector<unsigned int> numbers;
+  DIR* dir = opendir(directory.c_str());
+  if(!dir)
+    return numbers;
+
+  while(dirent* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if(name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+      name.find_first_not_of("0123456789", prefix.size()) == std::string::npos)
+      numbers.push_back(std::stoul(name.substr(prefix.size())));
+  }
+
+  closedir(dir);
+  std::sort(numbers.begin(), numbers.end());
+
+  return numbers;
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+cpu_topology::cpu_topology(const std::string& sys_root, bool allowed_only)
+{
+  std::vector<unsigned int> ids;
+  std::string online;
+  if(!read_line(sys_root + "/cpu/online", online) || !parse_cpu_list(online, ids))
+    ids = numbered_entries(sys_root + "/cpu", "cpu");
+
+  if(ids.empty())
+    for(unsigned int id = 0; id < std::max(1u, std::thread::hardware_concurrency()); ++id)
+      ids.push_back(id);
+
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if(allowed_only && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    auto refused = [&](unsigned int id) { return id >= CPU_SETSIZE || !CPU_ISSET(id, &allowed); };
+    ids.erase(std::remove_if(ids.begin(), ids.end(), refused), ids.end());
+  }
+
+  // CPUs of no listed node, on kernels without NUMA, go to the first one.
+  std::map<unsigned int, unsigned int> cpu_nodes;
+  std::vector<unsigned int> node_ids = numbered_entries(sys_root + "/node", "node");
+  for(unsigned int node_id : node_ids) {
+    std::string list;
+    std::vector<unsigned int> node_cpus;
+    if(read_line(sys_root + "/node/node" + std::to_string(node_id) + "/cpulist", list) &&
+      parse_cpu_list(list, node_cpus))
+      for(unsigned int id : node_cpus)
+        cpu_nodes.emplace(id, node_id);
+  }
+
+  std::vector<unsigned int> cpu_node_ids;
+  for(unsigned int id : ids) {
+    auto node = cpu_nodes.find(id);
+    cpu_node_ids.push_back(node != cpu_nodes.end() ? node->second : node_ids.empty() ? 0 : node_ids.front());
+  }
+
+  // Node indices follow the node ids, skipping nodes without CPUs here.
+  std::map<unsigned int, unsigned int> node_index;
+  for(unsigned int node_id : cpu_node_ids)
+    node_index.emplace(node_id, 0);
+
+  unsigned int index = 0;
+  for(auto& node : node_index)
+    node.second = index++;
+
+  for(size_t i = 0; i < ids.size(); ++i) {
+    std::string topology = sys_root + "/cpu/cpu" + std::to_string(ids[i]) + "/topology/";
+
+    cpu_t cpu;
+    cpu.id = ids[i];
+    cpu.core = read_number(topology + "core_id", ids[i]);
+    cpu.package = read_number(topology + "physical_package_id", 0);
+    cpu.node = node_index[cpu_node_ids[i]];
+    cpus_.push_back(cpu);
+  }
+
+  num_nodes_ = std::max<size_t>(1, node_index.size());
+}
+
+
+const std::vector<cpu_t>& cpu_topology::cpus() const noexcept
+{
+  return cpus_;
+}
+
+
+unsigned int cpu_topology::num_nodes() const noexcept
+{
+  return num_nodes_;
+}
+
+
+std::vector<unsigned int> cpu_topology::node_cpus(unsigned int node) const
+{
+  std::vector<unsigned int> ids;
+  for(auto& cpu : cpus_)
+    if(cpu.node == node)
+      ids.push_back(cpu.id);
+
+  return ids;
+}
+
+
+std::vector<unsigned int> cpu_topology::place(unsigned int workers, placement_policy_t policy) const
+{
+  std::vector<unsigned int> placement;
+  if(policy == placement_policy_t::NONE || cpus_.empty())
+    return placement;
+
+  std::vector<std::vector<unsigned int>> nodes;
+  for(unsigned int node = 0; node < num_nodes_; ++node) {
+    auto ids = ordered_node_cpus_(node);
+    if(!ids.empty())
+      nodes.push_back(ids);
+  }
+
+  if(policy == placement_policy_t::COMPACT) {
+    std::vector<unsigned int> order;
+    for(auto& ids : nodes)
+      order.insert(order.end(), ids.begin(), ids.end());
+
+    for(unsigned int worker = 0; worker < workers; ++worker)
+      placement.push_back(order[worker % order.size()]);
+  }
+  else {
+    for(unsigned int worker = 0; worker < workers; ++worker) {
+      auto& ids = nodes[worker % nodes.size()];
+      placement.push_back(ids[(worker / nodes.size()) % ids.size()]);
+    }
+  }
+
+  return placement;
+}
+
+
+bool cpu_topology::parse_cpu_list(const std::string& text, std::vector<unsigned int>& cpus)
+{
+  cpus.clear();
+  std::istringstream stream(text);
+  std::string range;
+
+  while(std::getline(stream, range, ',')) {
+    size_t dash = range.find('-');
+    try {
+      size_t end = 0;
+      unsigned long first = std::stoul(range, &end);
+      unsigned long last = first;
+
+      if(dash != std::string::npos) {
+        if(end != dash)
+          return false;
+
+        last = std::stoul(range.substr(dash + 1), &end);
+        end += dash + 1;
+      }
+
+      if(range.find_first_not_of(" \n", end) != std::string::npos || last < first || last >= CPU_SETSIZE)
+        return false;
+
+      for(unsigned long cpu = first; cpu <= last; ++cpu)
+        cpus.push_back(cpu);
+    }
+    catch(const std::exception&) {
+      return false;
+    }
+  }
+
+  return !cpus.empty();
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+std::vector<unsigned int> cpu_topology::ordered_node_cpus_(unsigned int node) const
+{
+  // Rank of each CPU among the SMT siblings of its core.
+  std::map<std::pair<unsigned int, unsigned int>, unsigned int> siblings;
+  std::vector<std::pair<unsigned int, unsigned int>> ranked;
+
+  for(auto& cpu : cpus_) {
+    if(cpu.node != node)
+      continue;
+
+    unsigned int rank = siblings[std::make_pair(cpu.package, cpu.core)]++;
+    ranked.emplace_back(rank, cpu.id);
+  }
+
+  std::sort(ranked.begin(), ranked.end());
+
+  std::vector<unsigned int> ids;
+  for(auto& cpu : ranked)
+    ids.push_back(cpu.second);
+
+  return ids;
+}
+
+
+// ## FUNCTION DEFINITIONS ####################################################
+
+bool pin_thread(const std::vector<unsigned int>& cpus)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  bool any = false;
+  for(unsigned int cpu : cpus) {
+    if(cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+      any = true;
+    }
+  }
+
+  return any && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+
+bool parse_placement_policy(const std::string& policy, placement_policy_t& placement)
+{
+  if(policy == "none")
+    placement = placement_policy_t::NONE;
+  else if(policy == "compact")
+    placement = placement_policy_t::COMPACT;
+  else if(policy == "spread")
+    placement = placement_policy_t::SPREAD;
+  else
+    return false;
+
+  return true;
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,691 @@
+/* Distance kernels for face embeddings.
+ * Squared L2 distances and dot products computed in place on contiguous float
+ * data, with AVX2 and AVX-512 versions selected at runtime and a portable
+ * scalar fallback.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/distance.h>
+#include <facetools/error.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define FACETOOLS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+/* Number of elements summed between early termination checks. */
+static const size_t EARLY_EXIT_STRIDE = 32;
+
+/* Rows per tile in the many-vs-many functions. 64 rows of 128 floats fit in L1. */
+static const size_t TILE_ROWS = 64;
+
+
+// ## CUSTOM STRUCTURES #######################################################
+
+/* Per instruction set kernel entry points. */
+struct distance_kernels_t {
+  distance_kernel_t type;
+  float (*squared_distance)(const float*, const float*, size_t);
+  float (*dot_product)(const float*, const float*, size_t);
+  bool (*within_squared_distance)(const float*, const float*, size_t, float);
+  void (*dot_tile)(const float*, size_t, const float*, size_t, size_t, float*, size_t);
+  void (*half_to_float)(const uint16_t*, float*, size_t);
+  void (*float_to_half)(const float*, uint16_t*, size_t);
+};
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+static float scalar_squared_distance_(const float* a, const float* b, size_t dims)
+{
+  float sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+  size_t i = 0;
+
+  for(; i + 4 <= dims; i += 4) {
+    float d0 = a[i] - b[i];
+    float d1 = a[i+1] - b[i+1];
+    float d2 = a[i+2] - b[i+2];
+    float d3 = a[i+3] - b[i+3];
+    sum0 += d0 * d0;
+    sum1 += d1 * d1;
+    sum2 += d2 * d2;
+    sum3 += d3 * d3;
+  }
+
+  for(; i < dims; ++i) {
+    float d = a[i] - b[i];
+    sum0 += d * d;
+  }
+
+  return (sum0 + sum1) + (sum2 + sum3);
+}
+
+
+static float scalar_dot_product_(const float* a, const float* b, size_t dims)
+{
+  float sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+  size_t i = 0;
+
+  for(; i + 4 <= dims; i += 4) {
+    sum0 += a[i] * b[i];
+    sum1 += a[i+1] * b[i+1];
+    sum2 += a[i+2] * b[i+2];
+    sum3 += a[i+3] * b[i+3];
+  }
+
+  for(; i < dims; ++i)
+    sum0 += a[i] * b[i];
+
+  return (sum0 + sum1) + (sum2 + sum3);
+}
+
+
+static bool scalar_within_squared_distance_(const float* a, const float* b, size_t dims, float squared_threshold)
+{
+  float sum = 0;
+  size_t i = 0;
+
+  for(; i + EARLY_EXIT_STRIDE <= dims; i += EARLY_EXIT_STRIDE) {
+    sum += scalar_squared_distance_(a + i, b + i, EARLY_EXIT_STRIDE);
+    if(sum >= squared_threshold)
+      return false;
+  }
+
+  sum += scalar_squared_distance_(a + i, b + i, dims - i);
+
+  return sum < squared_threshold;
+}
+
+
+static void scalar_dot_tile_(const float* queries, size_t num_queries, const float* rows, size_t num_rows, size_t dims,
+  float* products, size_t stride)
+{
+  for(size_t q = 0; q < num_queries; ++q)
+    for(size_t r = 0; r < num_rows; ++r)
+      products[q * stride + r] = scalar_dot_product_(queries + q * dims, rows + r * dims, dims);
+}
+
+
+static void scalar_half_to_float_(const uint16_t* in, float* out, size_t count)
+{
+  for(size_t i = 0; i < count; ++i) {
+    uint32_t sign = uint32_t(in[i] & 0x8000) << 16;
+    uint32_t exponent = (in[i] >> 10) & 0x1f;
+    uint32_t mantissa = in[i] & 0x3ff;
+    uint32_t bits;
+
+    if(exponent == 0) {
+      // Zero or subnormal: mantissa * 2^-24.
+      float value = std::ldexp(float(mantissa), -24);
+      std::memcpy(&bits, &value, sizeof(bits));
+      bits |= sign;
+    }
+    else if(exponent == 31) {
+      // Infinity, or a NaN made quiet the way the F16C instructions do.
+      bits = sign | 0x7f800000 | (mantissa << 13) | (mantissa ? 0x400000 : 0);
+    }
+    else {
+      bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+
+    std::memcpy(&out[i], &bits, sizeof(bits));
+  }
+}
+
+
+static void scalar_float_to_half_(const float* in, uint16_t* out, size_t count)
+{
+  for(size_t i = 0; i < count; ++i) {
+    uint32_t bits;
+    std::memcpy(&bits, &in[i], sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if(magnitude >= 0x7f800000) {
+      out[i] = sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+    else if(magnitude >= 0x477ff000) {
+      // Rounds to 65520 or more, which is past the largest half.
+      out[i] = sign | 0x7c00;
+    }
+    else if(magnitude < 0x38800000) {
+      // Subnormal half: scale to units of 2^-24 and round to nearest even.
+      float value;
+      std::memcpy(&value, &magnitude, sizeof(value));
+      out[i] = sign | uint16_t(std::nearbyint(value * 16777216.0f));
+    }
+    else {
+      // Rebias the exponent and round the 13 dropped mantissa bits to nearest even.
+      magnitude += 0xc8000fff + ((magnitude >> 13) & 1);
+      out[i] = sign | (magnitude >> 13);
+    }
+  }
+}
+
+
+#ifdef FACETOOLS_X86_KERNELS
+
+__attribute__((target("avx2,fma")))
+static inline float avx2_horizontal_sum_(__m256 v)
+{
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+  return _mm_cvtss_f32(sum);
+}
+
+
+__attribute__((target("avx2,fma")))
+static float avx2_squared_distance_(const float* a, const float* b, size_t dims)
+{
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  __m256 acc2 = _mm256_setzero_ps();
+  __m256 acc3 = _mm256_setzero_ps();
+  size_t i = 0;
+
+  for(; i + 32 <= dims; i += 32) {
+    __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+    __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+    __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+    acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+    acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+  }
+
+  for(; i + 8 <= dims; i += 8) {
+    __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    acc0 = _mm256_fmadd_ps(d, d, acc0);
+  }
+
+  float sum = avx2_horizontal_sum_(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+
+  for(; i < dims; ++i) {
+    float d = a[i] - b[i];
+    sum += d * d;
+  }
+
+  return sum;
+}
+
+
+__attribute__((target("avx2,fma")))
+static float avx2_dot_product_(const float* a, const float* b, size_t dims)
+{
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  __m256 acc2 = _mm256_setzero_ps();
+  __m256 acc3 = _mm256_setzero_ps();
+  size_t i = 0;
+
+  for(; i + 32 <= dims; i += 32) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+    acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+  }
+
+  for(; i + 8 <= dims; i += 8)
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+
+  float sum = avx2_horizontal_sum_(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+
+  for(; i < dims; ++i)
+    sum += a[i] * b[i];
+
+  return sum;
+}
+
+
+__attribute__((target("avx2,fma")))
+static bool avx2_within_squared_distance_(const float* a, const float* b, size_t dims, float squared_threshold)
+{
+  float sum = 0;
+  size_t i = 0;
+
+  for(; i + EARLY_EXIT_STRIDE <= dims; i += EARLY_EXIT_STRIDE) {
+    sum += avx2_squared_distance_(a + i, b + i, EARLY_EXIT_STRIDE);
+    if(sum >= squared_threshold)
+      return false;
+  }
+
+  sum += avx2_squared_distance_(a + i, b + i, dims - i);
+
+  return sum < squared_threshold;
+}
+
+
+/* Register blocked 2 query x 4 row dot products. Each step loads 6 vectors for 8 multiply-adds. */
+__attribute__((target("avx2,fma")))
+static void avx2_dot_tile_(const float* queries, size_t num_queries, const float* rows, size_t num_rows, size_t dims,
+  float* products, size_t stride)
+{
+  size_t vector_dims = dims & ~size_t(7);
+  size_t q = 0;
+
+  for(; q + 2 <= num_queries; q += 2) {
+    const float* q0 = queries + q * dims;
+    const float* q1 = q0 + dims;
+    size_t r = 0;
+
+    for(; r + 4 <= num_rows; r += 4) {
+      const float* r0 = rows + r * dims;
+      const float* r1 = r0 + dims;
+      const float* r2 = r1 + dims;
+      const float* r3 = r2 + dims;
+      __m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps(), acc02 = _mm256_setzero_ps(), acc03 = _mm256_setzero_ps();
+      __m256 acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps(), acc12 = _mm256_setzero_ps(), acc13 = _mm256_setzero_ps();
+
+      for(size_t i = 0; i < vector_dims; i += 8) {
+        __m256 a0 = _mm256_loadu_ps(q0 + i);
+        __m256 a1 = _mm256_loadu_ps(q1 + i);
+        __m256 b = _mm256_loadu_ps(r0 + i);
+        acc00 = _mm256_fmadd_ps(a0, b, acc00);
+        acc10 = _mm256_fmadd_ps(a1, b, acc10);
+        b = _mm256_loadu_ps(r1 + i);
+        acc01 = _mm256_fmadd_ps(a0, b, acc01);
+        acc11 = _mm256_fmadd_ps(a1, b, acc11);
+        b = _mm256_loadu_ps(r2 + i);
+        acc02 = _mm256_fmadd_ps(a0, b, acc02);
+        acc12 = _mm256_fmadd_ps(a1, b, acc12);
+        b = _mm256_loadu_ps(r3 + i);
+        acc03 = _mm256_fmadd_ps(a0, b, acc03);
+        acc13 = _mm256_fmadd_ps(a1, b, acc13);
+      }
+
+      float* out0 = products + q * stride + r;
+      float* out1 = out0 + stride;
+      out0[0] = avx2_horizontal_sum_(acc00) + scalar_dot_product_(q0 + vector_dims, r0 + vector_dims, dims - vector_dims);
+      out0[1] = avx2_horizontal_sum_(acc01) + scalar_dot_product_(q0 + vector_dims, r1 + vector_dims, dims - vector_dims);
+      out0[2] = avx2_horizontal_sum_(acc02) + scalar_dot_product_(q0 + vector_dims, r2 + vector_dims, dims - vector_dims);
+      out0[3] = avx2_horizontal_sum_(acc03) + scalar_dot_product_(q0 + vector_dims, r3 + vector_dims, dims - vector_dims);
+      out1[0] = avx2_horizontal_sum_(acc10) + scalar_dot_product_(q1 + vector_dims, r0 + vector_dims, dims - vector_dims);
+      out1[1] = avx2_horizontal_sum_(acc11) + scalar_dot_product_(q1 + vector_dims, r1 + vector_dims, dims - vector_dims);
+      out1[2] = avx2_horizontal_sum_(acc12) + scalar_dot_product_(q1 + vector_dims, r2 + vector_dims, dims - vector_dims);
+      out1[3] = avx2_horizontal_sum_(acc13) + scalar_dot_product_(q1 + vector_dims, r3 + vector_dims, dims - vector_dims);
+    }
+
+    for(; r < num_rows; ++r) {
+      products[q * stride + r] = avx2_dot_product_(q0, rows + r * dims, dims);
+      products[(q + 1) * stride + r] = avx2_dot_product_(q1, rows + r * dims, dims);
+    }
+  }
+
+  for(; q < num_queries; ++q)
+    for(size_t r = 0; r < num_rows; ++r)
+      products[q * stride + r] = avx2_dot_product_(queries + q * dims, rows + r * dims, dims);
+}
+
+
+__attribute__((target("avx,f16c")))
+static void f16c_half_to_float_(const uint16_t* in, float* out, size_t count)
+{
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))));
+
+  scalar_half_to_float_(in + i, out + i, count - i);
+}
+
+
+__attribute__((target("avx,f16c")))
+static void f16c_float_to_half_(const float* in, uint16_t* out, size_t count)
+{
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+
+  scalar_float_to_half_(in + i, out + i, count - i);
+}
+
+
+__attribute__((target("avx512f")))
+static float avx512_squared_distance_(const float* a, const float* b, size_t dims)
+{
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  size_t i = 0;
+
+  for(; i + 32 <= dims; i += 32) {
+    __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+    acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+  }
+
+  if(i + 16 <= dims) {
+    __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    acc0 = _mm512_fmadd_ps(d, d, acc0);
+    i += 16;
+  }
+
+  if(i < dims) {
+    __mmask16 mask = (__mmask16)((1u << (dims - i)) - 1);
+    __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+    acc1 = _mm512_fmadd_ps(d, d, acc1);
+  }
+
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+
+__attribute__((target("avx512f")))
+static float avx512_dot_product_(const float* a, const float* b, size_t dims)
+{
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  size_t i = 0;
+
+  for(; i + 32 <= dims; i += 32) {
+    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+  }
+
+  if(i + 16 <= dims) {
+    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    i += 16;
+  }
+
+  if(i < dims) {
+    __mmask16 mask = (__mmask16)((1u << (dims - i)) - 1);
+    acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+  }
+
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+
+__attribute__((target("avx512f")))
+static bool avx512_within_squared_distance_(const float* a, const float* b, size_t dims, float squared_threshold)
+{
+  float sum = 0;
+  size_t i = 0;
+
+  for(; i + EARLY_EXIT_STRIDE <= dims; i += EARLY_EXIT_STRIDE) {
+    sum += avx512_squared_distance_(a + i, b + i, EARLY_EXIT_STRIDE);
+    if(sum >= squared_threshold)
+      return false;
+  }
+
+  sum += avx512_squared_distance_(a + i, b + i, dims - i);
+
+  return sum < squared_threshold;
+}
+
+
+/* Register blocked 2 query x 4 row dot products, masking the final partial vector. */
+__attribute__((target("avx512f")))
+static void avx512_dot_tile_(const float* queries, size_t num_queries, const float* rows, size_t num_rows, size_t dims,
+  float* products, size_t stride)
+{
+  size_t q = 0;
+
+  for(; q + 2 <= num_queries; q += 2) {
+    const float* q0 = queries + q * dims;
+    const float* q1 = q0 + dims;
+    size_t r = 0;
+
+    for(; r + 4 <= num_rows; r += 4) {
+      const float* r0 = rows + r * dims;
+      const float* r1 = r0 + dims;
+      const float* r2 = r1 + dims;
+      const float* r3 = r2 + dims;
+      __m512 acc00 = _mm512_setzero_ps(), acc01 = _mm512_setzero_ps(), acc02 = _mm512_setzero_ps(), acc03 = _mm512_setzero_ps();
+      __m512 acc10 = _mm512_setzero_ps(), acc11 = _mm512_setzero_ps(), acc12 = _mm512_setzero_ps(), acc13 = _mm512_setzero_ps();
+
+      for(size_t i = 0; i < dims; i += 16) {
+        __mmask16 mask = dims - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (dims - i)) - 1);
+        __m512 a0 = _mm512_maskz_loadu_ps(mask, q0 + i);
+        __m512 a1 = _mm512_maskz_loadu_ps(mask, q1 + i);
+        __m512 b = _mm512_maskz_loadu_ps(mask, r0 + i);
+        acc00 = _mm512_fmadd_ps(a0, b, acc00);
+        acc10 = _mm512_fmadd_ps(a1, b, acc10);
+        b = _mm512_maskz_loadu_ps(mask, r1 + i);
+        acc01 = _mm512_fmadd_ps(a0, b, acc01);
+        acc11 = _mm512_fmadd_ps(a1, b, acc11);
+        b = _mm512_maskz_loadu_ps(mask, r2 + i);
+        acc02 = _mm512_fmadd_ps(a0, b, acc02);
+        acc12 = _mm512_fmadd_ps(a1, b, acc12);
+        b = _mm512_maskz_loadu_ps(mask, r3 + i);
+        acc03 = _mm512_fmadd_ps(a0, b, acc03);
+        acc13 = _mm512_fmadd_ps(a1, b, acc13);
+      }
+
+      float* out0 = products + q * stride + r;
+      float* out1 = out0 + stride;
+      out0[0] = _mm512_reduce_add_ps(acc00);
+      out0[1] = _mm512_reduce_add_ps(acc01);
+      out0[2] = _mm512_reduce_add_ps(acc02);
+      out0[3] = _mm512_reduce_add_ps(acc03);
+      out1[0] = _mm512_reduce_add_ps(acc10);
+      out1[1] = _mm512_reduce_add_ps(acc11);
+      out1[2] = _mm512_reduce_add_ps(acc12);
+      out1[3] = _mm512_reduce_add_ps(acc13);
+    }
+
+    for(; r < num_rows; ++r) {
+      products[q * stride + r] = avx512_dot_product_(q0, rows + r * dims, dims);
+      products[(q + 1) * stride + r] = avx512_dot_product_(q1, rows + r * dims, dims);
+    }
+  }
+
+  for(; q < num_queries; ++q)
+    for(size_t r = 0; r < num_rows; ++r)
+      products[q * stride + r] = avx512_dot_product_(queries + q * dims, rows + r * dims, dims);
+}
+
+#endif // FACETOOLS_X86_KERNELS
+
+
+static const distance_kernels_t scalar_kernels_ = {
+  distance_kernel_t::SCALAR, scalar_squared_distance_, scalar_dot_product_, scalar_within_squared_distance_,
+  scalar_dot_tile_, scalar_half_to_float_, scalar_float_to_half_
+};
+
+#ifdef FACETOOLS_X86_KERNELS
+static const distance_kernels_t avx2_kernels_ = {
+  distance_kernel_t::AVX2, avx2_squared_distance_, avx2_dot_product_, avx2_within_squared_distance_, avx2_dot_tile_,
+  f16c_half_to_float_, f16c_float_to_half_
+};
+
+static const distance_kernels_t avx512_kernels_ = {
+  distance_kernel_t::AVX512, avx512_squared_distance_, avx512_dot_product_, avx512_within_squared_distance_,
+  avx512_dot_tile_, f16c_half_to_float_, f16c_float_to_half_
+};
+#endif
+
+
+static const distance_kernels_t* kernels_for_(distance_kernel_t kernel)
+{
+  if(!distance_kernel_supported(kernel))
+    return nullptr;
+
+#ifdef FACETOOLS_X86_KERNELS
+  if(kernel == distance_kernel_t::AVX512)
+    return &avx512_kernels_;
+  else if(kernel == distance_kernel_t::AVX2)
+    return &avx2_kernels_;
+#endif
+
+  return &scalar_kernels_;
+}
+
+
+static std::atomic<const distance_kernels_t*>& active_kernels_()
+{
+  static std::atomic<const distance_kernels_t*> kernels(
+    distance_kernel_supported(distance_kernel_t::AVX512) ? kernels_for_(distance_kernel_t::AVX512) :
+    distance_kernel_supported(distance_kernel_t::AVX2) ? kernels_for_(distance_kernel_t::AVX2) :
+    &scalar_kernels_);
+
+  return kernels;
+}
+
+
+static inline const distance_kernels_t& kernels_()
+{
+  return *active_kernels_().load(std::memory_order_relaxed);
+}
+
+
+static inline const float* embedding_data_(const embedding_t& embedding)
+{
+  return embedding.size() ? &embedding(0) : nullptr;
+}
+
+
+// ## FUNCTION DEFINITIONS ####################################################
+
+distance_kernel_t get_distance_kernel() noexcept
+{
+  return kernels_().type;
+}
+
+
+bool distance_kernel_supported(distance_kernel_t kernel) noexcept
+{
+  if(kernel == distance_kernel_t::SCALAR)
+    return true;
+
+#ifdef FACETOOLS_X86_KERNELS
+  __builtin_cpu_init();
+
+  // Every AVX2 capable CPU also has F16C, which the half precision conversions of both kernels use.
+  if(kernel == distance_kernel_t::AVX2)
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  else if(kernel == distance_kernel_t::AVX512)
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2");
+#endif
+
+  return false;
+}
+
+
+void set_distance_kernel(distance_kernel_t kernel)
+{
+  auto kernels = kernels_for_(kernel);
+  require_true(kernels != nullptr, "distance: kernel not supported on this CPU");
+  active_kernels_().store(kernels, std::memory_order_relaxed);
+}
+
+
+float squared_distance(const float* a, const float* b, size_t dims) noexcept
+{
+  return kernels_().squared_distance(a, b, dims);
+}
+
+
+float dot_product(const float* a, const float* b, size_t dims) noexcept
+{
+  return kernels_().dot_product(a, b, dims);
+}
+
+
+bool within_squared_distance(const float* a, const float* b, size_t dims, float squared_threshold) noexcept
+{
+  return kernels_().within_squared_distance(a, b, dims, squared_threshold);
+}
+
+
+void squared_distances(const float* query, const float* rows, size_t num_rows, size_t dims, float* distances) noexcept
+{
+  auto kernel = kernels_().squared_distance;
+
+  for(size_t i = 0; i < num_rows; ++i)
+    distances[i] = kernel(query, rows + i * dims, dims);
+}
+
+
+void dot_products(const float* query, const float* rows, size_t num_rows, size_t dims, float* products) noexcept
+{
+  auto kernel = kernels_().dot_product;
+
+  for(size_t i = 0; i < num_rows; ++i)
+    products[i] = kernel(query, rows + i * dims, dims);
+}
+
+
+void pairwise_squared_distances(const float* queries, size_t num_queries, const float* rows, size_t num_rows,
+  size_t dims, float* distances) noexcept
+{
+  auto kernel = kernels_().squared_distance;
+
+  for(size_t row_begin = 0; row_begin < num_rows; row_begin += TILE_ROWS) {
+    size_t row_end = std::min(num_rows, row_begin + TILE_ROWS);
+
+    for(size_t q = 0; q < num_queries; ++q) {
+      const float* query = queries + q * dims;
+      float* output = distances + q * num_rows;
+
+      for(size_t r = row_begin; r < row_end; ++r)
+        output[r] = kernel(query, rows + r * dims, dims);
+    }
+  }
+}
+
+
+void pairwise_dot_products(const float* queries, size_t num_queries, const float* rows, size_t num_rows,
+  size_t dims, float* products) noexcept
+{
+  auto kernel = kernels_().dot_tile;
+
+  for(size_t row_begin = 0; row_begin < num_rows; row_begin += TILE_ROWS) {
+    size_t tile_rows = std::min(num_rows - row_begin, TILE_ROWS);
+    kernel(queries, num_queries, rows + row_begin * dims, tile_rows, dims, products + row_begin, num_rows);
+  }
+}
+
+
+void half_to_float(const uint16_t* in, float* out, size_t count) noexcept
+{
+  kernels_().half_to_float(in, out, count);
+}
+
+
+void float_to_half(const float* in, uint16_t* out, size_t count) noexcept
+{
+  kernels_().float_to_half(in, out, count);
+}
+
+
+float squared_distance(const embedding_t& a, const embedding_t& b)
+{
+  require_true(a.size() == b.size(), "distance: embedding sizes differ");
+
+  return squared_distance(embedding_data_(a), embedding_data_(b), a.size());
+}
+
+
+bool within_distance(const embedding_t& a, const embedding_t& b, float threshold)
+{
+  require_true(a.size() == b.size(), "distance: embedding sizes differ");
+
+  return within_squared_distance(embedding_data_(a), embedding_data_(b), a.size(), threshold * threshold);
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,214 @@
+/* Bounded LRU cache of face embeddings keyed by content hash, with an
+ * optional on-disk backing store.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/embedding_cache.h>
+#include <facetools/error.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+static const char CACHE_MAGIC[4] = {'F', 'T', 'E', 'C'};
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+static bool make_directory_(const std::string& directory)
+{
+  return mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+embedding_cache::embedding_cache(size_t capacity, const std::string& directory)
+{
+  require_true(capacity > 0, "embedding cache: capacity must be > 0");
+
+  capacity_ = capacity;
+  directory_ = directory;
+  hits_ = 0;
+  misses_ = 0;
+
+  if(!directory_.empty())
+    require_true(make_directory_(directory_), "embedding cache: cannot create " + directory_);
+}
+
+
+bool embedding_cache::get(uint64_t key, embedding_t& embedding)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto entry = index_.find(key);
+    if(entry != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, entry->second);
+      embedding = entry->second->second;
+      ++hits_;
+      return true;
+    }
+  }
+
+  bool found = !directory_.empty() && load_(key, embedding);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if(found) {
+    insert_(key, embedding);
+    ++hits_;
+  }
+  else {
+    ++misses_;
+  }
+
+  return found;
+}
+
+
+void embedding_cache::put(uint64_t key, const embedding_t& embedding)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    insert_(key, embedding);
+  }
+
+  if(!directory_.empty())
+    save_(key, embedding);
+}
+
+
+size_t embedding_cache::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+
+size_t embedding_cache::get_hits() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+
+size_t embedding_cache::get_misses() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+void embedding_cache::insert_(uint64_t key, const embedding_t& embedding)
+{
+  auto entry = index_.find(key);
+  if(entry != index_.end()) {
+    entry->second->second = embedding;
+    entries_.splice(entries_.begin(), entries_, entry->second);
+    return;
+  }
+
+  entries_.push_front(std::make_pair(key, embedding));
+  index_[key] = entries_.begin();
+
+  if(entries_.size() > capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+
+std::string embedding_cache::file_name_(uint64_t key) const
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+
+  // Two character subdirectories keep directory sizes manageable for large stores.
+  return directory_ + "/" + std::string(name, 2) + "/" + name;
+}
+
+
+bool embedding_cache::load_(uint64_t key, embedding_t& embedding) const
+{
+  std::ifstream file(file_name_(key), std::ios::binary);
+  if(!file)
+    return false;
+
+  char magic[4];
+  uint32_t dims = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&dims), sizeof(dims));
+
+  if(!file || !std::equal(magic, magic + 4, CACHE_MAGIC) || dims == 0 || dims > 65536)
+    return false;
+
+  std::vector<float> values(dims);
+  file.read(reinterpret_cast<char*>(values.data()), dims * sizeof(float));
+  if(!file)
+    return false;
+
+  embedding.set_size(dims);
+  for(uint32_t d = 0; d < dims; ++d)
+    embedding(d) = values[d];
+
+  return true;
+}
+
+
+void embedding_cache::save_(uint64_t key, const embedding_t& embedding) const
+{
+  std::string file_name = file_name_(key);
+  if(!expect_true(make_directory_(file_name.substr(0, file_name.rfind('/'))), "embedding cache: cannot write " + file_name))
+    return;
+
+  std::ostringstream temporary;
+  temporary << file_name << ".tmp." << getpid() << "." << std::hash<std::thread::id>()(std::this_thread::get_id());
+
+  uint32_t dims = embedding.size();
+  std::vector<float> values(dims);
+  for(uint32_t d = 0; d < dims; ++d)
+    values[d] = embedding(d);
+
+  {
+    std::ofstream file(temporary.str(), std::ios::binary | std::ios::trunc);
+    file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    file.write(reinterpret_cast<const char*>(&dims), sizeof(dims));
+    file.write(reinterpret_cast<const char*>(values.data()), dims * sizeof(float));
+
+    if(!expect_true(file.good(), "embedding cache: cannot write " + file_name)) {
+      std::remove(temporary.str().c_str());
+      return;
+    }
+  }
+
+  if(std::rename(temporary.str().c_str(), file_name.c_str()) != 0)
+    std::remove(temporary.str().c_str());
+}
+
+
+} // NAMESPACE facetools
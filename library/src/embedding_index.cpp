@@ -0,0 +1,452 @@
+/* Memory-mapped flat index of face embeddings, with a streaming writer.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/embedding_index.h>
+#include <facetools/distance.h>
+#include <facetools/error.h>
+#include <facetools/parallel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+static const char INDEX_MAGIC[4] = {'F', 'T', 'E', 'I'};
+static const uint32_t INDEX_VERSION = 1;
+
+/** Sections start on cache line boundaries. */
+static const uint64_t INDEX_ALIGNMENT = 64;
+
+static const uint32_t MAX_DIMS = 4096;
+
+/** Rows handed to a scanning thread at a time: large enough to stream, small enough to stay in cache. */
+static const size_t SCAN_BLOCK_ROWS = 4096;
+
+
+// ## PRIVATE STRUCTURES ######################################################
+
+/**
+ * File header. Occupies the first INDEX_ALIGNMENT bytes of the file.
+ */
+struct index_header_t {
+  char magic[4];
+  uint32_t version;
+  uint32_t dims;
+  uint32_t element;
+  uint64_t num_rows;
+  uint64_t rows_offset;
+  uint64_t table_offset;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  uint64_t reserved;
+};
+
+
+/**
+ * Row table record.
+ */
+struct index_record_t {
+  uint64_t name_offset;
+  uint32_t name_size;
+  uint32_t face;
+  int32_t left;
+  int32_t top;
+  int32_t right;
+  int32_t bottom;
+};
+
+static_assert(sizeof(index_header_t) == INDEX_ALIGNMENT, "index header must fill its section");
+static_assert(sizeof(index_record_t) == 32, "index records must be packed");
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+static size_t element_size_(index_element_t element)
+{
+  return element == index_element_t::FLOAT16 ? sizeof(uint16_t) : sizeof(float);
+}
+
+
+static uint64_t align_(uint64_t offset)
+{
+  return (offset + INDEX_ALIGNMENT - 1) / INDEX_ALIGNMENT * INDEX_ALIGNMENT;
+}
+
+
+static void pad_(std::ofstream& file, uint64_t offset)
+{
+  static const char zeros[INDEX_ALIGNMENT] = {};
+  file.write(zeros, align_(offset) - offset);
+}
+
+
+// ## WRITER PUBLIC METHODS ###################################################
+
+embedding_index_writer::embedding_index_writer(const std::string& file_name, size_t dims, index_element_t element)
+{
+  require_true(dims > 0 && dims <= MAX_DIMS, "embedding index: unsupported dimensions");
+
+  file_name_ = file_name;
+  dims_ = dims;
+  element_ = element;
+  finished_ = false;
+  half_row_.resize(dims_);
+
+  file_.open(temporary_name_(), std::ios::binary | std::ios::trunc);
+  require_true(file_.is_open(), "embedding index: cannot write " + temporary_name_());
+
+  // Placeholder, the real header is written by finish().
+  index_header_t header = {};
+  file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+
+embedding_index_writer::~embedding_index_writer()
+{
+  if(!finished_) {
+    file_.close();
+    std::remove(temporary_name_().c_str());
+  }
+}
+
+
+void embedding_index_writer::add(const embedding_t& embedding, const std::string& file, const dlib::rectangle& box,
+  uint32_t face)
+{
+  require_true(size_t(embedding.size()) == dims_, "embedding index: embedding has the wrong dimensions");
+  add(&embedding(0), file, box, face);
+}
+
+
+void embedding_index_writer::add(const float* embedding, const std::string& file, const dlib::rectangle& box,
+  uint32_t face)
+{
+  require_true(!finished_, "embedding index: already finished");
+
+  if(element_ == index_element_t::FLOAT16) {
+    float_to_half(embedding, half_row_.data(), dims_);
+    file_.write(reinterpret_cast<const char*>(half_row_.data()), dims_ * sizeof(uint16_t));
+  }
+  else {
+    file_.write(reinterpret_cast<const char*>(embedding), dims_ * sizeof(float));
+  }
+
+  require_true(static_cast<bool>(file_), "embedding index: cannot write " + temporary_name_());
+
+  // File names repeat for every face in an image, so each is stored once.
+  auto name = string_offsets_.find(file);
+  if(name == string_offsets_.end()) {
+    name = string_offsets_.emplace(file, strings_.size()).first;
+    strings_ += file;
+  }
+
+  index_record_t record;
+  record.name_offset = name->second;
+  record.name_size = file.size();
+  record.face = face;
+  record.left = box.left();
+  record.top = box.top();
+  record.right = box.right();
+  record.bottom = box.bottom();
+
+  const char* bytes = reinterpret_cast<const char*>(&record);
+  table_.insert(table_.end(), bytes, bytes + sizeof(record));
+}
+
+
+void embedding_index_writer::finish()
+{
+  require_true(!finished_, "embedding index: already finished");
+
+  index_header_t header = {};
+  std::copy(INDEX_MAGIC, INDEX_MAGIC + 4, header.magic);
+  header.version = INDEX_VERSION;
+  header.dims = dims_;
+  header.element = static_cast<uint32_t>(element_);
+  header.num_rows = size();
+  header.rows_offset = INDEX_ALIGNMENT;
+
+  uint64_t rows_end = header.rows_offset + header.num_rows * dims_ * element_size_(element_);
+  header.table_offset = align_(rows_end);
+  header.strings_offset = header.table_offset + table_.size();
+  header.strings_size = strings_.size();
+
+  pad_(file_, rows_end);
+  file_.write(table_.data(), table_.size());
+  file_.write(strings_.data(), strings_.size());
+  file_.seekp(0);
+  file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file_.close();
+
+  require_true(!file_.fail(), "embedding index: cannot write " + temporary_name_());
+  require_true(std::rename(temporary_name_().c_str(), file_name_.c_str()) == 0,
+    "embedding index: cannot write " + file_name_);
+
+  finished_ = true;
+}
+
+
+size_t embedding_index_writer::size() const
+{
+  return table_.size() / sizeof(index_record_t);
+}
+
+
+// ## WRITER PRIVATE METHODS ##################################################
+
+std::string embedding_index_writer::temporary_name_() const
+{
+  return file_name_ + ".tmp";
+}
+
+
+// ## READER PUBLIC METHODS ###################################################
+
+embedding_index::embedding_index(const std::string& file_name)
+{
+  file_name_ = file_name;
+  data_ = nullptr;
+  data_size_ = 0;
+
+  int fd = open(file_name_.c_str(), O_RDONLY | O_CLOEXEC);
+  require_true(fd >= 0, "embedding index: cannot open " + file_name_);
+
+  struct stat sb;
+  bool stat_ok = fstat(fd, &sb) == 0;
+  data_size_ = stat_ok ? sb.st_size : 0;
+
+  void* mapping = MAP_FAILED;
+  if(data_size_ >= sizeof(index_header_t))
+    mapping = mmap(nullptr, data_size_, PROT_READ, MAP_SHARED, fd, 0);
+
+  close(fd);
+  require_true(mapping != MAP_FAILED, "embedding index: cannot map " + file_name_);
+
+  data_ = static_cast<const char*>(mapping);
+  madvise(mapping, data_size_, MADV_SEQUENTIAL);
+
+  // Validates everything up front so the scans and lookups never leave the mapping.
+  index_header_t header;
+  std::memcpy(&header, data_, sizeof(header));
+
+  size_t row_bytes = header.dims * element_size_(index_element_t(header.element));
+  bool valid = std::equal(INDEX_MAGIC, INDEX_MAGIC + 4, header.magic) && header.version == INDEX_VERSION &&
+    header.dims > 0 && header.dims <= MAX_DIMS && header.element <= uint32_t(index_element_t::FLOAT16) &&
+    header.rows_offset == INDEX_ALIGNMENT && header.num_rows <= data_size_ / row_bytes &&
+    header.table_offset >= header.rows_offset + header.num_rows * row_bytes &&
+    header.table_offset % INDEX_ALIGNMENT == 0 && header.table_offset <= data_size_ &&
+    header.num_rows <= (data_size_ - header.table_offset) / sizeof(index_record_t) &&
+    header.strings_offset == header.table_offset + header.num_rows * sizeof(index_record_t) &&
+    header.strings_size <= data_size_ - header.strings_offset;
+
+  if(!valid) {
+    munmap(mapping, data_size_);
+    require_true(false, "embedding index: corrupt file " + file_name_);
+  }
+
+  size_ = header.num_rows;
+  dims_ = header.dims;
+  element_ = index_element_t(header.element);
+  rows_ = data_ + header.rows_offset;
+  table_ = data_ + header.table_offset;
+  strings_ = data_ + header.strings_offset;
+
+  // Record bounds are checked once here rather than on every lookup.
+  for(size_t row = 0; row < size_; ++row) {
+    index_record_t record;
+    std::memcpy(&record, table_ + row * sizeof(record), sizeof(record));
+
+    if(record.name_offset > header.strings_size || record.name_size > header.strings_size - record.name_offset) {
+      munmap(mapping, data_size_);
+      require_true(false, "embedding index: corrupt file " + file_name_);
+    }
+  }
+}
+
+
+embedding_index::~embedding_index()
+{
+  munmap(const_cast<char*>(data_), data_size_);
+}
+
+
+size_t embedding_index::size() const
+{
+  return size_;
+}
+
+
+size_t embedding_index::dims() const
+{
+  return dims_;
+}
+
+
+index_element_t embedding_index::element() const
+{
+  return element_;
+}
+
+
+index_entry_t embedding_index::get_entry(size_t row) const
+{
+  require_true(row < size_, "embedding index: row out of range");
+
+  index_record_t record;
+  std::memcpy(&record, table_ + row * sizeof(record), sizeof(record));
+
+  index_entry_t entry;
+  entry.file.assign(strings_ + record.name_offset, record.name_size);
+  entry.box = dlib::rectangle(record.left, record.top, record.right, record.bottom);
+  entry.face = record.face;
+
+  return entry;
+}
+
+
+embedding_t embedding_index::get_embedding(size_t row) const
+{
+  embedding_t embedding(dims_);
+  get_row(row, &embedding(0));
+
+  return embedding;
+}
+
+
+void embedding_index::get_row(size_t row, float* output) const
+{
+  require_true(row < size_, "embedding index: row out of range");
+
+  const char* data = rows_ + row * dims_ * element_size_(element_);
+  if(element_ == index_element_t::FLOAT16)
+    half_to_float(reinterpret_cast<const uint16_t*>(data), output, dims_);
+  else
+    std::memcpy(output, data, dims_ * sizeof(float));
+}
+
+
+std::vector<index_match_t> embedding_index::search(const embedding_t& query, float threshold,
+  unsigned int num_threads) const
+{
+  unsigned int workers = resolve_thread_count(num_threads);
+  float squared_threshold = threshold * threshold;
+  std::vector<std::vector<index_match_t>> matches(workers);
+
+  scan_(query, workers, [&](unsigned int worker, size_t first, const float* distances, size_t count) {
+    for(size_t i = 0; i < count; ++i)
+      if(distances[i] <= squared_threshold)
+        matches[worker].push_back({first + i, distances[i]});
+  });
+
+  return merge_matches_(matches, size_);
+}
+
+
+std::vector<index_match_t> embedding_index::nearest(const embedding_t& query, size_t k, unsigned int num_threads) const
+{
+  unsigned int workers = resolve_thread_count(num_threads);
+  std::vector<std::vector<index_match_t>> matches(workers);
+
+  if(k == 0)
+    return {};
+
+  // Each worker keeps a max-heap of its k nearest rows, so the common case is one comparison against the top.
+  scan_(query, workers, [&](unsigned int worker, size_t first, const float* distances, size_t count) {
+    auto& heap = matches[worker];
+
+    for(size_t i = 0; i < count; ++i) {
+      if(heap.size() == k && !nearer_({first + i, distances[i]}, heap.front()))
+        continue;
+
+      if(heap.size() == k) {
+        std::pop_heap(heap.begin(), heap.end(), nearer_);
+        heap.pop_back();
+      }
+
+      heap.push_back({first + i, distances[i]});
+      std::push_heap(heap.begin(), heap.end(), nearer_);
+    }
+  });
+
+  return merge_matches_(matches, k);
+}
+
+
+// ## READER PRIVATE METHODS ##################################################
+
+void embedding_index::scan_(const embedding_t& query, unsigned int num_threads, const scan_callback_t& callback) const
+{
+  require_true(size_t(query.size()) == dims_, "embedding index: query has the wrong dimensions");
+
+  size_t blocks = (size_ + SCAN_BLOCK_ROWS - 1) / SCAN_BLOCK_ROWS;
+  std::vector<std::vector<float>> distances(num_threads, std::vector<float>(SCAN_BLOCK_ROWS));
+  std::vector<std::vector<float>> buffers(num_threads);
+
+  // Single precision rows are read straight from the mapping. Half precision blocks are widened into a per thread
+  // buffer first, which stays in cache for the distance pass.
+  if(element_ == index_element_t::FLOAT16)
+    for(auto& buffer : buffers)
+      buffer.resize(SCAN_BLOCK_ROWS * dims_);
+
+  parallel_for(0, blocks, num_threads, [&](unsigned int worker, size_t block) {
+    size_t first = block * SCAN_BLOCK_ROWS;
+    size_t count = std::min(SCAN_BLOCK_ROWS, size_ - first);
+    const float* rows = reinterpret_cast<const float*>(rows_) + first * dims_;
+
+    if(element_ == index_element_t::FLOAT16) {
+      half_to_float(reinterpret_cast<const uint16_t*>(rows_) + first * dims_, buffers[worker].data(), count * dims_);
+      rows = buffers[worker].data();
+    }
+
+    squared_distances(&query(0), rows, count, dims_, distances[worker].data());
+    callback(worker, first, distances[worker].data(), count);
+  });
+}
+
+
+bool embedding_index::nearer_(const index_match_t& a, const index_match_t& b)
+{
+  return a.distance < b.distance || (a.distance == b.distance && a.row < b.row);
+}
+
+
+std::vector<index_match_t> embedding_index::merge_matches_(const std::vector<std::vector<index_match_t>>& matches,
+  size_t limit)
+{
+  std::vector<index_match_t> result;
+  for(auto& worker_matches : matches)
+    result.insert(result.end(), worker_matches.begin(), worker_matches.end());
+
+  std::sort(result.begin(), result.end(), nearer_);
+  if(result.size() > limit)
+    result.resize(limit);
+
+  for(auto& match : result)
+    match.distance = std::sqrt(match.distance);
+
+  return result;
+}
+
+
+} // NAMESPACE facetools
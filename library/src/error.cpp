@@ -41,4 +41,13 @@ void require_true(bool expression, std::string message)
 }
 
 
+void require_true(bool expression, const char* message)
+{
+  if(expression)
+    return;
+
+  throw std::runtime_error(message);
+}
+
+
 } // NAMESPACE facetools
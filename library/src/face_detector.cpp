@@ -22,6 +22,8 @@
 
 #include <facetools/face_detector.h>
 #include <facetools/error.h>
+#include <facetools/stats.h>
+#include <facetools/trace.h>
 
 #include <algorithm>
 
@@ -50,7 +52,13 @@ face_detector::face_detector(const face_detector_parameters_t& params)
 
 void face_detector::align(face& face, const dlib::matrix<dlib::rgb_pixel>& image)
 {
-  auto shape = shape_predictor_(image, face.bounding_box);
+  dlib::full_object_detection shape;
+  {
+    stat_timer timer(stat_timer_t::SHAPE_PREDICT);
+    shape = shape_predictor_(image, face.bounding_box);
+  }
+
+  stat_timer timer(stat_timer_t::CHIP_EXTRACT);
   dlib::matrix<dlib::rgb_pixel> face_chip;
   dlib::extract_image_chip(image, dlib::get_face_chip_details(shape,150,0.25), face_chip);
   face.image = face_chip;
@@ -69,23 +77,32 @@ std::vector<face> face_detector::detect(dlib::matrix<dlib::rgb_pixel>& image)
   int max_size = std::max(image.nr(), image.nc());
   int times_scaled = 0;
 
-  while(max_size < params_.max_scaling_length && times_scaled < params_.max_scaling_times) {
-    dlib::pyramid_up(image);
-    max_size = std::max(image.nr(), image.nc());
-    ++times_scaled;
+  if(max_size < params_.max_scaling_length && params_.max_scaling_times > 0) {
+    stat_timer timer(stat_timer_t::PYRAMID_UP);
+
+    while(max_size < params_.max_scaling_length && times_scaled < params_.max_scaling_times) {
+      dlib::pyramid_up(image);
+      max_size = std::max(image.nr(), image.nc());
+      ++times_scaled;
+    }
   }
 
-  if(params_.detector_type == face_detector_type_t::MMOD)
-    return mmod_detection_(image);
-  else
-    return frontal_face_detection_(image);
+  stat_timer timer(stat_timer_t::DETECT);
+  auto faces = params_.detector_type == face_detector_type_t::MMOD ? mmod_detection_(image) :
+    frontal_face_detection_(image);
+
+  add_stat(stat_counter_t::FACES, faces.size());
+  return faces;
 }
 
 
 std::vector<face> face_detector::detect(const std::string image_file)
 {
   dlib::matrix<dlib::rgb_pixel> image;
-  dlib::load_image(image, image_file);
+  {
+    stat_timer timer(stat_timer_t::DECODE);
+    dlib::load_image(image, image_file);
+  }
 
   return detect(image);
 }
@@ -95,6 +112,7 @@ dlib::matrix<dlib::rgb_pixel> face_detector::downscale_image(const dlib::matrix<
 {
   int max_dimension = std::max(input_image.nr(), input_image.nc());
 
+  stat_timer timer(stat_timer_t::DOWNSCALE);
   dlib::matrix<dlib::rgb_pixel> image;
 
   if(max_dimension > params_.max_scaling_length) {
@@ -115,7 +133,10 @@ dlib::matrix<dlib::rgb_pixel> face_detector::downscale_image(const dlib::matrix<
 std::vector<face> face_detector::extract_faces(const std::string image_file)
 {
     dlib::matrix<dlib::rgb_pixel> image;
-    dlib::load_image(image, image_file);
+    {
+      stat_timer timer(stat_timer_t::DECODE);
+      dlib::load_image(image, image_file);
+    }
 
     return extract_faces(image);
 }
@@ -123,6 +144,7 @@ std::vector<face> face_detector::extract_faces(const std::string image_file)
 
 std::vector<face> face_detector::extract_faces(dlib::matrix<dlib::rgb_pixel>& image)
 {
+    trace_span span("extract_faces", "facetools");
     auto resized_image = downscale_image(image);
     auto faces = detect(resized_image);
     align(faces, resized_image);
@@ -22,7 +22,12 @@
 // ## INCLUDES ################################################################
 
 #include <facetools/face_recogniser.h>
+#include <facetools/chinese_whispers.h>
 #include <facetools/error.h>
+#include <facetools/hash.h>
+#include <facetools/similarity_graph.h>
+#include <facetools/stats.h>
+#include <facetools/trace.h>
 
 
 // ## NAMESPACES ##############################################################
@@ -38,15 +43,45 @@ face_recogniser::face_recogniser(const face_recogniser_parameters_t& params)
 
   params_.face_difference_threshold = params.face_difference_threshold;
   params_.jitter_images = params.jitter_images;
+  params_.num_threads = params.num_threads;
   dlib::deserialize(params.recogniser_model_file) >> recogniser_;
+
+  model_hash_ = 0;
+  if(params.embedding_cache_size) {
+    cache_ = std::make_shared<embedding_cache>(params.embedding_cache_size, params.embedding_cache_directory);
+    model_hash_ = hash_file(params.recogniser_model_file);
+  }
 }
 
 
 embedding_t face_recogniser::get_embedding(const face& input_face)
 {
+  trace_span span("get_embedding", "facetools", "faces", 1);
+
+  uint64_t key = 0;
+  embedding_t embedding;
+
+  if(cache_) {
+    key = cache_key_(input_face, false);
+    if(cache_->get(key, embedding)) {
+      add_stat(stat_counter_t::EMBEDDING_CACHE_HITS);
+      return embedding;
+    }
+  }
+
   std::vector<dlib::matrix<dlib::rgb_pixel>> face;
   face.push_back(input_face.image);
-  auto embeddings = recogniser_(face);
+
+  std::vector<embedding_t> embeddings;
+  {
+    stat_timer timer(stat_timer_t::EMBED);
+    embeddings = recogniser_(face);
+  }
+
+  add_stat(stat_counter_t::EMBEDDINGS);
+
+  if(cache_)
+    cache_->put(key, embeddings[0]);
 
   return embeddings[0];
 }
@@ -54,25 +89,52 @@ embedding_t face_recogniser::get_embedding(const face& input_face)
 
 std::vector<embedding_t> face_recogniser::get_embedding(const std::vector<face>& input_faces)
 {
+  trace_span span("get_embedding", "facetools", "faces", input_faces.size());
   unsigned int input_faces_size = input_faces.size();
-  std::vector<dlib::matrix<dlib::rgb_pixel>> faces(input_faces_size);
+  std::vector<embedding_t> embeddings(input_faces_size);
+  std::vector<uint64_t> keys(input_faces_size);
+  std::vector<unsigned int> misses;
+
+  for(unsigned int i=0; i<input_faces_size; i++) {
+    if(cache_) {
+      keys[i] = cache_key_(input_faces[i], params_.jitter_images);
+      if(cache_->get(keys[i], embeddings[i]))
+        continue;
+    }
 
-  std::vector<embedding_t> embeddings;
+    misses.push_back(i);
+  }
+
+  add_stat(stat_counter_t::EMBEDDING_CACHE_HITS, input_faces_size - misses.size());
+  add_stat(stat_counter_t::EMBEDDINGS, misses.size());
 
   if(params_.jitter_images) {
-    for(int i=0; i<input_faces_size; i++) {
+    for(auto i : misses) {
       auto jitter_stack = jitter_image_(input_faces[i].image);
+      stat_timer timer(stat_timer_t::EMBED);
       dlib::matrix<float,0,1> face_descriptor = dlib::mean(dlib::mat(recogniser_(jitter_stack)));
-      embeddings.push_back(std::move(face_descriptor));
+      embeddings[i] = std::move(face_descriptor);
     }
   }
-  else {
-    for(int i=0; i<input_faces_size; i++)
-      faces[i] = input_faces[i].image;
+  else if(!misses.empty()) {
+    std::vector<dlib::matrix<dlib::rgb_pixel>> faces(misses.size());
+    for(size_t i=0; i<misses.size(); i++)
+      faces[i] = input_faces[misses[i]].image;
+
+    std::vector<embedding_t> computed;
+    {
+      stat_timer timer(stat_timer_t::EMBED);
+      computed = recogniser_(faces);
+    }
 
-    embeddings = recogniser_(faces);
+    for(size_t i=0; i<misses.size(); i++)
+      embeddings[misses[i]] = std::move(computed[i]);
   }
 
+  if(cache_)
+    for(auto i : misses)
+      cache_->put(keys[i], embeddings[i]);
+
   return embeddings;
 }
 
@@ -96,57 +158,36 @@ void face_recogniser::set_jitter(bool state) noexcept
 
 // ## PRIVATE METHODS #########################################################
 
-size_t face_recogniser::chinese_whispers_get_unvisited_faces_(std::vector<bool>& visited_face, const size_t labels_size)
+uint64_t face_recogniser::cache_key_(const face& input_face, bool jitter) const
 {
-  for(size_t i=0; i<labels_size; ++i)
-    visited_face[i] = true;
+  auto& image = input_face.image;
+  uint64_t key = hash_combine(model_hash_, jitter);
+  key = hash_combine(key, image.nr());
+  key = hash_combine(key, image.nc());
 
-  size_t unvisited_count = 0;
-  for(auto visited : visited_face)
-    if(!visited)
-      ++unvisited_count;
+  if(image.size())
+    key = hash_bytes(&image(0,0), image.size() * sizeof(dlib::rgb_pixel), key);
 
-  return unvisited_count;
-}
-
-
-void face_recogniser::chinese_whispers_add_remaining_faces_(std::vector<facelist_t>& people, const std::vector<bool>& visited_face,
-  const size_t faces_size, const size_t num_clusters)
-{
-  size_t write_position = num_clusters;
-  for(size_t i=0; i<faces_size; ++i) {
-    if(!visited_face[i]) {
-      people[write_position].push_back(i);
-      ++write_position;
-    }
-  }
+  return key;
 }
 
 
 std::vector<facelist_t> face_recogniser::get_chinese_whispers_clusters_(const std::vector<embedding_t>& embeddings)
 {
-  size_t faces_size = embeddings.size();
+  auto edges = find_similar_pairs(embeddings, params_.face_difference_threshold, params_.num_threads);
 
-  std::vector<dlib::sample_pair> edges;
-  for (size_t i = 0; i < faces_size; ++i)
-    for (size_t j = i+1; j < faces_size; ++j)
-      if (dlib::length(embeddings[i]-embeddings[j]) < params_.face_difference_threshold)
-        edges.push_back(dlib::sample_pair(i,j));
+  // Photos of one person form a clique, so a coloured sweep would run one pass per photo.
+  chinese_whispers_parameters_t whispers_params;
+  whispers_params.sweep = chinese_whispers_sweep_t::SYNCHRONOUS;
+  whispers_params.num_threads = params_.num_threads;
 
   std::vector<unsigned long> labels;
-  const auto num_clusters = dlib::chinese_whispers(edges, labels);
-  auto labels_size = labels.size();
+  const auto num_clusters = chinese_whispers(edges, embeddings.size(), labels, whispers_params);
 
-  std::vector<bool> visited_face(faces_size);
-  auto unvisited_count = chinese_whispers_get_unvisited_faces_(visited_face, labels_size);
-
-  std::vector<facelist_t> people(num_clusters + unvisited_count);
-
-  for(size_t i=0; i<labels_size; ++i)
+  std::vector<facelist_t> people(num_clusters);
+  for(size_t i=0; i<labels.size(); ++i)
     people[labels[i]].push_back(i);
 
-  chinese_whispers_add_remaining_faces_(people, visited_face, faces_size, num_clusters);
-
   return people;
 }
 
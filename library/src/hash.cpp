@@ -0,0 +1,125 @@
+/* Fast non-cryptographic hashing used for cache keys.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/hash.h>
+#include <facetools/error.h>
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ULL;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t PRIME3 = 0x165667b19e3779f9ULL;
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+static inline uint64_t rotate_left_(uint64_t value, int bits) noexcept
+{
+  return (value << bits) | (value >> (64 - bits));
+}
+
+
+static inline uint64_t read64_(const unsigned char* data) noexcept
+{
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+
+static inline uint64_t round_(uint64_t accumulator, uint64_t input) noexcept
+{
+  accumulator += input * PRIME2;
+  accumulator = rotate_left_(accumulator, 31);
+  return accumulator * PRIME1;
+}
+
+
+static inline uint64_t avalanche_(uint64_t hash) noexcept
+{
+  hash ^= hash >> 33;
+  hash *= PRIME2;
+  hash ^= hash >> 29;
+  hash *= PRIME3;
+  return hash ^ (hash >> 32);
+}
+
+
+// ## FUNCTION DEFINITIONS ####################################################
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) noexcept
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  const unsigned char* end = bytes + size;
+
+  // Four independent lanes over 32 byte stripes keep the multipliers busy.
+  uint64_t lane0 = seed + PRIME1 + PRIME2;
+  uint64_t lane1 = seed + PRIME2;
+  uint64_t lane2 = seed;
+  uint64_t lane3 = seed - PRIME1;
+
+  for(; bytes + 32 <= end; bytes += 32) {
+    lane0 = round_(lane0, read64_(bytes));
+    lane1 = round_(lane1, read64_(bytes + 8));
+    lane2 = round_(lane2, read64_(bytes + 16));
+    lane3 = round_(lane3, read64_(bytes + 24));
+  }
+
+  uint64_t hash = rotate_left_(lane0, 1) + rotate_left_(lane1, 7) + rotate_left_(lane2, 12) + rotate_left_(lane3, 18);
+  hash += size;
+
+  for(; bytes + 8 <= end; bytes += 8)
+    hash = rotate_left_(hash ^ round_(0, read64_(bytes)), 27) * PRIME1 + PRIME3;
+
+  for(; bytes < end; ++bytes)
+    hash = rotate_left_(hash ^ (*bytes * PRIME3), 11) * PRIME1;
+
+  return avalanche_(hash);
+}
+
+
+uint64_t hash_combine(uint64_t hash, uint64_t value) noexcept
+{
+  return avalanche_(round_(hash, value) ^ rotate_left_(hash, 17));
+}
+
+
+uint64_t hash_file(const std::string& file_name)
+{
+  std::ifstream file(file_name, std::ios::binary);
+  require_true(file.good(), "hash: cannot open " + file_name);
+
+  std::vector<char> buffer(1 << 20);
+  uint64_t hash = 0;
+
+  while(file) {
+    file.read(buffer.data(), buffer.size());
+    auto bytes_read = file.gcount();
+    if(bytes_read > 0)
+      hash = hash_bytes(buffer.data(), bytes_read, hash);
+  }
+
+  return hash;
+}
+
+
+} // NAMESPACE facetools
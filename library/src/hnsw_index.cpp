@@ -0,0 +1,539 @@
+/* Hierarchical navigable small world graph for approximate nearest neighbour
+ * queries over face embeddings.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/hnsw_index.h>
+#include <facetools/distance.h>
+#include <facetools/error.h>
+#include <facetools/hash.h>
+#include <facetools/parallel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <queue>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+static const char HNSW_MAGIC[4] = {'F', 'T', 'H', 'N'};
+static const uint32_t HNSW_VERSION = 1;
+
+/** Levels are capped so a freak draw cannot build a tower of empty layers. */
+static const int MAX_LEVEL = 32;
+
+static const uint32_t MAX_DIMS = 4096;
+
+
+// ## PRIVATE STRUCTURES ######################################################
+
+/**
+ * Per thread record of the nodes a search has seen. A node is visited when its mark equals the current epoch, so
+ * starting a search costs one increment instead of clearing an array the size of the gallery.
+ */
+struct visited_list_t {
+  std::vector<uint32_t> marks;
+  uint32_t epoch = 0;
+
+  void begin(size_t size)
+  {
+    if(marks.size() < size)
+      marks.resize(size, 0);
+
+    if(++epoch == 0) {
+      std::fill(marks.begin(), marks.end(), 0);
+      epoch = 1;
+    }
+  }
+
+  bool visit(uint32_t node)
+  {
+    if(marks[node] == epoch)
+      return false;
+
+    marks[node] = epoch;
+    return true;
+  }
+};
+
+static thread_local visited_list_t visited_;
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+template <typename T>
+static void write_value_(std::ostream& stream, const T& value)
+{
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+
+template <typename T>
+static bool read_value_(std::istream& stream, T& value)
+{
+  return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+hnsw_index::hnsw_index(size_t dims, const hnsw_parameters_t& params)
+{
+  require_true(dims > 0 && dims <= MAX_DIMS, "hnsw index: unsupported dimensions");
+  require_true(params.M >= 2, "hnsw index: M must be >= 2");
+
+  params_ = params;
+  dims_ = dims;
+  size_ = 0;
+  reserved_ = 0;
+  entry_point_ = 0;
+  max_level_ = -1;
+}
+
+
+void hnsw_index::build(const std::vector<embedding_t>& embeddings)
+{
+  std::vector<float> rows(embeddings.size() * dims_);
+
+  for(size_t i = 0; i < embeddings.size(); ++i) {
+    require_true(size_t(embeddings[i].size()) == dims_, "hnsw index: embedding has the wrong dimensions");
+    std::copy(embeddings[i].begin(), embeddings[i].end(), rows.begin() + i * dims_);
+  }
+
+  build(rows.data(), embeddings.size());
+}
+
+
+void hnsw_index::build(const float* rows, size_t num_rows)
+{
+  size_t first = size_;
+  require_true(first + num_rows <= UINT32_MAX, "hnsw index: too many nodes");
+
+  // Everything a node needs is in place before any thread can reach it, so inserts only ever touch links.
+  reserve_(first + num_rows);
+  std::copy(rows, rows + num_rows * dims_, data_.begin() + first * dims_);
+
+  for(size_t node = first; node < first + num_rows; ++node) {
+    levels_[node] = random_level_(node);
+    links_[node].assign(levels_[node] + 1, std::vector<uint32_t>());
+  }
+
+  size_ = first + num_rows;
+
+  parallel_for(first, first + num_rows, params_.num_threads, [&](unsigned int, size_t node) {
+    insert_(node);
+  });
+}
+
+
+size_t hnsw_index::insert(const embedding_t& embedding)
+{
+  require_true(size_t(embedding.size()) == dims_, "hnsw index: embedding has the wrong dimensions");
+  build(&embedding(0), 1);
+
+  return size_ - 1;
+}
+
+
+std::vector<index_match_t> hnsw_index::knn(const embedding_t& query, size_t k, size_t ef) const
+{
+  require_true(size_t(query.size()) == dims_, "hnsw index: query has the wrong dimensions");
+
+  std::vector<index_match_t> matches;
+  if(!size_ || !k)
+    return matches;
+
+  uint32_t entry = descend_(&query(0), entry_point_, max_level_, 1, false);
+  auto candidates = search_layer_(&query(0), entry, std::max(k, ef ? ef : params_.ef_search), 0, false);
+
+  std::sort(candidates.begin(), candidates.end());
+  candidates.resize(std::min(k, candidates.size()));
+
+  for(auto& candidate : candidates)
+    matches.push_back({candidate.second, std::sqrt(candidate.first)});
+
+  return matches;
+}
+
+
+std::vector<index_match_t> hnsw_index::radius(const embedding_t& query, float threshold, size_t ef) const
+{
+  require_true(size_t(query.size()) == dims_, "hnsw index: query has the wrong dimensions");
+
+  std::vector<index_match_t> matches;
+  if(!size_)
+    return matches;
+
+  float squared_threshold = threshold * threshold;
+  uint32_t entry = descend_(&query(0), entry_point_, max_level_, 1, false);
+  std::vector<candidate_t> candidates;
+
+  // A full candidate list whose farthest member is still in range may be hiding more matches.
+  for(ef = std::max<size_t>(ef ? ef : params_.ef_search, 1);; ef *= 2) {
+    candidates = search_layer_(&query(0), entry, ef, 0, false);
+    std::sort(candidates.begin(), candidates.end());
+
+    if(candidates.size() < ef || candidates.back().first > squared_threshold || ef >= size_)
+      break;
+  }
+
+  for(auto& candidate : candidates)
+    if(candidate.first <= squared_threshold)
+      matches.push_back({candidate.second, std::sqrt(candidate.first)});
+
+  return matches;
+}
+
+
+embedding_t hnsw_index::get_embedding(size_t node) const
+{
+  require_true(node < size_, "hnsw index: node out of range");
+
+  embedding_t embedding(dims_);
+  std::copy(row_(node), row_(node) + dims_, embedding.begin());
+
+  return embedding;
+}
+
+
+size_t hnsw_index::size() const
+{
+  return size_;
+}
+
+
+size_t hnsw_index::dims() const
+{
+  return dims_;
+}
+
+
+void hnsw_index::save(const std::string& file_name) const
+{
+  std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+  require_true(file.is_open(), "hnsw index: cannot write " + file_name);
+
+  file.write(HNSW_MAGIC, sizeof(HNSW_MAGIC));
+  write_value_(file, HNSW_VERSION);
+  write_value_(file, uint32_t(dims_));
+  write_value_(file, uint32_t(params_.M));
+  write_value_(file, uint32_t(params_.ef_construction));
+  write_value_(file, uint64_t(size_));
+  write_value_(file, entry_point_);
+  write_value_(file, int32_t(max_level_));
+
+  file.write(reinterpret_cast<const char*>(data_.data()), size_ * dims_ * sizeof(float));
+  file.write(reinterpret_cast<const char*>(levels_.data()), size_);
+
+  for(size_t node = 0; node < size_; ++node) {
+    for(auto& links : links_[node]) {
+      write_value_(file, uint32_t(links.size()));
+      file.write(reinterpret_cast<const char*>(links.data()), links.size() * sizeof(uint32_t));
+    }
+  }
+
+  require_true(static_cast<bool>(file.flush()), "hnsw index: cannot write " + file_name);
+}
+
+
+void hnsw_index::load(const std::string& file_name)
+{
+  std::ifstream file(file_name, std::ios::binary);
+  require_true(file.is_open(), "hnsw index: cannot open " + file_name);
+
+  char magic[4];
+  uint32_t version = 0, dims = 0, M = 0, ef_construction = 0, entry_point = 0;
+  uint64_t size = 0;
+  int32_t max_level = 0;
+  file.read(magic, sizeof(magic));
+
+  bool valid = file && std::equal(magic, magic + 4, HNSW_MAGIC) && read_value_(file, version) &&
+    version == HNSW_VERSION && read_value_(file, dims) && dims > 0 && dims <= MAX_DIMS && read_value_(file, M) &&
+    M >= 2 && read_value_(file, ef_construction) && read_value_(file, size) && size <= UINT32_MAX &&
+    read_value_(file, entry_point) && read_value_(file, max_level) && max_level <= MAX_LEVEL &&
+    (size ? entry_point < size && max_level >= 0 : max_level == -1);
+  require_true(valid, "hnsw index: corrupt file " + file_name);
+
+  hnsw_parameters_t params = params_;
+  params.M = M;
+  params.ef_construction = ef_construction;
+  hnsw_index index(dims, params);
+
+  index.reserve_(size);
+  index.size_ = size;
+  index.entry_point_ = entry_point;
+  index.max_level_ = max_level;
+
+  file.read(reinterpret_cast<char*>(index.data_.data()), size * dims * sizeof(float));
+  file.read(reinterpret_cast<char*>(index.levels_.data()), size);
+  require_true(static_cast<bool>(file), "hnsw index: corrupt file " + file_name);
+
+  for(size_t node = 0; node < size; ++node) {
+    require_true(index.levels_[node] <= max_level, "hnsw index: corrupt file " + file_name);
+    index.links_[node].resize(index.levels_[node] + 1);
+
+    for(int level = 0; level <= index.levels_[node]; ++level) {
+      auto& links = index.links_[node][level];
+      uint32_t count = 0;
+
+      require_true(read_value_(file, count) && count <= index.max_links_(level), "hnsw index: corrupt file " +
+        file_name);
+      links.resize(count);
+      file.read(reinterpret_cast<char*>(links.data()), count * sizeof(uint32_t));
+
+      // A link must point at a node that exists on the layer, or searches would read past the arrays.
+      require_true(static_cast<bool>(file), "hnsw index: corrupt file " + file_name);
+      for(auto link : links)
+        require_true(link < size && index.levels_[link] >= level, "hnsw index: corrupt file " + file_name);
+    }
+  }
+
+  require_true(!size || index.levels_[entry_point] == max_level, "hnsw index: corrupt file " + file_name);
+
+  params_ = index.params_;
+  dims_ = index.dims_;
+  size_ = index.size_;
+  data_ = std::move(index.data_);
+  levels_ = std::move(index.levels_);
+  links_ = std::move(index.links_);
+  node_mutexes_ = std::move(index.node_mutexes_);
+  reserved_ = index.reserved_;
+  entry_point_ = index.entry_point_;
+  max_level_ = index.max_level_;
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+void hnsw_index::reserve_(size_t capacity)
+{
+  data_.resize(capacity * dims_);
+  levels_.resize(capacity);
+  links_.resize(capacity);
+
+  if(capacity > reserved_) {
+    reserved_ = std::max(capacity, 2 * reserved_);
+    node_mutexes_.reset(new std::mutex[reserved_]);
+  }
+}
+
+
+int hnsw_index::random_level_(size_t node) const
+{
+  // Levels hash the node number rather than draw from a shared generator, so they do not depend on thread timing.
+  double uniform = ((hash_combine(params_.seed, node) >> 11) + 1) * (1.0 / 9007199254740992.0);
+  int level = -std::log(uniform) / std::log(double(params_.M));
+
+  return std::min(level, MAX_LEVEL);
+}
+
+
+void hnsw_index::insert_(uint32_t node)
+{
+  const float* query = row_(node);
+  int level = levels_[node];
+
+  // A node that raises the top of the graph becomes the entry point, and holds the lock until it is linked so
+  // nobody starts from it half built.
+  std::unique_lock<std::mutex> entry_lock(entry_mutex_);
+  uint32_t entry = entry_point_;
+  int max_level = max_level_;
+
+  if(max_level < 0) {
+    entry_point_ = node;
+    max_level_ = level;
+    return;
+  }
+
+  if(level <= max_level)
+    entry_lock.unlock();
+
+  entry = descend_(query, entry, max_level, level + 1, true);
+
+  for(int layer = std::min(level, max_level); layer >= 0; --layer) {
+    auto candidates = search_layer_(query, entry, params_.ef_construction, layer, true);
+    entry = std::min_element(candidates.begin(), candidates.end())->second;
+
+    auto neighbours = select_neighbours_(candidates, params_.M);
+
+    {
+      std::lock_guard<std::mutex> lock(node_mutexes_[node]);
+      links_[node][layer] = neighbours;
+    }
+
+    for(auto neighbour : neighbours) {
+      std::lock_guard<std::mutex> lock(node_mutexes_[neighbour]);
+      add_link_(neighbour, node, layer);
+    }
+  }
+
+  if(level > max_level) {
+    entry_point_ = node;
+    max_level_ = level;
+  }
+}
+
+
+std::vector<hnsw_index::candidate_t> hnsw_index::search_layer_(const float* query, uint32_t entry, size_t ef,
+  int level, bool lock) const
+{
+  std::priority_queue<candidate_t, std::vector<candidate_t>, std::greater<candidate_t>> candidates;
+  std::priority_queue<candidate_t> nearest;
+  std::vector<uint32_t> links;
+
+  visited_.begin(size_);
+  visited_.visit(entry);
+
+  float distance = squared_distance(query, row_(entry), dims_);
+  candidates.emplace(distance, entry);
+  nearest.emplace(distance, entry);
+
+  while(!candidates.empty()) {
+    candidate_t current = candidates.top();
+    if(current.first > nearest.top().first && nearest.size() >= ef)
+      break;
+
+    candidates.pop();
+
+    // Concurrent inserts may be rewriting the list, so it is copied under the node's lock.
+    const std::vector<uint32_t>* neighbours = &links_[current.second][level];
+    if(lock) {
+      std::lock_guard<std::mutex> guard(node_mutexes_[current.second]);
+      links = *neighbours;
+      neighbours = &links;
+    }
+
+    for(auto neighbour : *neighbours) {
+      if(!visited_.visit(neighbour))
+        continue;
+
+      distance = squared_distance(query, row_(neighbour), dims_);
+      if(nearest.size() < ef || distance < nearest.top().first) {
+        candidates.emplace(distance, neighbour);
+        nearest.emplace(distance, neighbour);
+
+        if(nearest.size() > ef)
+          nearest.pop();
+      }
+    }
+  }
+
+  std::vector<candidate_t> result;
+  result.reserve(nearest.size());
+
+  for(; !nearest.empty(); nearest.pop())
+    result.push_back(nearest.top());
+
+  return result;
+}
+
+
+uint32_t hnsw_index::descend_(const float* query, uint32_t entry, int from_level, int to_level, bool lock) const
+{
+  float best = squared_distance(query, row_(entry), dims_);
+  std::vector<uint32_t> links;
+
+  for(int level = from_level; level >= to_level; --level) {
+    for(bool improved = true; improved;) {
+      improved = false;
+
+      const std::vector<uint32_t>* neighbours = &links_[entry][level];
+      if(lock) {
+        std::lock_guard<std::mutex> guard(node_mutexes_[entry]);
+        links = *neighbours;
+        neighbours = &links;
+      }
+
+      for(auto neighbour : *neighbours) {
+        float distance = squared_distance(query, row_(neighbour), dims_);
+        if(distance < best) {
+          best = distance;
+          entry = neighbour;
+          improved = true;
+        }
+      }
+    }
+  }
+
+  return entry;
+}
+
+
+std::vector<uint32_t> hnsw_index::select_neighbours_(std::vector<candidate_t> candidates, size_t max_links) const
+{
+  std::sort(candidates.begin(), candidates.end());
+
+  std::vector<uint32_t> neighbours, pruned;
+  for(auto& candidate : candidates) {
+    if(neighbours.size() >= max_links)
+      break;
+
+    bool diverse = true;
+    for(auto neighbour : neighbours) {
+      if(squared_distance(row_(candidate.second), row_(neighbour), dims_) < candidate.first) {
+        diverse = false;
+        break;
+      }
+    }
+
+    if(diverse)
+      neighbours.push_back(candidate.second);
+    else
+      pruned.push_back(candidate.second);
+  }
+
+  for(size_t i = 0; i < pruned.size() && neighbours.size() < max_links; ++i)
+    neighbours.push_back(pruned[i]);
+
+  return neighbours;
+}
+
+
+void hnsw_index::add_link_(uint32_t node, uint32_t neighbour, int level)
+{
+  auto& links = links_[node][level];
+
+  if(links.size() < max_links_(level)) {
+    links.push_back(neighbour);
+    return;
+  }
+
+  std::vector<candidate_t> candidates;
+  candidates.reserve(links.size() + 1);
+  candidates.emplace_back(squared_distance(row_(node), row_(neighbour), dims_), neighbour);
+
+  for(auto link : links)
+    candidates.emplace_back(squared_distance(row_(node), row_(link), dims_), link);
+
+  links = select_neighbours_(std::move(candidates), max_links_(level));
+}
+
+
+size_t hnsw_index::max_links_(int level) const
+{
+  return level ? params_.M : 2 * params_.M;
+}
+
+
+const float* hnsw_index::row_(uint32_t node) const
+{
+  return data_.data() + size_t(node) * dims_;
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,424 @@
+/* Incremental face clustering.
+ * Keeps cluster assignments and representative embeddings between calls, so
+ * new faces can be added to an existing gallery without reclustering it.
+ * Each batch is compared with the cluster representatives; only clusters
+ * that gain an edge to a new face are reclustered (with Chinese whispers)
+ * together with the batch, which lets them merge or split locally.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/incremental_clusterer.h>
+#include <facetools/chinese_whispers.h>
+#include <facetools/distance.h>
+#include <facetools/error.h>
+#include <facetools/parallel.h>
+#include <facetools/similarity_graph.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <utility>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+static const unsigned long NO_CLUSTER = std::numeric_limits<unsigned long>::max();
+
+static const size_t NO_NODE = std::numeric_limits<size_t>::max();
+
+/* Absorbs rounding in the representative distance bound. */
+static const float RADIUS_SLACK = 1e-4f;
+
+/* New faces and representatives per tile of the candidate search. A 64 x 1024 tile of products stays in L2. */
+static const size_t FACE_BLOCK = 64;
+static const size_t REPRESENTATIVE_BLOCK = 1024;
+
+
+// ## PUBLIC METHODS ##########################################################
+
+incremental_clusterer::incremental_clusterer(const incremental_clusterer_parameters_t& params)
+{
+  require_true(params.face_difference_threshold > 0, "incremental clusterer: face difference threshold must be > 0");
+
+  params_ = params;
+  dims_ = 0;
+  num_clusters_ = 0;
+  stale_nodes_ = 0;
+}
+
+
+std::vector<cluster_assignment_t> incremental_clusterer::add(const std::vector<embedding_t>& embeddings)
+{
+  if(embeddings.empty())
+    return std::vector<cluster_assignment_t>();
+
+  auto batch = pack_embeddings(embeddings);
+  if(dims_ == 0)
+    dims_ = embeddings[0].size();
+
+  require_true(dims_ > 0 && size_t(embeddings[0].size()) == dims_,
+    "incremental clusterer: embedding size differs from earlier batches");
+
+  const size_t batch_size = embeddings.size();
+  const size_t first_new = labels_.size();
+
+  // Existing clusters that the batch connects to.
+  auto touched_by_face = find_candidate_clusters_(batch.data(), batch_size);
+  parallel_for(0, batch_size, params_.num_threads, [&](unsigned int, size_t i) {
+    touched_by_face[i] = find_touched_clusters_(&batch[i * dims_], touched_by_face[i]);
+  });
+
+  std::vector<unsigned long> touched;
+  for(auto& clusters : touched_by_face)
+    touched.insert(touched.end(), clusters.begin(), clusters.end());
+  std::sort(touched.begin(), touched.end());
+  touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+  rows_.insert(rows_.end(), batch.begin(), batch.end());
+  labels_.resize(first_new + batch_size, NO_CLUSTER);
+
+  // Recluster the touched clusters together with the batch.
+  std::vector<unsigned int> local_faces;
+  for(auto cluster : touched)
+    local_faces.insert(local_faces.end(), clusters_[cluster].members.begin(), clusters_[cluster].members.end());
+  for(size_t i = 0; i < batch_size; ++i)
+    local_faces.push_back(first_new + i);
+
+  std::vector<float> local_rows(local_faces.size() * dims_);
+  for(size_t i = 0; i < local_faces.size(); ++i)
+    std::copy(&rows_[local_faces[i] * dims_], &rows_[local_faces[i] * dims_] + dims_, &local_rows[i * dims_]);
+
+  auto edges = find_similar_pairs(local_rows.data(), local_faces.size(), dims_, params_.face_difference_threshold,
+    params_.num_threads);
+
+  chinese_whispers_parameters_t whispers_params;
+  whispers_params.seed = params_.seed;
+  whispers_params.num_threads = params_.num_threads;
+
+  std::vector<unsigned long> local_labels;
+  auto num_local_clusters = chinese_whispers(edges, local_faces.size(), local_labels, whispers_params);
+
+  // Each local cluster keeps the identifier of the old cluster it shares the most faces with, largest overlaps
+  // first. Local clusters left over are new clusters (or split off parts); old clusters left over were merged.
+  std::map<std::pair<unsigned long, unsigned long>, size_t> overlap_counts;
+  for(size_t i = 0; i < local_faces.size(); ++i)
+    if(labels_[local_faces[i]] != NO_CLUSTER)
+      ++overlap_counts[std::make_pair(local_labels[i], labels_[local_faces[i]])];
+
+  std::vector<std::pair<size_t, std::pair<unsigned long, unsigned long>>> overlaps;
+  for(auto& entry : overlap_counts)
+    overlaps.push_back(std::make_pair(entry.second, entry.first));
+  std::stable_sort(overlaps.begin(), overlaps.end(), [](const decltype(overlaps)::value_type& a,
+    const decltype(overlaps)::value_type& b) { return a.first > b.first; });
+
+  std::vector<unsigned long> local_to_cluster(num_local_clusters, NO_CLUSTER);
+  std::vector<unsigned long> claimed;
+  for(auto& overlap : overlaps) {
+    unsigned long local = overlap.second.first;
+    unsigned long cluster = overlap.second.second;
+
+    if(local_to_cluster[local] == NO_CLUSTER && std::find(claimed.begin(), claimed.end(), cluster) == claimed.end()) {
+      local_to_cluster[local] = cluster;
+      claimed.push_back(cluster);
+    }
+  }
+
+  for(auto& cluster : local_to_cluster) {
+    if(cluster == NO_CLUSTER) {
+      cluster = clusters_.size();
+      clusters_.push_back(cluster_t());
+      clusters_.back().radius = 0;
+      clusters_.back().node = NO_NODE;
+    }
+  }
+
+  // Apply the new assignments.
+  num_clusters_ -= touched.size();
+  for(auto cluster : touched)
+    clusters_[cluster].members.clear();
+
+  std::vector<cluster_assignment_t> changes;
+  for(size_t i = 0; i < local_faces.size(); ++i) {
+    unsigned int face = local_faces[i];
+    unsigned long cluster = local_to_cluster[local_labels[i]];
+
+    if(labels_[face] != cluster) {
+      labels_[face] = cluster;
+      changes.push_back(cluster_assignment_t{face, cluster});
+    }
+
+    clusters_[cluster].members.push_back(face);
+  }
+
+  std::vector<unsigned long> affected(touched);
+  affected.insert(affected.end(), local_to_cluster.begin(), local_to_cluster.end());
+  std::sort(affected.begin(), affected.end());
+  affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+
+  for(auto cluster : affected) {
+    auto& state = clusters_[cluster];
+    std::sort(state.members.begin(), state.members.end());
+    update_cluster_(state);
+
+    if(!state.members.empty())
+      ++num_clusters_;
+  }
+
+  update_index_(affected);
+
+  std::sort(changes.begin(), changes.end(), [](const cluster_assignment_t& a, const cluster_assignment_t& b) {
+    return a.face < b.face;
+  });
+
+  return changes;
+}
+
+
+unsigned long incremental_clusterer::get_cluster(unsigned int face) const
+{
+  require_true(face < labels_.size(), "incremental clusterer: face index out of range");
+
+  return labels_[face];
+}
+
+
+const facelist_t& incremental_clusterer::get_members(unsigned long cluster) const
+{
+  require_true(cluster < clusters_.size(), "incremental clusterer: cluster identifier out of range");
+
+  return clusters_[cluster].members;
+}
+
+
+std::vector<facelist_t> incremental_clusterer::get_people() const
+{
+  std::vector<facelist_t> people;
+  people.reserve(num_clusters_);
+
+  for(auto& cluster : clusters_)
+    if(!cluster.members.empty())
+      people.push_back(cluster.members);
+
+  return people;
+}
+
+
+embedding_t incremental_clusterer::get_representative(unsigned long cluster) const
+{
+  require_true(cluster < clusters_.size(), "incremental clusterer: cluster identifier out of range");
+
+  auto& representative = clusters_[cluster].representative;
+  embedding_t embedding(representative.size());
+  for(size_t d = 0; d < representative.size(); ++d)
+    embedding(d) = representative[d];
+
+  return embedding;
+}
+
+
+size_t incremental_clusterer::num_clusters() const noexcept
+{
+  return num_clusters_;
+}
+
+
+size_t incremental_clusterer::size() const noexcept
+{
+  return labels_.size();
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+std::vector<std::vector<unsigned long>> incremental_clusterer::find_candidate_clusters_(const float* faces,
+  size_t num_faces) const
+{
+  const float threshold = params_.face_difference_threshold;
+  std::vector<std::vector<unsigned long>> candidates(num_faces);
+
+  if(index_) {
+    float reach = threshold + *radii_.rbegin() + RADIUS_SLACK;
+
+    parallel_for(0, num_faces, params_.num_threads, [&](unsigned int, size_t i) {
+      embedding_t query(dims_);
+      std::copy(&faces[i * dims_], &faces[(i + 1) * dims_], query.begin());
+
+      for(auto& match : index_->radius(query, reach)) {
+        unsigned long c = node_clusters_[match.row];
+        if(c != NO_CLUSTER)
+          candidates[i].push_back(c);
+      }
+
+      std::sort(candidates[i].begin(), candidates[i].end());
+    });
+
+    return candidates;
+  }
+
+  // Every face against every representative, in blocked matrix products rather than one distance at a time.
+  std::vector<unsigned long> live;
+  std::vector<float> representatives;
+  std::vector<float> bounds;
+
+  for(size_t c = 0; c < clusters_.size(); ++c) {
+    auto& cluster = clusters_[c];
+    if(cluster.members.empty())
+      continue;
+
+    float reach = threshold + cluster.radius + RADIUS_SLACK;
+    live.push_back(c);
+    representatives.insert(representatives.end(), cluster.representative.begin(), cluster.representative.end());
+    bounds.push_back(reach * reach);
+  }
+
+  std::vector<float> face_norms(num_faces);
+  std::vector<float> norms(live.size());
+
+  for(size_t i = 0; i < num_faces; ++i)
+    face_norms[i] = dot_product(&faces[i * dims_], &faces[i * dims_], dims_);
+  for(size_t j = 0; j < live.size(); ++j)
+    norms[j] = dot_product(&representatives[j * dims_], &representatives[j * dims_], dims_);
+
+  parallel_for(0, (num_faces + FACE_BLOCK - 1) / FACE_BLOCK, params_.num_threads, [&](unsigned int, size_t block) {
+    size_t face_begin = block * FACE_BLOCK;
+    size_t face_count = std::min(num_faces, face_begin + FACE_BLOCK) - face_begin;
+    std::vector<float> tile(FACE_BLOCK * REPRESENTATIVE_BLOCK);
+
+    for(size_t begin = 0; begin < live.size(); begin += REPRESENTATIVE_BLOCK) {
+      size_t count = std::min(live.size(), begin + REPRESENTATIVE_BLOCK) - begin;
+      pairwise_dot_products(&faces[face_begin * dims_], face_count, &representatives[begin * dims_], count, dims_,
+        tile.data());
+
+      for(size_t i = 0; i < face_count; ++i) {
+        float face_norm = face_norms[face_begin + i];
+
+        for(size_t j = 0; j < count; ++j) {
+          float estimate = face_norm + norms[begin + j] - 2 * tile[i * count + j];
+          if(estimate < bounds[begin + j] + DISTANCE_ESTIMATE_SLACK * (face_norm + norms[begin + j]))
+            candidates[face_begin + i].push_back(live[begin + j]);
+        }
+      }
+    }
+  });
+
+  return candidates;
+}
+
+
+std::vector<unsigned long> incremental_clusterer::find_touched_clusters_(const float* face,
+  const std::vector<unsigned long>& candidates) const
+{
+  const float threshold = params_.face_difference_threshold;
+  const float squared_threshold = threshold * threshold;
+  std::vector<unsigned long> touched;
+
+  for(auto c : candidates) {
+    auto& cluster = clusters_[c];
+
+    // No member can be within the threshold unless the representative is within threshold + radius.
+    float reach = threshold + cluster.radius + RADIUS_SLACK;
+    if(!within_squared_distance(face, cluster.representative.data(), dims_, reach * reach))
+      continue;
+
+    for(auto member : cluster.members) {
+      if(within_squared_distance(face, &rows_[member * dims_], dims_, squared_threshold)) {
+        touched.push_back(c);
+        break;
+      }
+    }
+  }
+
+  return touched;
+}
+
+
+void incremental_clusterer::update_cluster_(cluster_t& cluster)
+{
+  if(!cluster.representative.empty())
+    radii_.erase(radii_.find(cluster.radius));
+
+  if(index_ && cluster.node != NO_NODE) {
+    node_clusters_[cluster.node] = NO_CLUSTER;
+    ++stale_nodes_;
+  }
+
+  cluster.radius = 0;
+  cluster.node = NO_NODE;
+
+  if(cluster.members.empty()) {
+    cluster.representative.clear();
+    return;
+  }
+
+  cluster.representative.assign(dims_, 0);
+  for(auto member : cluster.members)
+    for(size_t d = 0; d < dims_; ++d)
+      cluster.representative[d] += rows_[member * dims_ + d];
+
+  for(auto& value : cluster.representative)
+    value /= cluster.members.size();
+
+  for(auto member : cluster.members)
+    cluster.radius = std::max(cluster.radius,
+      std::sqrt(squared_distance(cluster.representative.data(), &rows_[member * dims_], dims_)));
+
+  radii_.insert(cluster.radius);
+}
+
+
+void incremental_clusterer::update_index_(const std::vector<unsigned long>& affected)
+{
+  if(num_clusters_ < params_.index_clusters) {
+    index_.reset();
+    return;
+  }
+
+  std::vector<unsigned long> inserted;
+
+  if(index_ && stale_nodes_ <= num_clusters_) {
+    for(auto c : affected)
+      if(!clusters_[c].members.empty())
+        inserted.push_back(c);
+  }
+  else {
+    hnsw_parameters_t index_params;
+    index_params.seed = params_.seed;
+    index_params.num_threads = params_.num_threads;
+
+    index_.reset(new hnsw_index(dims_, index_params));
+    node_clusters_.clear();
+    stale_nodes_ = 0;
+
+    for(size_t c = 0; c < clusters_.size(); ++c)
+      if(!clusters_[c].members.empty())
+        inserted.push_back(c);
+  }
+
+  std::vector<float> rows(inserted.size() * dims_);
+  for(size_t i = 0; i < inserted.size(); ++i) {
+    auto& cluster = clusters_[inserted[i]];
+    std::copy(cluster.representative.begin(), cluster.representative.end(), &rows[i * dims_]);
+    cluster.node = node_clusters_.size();
+    node_clusters_.push_back(inserted[i]);
+  }
+
+  if(!inserted.empty())
+    index_->build(rows.data(), inserted.size());
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,448 @@
+/* Inverted file index with product quantised codes, for galleries too large
+ * to hold as float embeddings.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/ivfpq_index.h>
+#include <facetools/distance.h>
+#include <facetools/error.h>
+#include <facetools/hash.h>
+#include <facetools/parallel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <utility>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+static const char IVFPQ_MAGIC[4] = {'F', 'T', 'I', 'P'};
+static const uint32_t IVFPQ_VERSION = 1;
+
+/** Centroids per sub-quantiser: one byte per code element. */
+static const size_t CODEBOOK_SIZE = 256;
+
+/** Rows assigned per work item when clustering. */
+static const size_t ASSIGN_BLOCK_ROWS = 256;
+
+static const uint32_t MAX_DIMS = 4096;
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+template <typename T>
+static void write_value_(std::ostream& stream, const T& value)
+{
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+
+template <typename T>
+static bool read_value_(std::istream& stream, T& value)
+{
+  return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+
+/**
+ * Finds the nearest centroid of each row, in blocks on a pool of threads.
+ */
+static void nearest_centroids_(const float* rows, size_t num_rows, const float* centroids, size_t num_centroids,
+  size_t dims, unsigned int num_threads, uint32_t* nearest)
+{
+  size_t blocks = (num_rows + ASSIGN_BLOCK_ROWS - 1) / ASSIGN_BLOCK_ROWS;
+  unsigned int workers = resolve_thread_count(num_threads);
+  std::vector<std::vector<float>> distances(workers, std::vector<float>(ASSIGN_BLOCK_ROWS * num_centroids));
+
+  parallel_for(0, blocks, workers, [&](unsigned int worker, size_t block) {
+    size_t first = block * ASSIGN_BLOCK_ROWS;
+    size_t count = std::min(ASSIGN_BLOCK_ROWS, num_rows - first);
+    float* block_distances = distances[worker].data();
+
+    pairwise_squared_distances(rows + first * dims, count, centroids, num_centroids, dims, block_distances);
+
+    for(size_t i = 0; i < count; ++i) {
+      const float* row_distances = block_distances + i * num_centroids;
+      nearest[first + i] = std::min_element(row_distances, row_distances + num_centroids) - row_distances;
+    }
+  });
+}
+
+
+/**
+ * Lloyd's k-means. Centroids start on distinct seeded sample rows, and a centroid left empty by an iteration is
+ * moved onto a row of the largest cluster so none go to waste.
+ */
+static void kmeans_(const float* rows, size_t num_rows, size_t dims, size_t k, unsigned int iterations,
+  uint64_t seed, unsigned int num_threads, float* centroids)
+{
+  std::vector<std::pair<uint64_t, size_t>> order(num_rows);
+  for(size_t i = 0; i < num_rows; ++i)
+    order[i] = std::make_pair(hash_combine(seed, i), i);
+
+  std::partial_sort(order.begin(), order.begin() + k, order.end());
+  for(size_t c = 0; c < k; ++c)
+    std::copy(rows + order[c].second * dims, rows + (order[c].second + 1) * dims, centroids + c * dims);
+
+  std::vector<uint32_t> assignment(num_rows);
+  std::vector<double> sums(k * dims);
+  std::vector<size_t> counts(k);
+
+  for(unsigned int iteration = 0; iteration < iterations; ++iteration) {
+    nearest_centroids_(rows, num_rows, centroids, k, dims, num_threads, assignment.data());
+
+    std::fill(sums.begin(), sums.end(), 0.0);
+    std::fill(counts.begin(), counts.end(), 0);
+
+    for(size_t i = 0; i < num_rows; ++i) {
+      double* sum = &sums[assignment[i] * dims];
+      for(size_t d = 0; d < dims; ++d)
+        sum[d] += rows[i * dims + d];
+
+      ++counts[assignment[i]];
+    }
+
+    size_t largest = std::max_element(counts.begin(), counts.end()) - counts.begin();
+
+    for(size_t c = 0; c < k; ++c) {
+      if(counts[c]) {
+        for(size_t d = 0; d < dims; ++d)
+          centroids[c * dims + d] = sums[c * dims + d] / counts[c];
+
+        continue;
+      }
+
+      // Reseeds on a member of the largest cluster, nudged so the two split it on the next pass.
+      for(size_t i = hash_combine(seed ^ iteration, c) % num_rows;; i = (i + 1) % num_rows) {
+        if(assignment[i] == largest) {
+          for(size_t d = 0; d < dims; ++d)
+            centroids[c * dims + d] = rows[i * dims + d] * (1.0f + 1e-4f * ((d & 1) ? 1 : -1));
+
+          break;
+        }
+      }
+    }
+  }
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+ivfpq_index::ivfpq_index(size_t dims, const ivfpq_parameters_t& params)
+{
+  require_true(dims > 0 && dims <= MAX_DIMS, "ivfpq index: unsupported dimensions");
+  require_true(params.num_lists > 0, "ivfpq index: num_lists must be > 0");
+  require_true(params.code_size > 0 && dims % params.code_size == 0, "ivfpq index: code_size must divide dims");
+
+  params_ = params;
+  dims_ = dims;
+  sub_dims_ = dims / params.code_size;
+  size_ = 0;
+}
+
+
+void ivfpq_index::train(const float* sample, size_t num_rows)
+{
+  require_true(num_rows >= params_.num_lists && num_rows >= CODEBOOK_SIZE, "ivfpq index: training sample too small");
+
+  size_t code_size = params_.code_size;
+
+  centroids_.resize(params_.num_lists * dims_);
+  kmeans_(sample, num_rows, dims_, params_.num_lists, params_.training_iterations, params_.seed,
+    params_.num_threads, centroids_.data());
+
+  // Codebooks quantise residuals from the coarse centroids, which are far smaller and more alike than the
+  // embeddings themselves. Each subspace is clustered on its own contiguous slice of the residuals.
+  std::vector<uint32_t> lists(num_rows);
+  assign_(sample, num_rows, lists.data());
+
+  std::vector<float> slice(num_rows * sub_dims_);
+  codebooks_.resize(code_size * CODEBOOK_SIZE * sub_dims_);
+
+  for(size_t s = 0; s < code_size; ++s) {
+    for(size_t i = 0; i < num_rows; ++i)
+      for(size_t d = 0; d < sub_dims_; ++d) {
+        size_t column = s * sub_dims_ + d;
+        slice[i * sub_dims_ + d] = sample[i * dims_ + column] - centroids_[lists[i] * dims_ + column];
+      }
+
+    kmeans_(slice.data(), num_rows, sub_dims_, CODEBOOK_SIZE, params_.training_iterations,
+      hash_combine(params_.seed, s + 1), params_.num_threads, &codebooks_[s * CODEBOOK_SIZE * sub_dims_]);
+  }
+
+  size_ = 0;
+  list_rows_.assign(params_.num_lists, std::vector<uint32_t>());
+  list_codes_.assign(params_.num_lists, std::vector<uint8_t>());
+}
+
+
+void ivfpq_index::train(const std::vector<embedding_t>& sample)
+{
+  std::vector<float> rows(sample.size() * dims_);
+
+  for(size_t i = 0; i < sample.size(); ++i) {
+    require_true(size_t(sample[i].size()) == dims_, "ivfpq index: embedding has the wrong dimensions");
+    std::copy(sample[i].begin(), sample[i].end(), rows.begin() + i * dims_);
+  }
+
+  train(rows.data(), sample.size());
+}
+
+
+void ivfpq_index::add(const float* rows, size_t num_rows, size_t first_row)
+{
+  require_true(trained(), "ivfpq index: not trained");
+  require_true(first_row + num_rows <= UINT32_MAX, "ivfpq index: row numbers must fit in 32 bits");
+
+  std::vector<uint32_t> lists(num_rows);
+  assign_(rows, num_rows, lists.data());
+
+  std::vector<uint8_t> codes(num_rows * params_.code_size);
+  parallel_for(0, num_rows, params_.num_threads, [&](unsigned int, size_t i) {
+    std::vector<float> residual(dims_);
+    for(size_t d = 0; d < dims_; ++d)
+      residual[d] = rows[i * dims_ + d] - centroids_[lists[i] * dims_ + d];
+
+    encode_(residual.data(), &codes[i * params_.code_size]);
+  });
+
+  for(size_t i = 0; i < num_rows; ++i) {
+    list_rows_[lists[i]].push_back(first_row + i);
+    list_codes_[lists[i]].insert(list_codes_[lists[i]].end(), &codes[i * params_.code_size],
+      &codes[(i + 1) * params_.code_size]);
+  }
+
+  size_ += num_rows;
+}
+
+
+void ivfpq_index::add(const embedding_index& store)
+{
+  require_true(store.dims() == dims_, "ivfpq index: store has the wrong dimensions");
+
+  // Blocks keep the float copy small whatever the size of the store.
+  const size_t block_rows = 65536;
+  std::vector<float> rows;
+
+  for(size_t first = 0; first < store.size(); first += block_rows) {
+    size_t count = std::min(block_rows, store.size() - first);
+    rows.resize(count * dims_);
+
+    for(size_t i = 0; i < count; ++i)
+      store.get_row(first + i, &rows[i * dims_]);
+
+    add(rows.data(), count, first);
+  }
+}
+
+
+std::vector<index_match_t> ivfpq_index::search(const embedding_t& query, size_t k, const embedding_index* store,
+  size_t num_probes, size_t rerank) const
+{
+  require_true(trained(), "ivfpq index: not trained");
+  require_true(size_t(query.size()) == dims_, "ivfpq index: query has the wrong dimensions");
+  require_true(!store || store->dims() == dims_, "ivfpq index: store has the wrong dimensions");
+
+  num_probes = std::min<size_t>(num_probes ? num_probes : params_.num_probes, params_.num_lists);
+  size_t candidates = store ? std::max(k, rerank ? rerank : size_t(params_.rerank)) : k;
+  size_t code_size = params_.code_size;
+
+  // Lists to scan, nearest centroid first.
+  std::vector<float> centroid_distances(params_.num_lists);
+  squared_distances(&query(0), centroids_.data(), params_.num_lists, dims_, centroid_distances.data());
+
+  std::vector<std::pair<float, uint32_t>> lists(params_.num_lists);
+  for(uint32_t list = 0; list < params_.num_lists; ++list)
+    lists[list] = std::make_pair(centroid_distances[list], list);
+
+  std::partial_sort(lists.begin(), lists.begin() + num_probes, lists.end());
+
+  // Each worker keeps a max-heap of its best candidates.
+  unsigned int workers = resolve_thread_count(params_.num_threads);
+  std::vector<std::vector<std::pair<float, uint32_t>>> heaps(workers);
+
+  parallel_for(0, num_probes, workers, [&](unsigned int worker, size_t probe) {
+    uint32_t list = lists[probe].second;
+    const auto& rows = list_rows_[list];
+    const uint8_t* codes = list_codes_[list].data();
+    auto& heap = heaps[worker];
+
+    // Distance table: squared distance from each slice of the query residual to every codeword of that slice.
+    std::vector<float> residual(dims_);
+    std::vector<float> table(code_size * CODEBOOK_SIZE);
+
+    for(size_t d = 0; d < dims_; ++d)
+      residual[d] = query(d) - centroids_[list * dims_ + d];
+
+    for(size_t s = 0; s < code_size; ++s)
+      squared_distances(&residual[s * sub_dims_], &codebooks_[s * CODEBOOK_SIZE * sub_dims_], CODEBOOK_SIZE,
+        sub_dims_, &table[s * CODEBOOK_SIZE]);
+
+    for(size_t i = 0; i < rows.size(); ++i, codes += code_size) {
+      float distance = 0;
+      for(size_t s = 0; s < code_size; ++s)
+        distance += table[s * CODEBOOK_SIZE + codes[s]];
+
+      if(heap.size() == candidates && distance >= heap.front().first)
+        continue;
+
+      if(heap.size() == candidates) {
+        std::pop_heap(heap.begin(), heap.end());
+        heap.pop_back();
+      }
+
+      heap.emplace_back(distance, rows[i]);
+      std::push_heap(heap.begin(), heap.end());
+    }
+  });
+
+  std::vector<std::pair<float, uint32_t>> best;
+  for(auto& heap : heaps)
+    best.insert(best.end(), heap.begin(), heap.end());
+
+  std::sort(best.begin(), best.end());
+  if(best.size() > candidates)
+    best.resize(candidates);
+
+  // Re-ranking reads only the shortlisted rows, so a store far larger than memory costs a few page faults.
+  if(store) {
+    std::vector<float> row(dims_);
+    for(auto& candidate : best) {
+      store->get_row(candidate.second, row.data());
+      candidate.first = squared_distance(&query(0), row.data(), dims_);
+    }
+
+    std::sort(best.begin(), best.end());
+  }
+
+  std::vector<index_match_t> matches;
+  for(size_t i = 0; i < best.size() && i < k; ++i)
+    matches.push_back({best[i].second, std::sqrt(best[i].first)});
+
+  return matches;
+}
+
+
+bool ivfpq_index::trained() const
+{
+  return !codebooks_.empty();
+}
+
+
+size_t ivfpq_index::size() const
+{
+  return size_;
+}
+
+
+void ivfpq_index::save(const std::string& file_name) const
+{
+  require_true(trained(), "ivfpq index: not trained");
+
+  std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+  require_true(file.is_open(), "ivfpq index: cannot write " + file_name);
+
+  file.write(IVFPQ_MAGIC, sizeof(IVFPQ_MAGIC));
+  write_value_(file, IVFPQ_VERSION);
+  write_value_(file, uint32_t(dims_));
+  write_value_(file, uint32_t(params_.num_lists));
+  write_value_(file, uint32_t(params_.code_size));
+  write_value_(file, uint64_t(size_));
+
+  file.write(reinterpret_cast<const char*>(centroids_.data()), centroids_.size() * sizeof(float));
+  file.write(reinterpret_cast<const char*>(codebooks_.data()), codebooks_.size() * sizeof(float));
+
+  for(size_t list = 0; list < params_.num_lists; ++list) {
+    write_value_(file, uint64_t(list_rows_[list].size()));
+    file.write(reinterpret_cast<const char*>(list_rows_[list].data()), list_rows_[list].size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char*>(list_codes_[list].data()), list_codes_[list].size());
+  }
+
+  require_true(static_cast<bool>(file.flush()), "ivfpq index: cannot write " + file_name);
+}
+
+
+void ivfpq_index::load(const std::string& file_name)
+{
+  std::ifstream file(file_name, std::ios::binary);
+  require_true(file.is_open(), "ivfpq index: cannot open " + file_name);
+
+  char magic[4];
+  uint32_t version = 0, dims = 0, num_lists = 0, code_size = 0;
+  uint64_t size = 0;
+  file.read(magic, sizeof(magic));
+
+  bool valid = file && std::equal(magic, magic + 4, IVFPQ_MAGIC) && read_value_(file, version) &&
+    version == IVFPQ_VERSION && read_value_(file, dims) && dims > 0 && dims <= MAX_DIMS &&
+    read_value_(file, num_lists) && num_lists > 0 && read_value_(file, code_size) && code_size > 0 &&
+    dims % code_size == 0 && read_value_(file, size);
+  require_true(valid, "ivfpq index: corrupt file " + file_name);
+
+  ivfpq_parameters_t params = params_;
+  params.num_lists = num_lists;
+  params.code_size = code_size;
+  ivfpq_index index(dims, params);
+
+  index.centroids_.resize(size_t(num_lists) * dims);
+  index.codebooks_.resize(size_t(code_size) * CODEBOOK_SIZE * index.sub_dims_);
+  index.list_rows_.resize(num_lists);
+  index.list_codes_.resize(num_lists);
+
+  file.read(reinterpret_cast<char*>(index.centroids_.data()), index.centroids_.size() * sizeof(float));
+  file.read(reinterpret_cast<char*>(index.codebooks_.data()), index.codebooks_.size() * sizeof(float));
+  require_true(static_cast<bool>(file), "ivfpq index: corrupt file " + file_name);
+
+  for(size_t list = 0; list < num_lists; ++list) {
+    uint64_t count = 0;
+    require_true(read_value_(file, count) && index.size_ + count <= size, "ivfpq index: corrupt file " + file_name);
+
+    index.list_rows_[list].resize(count);
+    index.list_codes_[list].resize(count * code_size);
+    file.read(reinterpret_cast<char*>(index.list_rows_[list].data()), count * sizeof(uint32_t));
+    file.read(reinterpret_cast<char*>(index.list_codes_[list].data()), count * code_size);
+    require_true(static_cast<bool>(file), "ivfpq index: corrupt file " + file_name);
+
+    index.size_ += count;
+  }
+
+  require_true(index.size_ == size, "ivfpq index: corrupt file " + file_name);
+
+  *this = std::move(index);
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+void ivfpq_index::assign_(const float* rows, size_t num_rows, uint32_t* lists) const
+{
+  nearest_centroids_(rows, num_rows, centroids_.data(), params_.num_lists, dims_, params_.num_threads, lists);
+}
+
+
+void ivfpq_index::encode_(const float* residual, uint8_t* code) const
+{
+  float distances[CODEBOOK_SIZE];
+
+  for(size_t s = 0; s < params_.code_size; ++s) {
+    squared_distances(residual + s * sub_dims_, &codebooks_[s * CODEBOOK_SIZE * sub_dims_], CODEBOOK_SIZE,
+      sub_dims_, distances);
+    code[s] = std::min_element(distances, distances + CODEBOOK_SIZE) - distances;
+  }
+}
+
+
+} // NAMESPACE facetools
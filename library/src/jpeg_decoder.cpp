@@ -0,0 +1,100 @@
+/* JPEG decoding from memory, for images whose bytes are already loaded, such
+ * as EXIF thumbnails and files read ahead of the decoder.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/jpeg_decoder.h>
+
+#include <csetjmp>
+#include <cstdio>
+#include <jpeglib.h>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+/** Largest image decode_jpeg() accepts, so a corrupt header cannot make it allocate gigabytes. */
+static const unsigned long MAX_DECODE_PIXELS = 1ul << 28;
+
+
+// ## PRIVATE STRUCTURES ######################################################
+
+/** libjpeg error manager that jumps back to the caller instead of exiting. */
+struct jpeg_error_t {
+  jpeg_error_mgr manager;
+  jmp_buf jump;
+};
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+static void jpeg_error_exit(j_common_ptr info)
+{
+  longjmp(reinterpret_cast<jpeg_error_t*>(info->err)->jump, 1);
+}
+
+
+static void jpeg_output_message(j_common_ptr) {}
+
+
+// ## FUNCTION DEFINITIONS ####################################################
+
+bool decode_jpeg(const unsigned char* data, size_t size, dlib::matrix<dlib::rgb_pixel>& image)
+{
+  jpeg_decompress_struct info;
+  jpeg_error_t error;
+  info.err = jpeg_std_error(&error.manager);
+  error.manager.error_exit = jpeg_error_exit;
+  error.manager.output_message = jpeg_output_message;
+
+  // Nothing with a destructor is created after this point, so the jump back skips no cleanup.
+  if(setjmp(error.jump)) {
+    jpeg_destroy_decompress(&info);
+    return false;
+  }
+
+  jpeg_create_decompress(&info);
+  jpeg_mem_src(&info, const_cast<unsigned char*>(data), size);
+  jpeg_read_header(&info, TRUE);
+
+  if(info.image_width == 0 || info.image_height == 0 ||
+    (unsigned long)info.image_width * info.image_height > MAX_DECODE_PIXELS) {
+    jpeg_destroy_decompress(&info);
+    return false;
+  }
+
+  info.out_color_space = JCS_RGB;
+  jpeg_start_decompress(&info);
+
+  image.set_size(info.output_height, info.output_width);
+  JSAMPARRAY row = (*info.mem->alloc_sarray)(reinterpret_cast<j_common_ptr>(&info), JPOOL_IMAGE,
+    info.output_width * info.output_components, 1);
+
+  while(info.output_scanline < info.output_height) {
+    long r = info.output_scanline;
+    jpeg_read_scanlines(&info, row, 1);
+
+    for(long c = 0; c < long(info.output_width); ++c)
+      image(r, c) = dlib::rgb_pixel(row[0][3 * c], row[0][3 * c + 1], row[0][3 * c + 2]);
+  }
+
+  jpeg_finish_decompress(&info);
+  jpeg_destroy_decompress(&info);
+
+  return true;
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,144 @@
+/* Perceptual image hashes for spotting re-encoded and resized copies of the
+ * same photo.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/perceptual_hash.h>
+#include <facetools/error.h>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+/* Thumbnail size. One column more than there are bits per row, as each bit compares two neighbours. */
+static const long HASH_COLUMNS = 9;
+static const long HASH_ROWS = 8;
+
+
+// ## FUNCTION DEFINITIONS ####################################################
+
+uint64_t difference_hash(const dlib::matrix<dlib::rgb_pixel>& image) noexcept
+{
+  const long rows = image.nr();
+  const long columns = image.nc();
+  if(rows == 0 || columns == 0)
+    return 0;
+
+  // Box average: every pixel adds to the thumbnail cell it falls in, so no pixel is skipped however large the image.
+  uint64_t sums[HASH_ROWS][HASH_COLUMNS] = {};
+  uint64_t counts[HASH_ROWS][HASH_COLUMNS] = {};
+  std::vector<long> cell_columns(columns);
+  for(long c = 0; c < columns; ++c)
+    cell_columns[c] = c * HASH_COLUMNS / columns;
+
+  for(long r = 0; r < rows; ++r) {
+    long cell_row = r * HASH_ROWS / rows;
+
+    for(long c = 0; c < columns; ++c) {
+      const dlib::rgb_pixel& pixel = image(r, c);
+      sums[cell_row][cell_columns[c]] += 77 * pixel.red + 150 * pixel.green + 29 * pixel.blue;
+      ++counts[cell_row][cell_columns[c]];
+    }
+  }
+
+  // Averages compared by cross multiplication. Images narrower than the thumbnail leave cells empty, which compare
+  // as black.
+  uint64_t hash = 0;
+  for(long r = 0; r < HASH_ROWS; ++r) {
+    for(long c = 0; c + 1 < HASH_COLUMNS; ++c) {
+      bool darker = sums[r][c] * counts[r][c + 1] < sums[r][c + 1] * counts[r][c];
+      hash = (hash << 1) | darker;
+    }
+  }
+
+  return hash;
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+perceptual_hash_index::perceptual_hash_index(unsigned int radius)
+{
+  require_true(radius < 64, "perceptual hash index: radius must be below 64");
+  radius_ = radius;
+
+  unsigned int num_chunks = radius + 1;
+  unsigned int first = 0;
+  for(unsigned int chunk = 0; chunk < num_chunks; ++chunk) {
+    unsigned int width = 64 / num_chunks + (chunk < 64 % num_chunks);
+    chunks_.push_back({first, width});
+    first += width;
+  }
+
+  tables_.resize(num_chunks);
+}
+
+
+void perceptual_hash_index::insert(uint64_t hash, size_t id)
+{
+  size_t position = hashes_.size();
+  hashes_.push_back({hash, id});
+
+  for(size_t chunk = 0; chunk < chunks_.size(); ++chunk)
+    tables_[chunk][chunk_(hash, chunk)].push_back(position);
+}
+
+
+bool perceptual_hash_index::find(uint64_t hash, size_t& id) const
+{
+  unsigned int best_distance = radius_ + 1;
+  size_t best_position = 0;
+
+  for(size_t chunk = 0; chunk < chunks_.size(); ++chunk) {
+    auto bucket = tables_[chunk].find(chunk_(hash, chunk));
+    if(bucket == tables_[chunk].end())
+      continue;
+
+    for(size_t position : bucket->second) {
+      unsigned int distance = hamming_distance(hash, hashes_[position].first);
+      if(distance < best_distance || (distance == best_distance && position < best_position)) {
+        best_distance = distance;
+        best_position = position;
+      }
+    }
+  }
+
+  if(best_distance > radius_)
+    return false;
+
+  id = hashes_[best_position].second;
+
+  return true;
+}
+
+
+size_t perceptual_hash_index::size() const noexcept
+{
+  return hashes_.size();
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+uint64_t perceptual_hash_index::chunk_(uint64_t hash, size_t chunk) const noexcept
+{
+  unsigned int first = chunks_[chunk].first;
+  unsigned int width = chunks_[chunk].second;
+
+  return width == 64 ? hash : (hash >> first) & ((uint64_t(1) << width) - 1);
+}
+
+
+} // NAMESPACE facetools
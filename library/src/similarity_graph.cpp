@@ -0,0 +1,324 @@
+/* Similarity graph construction for face clustering.
+ * Finds every pair of embeddings closer than a threshold using a blocked,
+ * multi-threaded pass that computes distance tiles from dot products
+ * (|a-b|^2 = |a|^2 + |b|^2 - 2a.b).
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/similarity_graph.h>
+#include <facetools/distance.h>
+#include <facetools/error.h>
+#include <facetools/parallel.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <unistd.h>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+/* Rows per block. A 256 x 256 tile of products plus both 256 x 128 row blocks fit in L2. */
+static const size_t BLOCK_ROWS = 256;
+
+/* Edges read back from the spill file per call. */
+static const size_t SPILL_CHUNK_EDGES = size_t(1) << 20;
+
+/* Nodes per neighbour list sorting task. */
+static const size_t SORT_NODES = 4096;
+
+
+// ## PRIVATE STRUCTURES ######################################################
+
+/* Edge stored compactly while building large graphs. */
+struct compact_edge_t {
+  uint32_t i;
+  uint32_t j;
+};
+
+
+/* Spill file for compact edges, unlinked as soon as it is created and closed on destruction. */
+class edge_spill_file {
+public:
+  edge_spill_file(const std::string& directory) : directory_(directory), fd_(-1), size_(0) {}
+
+  ~edge_spill_file()
+  {
+    if(fd_ >= 0)
+      close(fd_);
+  }
+
+  /* Appends edges. Thread safe. */
+  void append(const std::vector<compact_edge_t>& edges)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if(fd_ < 0) {
+      std::string name = directory_ + "/facetools_edges_XXXXXX";
+      fd_ = mkstemp(&name[0]);
+      require_true(fd_ >= 0, "similarity graph: cannot create a spill file in " + directory_);
+      unlink(name.c_str());
+    }
+
+    const char* data = reinterpret_cast<const char*>(edges.data());
+    size_t bytes = edges.size() * sizeof(compact_edge_t);
+
+    while(bytes) {
+      ssize_t written = write(fd_, data, bytes);
+      if(written < 0 && errno == EINTR)
+        continue;
+
+      require_true(written > 0, "similarity graph: cannot write the spill file");
+      data += written;
+      bytes -= written;
+    }
+
+    size_ += edges.size();
+  }
+
+  /* Number of edges spilled. */
+  size_t size() const
+  {
+    return size_;
+  }
+
+  /* Calls function(edge) for every spilled edge, in the order they were appended. */
+  template <typename function_t>
+  void for_each(function_t function) const
+  {
+    std::vector<compact_edge_t> chunk(std::min(size_, SPILL_CHUNK_EDGES));
+
+    for(size_t first = 0; first < size_; first += chunk.size()) {
+      size_t count = std::min(chunk.size(), size_ - first);
+      char* data = reinterpret_cast<char*>(chunk.data());
+      size_t bytes = count * sizeof(compact_edge_t);
+      off_t offset = first * sizeof(compact_edge_t);
+
+      while(bytes) {
+        ssize_t got = pread(fd_, data, bytes, offset);
+        if(got < 0 && errno == EINTR)
+          continue;
+
+        require_true(got > 0, "similarity graph: cannot read the spill file");
+        data += got;
+        bytes -= got;
+        offset += got;
+      }
+
+      for(size_t e = 0; e < count; ++e)
+        function(chunk[e]);
+    }
+  }
+
+private:
+  std::string directory_;
+  std::mutex mutex_;
+  int fd_;
+  size_t size_;
+};
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/**
+ * Blocked search for the pairs of rows closer than the threshold. Block rows are handed out largest first (row 0
+ * owns the most tiles).
+ * \param rows Contiguous row-major block of num_rows vectors.
+ * \param num_rows Number of rows.
+ * \param dims Number of elements in each row.
+ * \param threshold Distance threshold.
+ * \param workers Number of threads.
+ * \param emit Called as emit(worker, block, i, j) for every pair, with i < j and i in the given block row.
+ */
+template <typename function_t>
+static void scan_similar_pairs(const float* rows, size_t num_rows, size_t dims, float threshold, unsigned int workers,
+  function_t emit)
+{
+  std::vector<float> norms(num_rows);
+  for(size_t i = 0; i < num_rows; ++i)
+    norms[i] = dot_product(&rows[i * dims], &rows[i * dims], dims);
+
+  const float squared_threshold = threshold * threshold;
+  const size_t num_blocks = (num_rows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+
+  std::vector<std::vector<float>> tiles(workers, std::vector<float>(BLOCK_ROWS * BLOCK_ROWS));
+
+  parallel_for(0, num_blocks, workers, [&](unsigned int worker, size_t block) {
+    auto& tile = tiles[worker];
+    size_t row_begin = block * BLOCK_ROWS;
+    size_t row_end = std::min(num_rows, row_begin + BLOCK_ROWS);
+
+    for(size_t column_begin = row_begin; column_begin < num_rows; column_begin += BLOCK_ROWS) {
+      size_t column_end = std::min(num_rows, column_begin + BLOCK_ROWS);
+      size_t num_columns = column_end - column_begin;
+
+      pairwise_dot_products(&rows[row_begin * dims], row_end - row_begin, &rows[column_begin * dims], num_columns,
+        dims, tile.data());
+
+      for(size_t i = row_begin; i < row_end; ++i) {
+        const float* products = &tile[(i - row_begin) * num_columns];
+
+        for(size_t j = std::max(column_begin, i + 1); j < column_end; ++j) {
+          float estimate = norms[i] + norms[j] - 2 * products[j - column_begin];
+          if(estimate < squared_threshold + DISTANCE_ESTIMATE_SLACK * (norms[i] + norms[j]) &&
+            within_squared_distance(&rows[i * dims], &rows[j * dims], dims, squared_threshold))
+            emit(worker, block, i, j);
+        }
+      }
+    }
+  });
+}
+
+
+// ## FUNCTION DEFINITIONS ####################################################
+
+std::vector<float> pack_embeddings(const std::vector<embedding_t>& embeddings)
+{
+  if(embeddings.empty())
+    return std::vector<float>();
+
+  size_t dims = embeddings[0].size();
+  std::vector<float> rows(embeddings.size() * dims);
+
+  for(size_t i = 0; i < embeddings.size(); ++i) {
+    require_true(size_t(embeddings[i].size()) == dims, "similarity graph: embedding sizes differ");
+    for(size_t d = 0; d < dims; ++d)
+      rows[i * dims + d] = embeddings[i](d);
+  }
+
+  return rows;
+}
+
+
+std::vector<dlib::sample_pair> find_similar_pairs(const std::vector<embedding_t>& embeddings, float threshold,
+  unsigned int num_threads)
+{
+  if(embeddings.size() < 2)
+    return std::vector<dlib::sample_pair>();
+
+  auto rows = pack_embeddings(embeddings);
+
+  return find_similar_pairs(rows.data(), embeddings.size(), embeddings[0].size(), threshold, num_threads);
+}
+
+
+std::vector<dlib::sample_pair> find_similar_pairs(const float* rows, size_t num_rows, size_t dims, float threshold,
+  unsigned int num_threads)
+{
+  if(num_rows < 2)
+    return std::vector<dlib::sample_pair>();
+
+  const size_t num_blocks = (num_rows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+  const unsigned int workers = resolve_thread_count(num_threads);
+  std::vector<std::vector<dlib::sample_pair>> block_edges(num_blocks);
+
+  // Each block row writes its own edge buffer.
+  scan_similar_pairs(rows, num_rows, dims, threshold, workers, [&](unsigned int, size_t block, size_t i, size_t j) {
+    block_edges[block].push_back(dlib::sample_pair(i, j));
+  });
+
+  parallel_for(0, num_blocks, workers, [&](unsigned int, size_t block) {
+    std::sort(block_edges[block].begin(), block_edges[block].end(),
+      [](const dlib::sample_pair& a, const dlib::sample_pair& b) {
+        return a.index1() < b.index1() || (a.index1() == b.index1() && a.index2() < b.index2());
+      });
+  });
+
+  size_t num_edges = 0;
+  for(auto& edges : block_edges)
+    num_edges += edges.size();
+
+  std::vector<dlib::sample_pair> edges;
+  edges.reserve(num_edges);
+  for(auto& block : block_edges)
+    edges.insert(edges.end(), block.begin(), block.end());
+
+  return edges;
+}
+
+
+csr_graph build_similarity_graph(const float* rows, size_t num_rows, size_t dims,
+  const similarity_graph_parameters_t& params)
+{
+  require_true(num_rows < (size_t(1) << 32), "similarity graph: too many rows");
+
+  const unsigned int workers = resolve_thread_count(params.num_threads);
+  const size_t buffer_edges = std::max<size_t>(1024, params.memory_budget / sizeof(compact_edge_t) / workers);
+
+  edge_spill_file spill(params.spill_directory);
+  std::vector<std::vector<compact_edge_t>> buffers(workers);
+
+  // Each worker keeps its share of the budget in memory and spills the rest as it goes.
+  scan_similar_pairs(rows, num_rows, dims, params.threshold, workers,
+    [&](unsigned int worker, size_t, size_t i, size_t j) {
+      auto& buffer = buffers[worker];
+      buffer.push_back({uint32_t(i), uint32_t(j)});
+
+      if(buffer.size() >= buffer_edges) {
+        spill.append(buffer);
+        buffer.clear();
+      }
+    });
+
+  // The edges left in memory fit in the budget, but the graph is about to take as much again. Once some edges are on
+  // disk anyway, the rest join them, so the budget and the graph are not held at once.
+  if(spill.size()) {
+    for(auto& buffer : buffers) {
+      spill.append(buffer);
+      std::vector<compact_edge_t>().swap(buffer);
+    }
+  }
+
+  auto for_each_edge = [&](auto function) {
+    spill.for_each(function);
+    for(auto& buffer : buffers)
+      for(auto& edge : buffer)
+        function(edge);
+  };
+
+  csr_graph graph;
+  graph.offsets.assign(num_rows + 1, 0);
+
+  for_each_edge([&](const compact_edge_t& edge) {
+    ++graph.offsets[edge.i + 1];
+    ++graph.offsets[edge.j + 1];
+  });
+
+  for(size_t i = 0; i < num_rows; ++i)
+    graph.offsets[i + 1] += graph.offsets[i];
+
+  graph.neighbours.resize(graph.offsets[num_rows]);
+
+  std::vector<size_t> position(graph.offsets.begin(), graph.offsets.end() - 1);
+  for_each_edge([&](const compact_edge_t& edge) {
+    graph.neighbours[position[edge.i]++] = edge.j;
+    graph.neighbours[position[edge.j]++] = edge.i;
+  });
+
+  // Edges arrive in whatever order the workers found them; sorted lists make the graph deterministic.
+  parallel_for(0, (num_rows + SORT_NODES - 1) / SORT_NODES, workers, [&](unsigned int, size_t task) {
+    size_t end = std::min(num_rows, (task + 1) * SORT_NODES);
+    for(size_t node = task * SORT_NODES; node < end; ++node)
+      std::sort(graph.neighbours.begin() + graph.offsets[node], graph.neighbours.begin() + graph.offsets[node + 1]);
+  });
+
+  return graph;
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,409 @@
+/* Low overhead counters and latency histograms of the detection, recognition and search stages.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/stats.h>
+#include <facetools/trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+static const size_t NUM_COUNTERS = size_t(stat_counter_t::COUNT);
+static const size_t NUM_TIMERS = size_t(stat_timer_t::COUNT);
+
+/** Report names, in enum order. */
+static const char* COUNTER_NAMES[NUM_COUNTERS] = {
+  "images", "bytes_read", "faces", "embeddings", "embedding_cache_hits", "search_cache_hits", "duplicates",
+  "thumbnail_skips", "matches"
+};
+
+static const char* TIMER_NAMES[NUM_TIMERS] = {
+  "decode", "downscale", "pyramid_up", "detect", "shape_predict", "chip_extract", "embed", "match",
+  "thumbnail_check", "perceptual_hash"
+};
+
+
+// ## PRIVATE STRUCTURES ######################################################
+
+/**
+ * Stats of one thread. Only the owning thread writes them, with plain relaxed loads and stores rather than atomic
+ * increments, so recording costs no more than an unshared variable. They are atomics so get_stats() may read them.
+ */
+struct thread_stats_t {
+  std::atomic<uint64_t> counters[NUM_COUNTERS];
+
+  struct {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint64_t> buckets[STAT_HISTOGRAM_BUCKETS];
+  } timers[NUM_TIMERS];
+
+  /** Whether a live thread owns the block. Blocks of exited threads are handed to new threads, totals and all. */
+  std::atomic<bool> owned;
+
+  /** Next block. Blocks are only ever pushed on the list, never removed. */
+  thread_stats_t* next;
+
+  thread_stats_t() : owned(true), next(nullptr)
+  {
+    for(auto& counter : counters)
+      counter.store(0, std::memory_order_relaxed);
+
+    for(auto& timer : timers) {
+      timer.count.store(0, std::memory_order_relaxed);
+      timer.total_ns.store(0, std::memory_order_relaxed);
+      timer.max_ns.store(0, std::memory_order_relaxed);
+
+      for(auto& bucket : timer.buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+
+/**
+ * Claims a block for the calling thread on first use, and hands it back when the thread exits.
+ */
+struct thread_stats_owner_t {
+  thread_stats_t* stats;
+
+  thread_stats_owner_t();
+
+  ~thread_stats_owner_t()
+  {
+    stats->owned.store(false, std::memory_order_release);
+  }
+};
+
+
+// ## PRIVATE VARIABLES #######################################################
+
+static std::atomic<bool> enabled(false);
+
+/** Every block ever claimed. Pipelines start threads for every search, so exited threads' blocks are reused. */
+static std::atomic<thread_stats_t*> all_stats(nullptr);
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+thread_stats_owner_t::thread_stats_owner_t()
+{
+  for(stats = all_stats.load(std::memory_order_acquire); stats; stats = stats->next) {
+    bool owned = false;
+    if(!stats->owned.load(std::memory_order_relaxed) &&
+      stats->owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+      return;
+  }
+
+  stats = new thread_stats_t();
+  stats->next = all_stats.load(std::memory_order_relaxed);
+  while(!all_stats.compare_exchange_weak(stats->next, stats, std::memory_order_release, std::memory_order_relaxed)) {
+  }
+}
+
+
+/**
+ * \return Stats block of the calling thread.
+ */
+static thread_stats_t& local_stats()
+{
+  thread_local thread_stats_owner_t owner;
+  return *owner.stats;
+}
+
+
+/**
+ * Adds to a value only the calling thread writes.
+ * \param value Value.
+ * \param amount Amount added.
+ */
+static inline void add(std::atomic<uint64_t>& value, uint64_t amount)
+{
+  value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+
+/**
+ * \param ns Time in nanoseconds.
+ * \return Its histogram bucket: the position of its highest set bit.
+ */
+static unsigned int bucket_of(uint64_t ns)
+{
+  return 63 - __builtin_clzll(ns | 1);
+}
+
+
+/**
+ * Writes a time in milliseconds, with a fixed width.
+ * \param out Stream to write to.
+ * \param ns Time in nanoseconds.
+ */
+static void write_ms(std::ostream& out, double ns)
+{
+  out << std::setw(11) << std::fixed << std::setprecision(3) << ns / 1e6;
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+double timer_stats_t::mean_ns() const
+{
+  return count ? double(total_ns) / count : 0;
+}
+
+
+double timer_stats_t::percentile_ns(double p) const
+{
+  if(!count)
+    return 0;
+
+  double rank = std::min(std::max(p, 0.0), 100.0) / 100 * count;
+  uint64_t below = 0;
+
+  for(unsigned int i = 0; i < buckets.size(); ++i) {
+    if(!buckets[i] || below + buckets[i] < rank) {
+      below += buckets[i];
+      continue;
+    }
+
+    double low = i ? double(uint64_t(1) << i) : 0;
+    double high = double(uint64_t(1) << i) * 2;
+    double estimate = low + (high - low) * (rank - below) / buckets[i];
+
+    return std::min(estimate, double(max_ns));
+  }
+
+  return max_ns;
+}
+
+
+stat_timer::stat_timer(stat_timer_t timer) : timer_(timer), running_(stats_enabled() || trace_enabled())
+{
+  if(running_)
+    start_ = std::chrono::steady_clock::now();
+}
+
+
+stat_timer::~stat_timer()
+{
+  if(!running_)
+    return;
+
+  // Every timed stage is a span of the trace too.
+  auto end = std::chrono::steady_clock::now();
+  record_time(timer_, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_).count());
+  trace_complete(stat_name(timer_), "stage", start_, end);
+}
+
+
+stats_writer::stats_writer(const std::string& file, unsigned int interval_seconds) :
+  file_(file), interval_seconds_(interval_seconds), stop_(false)
+{
+  if(!interval_seconds_)
+    return;
+
+  thread_ = std::thread([this] {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while(!wake_.wait_for(lock, std::chrono::seconds(interval_seconds_), [this] { return stop_; }))
+      write();
+  });
+}
+
+
+stats_writer::~stats_writer()
+{
+  if(thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+
+    wake_.notify_one();
+    thread_.join();
+  }
+
+  write();
+}
+
+
+bool stats_writer::write() const
+{
+  std::string temporary = file_ + ".tmp";
+
+  {
+    std::ofstream out(temporary);
+    write_stats_json(out, get_stats());
+
+    if(!out)
+      return false;
+  }
+
+  return std::rename(temporary.c_str(), file_.c_str()) == 0;
+}
+
+
+// ## FUNCTION DEFINITIONS ####################################################
+
+void set_stats_enabled(bool state) noexcept
+{
+  enabled.store(state, std::memory_order_relaxed);
+}
+
+
+bool stats_enabled() noexcept
+{
+  return enabled.load(std::memory_order_relaxed);
+}
+
+
+void add_stat(stat_counter_t counter, uint64_t amount) noexcept
+{
+  if(stats_enabled())
+    add(local_stats().counters[size_t(counter)], amount);
+}
+
+
+void record_time(stat_timer_t timer, uint64_t ns) noexcept
+{
+  if(!stats_enabled())
+    return;
+
+  auto& stats = local_stats().timers[size_t(timer)];
+  add(stats.count, 1);
+  add(stats.total_ns, ns);
+  add(stats.buckets[bucket_of(ns)], 1);
+
+  if(ns > stats.max_ns.load(std::memory_order_relaxed))
+    stats.max_ns.store(ns, std::memory_order_relaxed);
+}
+
+
+stats_snapshot_t get_stats()
+{
+  stats_snapshot_t snapshot;
+
+  for(auto stats = all_stats.load(std::memory_order_acquire); stats; stats = stats->next) {
+    for(size_t c = 0; c < NUM_COUNTERS; ++c)
+      snapshot.counters[c] += stats->counters[c].load(std::memory_order_relaxed);
+
+    for(size_t t = 0; t < NUM_TIMERS; ++t) {
+      auto& timer = stats->timers[t];
+      auto& total = snapshot.timers[t];
+
+      total.count += timer.count.load(std::memory_order_relaxed);
+      total.total_ns += timer.total_ns.load(std::memory_order_relaxed);
+      total.max_ns = std::max(total.max_ns, timer.max_ns.load(std::memory_order_relaxed));
+
+      for(unsigned int b = 0; b < STAT_HISTOGRAM_BUCKETS; ++b)
+        total.buckets[b] += timer.buckets[b].load(std::memory_order_relaxed);
+    }
+  }
+
+  return snapshot;
+}
+
+
+const char* stat_name(stat_counter_t counter) noexcept
+{
+  return size_t(counter) < NUM_COUNTERS ? COUNTER_NAMES[size_t(counter)] : "unknown";
+}
+
+
+const char* stat_name(stat_timer_t timer) noexcept
+{
+  return size_t(timer) < NUM_TIMERS ? TIMER_NAMES[size_t(timer)] : "unknown";
+}
+
+
+void write_stats(std::ostream& out, const stats_snapshot_t& stats)
+{
+  auto flags = out.flags();
+  auto precision = out.precision();
+
+  for(size_t c = 0; c < NUM_COUNTERS; ++c)
+    out << std::left << std::setw(22) << COUNTER_NAMES[c] << std::right << std::setw(14) << stats.counters[c] << '\n';
+
+  out << '\n' << std::left << std::setw(16) << "stage (ms)" << std::right << std::setw(10) << "count" <<
+    std::setw(11) << "total" << std::setw(11) << "mean" << std::setw(11) << "p50" << std::setw(11) << "p90" <<
+    std::setw(11) << "p99" << std::setw(11) << "max" << '\n';
+
+  for(size_t t = 0; t < NUM_TIMERS; ++t) {
+    auto& timer = stats.timers[t];
+    if(!timer.count)
+      continue;
+
+    out << std::left << std::setw(16) << TIMER_NAMES[t] << std::right << std::setw(10) << timer.count;
+    write_ms(out, timer.total_ns);
+    write_ms(out, timer.mean_ns());
+    write_ms(out, timer.percentile_ns(50));
+    write_ms(out, timer.percentile_ns(90));
+    write_ms(out, timer.percentile_ns(99));
+    write_ms(out, timer.max_ns);
+    out << '\n';
+  }
+
+  out.flags(flags);
+  out.precision(precision);
+}
+
+
+void write_stats_json(std::ostream& out, const stats_snapshot_t& stats)
+{
+  auto flags = out.flags();
+  auto precision = out.precision();
+  out << std::fixed << std::setprecision(0) << "{\n  \"counters\": {";
+
+  for(size_t c = 0; c < NUM_COUNTERS; ++c)
+    out << (c ? ", " : "") << '"' << COUNTER_NAMES[c] << "\": " << stats.counters[c];
+
+  out << "},\n  \"timers\": {";
+
+  for(size_t t = 0; t < NUM_TIMERS; ++t) {
+    auto& timer = stats.timers[t];
+
+    out << (t ? "," : "") << "\n    \"" << TIMER_NAMES[t] << "\": {\"count\": " << timer.count << ", \"total_ns\": " <<
+      timer.total_ns << ", \"mean_ns\": " << timer.mean_ns() << ", \"max_ns\": " << timer.max_ns << ", \"p50_ns\": " <<
+      timer.percentile_ns(50) << ", \"p90_ns\": " << timer.percentile_ns(90) << ", \"p99_ns\": " <<
+      timer.percentile_ns(99) << ", \"buckets\": {";
+
+    // Keyed by the lower bound of the bucket, in nanoseconds.
+    bool first = true;
+    for(unsigned int b = 0; b < STAT_HISTOGRAM_BUCKETS; ++b) {
+      if(!timer.buckets[b])
+        continue;
+
+      out << (first ? "" : ", ") << '"' << (b ? uint64_t(1) << b : 0) << "\": " << timer.buckets[b];
+      first = false;
+    }
+
+    out << "}}";
+  }
+
+  out << "\n  }\n}\n";
+  out.flags(flags);
+  out.precision(precision);
+}
+
+
+} // NAMESPACE facetools
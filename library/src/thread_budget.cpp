@@ -0,0 +1,110 @@
+/* A budget of cores, split between threads running models and the BLAS threads inside each model call.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/thread_budget.h>
+#include <facetools/cpu_topology.h>
+
+#include <algorithm>
+
+
+// ## PRIVATE FUNCTION DECLARATIONS ###########################################
+
+// OpenBLAS controls, weak so the library still links against other BLAS implementations, or none.
+extern "C" {
+  void openblas_set_num_threads(int threads) __attribute__((weak));
+  int openblas_get_num_threads() __attribute__((weak));
+}
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## PUBLIC METHODS ##########################################################
+
+thread_budget::thread_budget(unsigned int threads)
+{
+  threads_ = threads ? threads : std::max<unsigned int>(1, cpu_topology().cpus().size());
+}
+
+
+unsigned int thread_budget::threads() const noexcept
+{
+  return threads_;
+}
+
+
+thread_split_t thread_budget::split(unsigned int workers) const noexcept
+{
+  thread_split_t split;
+  split.workers = std::max(1u, workers);
+  split.blas_threads = std::max(1u, threads_ / split.workers);
+
+  return split;
+}
+
+
+std::vector<thread_split_t> thread_budget::candidates(unsigned int step) const
+{
+  step = std::max(1u, step);
+
+  std::vector<thread_split_t> splits;
+  for(unsigned int workers = step; workers <= threads_; workers *= 2)
+    splits.push_back(split(workers));
+
+  // A budget that is not a power of two times the step also gets a worker per core.
+  if(splits.empty() || (splits.back().workers < threads_ && threads_ % step == 0))
+    splits.push_back(split(std::max(step, threads_)));
+
+  return splits;
+}
+
+
+thread_split_t thread_budget::tune(const std::vector<thread_split_t>& candidates,
+  const std::function<double(const thread_split_t&)>& throughput)
+{
+  thread_split_t best = candidates.empty() ? thread_split_t{1, 1} : candidates.front();
+  double best_throughput = -1;
+
+  for(auto& candidate : candidates) {
+    double measured = throughput(candidate);
+
+    if(measured > best_throughput) {
+      best = candidate;
+      best_throughput = measured;
+    }
+  }
+
+  return best;
+}
+
+
+// ## FUNCTION DEFINITIONS ####################################################
+
+bool set_blas_threads(unsigned int threads)
+{
+  if(!openblas_set_num_threads)
+    return false;
+
+  openblas_set_num_threads(std::max(1u, threads));
+  return true;
+}
+
+
+unsigned int get_blas_threads()
+{
+  return openblas_get_num_threads ? std::max(0, openblas_get_num_threads()) : 0;
+}
+
+
+} // NAMESPACE facetools
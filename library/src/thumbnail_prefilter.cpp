@@ -0,0 +1,208 @@
+/* Cheap face prefilter working on the EXIF thumbnail of a JPEG, so that
+ * photos without faces can be rejected without decoding the main image.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/thumbnail_prefilter.h>
+#include <facetools/jpeg_decoder.h>
+
+#include <dlib/image_transforms.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###############################################################
+
+/** JPEG markers. */
+static const unsigned char MARKER_SOI = 0xd8;
+static const unsigned char MARKER_EOI = 0xd9;
+static const unsigned char MARKER_SOS = 0xda;
+static const unsigned char MARKER_APP1 = 0xe1;
+
+/** Bytes read from the start of a file to find the EXIF segment, which normally comes first and holds at most 64 KiB. */
+static const size_t HEADER_BYTES = 128 * 1024;
+
+/** TIFF tags of the thumbnail offset and length, in IFD1. */
+static const uint16_t TAG_THUMBNAIL_OFFSET = 0x0201;
+static const uint16_t TAG_THUMBNAIL_LENGTH = 0x0202;
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+/* Reads a TIFF value in the byte order of the EXIF block. */
+static uint32_t read_tiff(const unsigned char* data, size_t bytes, bool big_endian)
+{
+  uint32_t value = 0;
+  for(size_t i = 0; i < bytes; ++i)
+    value |= uint32_t(data[big_endian ? i : bytes - 1 - i]) << (8 * (bytes - 1 - i));
+
+  return value;
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+thumbnail_prefilter::thumbnail_prefilter(const thumbnail_prefilter_parameters_t& params)
+{
+  params_ = params;
+  detector_ = dlib::get_frontal_face_detector();
+}
+
+
+thumbnail_verdict_t thumbnail_prefilter::check(const std::string& image_file)
+{
+  std::vector<unsigned char> thumbnail;
+  if(!read_exif_thumbnail(image_file, thumbnail))
+    return thumbnail_verdict_t::NO_THUMBNAIL;
+
+  return check_thumbnail_(thumbnail);
+}
+
+
+thumbnail_verdict_t thumbnail_prefilter::check(const unsigned char* data, size_t size)
+{
+  std::vector<unsigned char> thumbnail;
+  if(!find_exif_thumbnail(data, size, thumbnail))
+    return thumbnail_verdict_t::NO_THUMBNAIL;
+
+  return check_thumbnail_(thumbnail);
+}
+
+
+bool thumbnail_prefilter::may_have_face(const dlib::matrix<dlib::rgb_pixel>& image)
+{
+  dlib::matrix<dlib::rgb_pixel> scaled = image;
+  while(scaled.size() && std::max(scaled.nr(), scaled.nc()) < long(params_.upscale_length))
+    dlib::pyramid_up(scaled);
+
+  return !detector_(scaled, params_.adjust_threshold).empty();
+}
+
+
+bool thumbnail_prefilter::read_exif_thumbnail(const std::string& image_file, std::vector<unsigned char>& thumbnail)
+{
+  std::ifstream file(image_file, std::ios::binary);
+  std::vector<unsigned char> header(HEADER_BYTES);
+  file.read(reinterpret_cast<char*>(header.data()), header.size());
+
+  return find_exif_thumbnail(header.data(), file.gcount(), thumbnail);
+}
+
+
+bool thumbnail_prefilter::find_exif_thumbnail(const unsigned char* data, size_t size,
+  std::vector<unsigned char>& thumbnail)
+{
+  if(size < 2 || data[0] != 0xff || data[1] != MARKER_SOI)
+    return false;
+
+  size_t position = 2;
+  while(position + 4 <= size) {
+    if(data[position] != 0xff)
+      return false;
+
+    // Fill bytes before a marker.
+    unsigned char marker = data[++position];
+    while(marker == 0xff && position + 1 < size)
+      marker = data[++position];
+
+    if(marker == MARKER_SOS || marker == MARKER_EOI || position + 3 > size)
+      return false;
+
+    size_t length = (size_t(data[position + 1]) << 8) | data[position + 2];
+    const unsigned char* payload = data + position + 3;
+    if(length < 2 || position + 1 + length > size)
+      return false;
+
+    length -= 2;
+
+    // An APP1 segment may also hold XMP. Only the EXIF one has a thumbnail.
+    if(marker == MARKER_APP1 && length >= 6 && std::memcmp(payload, "Exif\0\0", 6) == 0)
+      return parse_exif_(payload + 6, length - 6, thumbnail);
+
+    position += 3 + length;
+  }
+
+  return false;
+}
+
+
+// ## PRIVATE METHODS #########################################################
+
+thumbnail_verdict_t thumbnail_prefilter::check_thumbnail_(const std::vector<unsigned char>& thumbnail)
+{
+  dlib::matrix<dlib::rgb_pixel> image;
+  if(!decode_jpeg(thumbnail.data(), thumbnail.size(), image) ||
+    std::max(image.nr(), image.nc()) < long(params_.min_length))
+    return thumbnail_verdict_t::NO_THUMBNAIL;
+
+  return may_have_face(image) ? thumbnail_verdict_t::MAY_HAVE_FACE : thumbnail_verdict_t::NO_FACE;
+}
+
+
+bool thumbnail_prefilter::parse_exif_(const unsigned char* exif, size_t size, std::vector<unsigned char>& thumbnail)
+{
+  if(size < 8 || !((exif[0] == 'I' && exif[1] == 'I') || (exif[0] == 'M' && exif[1] == 'M')))
+    return false;
+
+  bool big_endian = exif[0] == 'M';
+  if(read_tiff(exif + 2, 2, big_endian) != 42)
+    return false;
+
+  // IFD0 describes the main image. The IFD after it, IFD1, describes the thumbnail.
+  size_t ifd = read_tiff(exif + 4, 4, big_endian);
+  if(ifd > size - 2)
+    return false;
+
+  size_t entries = read_tiff(exif + ifd, 2, big_endian);
+  size_t next = ifd + 2 + 12 * entries;
+  if(next > size - 4)
+    return false;
+
+  ifd = read_tiff(exif + next, 4, big_endian);
+  if(ifd == 0 || ifd > size - 2)
+    return false;
+
+  entries = read_tiff(exif + ifd, 2, big_endian);
+  if(ifd + 2 + 12 * entries > size)
+    return false;
+
+  size_t offset = 0, length = 0;
+  for(size_t entry = 0; entry < entries; ++entry) {
+    const unsigned char* field = exif + ifd + 2 + 12 * entry;
+    uint16_t tag = read_tiff(field, 2, big_endian);
+    uint16_t type = read_tiff(field + 2, 2, big_endian);
+
+    // Both are LONGs, but some writers use SHORTs, which sit at the start of the value field.
+    uint32_t value = type == 3 ? read_tiff(field + 8, 2, big_endian) : read_tiff(field + 8, 4, big_endian);
+
+    if(tag == TAG_THUMBNAIL_OFFSET)
+      offset = value;
+    else if(tag == TAG_THUMBNAIL_LENGTH)
+      length = value;
+  }
+
+  if(length < 4 || offset > size || length > size - offset || exif[offset] != 0xff || exif[offset + 1] != MARKER_SOI)
+    return false;
+
+  thumbnail.assign(exif + offset, exif + offset + length);
+
+  return true;
+}
+
+
+} // NAMESPACE facetools
@@ -0,0 +1,287 @@
+/* Execution traces of the detection, recognition and search stages, in the Chrome trace event format.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ################################################################
+
+#include <facetools/trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+
+// ## NAMESPACES ##############################################################
+
+namespace facetools {
+
+
+// ## PRIVATE STRUCTURES ######################################################
+
+/**
+ * A span, or a thread name when it has no category. Fields are relaxed atomics so write_trace() may read a slot the
+ * owner is overwriting, and notice from the ring head that it has to drop it.
+ */
+struct trace_event_t {
+  std::atomic<const char*> name;
+  std::atomic<const char*> category;
+  std::atomic<const char*> arg_name;
+  std::atomic<int64_t> arg;
+  std::atomic<int64_t> start_ns;
+  std::atomic<int64_t> duration_ns;
+  std::atomic<uint32_t> tid;
+};
+
+
+/**
+ * Ring buffer of one thread. Only the owning thread writes it.
+ */
+struct thread_trace_t {
+  std::unique_ptr<trace_event_t[]> events;
+
+  /** Number of events ever recorded. The latest TRACE_BUFFER_EVENTS of them are held. */
+  std::atomic<uint64_t> head;
+
+  /** Whether a live thread owns the ring. Rings of exited threads go to new threads, with their events. */
+  std::atomic<bool> owned;
+
+  /** Next ring. Rings are only ever pushed on the list, never removed. */
+  thread_trace_t* next;
+
+  thread_trace_t() : events(new trace_event_t[TRACE_BUFFER_EVENTS]), head(0), owned(true), next(nullptr) {}
+};
+
+
+/**
+ * Claims a ring for the calling thread on first use, and hands it back when the thread exits.
+ */
+struct thread_trace_owner_t {
+  thread_trace_t* trace;
+
+  /** Linux thread id, as the trace viewers show it. */
+  uint32_t tid;
+
+  thread_trace_owner_t();
+
+  ~thread_trace_owner_t()
+  {
+    trace->owned.store(false, std::memory_order_release);
+  }
+};
+
+
+/**
+ * Copy of an event, read out of a ring.
+ */
+struct trace_record_t {
+  const char* name;
+  const char* category;
+  const char* arg_name;
+  int64_t arg;
+  int64_t start_ns;
+  int64_t duration_ns;
+  uint32_t tid;
+};
+
+
+// ## PRIVATE VARIABLES #######################################################
+
+static std::atomic<bool> enabled(false);
+
+/** Steady clock time tracing was first enabled, in nanoseconds. Event times are written relative to it. */
+static std::atomic<int64_t> epoch_ns(0);
+
+/** Every ring ever claimed. */
+static std::atomic<thread_trace_t*> all_traces(nullptr);
+
+
+// ## PRIVATE FUNCTIONS #######################################################
+
+thread_trace_owner_t::thread_trace_owner_t() : tid(syscall(SYS_gettid))
+{
+  for(trace = all_traces.load(std::memory_order_acquire); trace; trace = trace->next) {
+    bool owned = false;
+    if(!trace->owned.load(std::memory_order_relaxed) &&
+      trace->owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+      return;
+  }
+
+  trace = new thread_trace_t();
+  trace->next = all_traces.load(std::memory_order_relaxed);
+  while(!all_traces.compare_exchange_weak(trace->next, trace, std::memory_order_release, std::memory_order_relaxed)) {
+  }
+}
+
+
+/**
+ * \param time Time point.
+ * \return Nanoseconds since the steady clock epoch.
+ */
+static int64_t to_ns(std::chrono::steady_clock::time_point time)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+
+/**
+ * Appends an event to the calling thread's ring.
+ * \param record Event. Its tid is filled in.
+ */
+static void append_event(const trace_record_t& record)
+{
+  thread_local thread_trace_owner_t owner;
+  auto& trace = *owner.trace;
+
+  uint64_t head = trace.head.load(std::memory_order_relaxed);
+  auto& event = trace.events[head % TRACE_BUFFER_EVENTS];
+
+  event.name.store(record.name, std::memory_order_relaxed);
+  event.category.store(record.category, std::memory_order_relaxed);
+  event.arg_name.store(record.arg_name, std::memory_order_relaxed);
+  event.arg.store(record.arg, std::memory_order_relaxed);
+  event.start_ns.store(record.start_ns, std::memory_order_relaxed);
+  event.duration_ns.store(record.duration_ns, std::memory_order_relaxed);
+  event.tid.store(owner.tid, std::memory_order_relaxed);
+
+  trace.head.store(head + 1, std::memory_order_release);
+}
+
+
+/**
+ * Reads the events a ring holds.
+ * \param trace Ring.
+ * \param records Output. Gets the events appended, oldest first.
+ */
+static void read_events(const thread_trace_t& trace, std::vector<trace_record_t>& records)
+{
+  uint64_t head = trace.head.load(std::memory_order_acquire);
+  uint64_t first = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+  size_t start = records.size();
+
+  for(uint64_t i = first; i < head; ++i) {
+    auto& event = trace.events[i % TRACE_BUFFER_EVENTS];
+    records.push_back({event.name.load(std::memory_order_relaxed), event.category.load(std::memory_order_relaxed),
+      event.arg_name.load(std::memory_order_relaxed), event.arg.load(std::memory_order_relaxed),
+      event.start_ns.load(std::memory_order_relaxed), event.duration_ns.load(std::memory_order_relaxed),
+      event.tid.load(std::memory_order_relaxed)});
+  }
+
+  // Slots the owner reached again while they were being read may hold halves of two events.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t now = trace.head.load(std::memory_order_relaxed);
+  uint64_t overwritten = now > TRACE_BUFFER_EVENTS ? now - TRACE_BUFFER_EVENTS : 0;
+
+  if(overwritten > first)
+    records.erase(records.begin() + start, records.begin() + start + std::min(overwritten, head) - first);
+}
+
+
+// ## PUBLIC METHODS ##########################################################
+
+trace_span::trace_span(const char* name, const char* category, const char* arg_name, int64_t arg) :
+  name_(name), category_(category), arg_name_(arg_name), arg_(arg), running_(trace_enabled())
+{
+  if(running_)
+    start_ = std::chrono::steady_clock::now();
+}
+
+
+trace_span::~trace_span()
+{
+  if(running_)
+    trace_complete(name_, category_, start_, std::chrono::steady_clock::now(), arg_name_, arg_);
+}
+
+
+// ## FUNCTION DEFINITIONS ####################################################
+
+void set_trace_enabled(bool state) noexcept
+{
+  int64_t unset = 0;
+  if(state)
+    epoch_ns.compare_exchange_strong(unset, to_ns(std::chrono::steady_clock::now()));
+
+  enabled.store(state, std::memory_order_relaxed);
+}
+
+
+bool trace_enabled() noexcept
+{
+  return enabled.load(std::memory_order_relaxed);
+}
+
+
+void trace_complete(const char* name, const char* category, std::chrono::steady_clock::time_point start,
+  std::chrono::steady_clock::time_point end, const char* arg_name, int64_t arg) noexcept
+{
+  if(trace_enabled())
+    append_event({name, category, arg_name, arg, to_ns(start), to_ns(end) - to_ns(start), 0});
+}
+
+
+void trace_thread_name(const char* name, unsigned int index) noexcept
+{
+  if(trace_enabled())
+    append_event({name, nullptr, nullptr, index, 0, 0, 0});
+}
+
+
+void write_trace(std::ostream& out)
+{
+  std::vector<trace_record_t> records;
+  for(auto trace = all_traces.load(std::memory_order_acquire); trace; trace = trace->next)
+    read_events(*trace, records);
+
+  auto flags = out.flags();
+  auto precision = out.precision();
+  int64_t epoch = epoch_ns.load();
+  long pid = getpid();
+
+  out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+
+  for(size_t i = 0; i < records.size(); ++i) {
+    auto& record = records[i];
+    out << (i ? "," : "") << "\n  {\"pid\": " << pid << ", \"tid\": " << record.tid << ", ";
+
+    if(!record.category) {
+      out << "\"ph\": \"M\", \"name\": \"thread_name\", \"args\": {\"name\": \"" << record.name << ' ' << record.arg <<
+        "\"}}";
+      continue;
+    }
+
+    out << "\"ph\": \"X\", \"name\": \"" << record.name << "\", \"cat\": \"" << record.category << "\", \"ts\": " <<
+      (record.start_ns - epoch) / 1e3 << ", \"dur\": " << record.duration_ns / 1e3;
+
+    if(record.arg_name)
+      out << ", \"args\": {\"" << record.arg_name << "\": " << record.arg << "}";
+
+    out << "}";
+  }
+
+  out << "\n]}\n";
+  out.flags(flags);
+  out.precision(precision);
+}
+
+
+bool write_trace(const std::string& file)
+{
+  std::ofstream out(file);
+  write_trace(out);
+
+  return bool(out);
+}
+
+
+} // NAMESPACE facetools
@@ -91,4 +91,101 @@ TEST(command_line_parser, parse_allopt)
   delete argdata[2];
   delete argdata[3];
   delete argdata[4];
-}
\ No newline at end of file
+}
+
+TEST(command_line_parser, parse_threads)
+{
+  facegrep_commandline_parameters_t params;
+
+  EXPECT_TRUE(command_line_parser::parse_threads("4", params));
+  EXPECT_EQ(params.load_threads, 4);
+  EXPECT_EQ(params.detect_threads, 4);
+  EXPECT_EQ(params.embed_threads, 4);
+
+  EXPECT_TRUE(command_line_parser::parse_threads("2,8,0", params));
+  EXPECT_EQ(params.load_threads, 2);
+  EXPECT_EQ(params.detect_threads, 8);
+  EXPECT_EQ(params.embed_threads, 0);
+
+  EXPECT_FALSE(command_line_parser::parse_threads("", params));
+  EXPECT_FALSE(command_line_parser::parse_threads("1,2", params));
+  EXPECT_FALSE(command_line_parser::parse_threads("-1", params));
+  EXPECT_FALSE(command_line_parser::parse_threads("two", params));
+}
+
+
+TEST(command_line_parser, parse_face_files)
+{
+  std::string progname = "./program";
+  std::string all_faces = "-a";
+  std::string bruce = "../test_data/facegrep/searchdir/bruce0.jpg";
+  std::string rock = "../test_data/facegrep/searchdir/rock0.jpg";
+  std::string directory = "../test_data/facegrep/searchdir";
+
+  char* argdata[] = {&progname[0], &all_faces[0], &bruce[0], &rock[0], &directory[0]};
+
+  // 0 makes glibc forget the option it was in the middle of, which pointed into the previous test's arguments.
+  optind = 0;
+  auto params = command_line_parser::parse(5, argdata);
+  EXPECT_TRUE(params.all_faces);
+  EXPECT_EQ(params.face_file, bruce);
+  ASSERT_EQ(params.face_files.size(), 2);
+  EXPECT_EQ(params.face_files[1], rock);
+  EXPECT_EQ(params.search_directory, directory);
+}
+
+
+TEST(command_line_parser, parse_serve)
+{
+  std::string progname = "./program";
+  std::string serve = "--serve";
+  std::string socket = "/tmp/facegrep.sock";
+  std::string instances = "-n";
+  std::string count = "3";
+
+  char* argdata[] = {&progname[0], &serve[0], &socket[0], &instances[0], &count[0]};
+
+  optind = 0;
+  auto params = command_line_parser::parse(5, argdata);
+  EXPECT_EQ(params.serve_socket, socket);
+  EXPECT_EQ(params.instances, 3);
+  EXPECT_TRUE(params.client_socket.empty());
+  EXPECT_TRUE(params.face_files.empty());
+
+  std::string client = "--client";
+  std::string bruce = "../test_data/facegrep/searchdir/bruce0.jpg";
+  std::string directory = "../test_data/facegrep/searchdir";
+
+  char* client_argdata[] = {&progname[0], &client[0], &socket[0], &bruce[0], &directory[0]};
+
+  optind = 0;
+  params = command_line_parser::parse(5, client_argdata);
+  EXPECT_EQ(params.client_socket, socket);
+  EXPECT_TRUE(params.serve_socket.empty());
+  EXPECT_EQ(params.face_file, bruce);
+  EXPECT_EQ(params.search_directory, directory);
+}
+
+
+TEST(command_line_parser, parse_workers)
+{
+  std::string progname = "./program";
+  std::string workers = "-w";
+  std::string count = "2";
+  std::string bruce = "../test_data/facegrep/searchdir/bruce0.jpg";
+  std::string directory = "../test_data/facegrep/searchdir";
+
+  char* argdata[] = {&progname[0], &workers[0], &count[0], &bruce[0], &directory[0]};
+
+  optind = 0;
+  auto params = command_line_parser::parse(5, argdata);
+  EXPECT_EQ(params.workers, 2);
+  EXPECT_FALSE(params.cache);
+
+  // Worker processes would each leave the cache alone, so asking for both is an error.
+  std::string cache = "--cache";
+  char* cache_argdata[] = {&progname[0], &workers[0], &count[0], &cache[0], &bruce[0], &directory[0]};
+
+  optind = 0;
+  EXPECT_EXIT(command_line_parser::parse(6, cache_argdata), ::testing::ExitedWithCode(1), "");
+}
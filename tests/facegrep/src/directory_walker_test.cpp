@@ -0,0 +1,52 @@
+/* Tests for the directory_walker class.
+ */
+
+// ## INCLUDES ################################################################
+
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+
+#include <directory_walker.h>
+#include <file_finder.h>
+
+
+// ## NAMESPACES ##############################################################
+
+// ## CONSTANTS ###############################################################
+
+static const char FILE_FINDER_DIR[] = "../test_data/facegrep/file_finder";
+static const char SEARCH_DIR[] = "../test_data/facegrep/searchdir";
+
+
+// ## PRIVATE METHODS #########################################################
+
+// ## TESTS ###################################################################
+
+TEST(directory_walker, find)
+{
+  for(unsigned int threads : {1, 2, 8}) {
+    directory_walker walker(file_finder::image_search_filter(), threads);
+    auto found = walker.find(FILE_FINDER_DIR);
+
+    ASSERT_EQ(found.size(), 2);
+    EXPECT_EQ(found[0], std::string(FILE_FINDER_DIR) + "/a.jpg");
+    EXPECT_EQ(found[1], std::string(FILE_FINDER_DIR) + "/sub/b.jpg");
+    EXPECT_EQ(walker.find(SEARCH_DIR).size(), 8);
+  }
+}
+
+
+TEST(directory_walker, walk_stops_early)
+{
+  directory_walker walker(file_finder::image_search_filter(), 4);
+  int found = 0;
+
+  EXPECT_TRUE(walker.walk(SEARCH_DIR, [&](const std::string&) { return ++found < 3; }));
+  EXPECT_EQ(found, 3);
+
+  EXPECT_THROW(walker.walk(SEARCH_DIR, [](const std::string&) -> bool { throw std::runtime_error("stop"); }),
+    std::runtime_error);
+
+  EXPECT_FALSE(walker.walk("../test_data/facegrep/missing", [](const std::string&) { return true; }));
+}
@@ -4,10 +4,15 @@
 // ## INCLUDES ################################################################
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdlib>
+#include <set>
 #include <string>
+#include <tuple>
 #include <unordered_set>
 
 #include <facegrep/facegrep.h>
+#include <facetools/stats.h>
 #include <file_finder.h>
 
 
@@ -24,11 +29,12 @@ static const char SHAPE_PREDICTOR_MODEL[] = "../models/shape_predictor_68_face_l
 static const char BRUCE_TEMPLATE[] = "../test_data/facegrep/searchdir/bruce0.jpg";
 static const char ROCK_TEMPLATE[] = "../test_data/facegrep/searchdir/rock0.jpg";
 static const char SEARCH_DIR[] = "../test_data/facegrep/searchdir";
+static const char GROUP_PHOTO[] = "../test_data/facetools/bald_guys.jpg";
 
 
 // ## PRIVATE METHODS #########################################################
 
-static facegrep get_facegrep()
+static facegrep_parameters_t default_params()
 {
   facegrep_parameters_t params;
   params.jitter = false;
@@ -37,12 +43,40 @@ static facegrep get_facegrep()
   params.detector_model = FACE_DETECTOR_MODEL;
   params.recogniser_model = FACE_RECOGNITION_MODEL;
   params.shape_model = SHAPE_PREDICTOR_MODEL;
-  facegrep fg(params);
+
+  return params;
+}
+
+
+static facegrep get_facegrep()
+{
+  facegrep fg(default_params());
 
   return fg;
 }
 
 
+/** Face of a clustering, as its file and box. */
+typedef std::tuple<std::string, long, long, long, long> clustered_face_t;
+
+
+static std::set<std::set<clustered_face_t>> get_memberships(const face_clusters_t& clusters)
+{
+  std::set<std::set<clustered_face_t>> memberships;
+  for(auto& cluster : clusters.clusters) {
+    std::set<clustered_face_t> members;
+    for(size_t face : cluster) {
+      auto& box = clusters.boxes[face];
+      members.emplace(clusters.files[clusters.face_files[face]], box.left(), box.top(), box.right(), box.bottom());
+    }
+
+    memberships.insert(members);
+  }
+
+  return memberships;
+}
+
+
 // ## TESTS ###################################################################
 
 TEST(facegrep, constructor)
@@ -60,6 +94,13 @@ TEST(facegrep, constructor)
   EXPECT_EQ(fg.detector_->params_.detector_type, face_detector_type_t::MMOD);
   EXPECT_FALSE(fg.recogniser_->params_.jitter_images);
   EXPECT_EQ(fg.recogniser_->params_.face_difference_threshold, 5.0);
+
+  // The thumbnail prefilter only knows the faces HOG finds.
+  params.prefilter_thumbnails = true;
+  EXPECT_TRUE(facegrep(params).prefilters_.empty());
+
+  params.detector_type = face_detector_type_t::DLIB_DEFAULT;
+  EXPECT_FALSE(facegrep(params).prefilters_.empty());
 }
 
 
@@ -72,6 +113,14 @@ TEST(facegrep, init)
   fg.init(BRUCE_TEMPLATE);
 
   EXPECT_TRUE(fg.initialised_);
+
+  // Templates are never jittered, whatever the recogniser does with the faces searched.
+  fg.recogniser_->set_jitter(true);
+  fg.init(BRUCE_TEMPLATE);
+
+  auto bruce_face = fg.detector_->extract_faces(BRUCE_TEMPLATE);
+  fg.recogniser_->set_jitter(false);
+  EXPECT_TRUE(fg.template_embeddings_[0] == fg.recogniser_->get_embedding(bruce_face[0]));
 }
 
 
@@ -82,8 +131,8 @@ TEST(facegrep, face_matched_)
 
   auto rock_face = fg.detector_->extract_faces(ROCK_TEMPLATE);
   auto rock_template = fg.recogniser_->get_embedding(rock_face[0]);
-  EXPECT_TRUE(fg.face_matched_(fg.template_embedding_, fg.template_embedding_));
-  EXPECT_FALSE(fg.face_matched_(fg.template_embedding_, rock_template));
+  EXPECT_TRUE(fg.face_matched_(fg.template_embeddings_[0], fg.template_embeddings_[0]));
+  EXPECT_FALSE(fg.face_matched_(fg.template_embeddings_[0], rock_template));
 }
 
 
@@ -123,4 +172,320 @@ TEST(facegrep, search2)
 
   for(auto& file : results)
     EXPECT_EQ(rock_set.count(file), 1);
-}
\ No newline at end of file
+}
+
+TEST(facegrep, search_threads)
+{
+  auto images = file_finder::find_images(SEARCH_DIR);
+  auto serial = get_facegrep();
+  auto expected = serial.search(BRUCE_TEMPLATE, images);
+
+  auto params = default_params();
+  params.load_threads = 2;
+  params.detect_threads = 3;
+  params.embed_threads = 2;
+  params.queue_size = 1;
+  facegrep fg(params);
+
+  EXPECT_EQ(fg.detector_replicas_.size(), 2);
+  EXPECT_EQ(fg.recogniser_replicas_.size(), 1);
+  EXPECT_EQ(fg.search(BRUCE_TEMPLATE, images), expected);
+}
+
+
+TEST(facegrep, search_batched)
+{
+  auto images = file_finder::find_images(SEARCH_DIR);
+  auto serial = get_facegrep();
+  auto expected = serial.search(ROCK_TEMPLATE, images);
+
+  auto params = default_params();
+  params.detect_threads = 2;
+  params.batch_size = 64;
+  params.batch_timeout_ms = 1000;
+  facegrep fg(params);
+
+  EXPECT_EQ(fg.search(ROCK_TEMPLATE, images), expected);
+}
+
+
+TEST(facegrep, search_directory)
+{
+  auto fg = get_facegrep();
+  fg.init(BRUCE_TEMPLATE);
+  auto results = fg.search_directory(SEARCH_DIR);
+  std::sort(results.begin(), results.end());
+
+  EXPECT_EQ(results, fg.search(file_finder::find_images(SEARCH_DIR)));
+}
+
+
+TEST(facegrep, search_streaming)
+{
+  auto images = file_finder::find_images(SEARCH_DIR);
+  auto fg = get_facegrep();
+  fg.init(BRUCE_TEMPLATE);
+  auto expected = fg.search(images);
+
+  std::vector<std::string> results;
+  fg.params_.ordered_results = true;
+  fg.search(images, [&](const search_result_t& result) {
+    results.push_back(result.file);
+    return result.distance < 0.6;
+  });
+  EXPECT_EQ(results, expected);
+
+  std::vector<float> distances;
+  fg.params_.search_mode = search_mode_t::TOP_K;
+  fg.params_.top_k = 2;
+  fg.search(images, [&](const search_result_t& result) {
+    distances.push_back(result.distance);
+    return true;
+  });
+  ASSERT_EQ(distances.size(), 2);
+  EXPECT_LE(distances[0], distances[1]);
+
+  unsigned int found = 0;
+  fg.params_.search_mode = search_mode_t::FIRST_MATCH;
+  fg.search(images, [&](const search_result_t&) {
+    return ++found < 1;
+  });
+  EXPECT_EQ(found, 1);
+}
+
+
+TEST(facegrep, search_templates)
+{
+  auto images = file_finder::find_images(SEARCH_DIR);
+  auto fg = get_facegrep();
+  auto bruce = fg.search(BRUCE_TEMPLATE, images);
+  auto rock = fg.search(ROCK_TEMPLATE, images);
+
+  fg.init(std::vector<std::string>{BRUCE_TEMPLATE, ROCK_TEMPLATE});
+  ASSERT_TRUE(fg.initialised_);
+  ASSERT_EQ(fg.get_templates().size(), 2);
+  EXPECT_EQ(fg.get_templates()[1].file, ROCK_TEMPLATE);
+
+  std::vector<std::string> hits[2];
+  fg.params_.ordered_results = true;
+  fg.search(images, [&](const search_result_t& result) {
+    hits[result.face_template].push_back(result.file);
+    return true;
+  });
+
+  EXPECT_EQ(hits[0], bruce);
+  EXPECT_EQ(hits[1], rock);
+  EXPECT_EQ(fg.search(images).size(), bruce.size() + rock.size());
+}
+
+
+TEST(facegrep, search_group_photo)
+{
+  // Every face of a group photo is a template of its own, so the photo holds all of them.
+  auto fg = get_facegrep();
+  fg.params_.all_template_faces = true;
+  fg.init(GROUP_PHOTO);
+  ASSERT_TRUE(fg.initialised_);
+  ASSERT_GT(fg.get_templates().size(), 1);
+
+  std::vector<search_result_t> results;
+  fg.search(std::vector<std::string>{GROUP_PHOTO}, [&](const search_result_t& result) {
+    results.push_back(result);
+    return true;
+  });
+
+  ASSERT_EQ(results.size(), fg.get_templates().size());
+  for(unsigned int t = 0; t < results.size(); ++t) {
+    EXPECT_EQ(results[t].file, GROUP_PHOTO);
+    EXPECT_EQ(results[t].face_template, t);
+    EXPECT_EQ(results[t].face, t);
+    EXPECT_NEAR(results[t].distance, 0, 1e-3);
+  }
+
+  unsigned int found = 0;
+  fg.params_.search_mode = search_mode_t::TOP_K;
+  fg.params_.top_k = 2;
+  fg.search(std::vector<std::string>{GROUP_PHOTO}, [&](const search_result_t&) {
+    ++found;
+    return true;
+  });
+  EXPECT_EQ(found, 2);
+}
+
+
+TEST(facegrep, search_cached)
+{
+  char directory[] = "/tmp/facegrep_test_XXXXXX";
+  ASSERT_NE(mkdtemp(directory), nullptr);
+
+  auto params = default_params();
+  params.cache_file = std::string(directory) + "/cache";
+
+  auto images = file_finder::find_images(SEARCH_DIR);
+  facegrep fg(params);
+  fg.init(BRUCE_TEMPLATE);
+  auto expected = fg.search(images);
+  EXPECT_EQ(fg.search(images), expected);
+
+  search_cache cache(params.cache_file, fg.settings_hash_);
+  EXPECT_EQ(cache.size(), images.size());
+
+  system((std::string("rm -rf ") + directory).c_str());
+}
+
+
+TEST(facegrep, search_duplicates)
+{
+  char directory[] = "/tmp/facegrep_test_XXXXXX";
+  ASSERT_NE(mkdtemp(directory), nullptr);
+
+  // Byte for byte copies hash alike, so the second one reuses the faces of the first.
+  std::string copies[] = {std::string(directory) + "/a.jpg", std::string(directory) + "/b.jpg"};
+  for(auto& copy : copies)
+    ASSERT_EQ(system(("cp " + std::string(BRUCE_TEMPLATE) + " " + copy).c_str()), 0);
+
+  auto params = default_params();
+  params.cache_file = std::string(directory) + "/cache";
+  params.skip_duplicates = true;
+
+  facegrep fg(params);
+  fg.init(BRUCE_TEMPLATE);
+
+  // Searched one after the other, so the first copy is in the store before the second is loaded.
+  std::vector<search_result_t> results;
+  auto search = [&](const std::string& path) {
+    fg.search(std::vector<std::string>{path}, [&](const search_result_t& result) {
+      results.push_back(result);
+      return true;
+    });
+  };
+
+  search(copies[0]);
+
+  set_stats_enabled(true);
+  auto before = get_stats();
+  search(copies[1]);
+  auto after = get_stats();
+  set_stats_enabled(false);
+
+  // The second copy went through neither the detector nor the network.
+  EXPECT_EQ(after[stat_counter_t::DUPLICATES] - before[stat_counter_t::DUPLICATES], 1u);
+  EXPECT_EQ(after[stat_timer_t::DETECT].count - before[stat_timer_t::DETECT].count, 0u);
+
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_FLOAT_EQ(results[0].distance, results[1].distance);
+
+  system((std::string("rm -rf ") + directory).c_str());
+}
+
+
+TEST(facegrep, duplicate_shapes)
+{
+  search_cache_entry_t original;
+  original.image_hash = 0x0123456789abcdef;
+  original.width = 640;
+  original.height = 480;
+  original.boxes.push_back(dlib::rectangle(100, 50, 199, 149));
+  original.embeddings.push_back(embedding_t(128));
+
+  facegrep::duplicate_store_t duplicates(4);
+  duplicates.add(original);
+
+  // A resized copy gets the boxes scaled to its size.
+  search_cache_entry_t found;
+  ASSERT_TRUE(duplicates.find(original.image_hash ^ 1, 320, 240, found));
+  ASSERT_EQ(found.boxes.size(), 1);
+  EXPECT_EQ(found.boxes[0], dlib::rectangle(50, 25, 99, 74));
+
+  // A square crop that hashes like the image is no copy of it, nor is a stretched one.
+  EXPECT_FALSE(duplicates.find(original.image_hash, 480, 480, found));
+  EXPECT_FALSE(duplicates.find(original.image_hash, 640, 400, found));
+  EXPECT_TRUE(duplicates.find(original.image_hash, 641, 480, found));
+}
+
+
+TEST(facegrep, search_workers)
+{
+  auto images = file_finder::find_images(SEARCH_DIR);
+  auto fg = get_facegrep();
+  fg.init(BRUCE_TEMPLATE);
+  auto expected = fg.search(images);
+
+  std::vector<search_result_t> top;
+  fg.params_.search_mode = search_mode_t::TOP_K;
+  fg.params_.top_k = 3;
+  fg.search(images, [&](const search_result_t& result) {
+    top.push_back(result);
+    return true;
+  });
+
+  fg.params_.workers = 2;
+  fg.params_.search_mode = search_mode_t::ALL;
+  EXPECT_EQ(fg.search(images), expected);
+
+  unsigned int i = 0;
+  fg.params_.search_mode = search_mode_t::TOP_K;
+  fg.search(images, [&](const search_result_t& result) {
+    EXPECT_EQ(result.file, top[i].file);
+    EXPECT_FLOAT_EQ(result.distance, top[i].distance);
+    return ++i < top.size();
+  });
+  EXPECT_EQ(i, top.size());
+}
+
+
+TEST(facegrep, tune_threads)
+{
+  auto images = file_finder::find_images(SEARCH_DIR);
+  auto serial = get_facegrep();
+  auto expected = serial.search(BRUCE_TEMPLATE, images);
+
+  auto params = default_params();
+  params.thread_budget = 8;
+  facegrep fg(params);
+  EXPECT_EQ(fg.params_.blas_threads, 4);
+
+  std::vector<std::string> sample(images.begin(), images.begin() + std::min<size_t>(4, images.size()));
+  auto split = fg.tune_threads(sample);
+  EXPECT_EQ(split.workers * split.blas_threads, 8);
+  EXPECT_EQ(fg.params_.detect_threads, split.workers / 2);
+  EXPECT_EQ(fg.params_.embed_threads, split.workers / 2);
+  EXPECT_EQ(fg.params_.blas_threads, split.blas_threads);
+  EXPECT_EQ(fg.detector_replicas_.size(), split.workers / 2 - 1);
+  EXPECT_EQ(fg.search(BRUCE_TEMPLATE, images), expected);
+}
+
+
+TEST(facegrep, cluster_directory)
+{
+  auto params = default_params();
+
+  facegrep fg(params);
+  auto clusters = fg.cluster_directory(SEARCH_DIR);
+  ASSERT_GT(clusters.clusters.size(), 1);
+  EXPECT_EQ(clusters.boxes.size(), clusters.face_files.size());
+
+  size_t faces = 0;
+  for(size_t c = 0; c < clusters.clusters.size(); ++c) {
+    faces += clusters.clusters[c].size();
+    if(c)
+      EXPECT_GE(clusters.clusters[c - 1].size(), clusters.clusters[c].size());
+  }
+  EXPECT_EQ(faces, clusters.face_files.size());
+
+  // Every face grouped with the bruce template comes from a photo of him.
+  for(auto& cluster : clusters.clusters) {
+    bool has_template = false;
+    for(size_t face : cluster)
+      has_template |= clusters.files[clusters.face_files[face]] == BRUCE_TEMPLATE;
+
+    for(size_t face : cluster)
+      if(has_template)
+        EXPECT_NE(clusters.files[clusters.face_files[face]].find("bruce"), std::string::npos);
+  }
+
+  // Spilling every edge to disk gives the same clusters.
+  params.cluster_memory_budget = 1;
+  facegrep spilling(params);
+  EXPECT_EQ(get_memberships(spilling.cluster_directory(SEARCH_DIR)), get_memberships(clusters));
+}
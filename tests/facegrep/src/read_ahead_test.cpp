@@ -0,0 +1,89 @@
+/* Tests for the read_ahead class.
+ */
+
+// ## INCLUDES ################################################################
+
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <facegrep/read_ahead.h>
+
+
+// ## NAMESPACES ##############################################################
+
+using namespace facetools;
+
+
+// ## PRIVATE METHODS #########################################################
+
+static std::string make_contents(size_t size, unsigned int seed)
+{
+  std::string contents(size, '\0');
+  for(size_t i = 0; i < size; ++i)
+    contents[i] = char((i * 31 + seed * 7) % 251);
+
+  return contents;
+}
+
+
+// ## TESTS ###################################################################
+
+TEST(read_ahead, reads_every_file)
+{
+  char directory[] = "/tmp/facegrep_read_ahead_XXXXXX";
+  ASSERT_NE(mkdtemp(directory), nullptr);
+
+  // Sizes around the page size and up to a few megabytes, and one file over the size limit.
+  std::vector<size_t> sizes = {1, 4095, 4096, 4097, 100000, 3 << 20, 5 << 20};
+  std::vector<std::string> names;
+  for(size_t i = 0; i < sizes.size(); ++i) {
+    names.push_back(std::string(directory) + "/" + std::to_string(i));
+    std::ofstream(names.back(), std::ios::binary) << make_contents(sizes[i], i);
+  }
+  names.push_back(std::string(directory) + "/missing");
+
+  for(bool use_io_uring : {true, false}) {
+    read_ahead_parameters_t params;
+    params.depth = 3;
+    params.max_file_size = 4 << 20;
+    params.use_io_uring = use_io_uring;
+    read_ahead reader(params);
+
+    // Every file twice, so buffers are reused.
+    std::map<size_t, size_t> seen;
+    size_t submitted = 0;
+    size_t total = 2 * names.size();
+    while(submitted < total || !reader.empty()) {
+      while(submitted < total && !reader.full()) {
+        reader.submit(submitted, names[submitted % names.size()]);
+        ++submitted;
+      }
+
+      file_read_t read;
+      ASSERT_TRUE(reader.next(read, true));
+      ++seen[read.tag];
+
+      size_t file = read.tag % names.size();
+      EXPECT_EQ(read.name, names[file]);
+
+      if(file < sizes.size() && sizes[file] <= params.max_file_size) {
+        ASSERT_EQ(read.size, sizes[file]);
+        EXPECT_EQ(std::string(read.data.begin(), read.data.begin() + read.size), make_contents(sizes[file], file));
+      }
+      else
+        EXPECT_EQ(read.size, 0u);
+
+      reader.release(std::move(read.data));
+    }
+
+    EXPECT_EQ(seen.size(), total);
+    EXPECT_FALSE(reader.uses_io_uring() && !use_io_uring);
+  }
+
+  system((std::string("rm -rf ") + directory).c_str());
+}
@@ -0,0 +1,120 @@
+/* Tests for the search_cache class.
+ */
+
+// ## INCLUDES ################################################################
+
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <facegrep/search_cache.h>
+
+
+// ## NAMESPACES ##############################################################
+
+using namespace facetools;
+
+
+// ## CONSTANTS ###############################################################
+
+static const uint64_t SETTINGS = 1234;
+
+
+// ## PRIVATE METHODS #########################################################
+
+static search_cache_entry_t make_entry(unsigned int faces)
+{
+  search_cache_entry_t entry;
+  entry.size = 100;
+  entry.mtime = 200;
+  entry.image_hash = 0xf00d0000u + faces;
+  entry.width = 640;
+  entry.height = 480;
+
+  for(unsigned int i = 0; i < faces; ++i) {
+    entry.boxes.push_back(dlib::rectangle(i, i + 1, i + 10, i + 11));
+    embedding_t embedding(128);
+    for(long d = 0; d < embedding.size(); ++d)
+      embedding(d) = i + d * 0.5f;
+
+    entry.embeddings.push_back(embedding);
+  }
+
+  return entry;
+}
+
+
+// ## TESTS ###################################################################
+
+TEST(search_cache, round_trip)
+{
+  char directory[] = "/tmp/facegrep_cache_XXXXXX";
+  ASSERT_NE(mkdtemp(directory), nullptr);
+  std::string file_name = std::string(directory) + "/cache";
+
+  {
+    search_cache cache(file_name, SETTINGS);
+    cache.put("a.jpg", make_entry(2));
+    cache.put("empty.jpg", make_entry(0));
+    cache.put("b.jpg", make_entry(1));
+    cache.put("b.jpg", make_entry(3));
+  }
+
+  {
+    search_cache cache(file_name, SETTINGS);
+    search_cache_entry_t entry;
+    EXPECT_EQ(cache.size(), 3);
+
+    ASSERT_TRUE(cache.get("a.jpg", 100, 200, entry));
+    ASSERT_EQ(entry.embeddings.size(), 2);
+    EXPECT_EQ(entry.boxes[1], dlib::rectangle(1, 2, 11, 12));
+    EXPECT_EQ(entry.embeddings[1](4), 3.0f);
+
+    EXPECT_EQ(entry.image_hash, 0xf00d0002u);
+    EXPECT_EQ(entry.width, 640u);
+    EXPECT_EQ(entry.height, 480u);
+
+    ASSERT_TRUE(cache.get("empty.jpg", 100, 200, entry));
+    EXPECT_TRUE(entry.boxes.empty());
+
+    ASSERT_TRUE(cache.get("b.jpg", 100, 200, entry));
+    EXPECT_EQ(entry.boxes.size(), 3);
+
+    EXPECT_FALSE(cache.get("a.jpg", 100, 201, entry));
+    EXPECT_FALSE(cache.get("a.jpg", 101, 200, entry));
+    EXPECT_FALSE(cache.get("c.jpg", 100, 200, entry));
+
+    size_t visited = 0;
+    cache.for_each([&](const std::string& path, const search_cache_entry_t& visited_entry) {
+      ++visited;
+      if(path == "b.jpg")
+        EXPECT_EQ(visited_entry.image_hash, 0xf00d0003u);
+    });
+    EXPECT_EQ(visited, 3u);
+  }
+
+  // A record cut short is dropped, the ones before it survive.
+  {
+    std::ofstream file(file_name, std::ios::binary | std::ios::app);
+    file << "partial";
+  }
+
+  {
+    search_cache cache(file_name, SETTINGS);
+    EXPECT_EQ(cache.size(), 3);
+    cache.put("c.jpg", make_entry(1));
+  }
+
+  {
+    search_cache cache(file_name, SETTINGS);
+    EXPECT_EQ(cache.size(), 4);
+  }
+
+  {
+    search_cache cache(file_name, SETTINGS + 1);
+    EXPECT_EQ(cache.size(), 0);
+  }
+
+  system((std::string("rm -rf ") + directory).c_str());
+}
@@ -0,0 +1,157 @@
+/* Tests for the facegrep_server and facegrep_client classes.
+ */
+
+// ## INCLUDES ################################################################
+
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include <facegrep/server.h>
+
+
+// ## NAMESPACES ##############################################################
+
+using namespace facetools;
+
+
+// ## CONSTANTS ###############################################################
+
+static const char FACE_DETECTOR_MODEL[] = "../models/mmod_human_face_detector.dat";
+static const char FACE_RECOGNITION_MODEL[] = "../models/dlib_face_recognition_resnet_model_v1.dat";
+static const char SHAPE_PREDICTOR_MODEL[] = "../models/shape_predictor_68_face_landmarks.dat";
+static const char BRUCE_TEMPLATE[] = "../test_data/facegrep/searchdir/bruce0.jpg";
+static const char ROCK_TEMPLATE[] = "../test_data/facegrep/searchdir/rock0.jpg";
+static const char SEARCH_DIR[] = "../test_data/facegrep/searchdir";
+
+
+// ## PRIVATE METHODS #########################################################
+
+static facegrep_parameters_t get_parameters()
+{
+  facegrep_parameters_t params;
+  params.jitter = false;
+  params.threshold = 0.6;
+  params.detector_type = face_detector_type_t::DLIB_DEFAULT;
+  params.detector_model = FACE_DETECTOR_MODEL;
+  params.recogniser_model = FACE_RECOGNITION_MODEL;
+  params.shape_model = SHAPE_PREDICTOR_MODEL;
+
+  return params;
+}
+
+
+static std::string get_socket_path()
+{
+  return "/tmp/facegrep_server_test_" + std::to_string(getpid()) + ".sock";
+}
+
+
+// ## TESTS ###################################################################
+
+TEST(facegrep_server, request_round_trip)
+{
+  facegrep_request_t request;
+  request.face_files = {"/a/bruce.jpg", "/b/rock with spaces.jpg"};
+  request.search_directory = "/c";
+  request.image_files = {"/d/1.jpg"};
+  request.threshold = 0.45;
+  request.search_mode = search_mode_t::TOP_K;
+  request.top_k = 3;
+  request.ordered_results = true;
+  request.all_template_faces = true;
+
+  auto text = format_request(request);
+  size_t start = text.find('\n') + 1;
+
+  facegrep_request_t parsed;
+  while(true) {
+    size_t end = text.find('\n', start);
+    std::string line = text.substr(start, end - start);
+    start = end + 1;
+
+    if(line == "end")
+      break;
+
+    ASSERT_TRUE(parse_request_line(line, parsed));
+  }
+
+  EXPECT_EQ(start, text.size());
+  EXPECT_EQ(parsed.face_files, request.face_files);
+  EXPECT_EQ(parsed.search_directory, request.search_directory);
+  EXPECT_EQ(parsed.image_files, request.image_files);
+  EXPECT_FLOAT_EQ(parsed.threshold, request.threshold);
+  EXPECT_TRUE(parsed.search_mode == search_mode_t::TOP_K);
+  EXPECT_EQ(parsed.top_k, 3u);
+  EXPECT_TRUE(parsed.ordered_results);
+  EXPECT_TRUE(parsed.all_template_faces);
+
+  EXPECT_FALSE(parse_request_line("threshold -1", parsed));
+  EXPECT_FALSE(parse_request_line("top_k zero", parsed));
+  EXPECT_FALSE(parse_request_line("mode best", parsed));
+  EXPECT_FALSE(parse_request_line("ordered yes", parsed));
+  EXPECT_FALSE(parse_request_line("unknown 1", parsed));
+  EXPECT_FALSE(parse_request_line("face", parsed));
+}
+
+
+TEST(facegrep_server, search)
+{
+  facegrep fg(get_parameters());
+  fg.init(std::vector<std::string>{BRUCE_TEMPLATE, ROCK_TEMPLATE});
+
+  // The directory walk order varies, so results are compared by file, relative to the search directory.
+  auto relative = [](const std::string& file) { return file.substr(file.find("searchdir")); };
+
+  std::map<std::string, search_result_t> expected;
+  fg.search_directory(SEARCH_DIR, [&](const search_result_t& result) {
+    expected[relative(result.file)] = result;
+    return true;
+  });
+
+  facegrep_server_parameters_t server_params;
+  server_params.socket_path = get_socket_path();
+  server_params.instances = 1;
+
+  facegrep_server server(server_params, get_parameters());
+  std::thread thread([&] { server.run(); });
+
+  facegrep_request_t request;
+  request.face_files = {BRUCE_TEMPLATE, ROCK_TEMPLATE};
+  request.search_directory = SEARCH_DIR;
+
+  std::vector<face_template_t> templates;
+  std::map<std::string, search_result_t> results;
+  facegrep_client::query(server_params.socket_path, request, templates, [&](const search_result_t& result) {
+    results[relative(result.file)] = result;
+    return true;
+  });
+
+  ASSERT_EQ(templates.size(), 2u);
+  EXPECT_EQ(relative(templates[0].file), "searchdir/bruce0.jpg");
+  ASSERT_EQ(results.size(), expected.size());
+  for(auto& result : results) {
+    ASSERT_EQ(expected.count(result.first), 1u);
+    EXPECT_EQ(result.second.face_template, expected[result.first].face_template);
+    EXPECT_NEAR(result.second.distance, expected[result.first].distance, 1e-6);
+  }
+
+  // Hanging up early stops the search, and the instance serves the next client.
+  size_t seen = 0;
+  facegrep_client::query(server_params.socket_path, request, templates, [&](const search_result_t&) {
+    return ++seen < 1;
+  });
+  EXPECT_EQ(seen, 1u);
+
+  request.search_directory = "/nonexistent";
+  EXPECT_THROW(facegrep_client::query(server_params.socket_path, request, templates,
+    [](const search_result_t&) { return true; }), std::runtime_error);
+
+  server.stop();
+  thread.join();
+
+  EXPECT_THROW(facegrep_client::query(server_params.socket_path, request, templates,
+    [](const search_result_t&) { return true; }), std::runtime_error);
+}
@@ -0,0 +1,124 @@
+/* Tests for the worker_pool class.
+ */
+
+// ## INCLUDES ################################################################
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include <facegrep/worker_pool.h>
+
+
+// ## NAMESPACES ##############################################################
+
+using namespace facetools;
+
+
+// ## TESTS ###################################################################
+
+TEST(worker_pool, runs_every_shard)
+{
+  worker_pool_parameters_t params;
+  params.workers = 3;
+  params.shard_size = 4;
+  worker_pool pool(params);
+
+  // Every third file matches, at a distance telling which one it is.
+  auto search = [](size_t first, size_t count, const result_callback_t& emit) {
+    for(size_t file = first; file < first + count; ++file) {
+      search_result_t result;
+      result.index = file;
+      result.distance = file / 100.0f;
+      result.face = 0;
+      result.face_template = 0;
+      result.matches = 1;
+
+      if(file % 3 == 0 && !emit(result))
+        return;
+    }
+  };
+
+  std::map<size_t, size_t> shards;
+  std::map<size_t, float> found;
+  auto skipped = pool.run(30, search, [&](size_t first, size_t count, std::vector<search_result_t>& results) {
+    shards[first] = count;
+    for(auto& result : results)
+      found[result.index] = result.distance;
+
+    return true;
+  });
+
+  EXPECT_TRUE(skipped.empty());
+  EXPECT_EQ(shards.size(), 8u);
+  EXPECT_EQ(shards[28], 2u);
+
+  EXPECT_EQ(found.size(), 10u);
+  for(auto& result : found) {
+    EXPECT_EQ(result.first % 3, 0u);
+    EXPECT_FLOAT_EQ(result.second, result.first / 100.0f);
+  }
+
+  EXPECT_TRUE(pool.workers_.empty());
+}
+
+
+TEST(worker_pool, survives_crashes)
+{
+  worker_pool_parameters_t params;
+  params.workers = 2;
+  params.shard_size = 5;
+  worker_pool pool(params);
+
+  // File 7 always takes its worker down, file 12 throws, and the others match.
+  auto search = [](size_t first, size_t count, const result_callback_t& emit) {
+    for(size_t file = first; file < first + count; ++file) {
+      if(file == 7)
+        abort();
+
+      if(file == 12)
+        throw std::runtime_error("bad image");
+
+      search_result_t result;
+      result.index = file;
+      result.distance = 0.5;
+      result.face = 0;
+      result.face_template = 0;
+      result.matches = 1;
+      emit(result);
+    }
+  };
+
+  std::vector<size_t> found, covered(20, 0);
+  auto skipped = pool.run(20, search, [&](size_t first, size_t count, std::vector<search_result_t>& results) {
+    for(size_t file = first; file < first + count; ++file)
+      ++covered[file];
+
+    for(auto& result : results)
+      found.push_back(result.index);
+
+    return true;
+  });
+
+  EXPECT_EQ(skipped, std::vector<size_t>({7, 12}));
+  EXPECT_EQ(covered, std::vector<size_t>(20, 1));
+
+  // Results of the shards that crashed are dropped, so the others come once.
+  std::sort(found.begin(), found.end());
+  std::vector<size_t> expected;
+  for(size_t file = 0; file < 20; ++file)
+    if(file != 7 && file != 12)
+      expected.push_back(file);
+  EXPECT_EQ(found, expected);
+
+  // Stopping early.
+  size_t shards = 0;
+  pool.run(20, search, [&](size_t, size_t, std::vector<search_result_t>&) {
+    return ++shards < 2;
+  });
+  EXPECT_EQ(shards, 2u);
+  EXPECT_TRUE(pool.workers_.empty());
+}
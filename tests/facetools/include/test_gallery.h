@@ -0,0 +1,172 @@
+/* Synthetic face galleries and exact searches shared by the FaceTools tests.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+#ifndef _FACETOOLS_TEST_GALLERY_H_
+#define _FACETOOLS_TEST_GALLERY_H_
+
+
+// ## INCLUDES ####################################################################################
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <facetools/embedding_index.h>
+#include <facetools/face.h>
+#include <facetools/similarity_graph.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+namespace facetools {
+
+
+// ## CONSTANTS ###################################################################################
+
+/** Dimensions of the gallery embeddings, as the recogniser makes them. */
+const size_t GALLERY_DIMS = 128;
+
+
+// ## FUNCTIONS ###################################################################################
+
+/**
+ * Makes a gallery shaped like real face embeddings: a few photos of each person, close together, with people far
+ * apart compared to the match thresholds. Photos of the same person are about 0.32 apart, people about 1.6.
+ * \param people Number of people.
+ * \param photos Number of photos of each person.
+ * \param seed Random seed.
+ * \return people * photos embeddings, the photos of each person one after another.
+ */
+inline std::vector<embedding_t> make_gallery(size_t people, size_t photos, unsigned int seed)
+{
+  std::mt19937 generator(seed);
+  std::normal_distribution<float> person(0.0f, 0.1f);
+  std::normal_distribution<float> photo(0.0f, 0.02f);
+
+  std::vector<embedding_t> gallery;
+  embedding_t centre(GALLERY_DIMS);
+
+  for(size_t p = 0; p < people; ++p) {
+    for(size_t d = 0; d < GALLERY_DIMS; ++d)
+      centre(d) = person(generator);
+
+    for(size_t i = 0; i < photos; ++i) {
+      embedding_t face(GALLERY_DIMS);
+      for(size_t d = 0; d < GALLERY_DIMS; ++d)
+        face(d) = centre(d) + photo(generator);
+
+      gallery.push_back(face);
+    }
+  }
+
+  return gallery;
+}
+
+
+/**
+ * \param row Row of GALLERY_DIMS elements.
+ * \return The row as an embedding.
+ */
+inline embedding_t to_embedding(const float* row)
+{
+  embedding_t embedding(GALLERY_DIMS);
+  for(size_t d = 0; d < GALLERY_DIMS; ++d)
+    embedding(d) = row[d];
+
+  return embedding;
+}
+
+
+/**
+ * Squared distances from a query to every row, in double precision, independently of the distance kernels.
+ * \param rows Contiguous row-major block of GALLERY_DIMS element rows.
+ * \param query Query row.
+ * \return Squared distance and row number of every row, in row order.
+ */
+inline std::vector<std::pair<double, size_t>> brute_force_distances(const std::vector<float>& rows, const float* query)
+{
+  std::vector<std::pair<double, size_t>> distances;
+
+  for(size_t row = 0; row < rows.size() / GALLERY_DIMS; ++row) {
+    double distance = 0;
+    for(size_t d = 0; d < GALLERY_DIMS; ++d)
+      distance += double(rows[row * GALLERY_DIMS + d] - query[d]) * (rows[row * GALLERY_DIMS + d] - query[d]);
+
+    distances.emplace_back(distance, row);
+  }
+
+  return distances;
+}
+
+
+/**
+ * \param rows Contiguous row-major block of GALLERY_DIMS element rows.
+ * \param query Query row.
+ * \param threshold Largest distance.
+ * \return Rows within the threshold of the query, in row order.
+ */
+inline std::vector<size_t> brute_force_radius(const std::vector<float>& rows, const float* query, float threshold)
+{
+  std::vector<size_t> found;
+  for(auto& distance : brute_force_distances(rows, query))
+    if(distance.first <= double(threshold) * threshold)
+      found.push_back(distance.second);
+
+  return found;
+}
+
+
+/**
+ * \param rows Contiguous row-major block of GALLERY_DIMS element rows.
+ * \param query Query row.
+ * \param k Number of rows.
+ * \return The k rows nearest to the query, nearest first.
+ */
+inline std::vector<size_t> brute_force_knn(const std::vector<float>& rows, const float* query, size_t k)
+{
+  auto distances = brute_force_distances(rows, query);
+  k = std::min(k, distances.size());
+  std::partial_sort(distances.begin(), distances.begin() + k, distances.end());
+
+  std::vector<size_t> found;
+  for(size_t i = 0; i < k; ++i)
+    found.push_back(distances[i].second);
+
+  return found;
+}
+
+
+/**
+ * \param matches Matches of a search.
+ * \param expected Rows an exact search finds.
+ * \return Fraction of the expected rows among the matches. 1 when none are expected.
+ */
+inline double recall(const std::vector<index_match_t>& matches, const std::vector<size_t>& expected)
+{
+  if(expected.empty())
+    return 1;
+
+  std::set<size_t> found;
+  for(auto& match : matches)
+    found.insert(match.row);
+
+  size_t count = 0;
+  for(auto row : expected)
+    count += found.count(row);
+
+  return double(count) / expected.size();
+}
+
+
+} // NAMESPACE facetools
+
+#endif // _FACETOOLS_TEST_GALLERY_H_
@@ -0,0 +1,170 @@
+/* Tests for the FaceTools Chinese whispers implementation.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <facetools/chinese_whispers.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## PRIVATE METHODS #############################################################################
+
+/* Dense cliques of the given sizes, joined in a chain by single bridging edges. */
+static vector<dlib::sample_pair> bridged_cliques(const vector<size_t>& sizes, size_t& num_nodes)
+{
+  vector<dlib::sample_pair> edges;
+  num_nodes = 0;
+
+  for(auto size : sizes) {
+    for(size_t i = 0; i < size; ++i)
+      for(size_t j = i+1; j < size; ++j)
+        edges.push_back(dlib::sample_pair(num_nodes + i, num_nodes + j));
+
+    if(num_nodes)
+      edges.push_back(dlib::sample_pair(num_nodes - 1, num_nodes));
+
+    num_nodes += size;
+  }
+
+  return edges;
+}
+
+
+/* Sparse random graph made of several communities with a little noise between them. */
+static vector<dlib::sample_pair> random_communities(size_t communities, size_t size, unsigned int seed)
+{
+  mt19937 generator(seed);
+  uniform_int_distribution<size_t> member(0, size - 1);
+  uniform_int_distribution<size_t> anyone(0, communities * size - 1);
+  vector<dlib::sample_pair> edges;
+
+  for(size_t c = 0; c < communities; ++c) {
+    for(size_t e = 0; e < size * 4; ++e)
+      edges.push_back(dlib::sample_pair(c * size + member(generator), c * size + member(generator)));
+    edges.push_back(dlib::sample_pair(anyone(generator), anyone(generator)));
+  }
+
+  return edges;
+}
+
+
+// ## TESTS #######################################################################################
+
+TEST(chinese_whispers, csr_graph)
+{
+  vector<dlib::sample_pair> edges = {dlib::sample_pair(0, 1), dlib::sample_pair(1, 2), dlib::sample_pair(2, 2)};
+  auto graph = make_csr_graph(edges, 4);
+
+  EXPECT_EQ(graph.num_nodes(), 4);
+  EXPECT_EQ(graph.neighbours.size(), 4);
+  EXPECT_EQ(graph.offsets[1] - graph.offsets[0], 1);
+  EXPECT_EQ(graph.offsets[2] - graph.offsets[1], 2);
+  EXPECT_EQ(graph.offsets[3] - graph.offsets[2], 1);
+  EXPECT_EQ(graph.offsets[4] - graph.offsets[3], 0);
+  EXPECT_TRUE(graph.weights.empty());
+  EXPECT_TRUE(make_csr_graph({dlib::sample_pair(0, 1, 0.5)}, 2).weights == vector<float>(2, 0.5f));
+  EXPECT_THROW(make_csr_graph(edges, 2), std::runtime_error);
+}
+
+
+TEST(chinese_whispers, separates_cliques)
+{
+  size_t num_nodes;
+  auto edges = bridged_cliques({8, 10, 6, 12}, num_nodes);
+
+  for(auto sweep : {chinese_whispers_sweep_t::COLOURED, chinese_whispers_sweep_t::SYNCHRONOUS}) {
+    chinese_whispers_parameters_t params;
+    params.sweep = sweep;
+    vector<unsigned long> labels;
+
+    EXPECT_EQ(chinese_whispers(edges, num_nodes + 2, labels, params), 6);
+    ASSERT_EQ(labels.size(), num_nodes + 2);
+    EXPECT_EQ(labels[0], 0);
+    EXPECT_EQ(labels[7], 0);
+    EXPECT_EQ(labels[8], 1);
+    EXPECT_EQ(labels[17], 1);
+    EXPECT_EQ(labels[18], 2);
+    EXPECT_EQ(labels[35], 3);
+    EXPECT_EQ(labels[36], 4);
+    EXPECT_EQ(labels[37], 5);
+  }
+}
+
+
+TEST(chinese_whispers, joins_pairs)
+{
+  // Sparse graphs give a sampled sweep every chance to change nothing while unsampled nodes still would.
+  vector<dlib::sample_pair> pair = {dlib::sample_pair(0, 1)};
+  vector<dlib::sample_pair> path = {dlib::sample_pair(0, 1), dlib::sample_pair(1, 2), dlib::sample_pair(2, 3)};
+
+  for(auto sweep : {chinese_whispers_sweep_t::COLOURED, chinese_whispers_sweep_t::SYNCHRONOUS}) {
+    chinese_whispers_parameters_t params;
+    params.sweep = sweep;
+
+    for(uint64_t seed = 0; seed < 200; ++seed) {
+      params.seed = seed;
+      vector<unsigned long> labels;
+
+      EXPECT_EQ(chinese_whispers(pair, 2, labels, params), 1);
+      EXPECT_EQ(labels[0], labels[1]);
+
+      // Whatever the split, no node of a path may be left wanting its neighbours' label.
+      unsigned long clusters = chinese_whispers(path, 4, labels, params);
+      EXPECT_GE(clusters, 1);
+      EXPECT_LE(clusters, 2);
+      EXPECT_EQ(labels[0], labels[1]);
+      EXPECT_EQ(labels[2], labels[3]);
+    }
+  }
+}
+
+
+TEST(chinese_whispers, deterministic_across_threads)
+{
+  auto edges = random_communities(40, 50, 1);
+  auto graph = make_csr_graph(edges, 40 * 50);
+
+  for(auto sweep : {chinese_whispers_sweep_t::COLOURED, chinese_whispers_sweep_t::SYNCHRONOUS}) {
+    chinese_whispers_parameters_t params;
+    params.sweep = sweep;
+    params.seed = 7;
+    params.num_threads = 1;
+
+    vector<unsigned long> expected;
+    auto expected_clusters = chinese_whispers(graph, expected, params);
+
+    for(unsigned int threads : {2, 5, 8}) {
+      params.num_threads = threads;
+      vector<unsigned long> labels;
+      EXPECT_EQ(chinese_whispers(graph, labels, params), expected_clusters);
+      EXPECT_TRUE(labels == expected);
+    }
+  }
+}
+
+
+TEST(chinese_whispers, empty_graph)
+{
+  vector<unsigned long> labels;
+  EXPECT_EQ(chinese_whispers(vector<dlib::sample_pair>(), 0, labels), 0);
+  EXPECT_EQ(labels.size(), 0);
+  EXPECT_EQ(chinese_whispers(vector<dlib::sample_pair>(), 3, labels), 3);
+  EXPECT_EQ(labels.size(), 3);
+}
@@ -0,0 +1,144 @@
+/* Tests for the FaceTools CPU topology discovery and thread placement.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <fstream>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include <facetools/cpu_topology.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## PRIVATE METHODS #############################################################################
+
+/* Writes a file, creating the directories on its path. */
+static void write_file(const string& path, const string& text)
+{
+  for(size_t slash = path.find('/', 1); slash != string::npos; slash = path.find('/', slash + 1))
+    mkdir(path.substr(0, slash).c_str(), 0755);
+
+  ofstream(path) << text << "\n";
+}
+
+
+/* A /sys/devices/system of two NUMA nodes, numbered 0 and 2, with two cores of two SMT threads each. The siblings of
+ * cores 0 and 1 are CPUs 4 to 7, as Linux numbers them. Node 1 has memory and no CPUs. */
+static string make_sys_root(char* directory)
+{
+  string root = directory;
+  write_file(root + "/cpu/online", "0-7");
+
+  for(unsigned int cpu = 0; cpu < 8; ++cpu) {
+    string topology = root + "/cpu/cpu" + to_string(cpu) + "/topology/";
+    write_file(topology + "core_id", to_string(cpu % 2));
+    write_file(topology + "physical_package_id", to_string(cpu % 4 / 2));
+  }
+
+  write_file(root + "/node/node0/cpulist", "0-1,4-5");
+  write_file(root + "/node/node1/cpulist", "");
+  write_file(root + "/node/node2/cpulist", "2-3,6-7");
+
+  return root;
+}
+
+
+// ## TESTS #######################################################################################
+
+TEST(cpu_topology, parse_cpu_list)
+{
+  vector<unsigned int> cpus;
+  EXPECT_TRUE(cpu_topology::parse_cpu_list("0-3,8,10-11\n", cpus));
+  EXPECT_EQ(cpus, vector<unsigned int>({0, 1, 2, 3, 8, 10, 11}));
+
+  EXPECT_TRUE(cpu_topology::parse_cpu_list("5", cpus));
+  EXPECT_EQ(cpus, vector<unsigned int>({5}));
+
+  EXPECT_FALSE(cpu_topology::parse_cpu_list("", cpus));
+  EXPECT_FALSE(cpu_topology::parse_cpu_list("3-1", cpus));
+  EXPECT_FALSE(cpu_topology::parse_cpu_list("1-", cpus));
+  EXPECT_FALSE(cpu_topology::parse_cpu_list("a", cpus));
+  EXPECT_FALSE(cpu_topology::parse_cpu_list("1,,2", cpus));
+}
+
+
+TEST(cpu_topology, discovery)
+{
+  char directory[] = "/tmp/facetools_topology_XXXXXX";
+  ASSERT_NE(mkdtemp(directory), nullptr);
+
+  cpu_topology topology(make_sys_root(directory), false);
+  ASSERT_EQ(topology.cpus().size(), 8u);
+  EXPECT_EQ(topology.num_nodes(), 2u);
+  EXPECT_EQ(topology.node_cpus(0), vector<unsigned int>({0, 1, 4, 5}));
+  EXPECT_EQ(topology.node_cpus(1), vector<unsigned int>({2, 3, 6, 7}));
+
+  EXPECT_EQ(topology.cpus()[6].core, 0u);
+  EXPECT_EQ(topology.cpus()[6].package, 1u);
+  EXPECT_EQ(topology.cpus()[6].node, 1u);
+
+  // Every core of a node before the SMT siblings, and every node before wrapping around.
+  EXPECT_EQ(topology.place(10, placement_policy_t::COMPACT),
+    vector<unsigned int>({0, 1, 4, 5, 2, 3, 6, 7, 0, 1}));
+  EXPECT_EQ(topology.place(5, placement_policy_t::SPREAD), vector<unsigned int>({0, 2, 1, 3, 4}));
+  EXPECT_TRUE(topology.place(4, placement_policy_t::NONE).empty());
+
+  system((string("rm -rf ") + directory).c_str());
+}
+
+
+TEST(cpu_topology, single_node)
+{
+  char directory[] = "/tmp/facetools_topology_XXXXXX";
+  ASSERT_NE(mkdtemp(directory), nullptr);
+
+  string root = directory;
+  write_file(root + "/cpu/cpu0/topology/core_id", "0");
+  write_file(root + "/cpu/cpu1/topology/core_id", "0");
+  write_file(root + "/cpu/cpu2/topology/core_id", "1");
+
+  // Without an online list or nodes, the cpu directories make one node.
+  cpu_topology topology(root, false);
+  EXPECT_EQ(topology.cpus().size(), 3u);
+  EXPECT_EQ(topology.num_nodes(), 1u);
+  EXPECT_EQ(topology.place(3, placement_policy_t::SPREAD), vector<unsigned int>({0, 2, 1}));
+
+  system((string("rm -rf ") + directory).c_str());
+}
+
+
+TEST(cpu_topology, pinning)
+{
+  cpu_topology topology;
+  ASSERT_FALSE(topology.cpus().empty());
+  unsigned int cpu = topology.cpus().back().id;
+
+  int ran_on = -1;
+  run_pinned(cpu, [&] { ran_on = sched_getcpu(); });
+  EXPECT_EQ(ran_on, int(cpu));
+
+  EXPECT_THROW(run_pinned(cpu, [] { throw runtime_error("failed"); }), runtime_error);
+
+  placement_policy_t policy;
+  EXPECT_TRUE(parse_placement_policy("spread", policy));
+  EXPECT_EQ(policy, placement_policy_t::SPREAD);
+  EXPECT_FALSE(parse_placement_policy("numa", policy));
+}
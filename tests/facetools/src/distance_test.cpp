@@ -0,0 +1,223 @@
+/* Tests for the FaceTools distance kernels.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <facetools/distance.h>
+#include <facetools/face.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## CONSTANTS ###################################################################################
+
+static const size_t DIMS = 128;
+
+
+// ## PRIVATE METHODS #############################################################################
+
+static vector<float> random_rows(size_t rows, size_t dims, unsigned int seed)
+{
+  mt19937 generator(seed);
+  normal_distribution<float> distribution(0, 0.1);
+  vector<float> data(rows * dims);
+
+  for(auto& value : data)
+    value = distribution(generator);
+
+  return data;
+}
+
+
+static double reference_squared_distance(const float* a, const float* b, size_t dims)
+{
+  double sum = 0;
+  for(size_t i = 0; i < dims; ++i)
+    sum += (double(a[i]) - b[i]) * (double(a[i]) - b[i]);
+
+  return sum;
+}
+
+
+static double reference_dot_product(const float* a, const float* b, size_t dims)
+{
+  double sum = 0;
+  for(size_t i = 0; i < dims; ++i)
+    sum += double(a[i]) * b[i];
+
+  return sum;
+}
+
+
+static vector<distance_kernel_t> supported_kernels()
+{
+  vector<distance_kernel_t> kernels;
+  for(auto kernel : {distance_kernel_t::SCALAR, distance_kernel_t::AVX2, distance_kernel_t::AVX512})
+    if(distance_kernel_supported(kernel))
+      kernels.push_back(kernel);
+
+  return kernels;
+}
+
+
+// ## TESTS #######################################################################################
+
+TEST(distance, squared_distance_all_kernels)
+{
+  auto default_kernel = get_distance_kernel();
+
+  for(auto kernel : supported_kernels()) {
+    set_distance_kernel(kernel);
+
+    for(size_t dims : {1, 7, 8, 31, 32, 33, 100, 128}) {
+      auto data = random_rows(2, dims, dims);
+      EXPECT_NEAR(squared_distance(&data[0], &data[dims], dims), reference_squared_distance(&data[0], &data[dims], dims), 1e-5);
+      EXPECT_NEAR(dot_product(&data[0], &data[dims], dims), reference_dot_product(&data[0], &data[dims], dims), 1e-5);
+    }
+  }
+
+  set_distance_kernel(default_kernel);
+}
+
+
+TEST(distance, within_squared_distance)
+{
+  auto default_kernel = get_distance_kernel();
+  auto data = random_rows(2, DIMS, 1);
+  float distance = reference_squared_distance(&data[0], &data[DIMS], DIMS);
+
+  for(auto kernel : supported_kernels()) {
+    set_distance_kernel(kernel);
+    EXPECT_TRUE(within_squared_distance(&data[0], &data[DIMS], DIMS, distance * 1.01f));
+    EXPECT_FALSE(within_squared_distance(&data[0], &data[DIMS], DIMS, distance * 0.99f));
+    EXPECT_FALSE(within_squared_distance(&data[0], &data[DIMS], DIMS, 1e-6f));
+    EXPECT_TRUE(within_squared_distance(&data[0], &data[0], DIMS, 1e-6f));
+  }
+
+  set_distance_kernel(default_kernel);
+}
+
+
+TEST(distance, one_vs_many)
+{
+  const size_t rows = 37;
+  auto query = random_rows(1, DIMS, 2);
+  auto data = random_rows(rows, DIMS, 3);
+  vector<float> distances(rows), products(rows);
+
+  squared_distances(query.data(), data.data(), rows, DIMS, distances.data());
+  dot_products(query.data(), data.data(), rows, DIMS, products.data());
+
+  for(size_t i = 0; i < rows; ++i) {
+    EXPECT_NEAR(distances[i], reference_squared_distance(query.data(), &data[i * DIMS], DIMS), 1e-5);
+    EXPECT_NEAR(products[i], reference_dot_product(query.data(), &data[i * DIMS], DIMS), 1e-5);
+  }
+}
+
+
+TEST(distance, many_vs_many)
+{
+  const size_t queries = 5;
+  const size_t rows = 150;
+  auto default_kernel = get_distance_kernel();
+  vector<float> distances(queries * rows), products(queries * rows);
+
+  for(auto kernel : supported_kernels()) {
+    set_distance_kernel(kernel);
+
+    for(size_t dims : {13, 128}) {
+      auto query_data = random_rows(queries, dims, 4);
+      auto data = random_rows(rows, dims, 5);
+
+      pairwise_squared_distances(query_data.data(), queries, data.data(), rows, dims, distances.data());
+      pairwise_dot_products(query_data.data(), queries, data.data(), rows, dims, products.data());
+
+      for(size_t q = 0; q < queries; ++q) {
+        for(size_t i = 0; i < rows; ++i) {
+          EXPECT_NEAR(distances[q * rows + i], reference_squared_distance(&query_data[q * dims], &data[i * dims], dims), 1e-5);
+          EXPECT_NEAR(products[q * rows + i], reference_dot_product(&query_data[q * dims], &data[i * dims], dims), 1e-5);
+        }
+      }
+    }
+  }
+
+  set_distance_kernel(default_kernel);
+}
+
+
+TEST(distance, embeddings)
+{
+  auto data = random_rows(2, DIMS, 6);
+  embedding_t a(DIMS), b(DIMS);
+
+  for(size_t i = 0; i < DIMS; ++i) {
+    a(i) = data[i];
+    b(i) = data[DIMS + i];
+  }
+
+  float distance = reference_squared_distance(&data[0], &data[DIMS], DIMS);
+  EXPECT_NEAR(squared_distance(a, b), distance, 1e-5);
+  EXPECT_TRUE(within_distance(a, b, std::sqrt(distance) * 1.01f));
+  EXPECT_FALSE(within_distance(a, b, std::sqrt(distance) * 0.99f));
+  EXPECT_THROW(within_distance(a, embedding_t(DIMS / 2), 1.0f), std::runtime_error);
+}
+
+
+TEST(distance, half_precision_all_kernels)
+{
+  auto default_kernel = get_distance_kernel();
+  vector<float> values = {0.0f, -0.0f, 1.0f, -2.5f, 0.333333f, 65504.0f, 1e6f, -1e6f, 6e-8f, 1e-10f, 0.1f, 3.14159f};
+  vector<uint16_t> expected = {0x0000, 0x8000, 0x3c00, 0xc100, 0x3555, 0x7bff, 0x7c00, 0xfc00, 0x0001, 0x0000,
+    0x2e66, 0x4248};
+
+  for(auto kernel : supported_kernels()) {
+    set_distance_kernel(kernel);
+
+    vector<uint16_t> halves(values.size());
+    vector<float> floats(values.size());
+    float_to_half(values.data(), halves.data(), values.size());
+    half_to_float(halves.data(), floats.data(), values.size());
+
+    for(size_t i = 0; i < values.size(); ++i) {
+      EXPECT_EQ(halves[i], expected[i]);
+
+      if(std::fabs(values[i]) <= 65504.0f && std::fabs(values[i]) >= 6.1e-5f)
+        EXPECT_NEAR(floats[i], values[i], std::fabs(values[i]) / 1024);
+    }
+
+    // Every half value survives the round trip.
+    vector<uint16_t> all(1 << 16), round_trip(1 << 16);
+    vector<float> widened(1 << 16);
+    for(size_t i = 0; i < all.size(); ++i)
+      all[i] = i;
+
+    half_to_float(all.data(), widened.data(), all.size());
+    float_to_half(widened.data(), round_trip.data(), all.size());
+
+    size_t mismatches = 0;
+    for(size_t i = 0; i < all.size(); ++i)
+      if(round_trip[i] != all[i] && !std::isnan(widened[i]))
+        ++mismatches;
+
+    EXPECT_EQ(mismatches, 0u);
+  }
+
+  set_distance_kernel(default_kernel);
+}
@@ -0,0 +1,101 @@
+/* Tests for the FaceTools embedding cache and content hashes.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <facetools/embedding_cache.h>
+#include <facetools/hash.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## PRIVATE METHODS #############################################################################
+
+static embedding_t make_embedding(float value)
+{
+  embedding_t embedding(128);
+  for(long i = 0; i < embedding.size(); ++i)
+    embedding(i) = value + i;
+
+  return embedding;
+}
+
+
+// ## TESTS #######################################################################################
+
+TEST(embedding_cache, hash)
+{
+  vector<unsigned char> data(1000);
+  for(size_t i = 0; i < data.size(); ++i)
+    data[i] = i * 7;
+
+  for(size_t size : {0, 1, 31, 32, 33, 1000})
+    EXPECT_EQ(hash_bytes(data.data(), size), hash_bytes(data.data(), size));
+
+  auto hash = hash_bytes(data.data(), data.size());
+  EXPECT_NE(hash, hash_bytes(data.data(), data.size() - 1));
+  EXPECT_NE(hash, hash_bytes(data.data(), data.size(), 1));
+
+  data[500] ^= 1;
+  EXPECT_NE(hash, hash_bytes(data.data(), data.size()));
+  EXPECT_NE(hash_combine(hash, 0), hash_combine(hash, 1));
+}
+
+
+TEST(embedding_cache, lru_eviction)
+{
+  embedding_cache cache(2);
+  embedding_t embedding;
+
+  cache.put(1, make_embedding(1));
+  cache.put(2, make_embedding(2));
+  EXPECT_TRUE(cache.get(1, embedding));
+  cache.put(3, make_embedding(3));
+
+  EXPECT_EQ(cache.size(), 2u);
+  EXPECT_TRUE(cache.get(1, embedding));
+  EXPECT_EQ(embedding(0), 1);
+  EXPECT_FALSE(cache.get(2, embedding));
+  EXPECT_TRUE(cache.get(3, embedding));
+  EXPECT_EQ(cache.get_hits(), 3u);
+  EXPECT_EQ(cache.get_misses(), 1u);
+}
+
+
+TEST(embedding_cache, disk_round_trip)
+{
+  char directory[] = "/tmp/facetools_cache_XXXXXX";
+  ASSERT_NE(mkdtemp(directory), nullptr);
+
+  {
+    embedding_cache cache(1, directory);
+    cache.put(10, make_embedding(10));
+    cache.put(20, make_embedding(20));
+  }
+
+  embedding_cache cache(1, directory);
+  embedding_t embedding;
+  ASSERT_TRUE(cache.get(10, embedding));
+  ASSERT_EQ(embedding.size(), 128);
+  EXPECT_EQ(embedding(5), 15);
+  EXPECT_TRUE(cache.get(20, embedding));
+  EXPECT_FALSE(cache.get(30, embedding));
+
+  system((string("rm -rf ") + directory).c_str());
+}
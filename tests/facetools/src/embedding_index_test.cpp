@@ -0,0 +1,156 @@
+/* Tests for the FaceTools memory-mapped embedding index.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <facetools/embedding_index.h>
+#include <test_gallery.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## CONSTANTS ###################################################################################
+
+static const size_t DIMS = GALLERY_DIMS;
+static const size_t ROWS = 10000;
+static const char* INDEX_FILE = "/tmp/facetools_index_test.ftei";
+
+
+// ## PRIVATE METHODS #############################################################################
+
+static void write_index(const vector<float>& data, index_element_t element)
+{
+  embedding_index_writer writer(INDEX_FILE, DIMS, element);
+
+  for(size_t row = 0; row < data.size() / DIMS; ++row)
+    writer.add(&data[row * DIMS], "image_" + to_string(row / 2) + ".jpg", dlib::rectangle(row, 1, row + 10, 11), row % 2);
+
+  EXPECT_EQ(writer.size(), data.size() / DIMS);
+  writer.finish();
+}
+
+
+// ## TESTS #######################################################################################
+
+TEST(embedding_index, float32_round_trip)
+{
+  auto data = pack_embeddings(make_gallery(ROWS, 1, 1));
+  write_index(data, index_element_t::FLOAT32);
+
+  embedding_index index(INDEX_FILE);
+  ASSERT_EQ(index.size(), ROWS);
+  EXPECT_EQ(index.dims(), DIMS);
+  EXPECT_EQ(index.element(), index_element_t::FLOAT32);
+
+  auto embedding = index.get_embedding(1234);
+  for(size_t i = 0; i < DIMS; ++i)
+    EXPECT_EQ(embedding(i), data[1234 * DIMS + i]);
+
+  auto entry = index.get_entry(1235);
+  EXPECT_EQ(entry.file, "image_617.jpg");
+  EXPECT_EQ(entry.box, dlib::rectangle(1235, 1, 1245, 11));
+  EXPECT_EQ(entry.face, 1u);
+  EXPECT_THROW(index.get_entry(ROWS), std::runtime_error);
+
+  remove(INDEX_FILE);
+}
+
+
+TEST(embedding_index, search_matches_brute_force)
+{
+  auto data = pack_embeddings(make_gallery(ROWS, 1, 2));
+  write_index(data, index_element_t::FLOAT32);
+  embedding_index index(INDEX_FILE);
+
+  const float* query = &data[42 * DIMS];
+  float threshold = 1.55f;
+  auto expected = brute_force_radius(data, query, threshold);
+
+  for(unsigned int threads : {1u, 4u}) {
+    auto matches = index.search(to_embedding(query), threshold, threads);
+    ASSERT_EQ(matches.size(), expected.size());
+    EXPECT_EQ(matches[0].row, 42u);
+    EXPECT_EQ(matches[0].distance, 0.0f);
+
+    vector<size_t> rows;
+    for(size_t i = 0; i < matches.size(); ++i) {
+      rows.push_back(matches[i].row);
+      if(i)
+        EXPECT_LE(matches[i - 1].distance, matches[i].distance);
+    }
+
+    sort(rows.begin(), rows.end());
+    EXPECT_EQ(rows, expected);
+  }
+
+  auto nearest = index.nearest(to_embedding(query), 5, 3);
+  ASSERT_EQ(nearest.size(), 5u);
+  EXPECT_EQ(nearest[0].row, 42u);
+
+  auto all = index.search(to_embedding(query), 1e9f, 3);
+  for(size_t i = 0; i < nearest.size(); ++i)
+    EXPECT_EQ(nearest[i].row, all[i].row);
+
+  remove(INDEX_FILE);
+}
+
+
+TEST(embedding_index, float16)
+{
+  auto data = pack_embeddings(make_gallery(ROWS, 1, 3));
+  write_index(data, index_element_t::FLOAT16);
+
+  embedding_index index(INDEX_FILE);
+  ASSERT_EQ(index.size(), ROWS);
+  EXPECT_EQ(index.element(), index_element_t::FLOAT16);
+
+  auto embedding = index.get_embedding(7);
+  for(size_t i = 0; i < DIMS; ++i)
+    EXPECT_NEAR(embedding(i), data[7 * DIMS + i], 1e-3);
+
+  auto nearest = index.nearest(to_embedding(&data[9999 * DIMS]), 1);
+  ASSERT_EQ(nearest.size(), 1u);
+  EXPECT_EQ(nearest[0].row, 9999u);
+  EXPECT_LT(nearest[0].distance, 0.01f);
+
+  remove(INDEX_FILE);
+}
+
+
+TEST(embedding_index, rejects_corrupt_files)
+{
+  auto data = pack_embeddings(make_gallery(10, 1, 4));
+  write_index(data, index_element_t::FLOAT32);
+
+  {
+    // Cuts the file inside the row table.
+    ifstream input(INDEX_FILE, ios::binary);
+    string contents((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+    ofstream output(INDEX_FILE, ios::binary | ios::trunc);
+    output.write(contents.data(), contents.size() - 100);
+  }
+
+  EXPECT_THROW(embedding_index index(INDEX_FILE), std::runtime_error);
+  EXPECT_THROW(embedding_index index("/tmp/facetools_missing_index.ftei"), std::runtime_error);
+
+  remove(INDEX_FILE);
+}
@@ -0,0 +1,147 @@
+/* Tests for the FaceTools HNSW index, including its recall against a brute
+ * force scan. Its speed is measured by facetools_bench.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+#include <facetools/distance.h>
+#include <facetools/hnsw_index.h>
+#include <test_gallery.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## CONSTANTS ###################################################################################
+
+static const size_t DIMS = GALLERY_DIMS;
+
+/** facegrep's default match threshold. */
+static const float THRESHOLD = 0.6f;
+
+static const char* INDEX_FILE = "/tmp/facetools_hnsw_test.fthn";
+
+
+// ## TESTS #######################################################################################
+
+TEST(hnsw_index, small_exact)
+{
+  auto gallery = make_gallery(50, 4, 1);
+  auto rows = pack_embeddings(gallery);
+  hnsw_index index;
+
+  for(auto& face : gallery)
+    index.insert(face);
+
+  ASSERT_EQ(index.size(), gallery.size());
+
+  // On a gallery this small the candidate list covers everything, so answers are exact.
+  for(size_t i = 0; i < gallery.size(); i += 7) {
+    auto matches = index.knn(gallery[i], 4, 400);
+    ASSERT_EQ(matches.size(), 4u);
+    EXPECT_EQ(matches[0].row, i);
+    EXPECT_EQ(matches[0].distance, 0.0f);
+    EXPECT_EQ(recall(matches, brute_force_knn(rows, &rows[i * DIMS], 4)), 1.0);
+
+    auto in_range = index.radius(gallery[i], THRESHOLD);
+    auto expected = brute_force_radius(rows, &rows[i * DIMS], THRESHOLD);
+    EXPECT_EQ(in_range.size(), expected.size());
+    EXPECT_EQ(recall(in_range, expected), 1.0);
+  }
+
+  EXPECT_THROW(index.knn(embedding_t(DIMS / 2), 1), std::runtime_error);
+}
+
+
+TEST(hnsw_index, recall_against_brute_force)
+{
+  const size_t identities = 1000;
+  const size_t photos = 4;
+  const size_t queries = 50;
+  const size_t k = 10;
+
+  auto gallery = make_gallery(identities, photos, 2);
+  auto rows = pack_embeddings(gallery);
+  hnsw_index index;
+  index.build(gallery);
+
+  ASSERT_EQ(index.size(), gallery.size());
+
+  // Queries are fresh photos of identities in the gallery.
+  mt19937 generator(3);
+  normal_distribution<float> photo(0.0f, 0.02f);
+  double radius_recall = 0, knn_recall = 0;
+
+  for(size_t q = 0; q < queries; ++q) {
+    embedding_t probe = gallery[(q * 97 % identities) * photos];
+    for(size_t d = 0; d < DIMS; ++d)
+      probe(d) += photo(generator);
+
+    auto expected = brute_force_radius(rows, &probe(0), THRESHOLD);
+    EXPECT_GE(expected.size(), photos);
+
+    radius_recall += recall(index.radius(probe, THRESHOLD), expected);
+    knn_recall += recall(index.knn(probe, k), brute_force_knn(rows, &probe(0), k));
+  }
+
+  EXPECT_GE(radius_recall / queries, 0.98);
+  EXPECT_GE(knn_recall / queries, 0.95);
+}
+
+
+TEST(hnsw_index, save_and_load)
+{
+  auto gallery = make_gallery(200, 3, 4);
+  hnsw_parameters_t params;
+  params.M = 8;
+  params.num_threads = 2;
+
+  hnsw_index index(DIMS, params);
+  index.build(gallery);
+  index.save(INDEX_FILE);
+
+  hnsw_index loaded;
+  loaded.load(INDEX_FILE);
+  ASSERT_EQ(loaded.size(), index.size());
+  EXPECT_EQ(loaded.dims(), DIMS);
+  EXPECT_EQ(loaded.params_.M, 8u);
+  EXPECT_EQ(squared_distance(loaded.get_embedding(17), gallery[17]), 0.0f);
+
+  for(size_t i = 0; i < gallery.size(); i += 11) {
+    auto expected = index.knn(gallery[i], 5);
+    auto matches = loaded.knn(gallery[i], 5);
+    ASSERT_EQ(matches.size(), expected.size());
+
+    for(size_t m = 0; m < matches.size(); ++m)
+      EXPECT_EQ(matches[m].row, expected[m].row);
+  }
+
+  // Inserting after a load keeps working.
+  loaded.insert(gallery[0]);
+  EXPECT_EQ(loaded.knn(gallery[0], 2).size(), 2u);
+
+  // A truncated file is rejected.
+  truncate(INDEX_FILE, 1000);
+  hnsw_index truncated;
+  EXPECT_THROW(truncated.load(INDEX_FILE), std::runtime_error);
+  EXPECT_EQ(truncated.size(), 0u);
+
+  remove(INDEX_FILE);
+}
@@ -0,0 +1,163 @@
+/* Tests for the FaceTools incremental_clusterer class.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include <facetools/chinese_whispers.h>
+#include <facetools/incremental_clusterer.h>
+#include <facetools/similarity_graph.h>
+#include <test_gallery.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## CONSTANTS ###################################################################################
+
+static const size_t DIMS = GALLERY_DIMS;
+static const float THRESHOLD = 0.4;
+
+
+// ## PRIVATE METHODS #############################################################################
+
+static embedding_t point(float offset, float noise, mt19937& generator)
+{
+  normal_distribution<float> distribution(0, noise);
+  embedding_t embedding(DIMS);
+
+  for(size_t d = 0; d < DIMS; ++d)
+    embedding(d) = distribution(generator);
+  embedding(0) += offset;
+
+  return embedding;
+}
+
+
+static set<facelist_t> as_partition(const vector<facelist_t>& people)
+{
+  return set<facelist_t>(people.begin(), people.end());
+}
+
+
+// ## TESTS #######################################################################################
+
+TEST(incremental_clusterer, matches_full_clustering)
+{
+  // Photos in random order, so batches both start clusters and join them.
+  auto embeddings = make_gallery(25, 24, 1);
+  shuffle(embeddings.begin(), embeddings.end(), mt19937(1));
+
+  vector<unsigned long> labels;
+  auto num_clusters = chinese_whispers(find_similar_pairs(embeddings, THRESHOLD), embeddings.size(), labels);
+  vector<facelist_t> expected(num_clusters);
+  for(size_t i = 0; i < labels.size(); ++i)
+    expected[labels[i]].push_back(i);
+
+  // Representatives checked in blocked products, then found through the index from the first batch on.
+  for(size_t index_clusters : {size_t(65536), size_t(0)}) {
+    incremental_clusterer_parameters_t params;
+    params.face_difference_threshold = THRESHOLD;
+    params.index_clusters = index_clusters;
+    incremental_clusterer clusterer(params);
+
+    for(size_t begin = 0; begin < embeddings.size(); begin += 100) {
+      vector<embedding_t> batch(embeddings.begin() + begin, embeddings.begin() + begin + 100);
+      auto changes = clusterer.add(batch);
+      EXPECT_GE(changes.size(), batch.size());
+    }
+
+    EXPECT_EQ(clusterer.size(), embeddings.size());
+    EXPECT_EQ(clusterer.index_ != nullptr, index_clusters == 0);
+    EXPECT_EQ(clusterer.num_clusters(), num_clusters);
+    EXPECT_TRUE(as_partition(clusterer.get_people()) == as_partition(expected));
+  }
+}
+
+
+TEST(incremental_clusterer, reports_only_changes)
+{
+  mt19937 generator(2);
+  incremental_clusterer_parameters_t params;
+  params.face_difference_threshold = THRESHOLD;
+  incremental_clusterer clusterer(params);
+
+  vector<embedding_t> first, second;
+  for(int i = 0; i < 10; ++i)
+    first.push_back(point(0, 0.001, generator));
+  for(int i = 0; i < 5; ++i)
+    second.push_back(point(5, 0.001, generator));
+
+  auto changes = clusterer.add(first);
+  EXPECT_EQ(changes.size(), 10);
+  EXPECT_EQ(clusterer.num_clusters(), 1);
+
+  changes = clusterer.add(second);
+  ASSERT_EQ(changes.size(), 5);
+  EXPECT_EQ(changes[0].face, 10);
+  EXPECT_EQ(changes[4].face, 14);
+  EXPECT_NE(changes[0].cluster, clusterer.get_cluster(0));
+  EXPECT_EQ(clusterer.num_clusters(), 2);
+
+  // A face close to the first group joins its cluster without touching anything else.
+  changes = clusterer.add(vector<embedding_t>(1, point(0.01, 0.001, generator)));
+  ASSERT_EQ(changes.size(), 1);
+  EXPECT_EQ(changes[0].face, 15);
+  EXPECT_EQ(changes[0].cluster, clusterer.get_cluster(0));
+  EXPECT_EQ(clusterer.get_members(clusterer.get_cluster(0)).size(), 11);
+}
+
+
+TEST(incremental_clusterer, merges_bridged_clusters)
+{
+  mt19937 generator(3);
+  incremental_clusterer_parameters_t params;
+  params.face_difference_threshold = THRESHOLD;
+  incremental_clusterer clusterer(params);
+
+  vector<embedding_t> groups, bridge;
+  for(int i = 0; i < 8; ++i)
+    groups.push_back(point(0, 0.001, generator));
+  for(int i = 0; i < 8; ++i)
+    groups.push_back(point(0.7, 0.001, generator));
+  for(int i = 0; i < 12; ++i)
+    bridge.push_back(point(0.35, 0.001, generator));
+
+  clusterer.add(groups);
+  EXPECT_EQ(clusterer.num_clusters(), 2);
+
+  auto changes = clusterer.add(bridge);
+  EXPECT_EQ(clusterer.num_clusters(), 1);
+  EXPECT_EQ(changes.size(), 12 + 8);
+  EXPECT_EQ(clusterer.get_members(clusterer.get_cluster(0)).size(), 28);
+
+  auto representative = clusterer.get_representative(clusterer.get_cluster(0));
+  EXPECT_NEAR(representative(0), (8 * 0.7 + 12 * 0.35) / 28, 0.01);
+}
+
+
+TEST(incremental_clusterer, rejects_mismatched_sizes)
+{
+  mt19937 generator(4);
+  incremental_clusterer clusterer((incremental_clusterer_parameters_t()));
+  clusterer.add(vector<embedding_t>(1, point(0, 0.01, generator)));
+
+  EXPECT_THROW(clusterer.add(vector<embedding_t>(1, embedding_t(DIMS / 2))), std::runtime_error);
+  EXPECT_THROW(clusterer.get_cluster(1), std::runtime_error);
+}
@@ -0,0 +1,131 @@
+/* Tests for the FaceTools IVF-PQ index.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+#include <facetools/embedding_index.h>
+#include <facetools/ivfpq_index.h>
+#include <test_gallery.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## CONSTANTS ###################################################################################
+
+static const size_t DIMS = GALLERY_DIMS;
+static const char* STORE_FILE = "/tmp/facetools_ivfpq_store.ftei";
+static const char* INDEX_FILE = "/tmp/facetools_ivfpq_test.ftip";
+
+
+// ## TESTS #######################################################################################
+
+TEST(ivfpq_index, recall_with_reranking)
+{
+  const size_t k = 4;
+  auto gallery = pack_embeddings(make_gallery(2000, 4, 1));
+  size_t rows = gallery.size() / DIMS;
+
+  {
+    embedding_index_writer writer(STORE_FILE);
+    for(size_t i = 0; i < rows; ++i)
+      writer.add(&gallery[i * DIMS], "image.jpg", dlib::rectangle(0, 0, 10, 10));
+
+    writer.finish();
+  }
+
+  embedding_index store(STORE_FILE);
+
+  ivfpq_parameters_t params;
+  params.num_lists = 64;
+  params.num_probes = 8;
+  params.training_iterations = 10;
+
+  ivfpq_index index(DIMS, params);
+  EXPECT_THROW(index.add(gallery.data(), 1, 0), std::runtime_error);
+
+  index.train(gallery.data(), rows);
+  index.add(store);
+  ASSERT_EQ(index.size(), rows);
+
+  double reranked = 0, coded = 0;
+  const size_t queries = 100;
+
+  for(size_t q = 0; q < queries; ++q) {
+    const float* query = &gallery[(q * 79 % rows) * DIMS];
+    auto expected = brute_force_knn(gallery, query, k);
+
+    auto matches = index.search(to_embedding(query), k, &store);
+    ASSERT_EQ(matches.size(), k);
+    EXPECT_EQ(matches[0].row, expected[0]);
+    EXPECT_EQ(matches[0].distance, 0.0f);
+
+    reranked += recall(matches, expected);
+    coded += recall(index.search(to_embedding(query), k), expected);
+  }
+
+  printf("ivfpq: %zu faces, %u byte codes, recall@%zu %.4f re-ranked, %.4f from codes alone\n", rows,
+    params.code_size, k, reranked / queries, coded / queries);
+
+  EXPECT_GE(reranked / queries, 0.95);
+  EXPECT_GE(coded / queries, 0.8);
+
+  remove(STORE_FILE);
+}
+
+
+TEST(ivfpq_index, save_and_load)
+{
+  auto gallery = pack_embeddings(make_gallery(300, 2, 2));
+  size_t rows = gallery.size() / DIMS;
+
+  ivfpq_parameters_t params;
+  params.num_lists = 16;
+  params.code_size = 32;
+  params.training_iterations = 5;
+
+  ivfpq_index index(DIMS, params);
+  index.train(gallery.data(), rows);
+  index.add(gallery.data(), rows, 1000);
+  index.save(INDEX_FILE);
+
+  ivfpq_index loaded;
+  loaded.load(INDEX_FILE);
+  ASSERT_EQ(loaded.size(), rows);
+  EXPECT_EQ(loaded.params_.code_size, 32u);
+
+  for(size_t i = 0; i < rows; i += 37) {
+    auto expected = index.search(to_embedding(&gallery[i * DIMS]), 3);
+    auto matches = loaded.search(to_embedding(&gallery[i * DIMS]), 3);
+    ASSERT_EQ(matches.size(), expected.size());
+    EXPECT_GE(matches[0].row, 1000u);
+
+    for(size_t m = 0; m < matches.size(); ++m) {
+      EXPECT_EQ(matches[m].row, expected[m].row);
+      EXPECT_EQ(matches[m].distance, expected[m].distance);
+    }
+  }
+
+  truncate(INDEX_FILE, 5000);
+  ivfpq_index truncated;
+  EXPECT_THROW(truncated.load(INDEX_FILE), std::runtime_error);
+  EXPECT_FALSE(truncated.trained());
+
+  remove(INDEX_FILE);
+}
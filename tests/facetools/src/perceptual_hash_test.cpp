@@ -0,0 +1,160 @@
+/* Tests for the FaceTools perceptual image hashes.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <facetools/perceptual_hash.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## PRIVATE METHODS #############################################################################
+
+/* Smooth random blobs, so the image has structure at the scale the hash looks at. */
+static dlib::matrix<dlib::rgb_pixel> make_image(long rows, long columns, unsigned int seed)
+{
+  mt19937 generator(seed);
+  uniform_real_distribution<float> position(0, 1);
+  uniform_real_distribution<float> colour(0, 255);
+
+  struct blob_t { float r, c, radius, red, green, blue; };
+  vector<blob_t> blobs(12);
+  for(auto& blob : blobs)
+    blob = {position(generator), position(generator), 0.1f + 0.3f * position(generator), colour(generator),
+      colour(generator), colour(generator)};
+
+  dlib::matrix<dlib::rgb_pixel> image(rows, columns);
+  for(long r = 0; r < rows; ++r) {
+    for(long c = 0; c < columns; ++c) {
+      float red = 0, green = 0, blue = 0, total = 1e-3f;
+
+      for(auto& blob : blobs) {
+        float dr = float(r) / rows - blob.r, dc = float(c) / columns - blob.c;
+        float weight = max(0.0f, 1 - (dr * dr + dc * dc) / (blob.radius * blob.radius));
+        red += weight * blob.red;
+        green += weight * blob.green;
+        blue += weight * blob.blue;
+        total += weight;
+      }
+
+      image(r, c) = dlib::rgb_pixel(red / total, green / total, blue / total);
+    }
+  }
+
+  return image;
+}
+
+
+/* Averages factor x factor blocks, as a resized copy would. */
+static dlib::matrix<dlib::rgb_pixel> shrink(const dlib::matrix<dlib::rgb_pixel>& image, long factor)
+{
+  dlib::matrix<dlib::rgb_pixel> small(image.nr() / factor, image.nc() / factor);
+
+  for(long r = 0; r < small.nr(); ++r) {
+    for(long c = 0; c < small.nc(); ++c) {
+      unsigned int sums[3] = {0, 0, 0};
+      for(long i = 0; i < factor; ++i) {
+        for(long j = 0; j < factor; ++j) {
+          auto& pixel = image(r * factor + i, c * factor + j);
+          sums[0] += pixel.red;
+          sums[1] += pixel.green;
+          sums[2] += pixel.blue;
+        }
+      }
+
+      small(r, c) = dlib::rgb_pixel(sums[0] / (factor * factor), sums[1] / (factor * factor),
+        sums[2] / (factor * factor));
+    }
+  }
+
+  return small;
+}
+
+
+// ## TESTS #######################################################################################
+
+TEST(perceptual_hash, survives_resizing_and_noise)
+{
+  auto image = make_image(480, 640, 1);
+  auto hash = difference_hash(image);
+
+  auto noisy = image;
+  mt19937 generator(2);
+  uniform_int_distribution<int> noise(-6, 6);
+  for(long r = 0; r < noisy.nr(); ++r) {
+    for(long c = 0; c < noisy.nc(); ++c) {
+      auto& pixel = noisy(r, c);
+      pixel.red = min(255, max(0, pixel.red + noise(generator)));
+      pixel.green = min(255, max(0, pixel.green + noise(generator)));
+      pixel.blue = min(255, max(0, pixel.blue + noise(generator)));
+    }
+  }
+
+  EXPECT_LE(hamming_distance(hash, difference_hash(shrink(image, 2))), 2);
+  EXPECT_LE(hamming_distance(hash, difference_hash(shrink(image, 4))), 4);
+  EXPECT_LE(hamming_distance(hash, difference_hash(noisy)), 4);
+
+  // Unrelated images differ in about half the bits.
+  for(unsigned int seed = 3; seed < 8; ++seed)
+    EXPECT_GT(hamming_distance(hash, difference_hash(make_image(480, 640, seed))), 12);
+
+  EXPECT_EQ(difference_hash(dlib::matrix<dlib::rgb_pixel>()), 0);
+}
+
+
+TEST(perceptual_hash, index_matches_brute_force)
+{
+  mt19937_64 generator(4);
+  vector<uint64_t> hashes(5000);
+  for(auto& hash : hashes)
+    hash = generator();
+
+  for(unsigned int radius : {0, 3, 8}) {
+    perceptual_hash_index index(radius);
+    for(size_t i = 0; i < hashes.size(); ++i)
+      index.insert(hashes[i], i + 100);
+
+    EXPECT_EQ(index.size(), hashes.size());
+
+    // Queries are stored hashes with up to twice the radius bits flipped, so some match and some do not.
+    uniform_int_distribution<size_t> pick(0, hashes.size() - 1);
+    uniform_int_distribution<int> bit(0, 63);
+    for(int query_number = 0; query_number < 500; ++query_number) {
+      uint64_t query = hashes[pick(generator)];
+      for(unsigned int flips = query_number % (2 * radius + 1); flips; --flips)
+        query ^= uint64_t(1) << bit(generator);
+
+      unsigned int best_distance = radius + 1;
+      size_t expected = 0;
+      for(size_t i = 0; i < hashes.size(); ++i) {
+        if(hamming_distance(query, hashes[i]) < best_distance) {
+          best_distance = hamming_distance(query, hashes[i]);
+          expected = i + 100;
+        }
+      }
+
+      size_t id = 0;
+      ASSERT_EQ(index.find(query, id), best_distance <= radius);
+      if(best_distance <= radius)
+        EXPECT_EQ(id, expected);
+    }
+  }
+
+  EXPECT_THROW(perceptual_hash_index(64), std::runtime_error);
+}
@@ -0,0 +1,92 @@
+/* Tests for the FaceTools similarity graph construction.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <facetools/distance.h>
+#include <facetools/similarity_graph.h>
+#include <test_gallery.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## CONSTANTS ###################################################################################
+
+static const size_t DIMS = GALLERY_DIMS;
+static const float THRESHOLD = 0.6;
+
+
+// ## TESTS #######################################################################################
+
+TEST(similarity_graph, matches_serial_loop)
+{
+  auto embeddings = make_gallery(12, 60, 1);
+
+  std::vector<dlib::sample_pair> expected;
+  for(size_t i = 0; i < embeddings.size(); ++i)
+    for(size_t j = i+1; j < embeddings.size(); ++j)
+      if(within_distance(embeddings[i], embeddings[j], THRESHOLD))
+        expected.push_back(dlib::sample_pair(i, j));
+
+  EXPECT_GT(expected.size(), 0);
+
+  for(unsigned int threads : {1, 3, 8}) {
+    auto edges = find_similar_pairs(embeddings, THRESHOLD, threads);
+    ASSERT_EQ(edges.size(), expected.size());
+
+    for(size_t i = 0; i < edges.size(); ++i) {
+      EXPECT_EQ(edges[i].index1(), expected[i].index1());
+      EXPECT_EQ(edges[i].index2(), expected[i].index2());
+    }
+  }
+}
+
+
+TEST(similarity_graph, small_inputs)
+{
+  EXPECT_EQ(find_similar_pairs(vector<embedding_t>(), THRESHOLD).size(), 0);
+  EXPECT_EQ(find_similar_pairs(make_gallery(1, 1, 2), THRESHOLD).size(), 0);
+  EXPECT_EQ(find_similar_pairs(make_gallery(1, 2, 2), THRESHOLD).size(), 1);
+}
+
+
+TEST(similarity_graph, build_graph_out_of_core)
+{
+  auto embeddings = make_gallery(12, 125, 3);
+  auto rows = pack_embeddings(embeddings);
+  auto expected = make_csr_graph(find_similar_pairs(embeddings, THRESHOLD), embeddings.size());
+
+  EXPECT_GT(expected.neighbours.size(), 20000);
+
+  // A budget of one byte spills every 1024 edges per worker. A large one never spills.
+  for(size_t budget : {size_t(1), size_t(1) << 30}) {
+    for(unsigned int threads : {1, 3}) {
+      similarity_graph_parameters_t params;
+      params.threshold = THRESHOLD;
+      params.memory_budget = budget;
+      params.num_threads = threads;
+
+      auto graph = build_similarity_graph(rows.data(), embeddings.size(), DIMS, params);
+      EXPECT_TRUE(graph.offsets == expected.offsets);
+      EXPECT_TRUE(graph.neighbours == expected.neighbours);
+      EXPECT_TRUE(graph.weights == expected.weights);
+    }
+  }
+
+  EXPECT_EQ(build_similarity_graph(rows.data(), 1, DIMS).num_nodes(), 1);
+  EXPECT_EQ(build_similarity_graph(rows.data(), 1, DIMS).neighbours.size(), 0);
+}
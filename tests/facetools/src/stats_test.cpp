@@ -0,0 +1,172 @@
+/* Tests for the FaceTools stage stats.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <facetools/stats.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## CONSTANTS ###################################################################################
+
+static const char* STATS_FILE = "/tmp/facetools_stats_test.json";
+
+
+// ## TESTS #######################################################################################
+
+TEST(stats, disabled)
+{
+  set_stats_enabled(false);
+  auto before = get_stats();
+
+  add_stat(stat_counter_t::FACES, 5);
+  record_time(stat_timer_t::DETECT, 1000);
+  {
+    stat_timer timer(stat_timer_t::DETECT);
+  }
+
+  auto after = get_stats();
+  EXPECT_EQ(after[stat_counter_t::FACES], before[stat_counter_t::FACES]);
+  EXPECT_EQ(after[stat_timer_t::DETECT].count, before[stat_timer_t::DETECT].count);
+}
+
+
+TEST(stats, counters)
+{
+  set_stats_enabled(true);
+  auto before = get_stats();
+
+  // Threads that have exited still count, and later threads take their storage over.
+  for(int round = 0; round < 2; ++round) {
+    vector<thread> threads;
+    for(int t = 0; t < 4; ++t)
+      threads.emplace_back([] {
+        for(int i = 0; i < 1000; ++i)
+          add_stat(stat_counter_t::IMAGES);
+
+        add_stat(stat_counter_t::BYTES_READ, 4096);
+      });
+
+    for(auto& thread : threads)
+      thread.join();
+  }
+
+  add_stat(stat_counter_t::IMAGES);
+
+  auto after = get_stats();
+  EXPECT_EQ(after[stat_counter_t::IMAGES] - before[stat_counter_t::IMAGES], 8001u);
+  EXPECT_EQ(after[stat_counter_t::BYTES_READ] - before[stat_counter_t::BYTES_READ], 8u * 4096);
+  set_stats_enabled(false);
+}
+
+
+TEST(stats, timers)
+{
+  set_stats_enabled(true);
+  auto before = get_stats()[stat_timer_t::CHIP_EXTRACT];
+
+  // 100 times of 1000 ns, falling in bucket 9, and one of 1 ms.
+  for(int i = 0; i < 100; ++i)
+    record_time(stat_timer_t::CHIP_EXTRACT, 1000);
+
+  record_time(stat_timer_t::CHIP_EXTRACT, 1000000);
+
+  {
+    stat_timer timer(stat_timer_t::CHIP_EXTRACT);
+    this_thread::sleep_for(chrono::milliseconds(2));
+  }
+
+  auto after = get_stats()[stat_timer_t::CHIP_EXTRACT];
+  set_stats_enabled(false);
+
+  EXPECT_EQ(after.count - before.count, 102u);
+  EXPECT_EQ(after.buckets[9] - before.buckets[9], 100u);
+  EXPECT_GE(after.total_ns - before.total_ns, 100u * 1000 + 1000000 + 2000000);
+  EXPECT_GE(after.max_ns, 2000000u);
+
+  // Percentiles stay within the bucket holding them.
+  timer_stats_t times;
+  times.count = 101;
+  times.total_ns = 1100000;
+  times.max_ns = 1000000;
+  times.buckets[9] = 100;
+  times.buckets[19] = 1;
+
+  EXPECT_GE(times.percentile_ns(50), 512);
+  EXPECT_LT(times.percentile_ns(50), 1024);
+  EXPECT_GE(times.percentile_ns(100), 524288);
+  EXPECT_LE(times.percentile_ns(100), 1000000);
+  EXPECT_NEAR(times.mean_ns(), 1100000.0 / 101, 1e-6);
+
+  EXPECT_EQ(timer_stats_t().percentile_ns(50), 0);
+  EXPECT_EQ(timer_stats_t().mean_ns(), 0);
+}
+
+
+TEST(stats, reports)
+{
+  stats_snapshot_t stats;
+  stats.counters[size_t(stat_counter_t::SEARCH_CACHE_HITS)] = 7;
+  stats.timers[size_t(stat_timer_t::PYRAMID_UP)].count = 1;
+  stats.timers[size_t(stat_timer_t::PYRAMID_UP)].total_ns = 3000;
+  stats.timers[size_t(stat_timer_t::PYRAMID_UP)].max_ns = 3000;
+  stats.timers[size_t(stat_timer_t::PYRAMID_UP)].buckets[11] = 1;
+
+  EXPECT_STREQ(stat_name(stat_counter_t::SEARCH_CACHE_HITS), "search_cache_hits");
+  EXPECT_STREQ(stat_name(stat_timer_t::PYRAMID_UP), "pyramid_up");
+
+  // Stages that never ran are left out of the summary, but not out of the JSON.
+  ostringstream summary;
+  write_stats(summary, stats);
+  EXPECT_NE(summary.str().find("search_cache_hits"), string::npos);
+  EXPECT_NE(summary.str().find("pyramid_up"), string::npos);
+  EXPECT_EQ(summary.str().find("shape_predict"), string::npos);
+
+  ostringstream json;
+  write_stats_json(json, stats);
+  EXPECT_NE(json.str().find("\"search_cache_hits\": 7"), string::npos);
+  EXPECT_NE(json.str().find("\"pyramid_up\": {\"count\": 1, \"total_ns\": 3000"), string::npos);
+  EXPECT_NE(json.str().find("\"buckets\": {\"2048\": 1}"), string::npos);
+  EXPECT_NE(json.str().find("\"shape_predict\": {\"count\": 0"), string::npos);
+}
+
+
+TEST(stats, writer)
+{
+  remove(STATS_FILE);
+
+  {
+    stats_writer writer(STATS_FILE, 0);
+    EXPECT_FALSE(ifstream(STATS_FILE).good());
+  }
+
+  // Written when the writer goes.
+  ifstream file(STATS_FILE);
+  ASSERT_TRUE(file.good());
+
+  string json((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+  EXPECT_NE(json.find("\"counters\""), string::npos);
+  EXPECT_NE(json.find("\"timers\""), string::npos);
+
+  remove(STATS_FILE);
+}
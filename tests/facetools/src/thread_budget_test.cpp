@@ -0,0 +1,87 @@
+/* Tests for the FaceTools thread budget.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <facetools/thread_budget.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## TESTS #######################################################################################
+
+TEST(thread_budget, split)
+{
+  thread_budget budget(12);
+  EXPECT_EQ(budget.threads(), 12u);
+
+  auto split = budget.split(4);
+  EXPECT_EQ(split.workers, 4u);
+  EXPECT_EQ(split.blas_threads, 3u);
+
+  // Over budget, every worker still gets a thread.
+  split = budget.split(16);
+  EXPECT_EQ(split.workers, 16u);
+  EXPECT_EQ(split.blas_threads, 1u);
+
+  EXPECT_GE(thread_budget().threads(), 1u);
+}
+
+
+TEST(thread_budget, candidates)
+{
+  vector<unsigned int> workers, blas_threads;
+  for(auto& split : thread_budget(12).candidates(2)) {
+    workers.push_back(split.workers);
+    blas_threads.push_back(split.blas_threads);
+  }
+
+  EXPECT_EQ(workers, vector<unsigned int>({2, 4, 8, 12}));
+  EXPECT_EQ(blas_threads, vector<unsigned int>({6, 3, 1, 1}));
+
+  EXPECT_EQ(thread_budget(8).candidates().size(), 4u);
+
+  auto splits = thread_budget(1).candidates(2);
+  ASSERT_EQ(splits.size(), 1u);
+  EXPECT_EQ(splits[0].workers, 2u);
+  EXPECT_EQ(splits[0].blas_threads, 1u);
+}
+
+
+TEST(thread_budget, tune)
+{
+  // Throughput peaks at 4 workers.
+  vector<unsigned int> tried;
+  auto best = thread_budget::tune(thread_budget(16).candidates(), [&](const thread_split_t& split) {
+    tried.push_back(split.workers);
+    return split.workers == 4 ? 10.0 : 1.0;
+  });
+
+  EXPECT_EQ(tried, vector<unsigned int>({1, 2, 4, 8, 16}));
+  EXPECT_EQ(best.workers, 4u);
+  EXPECT_EQ(best.blas_threads, 4u);
+}
+
+
+TEST(thread_budget, blas_threads)
+{
+  // Only OpenBLAS lets the thread count change at runtime.
+  if(set_blas_threads(2))
+    EXPECT_EQ(get_blas_threads(), 2u);
+  else
+    EXPECT_EQ(get_blas_threads(), 0u);
+}
@@ -0,0 +1,224 @@
+/* Tests for the FaceTools EXIF thumbnail prefilter.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <dlib/image_io.h>
+#include <dlib/image_transforms.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <facetools/face_detector.h>
+#include <facetools/jpeg_decoder.h>
+#include <facetools/thumbnail_prefilter.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## CONSTANTS ###################################################################################
+
+static const char FACE_DETECTOR_MODEL[] = "../models/mmod_human_face_detector.dat";
+static const char SHAPE_PREDICTOR_MODEL[] = "../models/shape_predictor_68_face_landmarks.dat";
+static const char* FACE_IMAGES[] = {
+  "../test_data/facetools/bald_guys.jpg",
+  "../test_data/facegrep/searchdir/bruce0.jpg",
+  "../test_data/facegrep/searchdir/rock0.jpg",
+  "../test_data/facegrep/searchdir/bruce/bruce1.jpg",
+  "../test_data/facegrep/searchdir/bruce/bruce2.jpg",
+  "../test_data/facegrep/searchdir/bruce/bruce3.jpg",
+  "../test_data/facegrep/searchdir/rock/rock1.jpg",
+  "../test_data/facegrep/searchdir/rock/rock2.jpg",
+  "../test_data/facegrep/searchdir/rock/rock3.jpg"
+};
+
+
+// ## PRIVATE METHODS #############################################################################
+
+static string temporary_file(const string& name)
+{
+  return "/tmp/thumbnail_prefilter_test_" + to_string(getpid()) + "_" + name;
+}
+
+
+static vector<unsigned char> encode_jpeg(const dlib::matrix<dlib::rgb_pixel>& image)
+{
+  string file_name = temporary_file("encode.jpg");
+  dlib::save_jpeg(image, file_name, 90);
+
+  ifstream file(file_name, ios::binary);
+  vector<unsigned char> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+  remove(file_name.c_str());
+
+  return data;
+}
+
+
+/* Writes a JPEG with an EXIF segment holding an empty IFD0 and an IFD1 pointing at the thumbnail, the layout cameras
+ * use. */
+static void write_exif_jpeg(const string& file_name, const vector<unsigned char>& image,
+  const vector<unsigned char>& thumbnail, bool big_endian)
+{
+  vector<unsigned char> tiff;
+  auto put = [&](uint32_t value, size_t bytes) {
+    for(size_t i = 0; i < bytes; ++i)
+      tiff.push_back(value >> (8 * (big_endian ? bytes - 1 - i : i)));
+  };
+
+  tiff.push_back(big_endian ? 'M' : 'I');
+  tiff.push_back(big_endian ? 'M' : 'I');
+  put(42, 2);
+  put(8, 4);
+
+  // IFD0, no entries.
+  put(0, 2);
+  put(14, 4);
+
+  // IFD1, thumbnail offset and length.
+  put(2, 2);
+  put(0x0201, 2);
+  put(4, 2);
+  put(1, 4);
+  put(44, 4);
+  put(0x0202, 2);
+  put(4, 2);
+  put(1, 4);
+  put(thumbnail.size(), 4);
+  put(0, 4);
+  tiff.insert(tiff.end(), thumbnail.begin(), thumbnail.end());
+
+  size_t length = 2 + 6 + tiff.size();
+  ofstream file(file_name, ios::binary);
+  file.write(reinterpret_cast<const char*>(image.data()), 2);
+  file << '\xff' << '\xe1' << char(length >> 8) << char(length & 0xff);
+  file.write("Exif\0\0", 6);
+  file.write(reinterpret_cast<const char*>(tiff.data()), tiff.size());
+  file.write(reinterpret_cast<const char*>(image.data()) + 2, image.size() - 2);
+}
+
+
+static dlib::matrix<dlib::rgb_pixel> make_thumbnail(const dlib::matrix<dlib::rgb_pixel>& image)
+{
+  double scale = 160.0 / max(image.nr(), image.nc());
+  dlib::matrix<dlib::rgb_pixel> thumbnail(long(image.nr() * scale), long(image.nc() * scale));
+  dlib::resize_image(image, thumbnail);
+
+  return thumbnail;
+}
+
+
+// ## TESTS #######################################################################################
+
+TEST(thumbnail_prefilter, reads_exif_thumbnail)
+{
+  dlib::matrix<dlib::rgb_pixel> image(480, 640), small(120, 160);
+  for(long r = 0; r < image.nr(); ++r)
+    for(long c = 0; c < image.nc(); ++c)
+      image(r, c) = dlib::rgb_pixel(r / 2, c / 3, 128);
+  dlib::resize_image(image, small);
+
+  auto image_data = encode_jpeg(image);
+  auto thumbnail_data = encode_jpeg(small);
+  string file_name = temporary_file("exif.jpg");
+
+  for(bool big_endian : {false, true}) {
+    write_exif_jpeg(file_name, image_data, thumbnail_data, big_endian);
+
+    vector<unsigned char> thumbnail;
+    ASSERT_TRUE(thumbnail_prefilter::read_exif_thumbnail(file_name, thumbnail));
+    EXPECT_EQ(thumbnail, thumbnail_data);
+
+    dlib::matrix<dlib::rgb_pixel> decoded;
+    ASSERT_TRUE(decode_jpeg(thumbnail.data(), thumbnail.size(), decoded));
+    EXPECT_EQ(decoded.nr(), 120);
+    EXPECT_EQ(decoded.nc(), 160);
+  }
+
+  // The file still decodes as the main image.
+  dlib::matrix<dlib::rgb_pixel> loaded;
+  dlib::load_image(loaded, file_name);
+  EXPECT_EQ(loaded.nc(), 640);
+
+  // No EXIF segment, not a JPEG, corrupt thumbnail.
+  vector<unsigned char> thumbnail;
+  ofstream(file_name, ios::binary).write(reinterpret_cast<const char*>(image_data.data()), image_data.size());
+  EXPECT_FALSE(thumbnail_prefilter::read_exif_thumbnail(file_name, thumbnail));
+  ofstream(file_name, ios::binary) << "not an image";
+  EXPECT_FALSE(thumbnail_prefilter::read_exif_thumbnail(file_name, thumbnail));
+  EXPECT_FALSE(thumbnail_prefilter::read_exif_thumbnail("/nonexistent.jpg", thumbnail));
+
+  dlib::matrix<dlib::rgb_pixel> decoded;
+  vector<unsigned char> garbage = {0xff, 0xd8, 0xff, 0xdb, 0x00, 0x02, 0x12, 0x34};
+  EXPECT_FALSE(decode_jpeg(garbage.data(), garbage.size(), decoded));
+
+  thumbnail_prefilter prefilter;
+  EXPECT_TRUE(prefilter.check(file_name) == thumbnail_verdict_t::NO_THUMBNAIL);
+
+  remove(file_name.c_str());
+}
+
+
+TEST(thumbnail_prefilter, missed_faces)
+{
+  face_detector_parameters_t detector_params;
+  detector_params.face_detector_model_file = FACE_DETECTOR_MODEL;
+  detector_params.shape_predictor_model_file = SHAPE_PREDICTOR_MODEL;
+  detector_params.detector_type = face_detector_type_t::DLIB_DEFAULT;
+  face_detector detector(detector_params);
+
+  thumbnail_prefilter_parameters_t strict_params;
+  strict_params.adjust_threshold = 0.5;
+  thumbnail_prefilter prefilter, strict_prefilter(strict_params);
+  string file_name = temporary_file("face.jpg");
+
+  // Images the full detector finds faces in, whose thumbnail the prefilter rejects.
+  unsigned int images_with_faces = 0, missed = 0, strict_missed = 0;
+  for(auto image_file : FACE_IMAGES) {
+    dlib::matrix<dlib::rgb_pixel> image;
+    dlib::load_image(image, image_file);
+
+    auto thumbnail = make_thumbnail(image);
+    write_exif_jpeg(file_name, encode_jpeg(image), encode_jpeg(thumbnail), false);
+
+    if(detector.detect(image).empty())
+      continue;
+
+    ++images_with_faces;
+    missed += prefilter.check(file_name) == thumbnail_verdict_t::NO_FACE;
+    strict_missed += strict_prefilter.check(file_name) == thumbnail_verdict_t::NO_FACE;
+  }
+
+  cout << "Thumbnail prefilter missed " << missed << " of " << images_with_faces << " images with faces (" <<
+    strict_missed << " with a stricter threshold)." << endl;
+
+  ASSERT_GT(images_with_faces, 0u);
+  EXPECT_LE(missed, images_with_faces / 8);
+  EXPECT_GE(strict_missed, missed);
+
+  // A photo without faces is rejected.
+  dlib::matrix<dlib::rgb_pixel> landscape(600, 800);
+  for(long r = 0; r < landscape.nr(); ++r)
+    for(long c = 0; c < landscape.nc(); ++c)
+      landscape(r, c) = r < 350 ? dlib::rgb_pixel(110, 160, 230) : dlib::rgb_pixel(60, 120 + c % 40, 50);
+
+  write_exif_jpeg(file_name, encode_jpeg(landscape), encode_jpeg(make_thumbnail(landscape)), true);
+  EXPECT_TRUE(prefilter.check(file_name) == thumbnail_verdict_t::NO_FACE);
+
+  remove(file_name.c_str());
+}
@@ -0,0 +1,121 @@
+/* Tests for the FaceTools execution trace.
+ *
+ * Released into the public domain.
+ * Explanation: http://creativecommons.org/licenses/publicdomain
+ * If your legal jurisdiction does not recognise the public domain, then it is
+ * licensed under Boost Software Licence.
+ * Boost Licence: http://www.boost.org/users/license.html
+ */
+
+
+// ## INCLUDES ####################################################################################
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <facetools/stats.h>
+#include <facetools/trace.h>
+
+
+// ## NAMESPACES ##################################################################################
+
+using namespace facetools;
+using namespace std;
+
+
+// ## PRIVATE FUNCTIONS ###########################################################################
+
+/**
+ * \param text Text to search.
+ * \param pattern Text to count.
+ * \return Number of times pattern occurs in text.
+ */
+static size_t count_of(const string& text, const string& pattern)
+{
+  size_t count = 0;
+  for(size_t at = text.find(pattern); at != string::npos; at = text.find(pattern, at + 1))
+    ++count;
+
+  return count;
+}
+
+
+/**
+ * \return The trace written so far.
+ */
+static string trace_json()
+{
+  ostringstream out;
+  write_trace(out);
+  return out.str();
+}
+
+
+// ## TESTS #######################################################################################
+
+TEST(trace, disabled)
+{
+  set_trace_enabled(false);
+  {
+    trace_span span("trace_test_disabled", "test");
+  }
+
+  trace_thread_name("trace_test_disabled_thread", 0);
+
+  EXPECT_EQ(trace_json().find("trace_test_disabled"), string::npos);
+}
+
+
+TEST(trace, spans)
+{
+  set_trace_enabled(true);
+
+  thread worker([] {
+    trace_thread_name("trace_test_worker", 3);
+    trace_span span("trace_test_span", "test", "file", 42);
+    this_thread::sleep_for(chrono::milliseconds(1));
+  });
+  worker.join();
+
+  // Stats timers are spans too.
+  {
+    stat_timer timer(stat_timer_t::PERCEPTUAL_HASH);
+  }
+
+  set_trace_enabled(false);
+  auto json = trace_json();
+
+  EXPECT_EQ(json.find("{\"displayTimeUnit\": \"ms\", \"traceEvents\": ["), 0u);
+  EXPECT_EQ(json.substr(json.size() - 4), "\n]}\n");
+  EXPECT_NE(json.find("\"ph\": \"M\", \"name\": \"thread_name\", \"args\": {\"name\": \"trace_test_worker 3\"}"),
+    string::npos);
+  EXPECT_NE(json.find("\"name\": \"perceptual_hash\", \"cat\": \"stage\""), string::npos);
+
+  size_t span = json.find("\"name\": \"trace_test_span\", \"cat\": \"test\"");
+  ASSERT_NE(span, string::npos);
+
+  auto line = json.substr(span, json.find('\n', span) - span);
+  EXPECT_NE(line.find("\"args\": {\"file\": 42}"), string::npos);
+
+  // At least the millisecond slept, in microseconds.
+  double duration = stod(line.substr(line.find("\"dur\": ") + 7));
+  EXPECT_GE(duration, 1000.0);
+}
+
+
+TEST(trace, ring)
+{
+  set_trace_enabled(true);
+
+  // A thread keeps its latest events once its ring is full.
+  thread worker([] {
+    for(size_t i = 0; i < TRACE_BUFFER_EVENTS + 100; ++i)
+      trace_complete("trace_test_ring", "test", chrono::steady_clock::now(), chrono::steady_clock::now());
+  });
+  worker.join();
+
+  set_trace_enabled(false);
+  EXPECT_EQ(count_of(trace_json(), "\"trace_test_ring\""), TRACE_BUFFER_EVENTS);
+}